@@ -2,12 +2,70 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <pthread.h>
+#include <math.h>
+#include <limits.h>
+#include <stdarg.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <signal.h>
+#endif
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#endif
+// 编译时加 -DHAVE_ZLIB -lz 或 -DHAVE_ZSTD -lzstd 后可以直接读取gzip / zstd压缩的数据文件
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
 
 // 区块数、交易数、用户数计数
 int calc_block = 0;
 int calc_transaction = 0;
 int calc_user = 0;
 
+// 数据版本号，每次插入交易后加一，用于判断缓存的图是否过期
+int data_version = 0;
+
+// 数据文件，以及初始化时读到的位置（跟踪模式从这里继续读）
+char* block_file = "block_part1.csv";
+char* transaction_file = "tx_data_part1_v2.csv";
+long block_file_offset = 0;
+long transaction_file_offset = 0;
+
+// -d指定的数据清单，启动时代替上面两个文件；-w指定的时间段，只加载与之相交的交易分区
+char* manifest_file = 0;
+unsigned manifest_time_start = 0;
+unsigned manifest_time_end = UINT_MAX;
+
+// -b指定的轮数：加载完后对逐笔出弧表和重新编号的压缩出弧各做这么多轮全图BFS计时，输出后退出
+int benchmark_rounds = 0;
+
+// 快照和预写日志：插入的交易先记日志，重启时加载快照再重放日志
+char* snapshot_file = "lab6.snap";
+char* wal_file = "lab6.wal";
+
+// 数据读写锁：查询持读锁，插入交易持写锁
+pthread_rwlock_t data_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+// 是否输出读取进度，后台线程关闭以免打断菜单
+__thread int show_progress = 1;
+
 // 时钟
 clock_t start_time, end_time;
 
@@ -36,7 +94,8 @@ typedef struct user
     int in_count;
     int out_count;
     int sign;  // 在最短路径算法中检验是否被使用过该顶点
-    int ring_sign; // 用于检查在检查环时有没有包含该节点
+    int uid;  // 用户的连续编号，图算法中用作数组下标
+    long first_seen;  // 首次出现的交易行号*2（作为收款方出现时再加1），分片模式合并排行时代替uid
 } user;
 
 typedef struct user_max
@@ -52,1257 +111,11120 @@ typedef struct HashTable
 {
     int size;
     user** table;
+    int user_count;     // 已编号的用户数
+    int user_capacity;
+    user** users;       // 按编号排列的用户，users[uid]
 } HashTable;
 
+// 一段连续存储，放在堆上或（外存模式下）磁盘上的映射文件中
+typedef struct Region
+{
+    void* data;
+    size_t capacity;  // 字节数
+    int mapped;       // 是否在映射文件中
+    int fd;
+    int registered;   // 是否已登记，外存模式切换和回收内存时遍历登记的存储
+} Region;
+
+// 压缩邻接表（CSR），同一对账户间的多笔交易合并为一条弧，权值为累计转账金额
+typedef struct Graph
+{
+    int vertex_count;
+    int edge_count;
+    int* offset;     // 账户u的出弧为 [offset[u], offset[u + 1])，常驻内存
+    int* target;     // 弧的终点编号
+    double* weight;  // 弧的权值
+    Region target_region;
+    Region weight_region;
+} Graph;
+
+// 按转出账户排列的交易，每笔交易一条弧（保留同一对账户间的多笔交易），替代每个用户的交易链表
+typedef struct TxAdjacency
+{
+    int vertex_count;
+    int edge_count;
+    int version;     // 对应的data_version
+    int* offset;     // 账户u的出弧为 [offset[u], offset[u + 1])，常驻内存
+    int* target;
+    double* amount;
+    int* block;      // 弧所属交易的区块序号，按截止时刻过滤弧用
+    Region target_region;
+    Region amount_region;
+    Region block_region;
+} TxAdjacency;
+
+/*
+ * 按访问局部性重新编号的逐笔出弧：从度数大的账户起沿出弧做BFS，访问顺序即新编号，
+ * 相邻账户的编号因此靠得近。每个账户的出弧按终点新编号升序排列，终点存为与前一条弧
+ * 终点之差的varint（首条弧存终点本身），多数弧只占1~2字节；amount和block按同样的弧序存放。
+ */
+typedef struct CompactAdjacency
+{
+    int vertex_count;
+    int edge_count;
+    int version;          // 对应的data_version
+    int* order;           // 新编号 -> uid
+    int* rank;            // uid -> 新编号
+    int* arc_offset;      // 新编号v的出弧为 [arc_offset[v], arc_offset[v + 1])，常驻内存
+    long* byte_offset;    // 新编号v的终点编码在bytes中的起点，常驻内存
+    unsigned char* bytes;
+    double* amount;
+    int* block;
+    long byte_count;
+    Region bytes_region;
+    Region amount_region;
+    Region block_region;
+} CompactAdjacency;
+
+// 顺序解码一个账户的出弧
+typedef struct ArcCursor
+{
+    unsigned char* p;
+    int arc;     // 当前弧的序号，amount和block的下标
+    int end;
+    int target;  // 当前弧终点的新编号
+} ArcCursor;
+
+// 检查环时的工作区，mark[v] == stamp表示本轮已入队
+typedef struct RingSearch
+{
+    CompactAdjacency* compact;
+    int block_limit;
+    int* mark;
+    int stamp;
+    int* queue;
+} RingSearch;
+
+// PageRank的拉取式邻接表（user_graph的转置）：账户v的入弧为 [offset[v], offset[v + 1])，
+// share为转出方在这条弧上的金额占其转出总额的比例，每轮迭代各线程只写自己负责的账户
+typedef struct PullGraph
+{
+    int vertex_count;
+    int version;     // 对应的user_graph_version
+    int* offset;
+    int* source;
+    double* share;
+    char* dangling;  // 没有转出金额的账户，它的分值均摊给所有账户
+    Region source_region;
+    Region share_region;
+} PullGraph;
+
+// 弱连通分量的并查集，加载和插入交易时随之合并。按大小合并加折半压缩，均摊O(α(n))；
+// 合并只由持写锁的加载线程做，查询线程在读锁下并发查找，折半压缩用CAS完成
+typedef struct ComponentForest
+{
+    int capacity;
+    int vertex_count;     // 已登记的账户数
+    int component_count;  // 账户数减去成功合并的次数
+    int* parent;
+    int* size;            // 分量的账户数，只在根上有效
+} ComponentForest;
+
+// 查询结果缓存的条目：键是规范化后的查询（账户换成uid，时间换成区块范围），值是当时输出的文本
+typedef struct CacheEntry
+{
+    char* key;
+    char* text;
+    long bytes;        // 条目连同键和文本占用的字节
+    int block_end;     // 结果只依赖区块 [0, block_end)，INT_MAX表示依赖全部区块
+    struct CacheEntry* next_hash;
+    struct CacheEntry* prev;   // LRU链表，越靠前越近使用
+    struct CacheEntry* next;
+} CacheEntry;
+
+// 查询结果缓存。查询在读锁内调用，哈希桶、LRU链表和计数由lock保护，多个查询线程可以同时查找和保存；
+// 插入交易在写锁内只记下受影响的最小区块，下次查询时再清理
+typedef struct QueryCache
+{
+    long limit;          // 字节上限，0表示关闭
+    long bytes;
+    int count;
+    int bucket_count;
+    CacheEntry** buckets;
+    CacheEntry* head;
+    CacheEntry* tail;
+    int touched_block;   // 上次清理之后插入交易的最小区块序号，INT_MAX表示没有
+    long hits;
+    long misses;
+    long evictions;
+    long invalidations;
+    pthread_mutex_t lock;
+} QueryCache;
+
+// 未命中的查询在本线程内记录自己的输出，由query_cache_store保存
+typedef struct QueryCapture
+{
+    int capturing;
+    char* text;
+    long length;
+    long capacity;
+} QueryCapture;
+
+// 按时间排序的交易流，时态查询顺序扫描一遍即可
+typedef struct TemporalStream
+{
+    int count;
+    int version;     // 对应的data_version
+    int* row;        // 按时间顺序排列的交易行号
+    unsigned* time;  // 对应交易所在区块的时间戳
+    Region row_region;
+    Region time_region;
+} TemporalStream;
+
+// 滚动窗口的四项指标：入度、出度、加权入度、加权出度
+#define WINDOW_METRICS 4
+
+// 最近若干区块上的滚动统计：新区块追加时最旧的区块移出，窗口内交易增量地计入各账户
+typedef struct RollingWindow
+{
+    int enabled;
+    int max_blocks;          // 窗口内最多的区块数，0表示不限
+    unsigned max_seconds;    // 窗口覆盖的时间跨度（秒），0表示不限
+    int begin;               // 窗口为区块索引中的 [begin, block_index.count)
+    int capacity;            // 账户数组的容量
+    int* in_count;
+    int* out_count;
+    double* in_amount;
+    double* out_amount;
+    int* heap[WINDOW_METRICS];      // 窗口内有交易的账户按各项指标排成的最大堆
+    int* position[WINDOW_METRICS];  // 账户在各个堆中的位置，-1表示不在堆中
+    int heap_size;
+    long transactions;       // 窗口内的交易数和交易总额
+    double amount;
+} RollingWindow;
+
+// 时间桶汇总：交易按所在区块的时间戳（取前缀最大值，与按时间二分区块的口径一致）归入宽width秒的桶，
+// 插入时增量维护全网和每个账户有交易的桶（按桶号递增的稀疏数组），个别很早或错误的时间戳不会铺开中间的空桶
+#define ROLLUP_MIN_WIDTH 60
+
+typedef struct RollupCell
+{
+    unsigned bucket;   // 桶号，即时间戳 / width
+    int in_count;
+    int out_count;
+    double in_amount;
+    double out_amount;
+} RollupCell;
+
+typedef struct RollupSeries
+{
+    int count;
+    int capacity;
+    RollupCell* cells;
+} RollupSeries;
+
+typedef struct Rollup
+{
+    unsigned width;          // 桶宽（秒）
+    RollupSeries network;    // 全网各桶，交易数和交易额记在out_count / out_amount
+    int account_capacity;
+    RollupSeries* accounts;  // 按账户编号
+    long cell_count;
+} Rollup;
+
+// 一段时间内的交易数和收支
+typedef struct RollupTotals
+{
+    int count;
+    double volume;
+    int in_count;
+    int out_count;
+    double in_amount;
+    double out_amount;
+} RollupTotals;
+
+// 流式概率摘要：每个账户两个HyperLogLog估计不同的转入 / 转出对手数；
+// 整个交易流上转出方和转入方各一个Count-Min和Space-Saving，按金额估计账户总额和前几名。内存固定，可合并
+#define HLL_BITS 6                      // 每个HLL有2^6个1字节寄存器，标准误差约1.04/8 = 13%
+#define HLL_REGISTERS (1 << HLL_BITS)
+#define SKETCH_DEPTH 4                  // Count-Min的行数，超出误差界的概率不超过e^-4
+#define SKETCH_WIDTH 16384              // 每行的计数器数，高估不超过该侧总额的e/16384（约0.017%）
+#define HEAVY_HITTERS 4096              // Space-Saving默认的计数器数，2的幂，内存与账户数无关
+
+typedef struct HeavyHitter
+{
+    int uid;
+    double weight;   // 估计值，不小于真实值
+    double error;    // 高估的上界，真实值不小于weight - error
+    int slot;        // 在索引中的槽
+} HeavyHitter;
+
+// 加权的Space-Saving，计数器数m可设置。误差不超过该侧总额N的N/m
+typedef struct SpaceSaving
+{
+    int capacity;        // 计数器数m，2的幂
+    int count;
+    double evicted;      // 被替换出表的账户的最大估计值，表未满时不在表中的账户真实值不超过它
+    HeavyHitter* items;  // 按估计值排成最小堆，堆顶是要被替换的账户
+    int* slot;           // 2m个槽，按uid开放寻址的索引，存堆中位置加1，0表示空
+} SpaceSaving;
+
+// 交易流一侧（转出方或转入方）的摘要
+typedef struct StreamSketch
+{
+    double total;
+    double count_min[SKETCH_DEPTH][SKETCH_WIDTH];
+    SpaceSaving heavy;
+} StreamSketch;
+
+typedef struct SketchState
+{
+    int capacity;               // HLL数组可容纳的账户数
+    unsigned char* hll_in;      // 账户uid的寄存器为 [uid * HLL_REGISTERS, (uid + 1) * HLL_REGISTERS)
+    unsigned char* hll_out;
+    StreamSketch senders;
+    StreamSketch receivers;
+    int frozen;                 // 从快照恢复时摘要直接读回，重放交易不再更新
+} SketchState;
+
+// 找到的一个环，nodes[i] -> nodes[i + 1]（最后一个回到nodes[0]）的金额为amounts[i]
+typedef struct Cycle
+{
+    int length;
+    double total;
+    int* nodes;
+    double* amounts;
+} Cycle;
+
+// 环枚举的参数与共享状态
+typedef struct CycleQuery
+{
+    Graph* graph;
+    HashTable* user_table;
+    int start;           // 起点账户编号，-1表示全图
+    int max_length;      // 环的最大长度L
+    int max_count;       // 单账户模式下最多输出的环数
+    int top_n;           // 全图模式下按总金额保留前N个，枚举全部环，只受时间上限限制
+    double deadline;     // 截止时间（now_seconds）
+    int found;           // 已找到的环数
+    int stop;            // 达到上限或超时后置1，各工作线程用__atomic读写
+    pthread_mutex_t lock;
+} CycleQuery;
+
+// 前k名（按value降序）
+typedef struct TopK
+{
+    int k;
+    int count;
+    int* uid;
+    double* value;
+} TopK;
+
+// 时间段净变化排行的工作区，跨查询复用：stamp[uid] == round时delta[uid]是本次查询的值，否则视为0
+typedef struct NetChangeScratch
+{
+    int capacity;
+    int round;
+    int count;       // 本次出现过的账户数，依次记在touched中
+    int* stamp;
+    int* touched;
+    double* delta;
+} NetChangeScratch;
+
+// 模式检测的参数：金额阈值作用于每条弧，度数阈值作用于扇出 / 扇入，剥离链按跳数
+typedef struct MotifQuery
+{
+    Graph* graph;
+    PullGraph* pull;
+    double min_amount;
+    int min_degree;
+    int min_chain;
+    int k;
+    int max_degree;   // 出度的最大值，决定交集缓冲区的大小
+} MotifQuery;
+
+// 各线程负责一段账户，往返交易的排行按弧编号记录，剥离链的排行按链首账户记录
+typedef struct MotifPartial
+{
+    long round_trips;
+    int fan_out;
+    int fan_in;
+    int chains;
+    TopK* round_trip_top;
+    TopK* fan_out_top;
+    TopK* fan_in_top;
+    TopK* chain_top;
+    int* common;      // 交集在出弧列表中的位置
+} MotifPartial;
+
+// k跳邻域和可达性的遍历方向
+#define HOP_OUT 1
+#define HOP_IN 2
+#define HOP_BOTH 3
+
+// 边界的出弧数超过未访问部分弧数的1/HOP_ALPHA时改为自底向上，边界账户数少于总数的1/HOP_BETA时改回自顶向下
+#define HOP_ALPHA 14
+#define HOP_BETA 24
+
+/*
+ * 方向优化的BFS：边界稀疏时自顶向下，沿边界账户的弧扩展；边界稠密时自底向上，
+ * 每个未访问的账户沿反向的弧找一个在边界中的前驱，找到即停。边界、下一层和已访问集合
+ * 都是按账户编号的位图，自底向上时各线程按位图的字划分账户，只写自己的字。
+ */
+typedef struct HopSearch
+{
+    Graph* forward[2];    // 自顶向下扩展用的弧
+    Graph* backward[2];   // 自底向上找前驱用的弧，与forward互为转置
+    int graph_count;
+    int vertex_count;
+    int words;            // 位图的字数
+    unsigned long long* visited;
+    unsigned long long* frontier;
+    unsigned long long* next;
+    int* parent;          // BFS树中的前驱，源点为自身
+    int* depth;           // 只对已访问的账户有效
+    int* reached;         // 按访问顺序排列的账户，最后frontier_count个是当前边界
+    int reached_count;
+    int frontier_count;
+    int limit;            // 最多访问的账户数（含源点）
+    int truncated;        // 是否因limit停止
+    int level;            // 正在扩展的层
+    int top_down_levels;
+    int bottom_up_levels;
+} HopSearch;
+
+// 平均入度出度统计的部分结果
+typedef struct DegreeSum
+{
+    long total_in;
+    long total_out;
+    double total_in_amount;
+    double total_out_amount;
+} DegreeSum;
+
+// 各账户截止某时刻的收支，按用户表中的账户编号存放
+typedef struct AccountTotals
+{
+    int count;           // 截止时刻之前出现过的账户数
+    int* in_count;
+    int* out_count;
+    double* in_amount;
+    double* out_amount;
+    char* seen;          // 截止时刻之前是否出现过
+} AccountTotals;
+
+// 并行运行时的回调：处理区间 [begin, end)
+typedef void (*RangeBody)(int begin, int end, void* ctx);
+typedef void (*ReduceInit)(void* partial, void* ctx);
+typedef void (*ReduceBody)(int begin, int end, void* partial, void* ctx);
+typedef void (*ReduceMerge)(void* result, void* partial, void* ctx);
+
+// 区块内交易的压缩段。每笔交易是一条定长记录：tx_id与段首tx_id之差、from和to的用户编号、
+// 金额（见amount_encode），差值和金额按zigzag映射为无符号数，
+// 每个字段按段内最大值取最少的字节数（小端），出现更大的值时整段按新宽度重写。
+// 记录定长，扫描时各笔交易的解码互不依赖；各段连续存放在segment_arena中，按区块范围扫描时顺序读内存
+#define SEGMENT_TX 0
+#define SEGMENT_FROM 1
+#define SEGMENT_TO 2
+#define SEGMENT_AMOUNT 3
+typedef struct TxSegment
+{
+    long offset;              // 在segment_arena中的位置
+    int count;
+    int capacity;             // 占用的字节数
+    int base_tx_id;
+    unsigned char width[4];   // 各字段的字节数
+} TxSegment;
+
+// 压缩段的存储区。初始加载按区块顺序写入，段是连续的；
+// 不在末尾的段需要变长时搬到末尾，空出的位置超过一半时按区块顺序整理
+typedef struct SegmentArena
+{
+    unsigned char* data;
+    long length;
+    long capacity;   // 末尾至少留8字节供整字读取
+    long garbage;    // 搬走的段留下的空位
+    Region region;
+} SegmentArena;
+
+// 按段的字段宽度解码
+typedef struct SegmentReader
+{
+    unsigned char* data;
+    int count;
+    int size;                    // 每条记录的字节数
+    int offset[4];
+    unsigned long long mask[4];
+    int base_tx_id;
+} SegmentReader;
+
+// 金额的定点精度，1e-8即比特币的最小单位，小数不超过8位的金额可以无损还原
+#define AMOUNT_SCALE 100000000.0
+
+// 定点数放不下（绝对值超过约4.6e10）或除回去不等于原值的金额原样存在这里，段中存下标
+typedef struct AmountEscapes
+{
+    int count;
+    int capacity;
+    double* values;
+} AmountEscapes;
+
 typedef struct Block
 {
     int blockID;
     char* hash;
     unsigned block_timestamp;
     int transaction_count;
-    Transaction* transaction_head;
+    TxSegment segment;  // 区块内的交易
     struct Block* next;
     struct Block* prev;
+    int index;  // 在block_index中的下标
 } Block;
 
+// 区块索引，按区块链顺序排列，便于按时间二分查找
+typedef struct BlockIndex
+{
+    int count;
+    int capacity;
+    Block** blocks;
+    unsigned* max_timestamp;  // 前缀最大时间戳，区块时间戳不严格递增时仍可二分
+} BlockIndex;
+
+// 交易的列式存储，行按插入顺序排列，账户用编号表示
+typedef struct TxColumns
+{
+    int count;
+    int capacity;
+    int block_ordered;  // 行是否按区块顺序排列，是则可按区块二分出行范围
+    int* tx_id;
+    int* block;         // 所在区块在block_index中的下标
+    int* from;
+    int* to;
+    double* amount;
+    Region regions[5];  // 以上五列的存储
+} TxColumns;
+
+// 按tx_id定位交易列中的行。tx_id基本连续，用稠密数组 row[tx_id - base]；
+// 小于base或离稠密区间太远的tx_id放进开放寻址的散列表
+typedef struct TxIdIndex
+{
+    int base;
+    int span;               // 稠密数组覆盖 [base, base + span)
+    int* row;               // -1表示没有该tx_id
+    int overflow_count;
+    int overflow_capacity;  // 2的幂
+    int* overflow_key;
+    int* overflow_row;      // -1表示空槽
+} TxIdIndex;
+
+// 按区块哈希定位区块。64位十六进制的哈希转成32字节作为键，开放寻址，槽中存block_index下标加一
+#define BLOCK_HASH_BYTES 32
+typedef struct BlockHashIndex
+{
+    int capacity;        // 2的幂
+    int count;
+    int* slot;
+    int key_capacity;
+    unsigned char* key;  // 按block_index下标存放各区块的键
+} BlockHashIndex;
+
+// 列式聚合的过滤条件
+#define SIDE_ANY 0   // 不限账户
+#define SIDE_FROM 1  // from为指定账户
+#define SIDE_TO 2    // to为指定账户且from不是（自转账算作转出）
+typedef struct AmountFilter
+{
+    int side;
+    int account;
+    int block_begin;   // 区块下标范围 [block_begin, block_end)
+    int block_end;
+    double threshold;  // 金额下限
+} AmountFilter;
+
+// 聚合结果
+typedef struct AmountStats
+{
+    int count;
+    double sum;
+    double min;
+    double max;
+} AmountStats;
+
+// 跟踪模式每批最多应用的行数和轮询间隔（毫秒）
+#define FOLLOW_BATCH 2048
+#define FOLLOW_POLL_MS 200
+
+// 所在区块还没到达的交易
+typedef struct PendingTransaction
+{
+    int tx_id;
+    int blockID;
+    char* from;
+    double amount;
+    char* to;
+} PendingTransaction;
+
+// 跟踪模式的状态
+typedef struct FollowState
+{
+    Block* head;
+    HashTable* user_table;
+    pthread_t thread;
+    int running;
+    int stop;
+    int use_inotify;
+    PendingTransaction* pending;
+    int pending_count;
+    int pending_capacity;
+    long applied_blocks;
+    long applied_transactions;
+    long batches;
+    double last_lag;  // 最近一批数据从写入文件到可查询的时间（秒）
+    double max_lag;
+    double started;
+} FollowState;
+
+FollowState follow_state;
+
+// 预写日志记录的格式：记录头后跟rows行，每行以类型字节开头
+#define WAL_MAGIC 0x4C415757
+#define WAL_ROW_BLOCK 1        // 区块
+#define WAL_ROW_TRANSACTION 2  // 已应用的交易
+#define WAL_ROW_DEFERRED 3     // 跟踪模式中挂起的交易
+typedef struct WalHeader
+{
+    unsigned magic;
+    unsigned length;  // 记录体字节数
+    unsigned rows;
+    unsigned crc;     // 记录体的CRC32
+    long long sequence;
+    long long base_block_offset;  // 应用这批数据前数据文件读到的位置
+    long long base_transaction_offset;
+    long long block_offset;       // 应用后读到的位置
+    long long transaction_offset;
+} WalHeader;
+
+// 当前写锁批次中尚未提交的日志行
+typedef struct WalBatch
+{
+    char* data;
+    int length;
+    int capacity;
+    int rows;
+    long base_block_offset;
+    long base_transaction_offset;
+} WalBatch;
+
+WalBatch wal_batch = {0, 0, 0, 0, 0, 0};
+FILE* wal_handle = 0;
+long long wal_sequence = 0;  // 最近提交（或快照包含）的日志记录序号
+
+// 快照格式：文件头、按编号排列的用户、区块、交易行、挂起交易、流式摘要，最后是全文的CRC32
+#define SNAPSHOT_MAGIC 0x33414E53
+typedef struct SnapshotHeader
+{
+    unsigned magic;
+    int user_count;
+    int block_count;
+    int transaction_count;
+    int pending_count;
+    int block_ordered;
+    long long sequence;
+    long long block_offset;
+    long long transaction_offset;
+} SnapshotHeader;
+
+typedef struct SnapshotRow
+{
+    int tx_id;
+    int block;
+    int from;
+    int to;
+    double amount;
+} SnapshotRow;
+
+// 后台加载每批应用的行数，批与批之间释放写锁让查询进来
+#define LOAD_BATCH 4096
+#define SCAN_WINDOW_ROWS (1 << 20)  // 部分结果保存解码出的行时，分段扫描每段最多的行数
+// 加载交易时一起解析账户的行数：先算出所有地址的桶号并预取，再逐行查找或插入
+#define INGEST_BATCH 64
+
+// 后台加载的进度，除lock/progress外的字段都在data_lock写锁内更新（done同时持lock）
+/*
+ * 数据文件的读取流。未压缩的文件直接用fgets读；压缩文件（按开头的魔数识别）由单独的解压线程
+ * 解压到INPUT_RING个缓冲组成的环里，解析线程从环里取行，解压和解析重叠进行。
+ * 解析线程就是后台加载线程，只有一个（行要按文件顺序插入），解压只有在另有空闲核时才能被掩盖，
+ * 单核上压缩文件的加载必然比未压缩的慢。
+ * 偏移量都按解压后的内容计，与未压缩的文件一致（预写日志和快照记录的读取位置也是如此）。
+ */
+#define INPUT_PLAIN 0
+#define INPUT_GZIP 1
+#define INPUT_ZSTD 2
+#define INPUT_RING 4
+#define INPUT_CHUNK (1 << 18)
+typedef struct InputStream
+{
+    FILE* file;
+    char* path;
+    int format;
+    long offset;              // 解析线程已取走的字节数（解压后）
+    long compressed;          // 解压线程已读的压缩数据字节数
+    char* buffer[INPUT_RING];
+    int length[INPUT_RING];
+    int head;                 // 解析线程正在读的缓冲
+    int count;                // 已解压好的缓冲数（含正在读的）
+    int holding;              // 解析线程是否占着head
+    int position;             // 在head中读到的位置
+    int done;                 // 解压线程已结束
+    int stop;                 // 解析线程提前关闭
+    int error;                // 压缩数据损坏或不完整
+    int partial;              // 压缩数据停在一帧的中间
+    unsigned char* source;    // 解压线程读入的压缩数据
+#ifdef HAVE_ZLIB
+    z_stream zlib;
+#endif
+#ifdef HAVE_ZSTD
+    ZSTD_DStream* zstd;
+    ZSTD_inBuffer zstd_in;
+#endif
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t filled;
+    pthread_cond_t drained;
+} InputStream;
+
+/*
+ * 数据清单：每行一个分区，格式为 "block|tx 文件 首区块号 末区块号 [首时间 末时间]"，#开头的行是注释，
+ * 相对路径相对于清单所在的目录。各分区由读取线程并行读入内存，再按区块顺序依次插入。
+ */
+#define PARTITION_BLOCK 0
+#define PARTITION_TX 1
+typedef struct PartitionRow
+{
+    int id;         // 区块号或tx_id
+    int block;      // 交易所在的区块号
+    unsigned time;  // 区块时间戳
+    double amount;
+    long from;      // 区块哈希或转出账户在text中的位置
+    long to;
+} PartitionRow;
+
+typedef struct Partition
+{
+    int kind;
+    char* path;
+    int first_block;
+    int last_block;
+    unsigned first_time;  // 清单中没给出时间时为0和UINT_MAX，交易分区按已加载区块的时间判断
+    unsigned last_time;
+    int loaded;           // 本进程已加载过
+    int ready;            // 已读入内存
+    int failed;
+    int count;
+    int capacity;
+    PartitionRow* rows;
+    char* text;
+    long text_length;
+    long text_capacity;
+    long file_size;
+} Partition;
+
+typedef struct Manifest
+{
+    int count;
+    Partition* partitions;
+} Manifest;
+
+// 一次清单加载：读取线程按order的顺序领取分区，领先插入进度不超过readers个
+typedef struct ManifestLoad
+{
+    Partition** order;
+    int count;
+    int next;
+    int applied;
+    int readers;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} ManifestLoad;
+
+typedef struct LoadState
+{
+    Block* head;
+    HashTable* user_table;
+    pthread_t thread;
+    int blocks_done;    // 区块文件已读完
+    int done;           // 交易已全部加载
+    int loaded_blocks;  // 前loaded_blocks个区块的交易已全部加载
+    long bytes_read;    // 交易文件已读字节数
+    long file_size;
+    double started;
+    pthread_mutex_t lock;
+    pthread_cond_t progress;
+    long block_limit;        // 大于0时只读数据文件的前这么多字节（其余部分由预写日志重放）
+    long transaction_limit;
+    int wal_pending;         // 还有预写日志要重放，日志中的交易可能属于任意区块，重放完之前不按区块判断就绪
+} LoadState;
+
+// 一批待插入的交易行，from和to指向line中的字段
+typedef struct IngestRow
+{
+    char line[512];
+    int row;          // 在文件中的行号
+    int tx_id;
+    int blockID;
+    char* from;
+    char* to;
+    double amount;
+    int from_index;   // 账户所在的哈希桶
+    int to_index;
+} IngestRow;
+
+Manifest manifest = {0, 0};
+LoadState load_state = {0, 0, 0, 0, 0, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0, 0};
+
+// 查询所需数据未加载完时：0等待，1立即给出部分结果
+int partial_results = 0;
+
+// 图分析（平均度、排行、环、最短路径）的截止时刻，UINT_MAX表示不限
+unsigned analysis_as_of = UINT_MAX;
+
+// 主区块链的区块索引和交易列
+BlockIndex block_index = {0, 0, 0, 0};
+SegmentArena segment_arena = {0, 0, 0, 0};
+AmountEscapes amount_escapes = {0, 0, 0};
+TxColumns tx_columns = {0, 0, 1, 0, 0, 0, 0, 0};
+TxIdIndex tx_id_index = {0, 0, 0, 0, 0, 0, 0};
+BlockHashIndex block_hash_index = {0, 0, 0, 0, 0};
+TxAdjacency tx_adjacency = {0, 0, -1, 0, 0, 0};
+CompactAdjacency compact_adjacency = {0, 0, -1, 0, 0, 0, 0, 0, 0, 0, 0};
+TemporalStream temporal_stream = {0, -1, 0, 0};
+PullGraph pull_graph = {0, -1, 0, 0, 0, 0};
+ComponentForest component_forest = {0, 0, 0, 0, 0};
+QueryCache query_cache = {16L << 20, 0, 0, 0, 0, 0, 0, INT_MAX, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER};
+__thread QueryCapture query_capture = {0, 0, 0, 0};
+RollingWindow rolling_window = {0, 0, 0, 0, 0};
+Rollup rollup = {86400, {0, 0, 0}, 0, 0, 0};
+NetChangeScratch net_change_scratch = {0, 0, 0, 0, 0, 0};
+SketchState sketch_state;
+int heavy_hitter_budget = 0;  // Space-Saving的计数器数：正数为固定个数，0为默认HEAVY_HITTERS个，-k为每k个账户一个
+
+// 主交易网络的压缩邻接表，插入交易后按data_version重建
+Graph* user_graph = 0;
+int user_graph_version = -1;
+
+// user_graph的转置，k跳邻域和可达性查询自底向上时使用
+Graph* reverse_graph = 0;
+int reverse_graph_version = -1;
+
+// 外存模式：交易列、压缩段和邻接数组放在spill_dir下的映射文件中，
+// 常驻内存超过memory_limit_mb时让出映射页，只有账户字典、区块索引和各账户的弧偏移常驻
+int out_of_core = 0;
+long memory_limit_mb = 0;
+char* spill_dir = "lab6.spill";
+Region** regions = 0;  // 已登记的存储区，按需扩容
+int region_count = 0;
+int region_capacity = 0;
+long storage_trims = 0;  // 让出映射页的次数
+
+// 分片模式：账户按哈希分到shard_count个本机工作进程，每个进程只保存与本分片账户有关的交易，
+// 因此本分片账户的交易都是完整的。主进程作为协调者，通过Unix域套接字把单账户查询转发给账户所在的分片，
+// 全局统计分发给所有分片再合并，最短路径按层在分片之间交换待松弛的顶点
+#define MAX_SHARDS 64
+#define SHARD_EXIT 0
+#define SHARD_STATUS 1
+#define SHARD_IN_OUT 2
+#define SHARD_AMOUNT 3
+#define SHARD_DEGREE 4
+#define SHARD_RANK 5
+#define SHARD_WEALTH 6
+#define SHARD_PATH_RESET 7
+#define SHARD_PATH_STEP 8
+#define SHARD_PATH_RESULT 9
+#define SHARD_SKETCH 10
+#define SHARD_HEAVY 11
+
+// 进程间的消息：消息头是操作码和长度，消息体的字符串和预写日志一样以unsigned short长度开头
+typedef struct ShardMessage
+{
+    char* data;
+    int length;
+    int capacity;
+} ShardMessage;
+
+// 合并排行时各分片发来的候选账户
+typedef struct ShardCandidate
+{
+    long first_seen;
+    int in_count;
+    int out_count;
+    double in_amount;
+    double out_amount;
+    char* user_id;
+} ShardCandidate;
+
+int shard_count = 0;        // 大于1时启用分片模式
+int shard_id = -1;          // 工作进程的分片号，协调者和单进程模式下为-1
+int shard_fd[MAX_SHARDS];   // 协调者到各工作进程的连接
+int shard_pid[MAX_SHARDS];
+long ingest_row = 0;        // 正在加载的交易行号
+
+// 工作进程中本分片负责的账户（按编号顺序），排行函数直接在这张表上运行
+HashTable shard_view;
+// 工作进程中各账户的标记：本分片负责、在待松弛顶点中、在待发出的距离中
+#define SHARD_OWNED 1
+#define SHARD_QUEUED 2
+#define SHARD_OUTGOING 4
+char* shard_flags = 0;
+int* shard_frontier = 0;
+int shard_frontier_count = 0;
+
+// 外存模式的存储管理
+void* region_reserve(Region* region, size_t bytes);
+void region_free(Region* region);
+void set_out_of_core(int enable, long limit_mb);
+void storage_trim();
+int storage_window(int count, int bytes_per_item);
+void storage_advise(Region* region, int sequential);
+long resident_bytes();
+TxAdjacency* get_tx_adjacency(HashTable* user_table);
+CompactAdjacency* get_compact_adjacency(HashTable* user_table);
+void adjacency_benchmark(HashTable* user_table, int rounds);
+void arc_cursor_open(CompactAdjacency* compact, int v, ArcCursor* cursor);
+int arc_cursor_next(ArcCursor* cursor);
+
+// 分片模式
+int shard_of(char* account);
+void start_shards();
+void stop_shards();
+void shard_worker(int fd);
+void shard_status();
+void shard_account_in_out(unsigned time_start, unsigned time_end, int k, char* account);
+void shard_account_amount(unsigned time_end, char* account);
+void shard_account_sketch(char* account);
+void shard_heavy_hitters(int k);
+void shard_wealth_rank(unsigned time_stamp, int k);
+void shard_average_degree();
+void shard_max_in_out(int k);
+void shard_shortest_path(char* from, char* to);
+
+// 查询结果缓存
+void query_print(const char* format, ...);
+int query_cache_replay(char* key);
+void query_cache_store(char* key, int block_end);
+int query_cache_horizon(int block_end);
+void query_cache_touch(int block);
+void query_cache_configure(long limit_mb);
+void print_query_cache_stats();
+
 // 读取csv和建立区块链函数
 Block* createLinkedList(HashTable* userTable);
+void publish_load_progress(int loaded_blocks, long bytes_read);
+int wait_until_loaded(unsigned time_stamp);
+void wait_load_finished();
+void print_load_progress();
 void readBlock(Block* list);
 void readTransaction(Block* list, HashTable* user_list);
+int input_format(char* path);
+InputStream* input_open(char* path);
+char* input_gets(char* line, int size, InputStream* in);
+long input_tell(InputStream* in);
+long input_progress(InputStream* in);
+void input_close(InputStream* in);
+int read_manifest(char* path);
+int partition_read(Partition* partition);
+void partition_apply(Partition* partition, Block* head, HashTable* user_table, long* added, long* skipped);
+void load_partitions(Partition** order, int count, Block* head, HashTable* user_table, long* added, long* skipped);
+void load_manifest(char* path, Block* head, HashTable* user_table, unsigned time_start, unsigned time_end);
+void manifest_menu(Block* head, HashTable* user_table);
 void add_new_transaction(Block* list, HashTable* user_list, char* file_name);
+int parse_block_line(char* line, int* blockID, char** hash, unsigned* time_stamp);
+int parse_transaction_line(char* line, int* tx_id, int* blockID, char** from, double* amount, char** to);
+Block* apply_transaction(Block* list, HashTable* user_list, int tx_id, int blockID, char* from, double amount, char* to);
+Block* apply_resolved(Block* list, HashTable* user_list, int tx_id, int blockID, user* from_user, double amount, user* to_user);
+Block* ingest_batch(Block* list, HashTable* user_list, IngestRow* rows, int count);
+Block* find_block(int blockID);
+int parse_block_hash(char* text, unsigned char* key);
+void block_hash_add(Block* block);
+Block* find_block_by_hash(char* hash);
+void tx_index_migrate(TxIdIndex* index, int old_span);
+void tx_index_add(int tx_id, int row);
+int tx_index_find(int tx_id);
 void insertBlock(Block* list, int blockID, char* hash, unsigned time_stamp);
-void insertTransaction(Block* list, int tx_id, int blockID, char* from, double amount, char* to);
-Transaction* copy_transaction(Transaction* source);
+Block* insertTransaction(Block* list, int tx_id, int blockID, int from, double amount, int to);
+void append_tx_column(Block* block, int tx_id, int from, int to, double amount);
+void segment_append(TxSegment* segment, int tx_id, int from, int to, double amount);
+void segment_open(TxSegment* segment, SegmentReader* reader);
+unsigned long long segment_field(SegmentReader* reader, int i, int field);
+int segment_tx_id(SegmentReader* reader, int i);
+unsigned long long amount_encode(double amount);
+double segment_amount(SegmentReader* reader, int i);
+void print_storage_stats(HashTable* user_table);
 
 // 处理用户名单和交易图（hash表、邻接图、逆邻接图）
 HashTable* initHashTable(int size);
 int hashFunction(char* key, int size);
 void insert(HashTable* hashTable, char* key, int sign);
-void insert_edge(HashTable* hashTable, int tx_id, int blockID, char* from, double amount, char* to);
-void pathHashtable(HashTable* user_table);
-void max_in_out(HashTable* user_table, int k);
-void wealth_rank(HashTable* user_table, int k);
+user* insert_user(HashTable* hashTable, char* key, int index, int sign);
+user* resolve_account(HashTable* hashTable, char* key, int index, long first_seen);
+void insert_edge(user* from_user, double amount, user* to_user);
+AccountTotals* account_totals(HashTable* user_table, unsigned as_of);
+void free_account_totals(AccountTotals* totals);
+void pathHashtable(HashTable* user_table, unsigned as_of);
+void print_average_degree(DegreeSum* sum, int count);
+void max_in_out(HashTable* user_table, int k, unsigned as_of);
+void wealth_rank(HashTable* user_table, int k, unsigned as_of);
 void free_hashTable(HashTable* HashTable);
 
-// 最短路径相关算法
-void check_ring(HashTable* user_table);
-void shortest_path(HashTable* user_table, char* from, char* to);
+// 最短路径相关算法（as_of为UINT_MAX表示不限时刻）
+void check_ring(HashTable* user_table, unsigned as_of);
+void shortest_path(HashTable* user_table, char* from, char* to, unsigned as_of);
 user* find_user(HashTable* user_table, char* key);
 void init_path(HashTable* user_table);
-int check_ring_by_key(HashTable* user_table, char* from);
-void init_ring(HashTable* user_table);
+int check_ring_by_key(RingSearch* search, int source);
+
+// 环枚举相关算法
+Graph* get_user_graph(HashTable* user_table);
+Graph* build_graph(HashTable* user_table);
+void free_graph(Graph* graph);
+int* strongly_connected_components(Graph* graph, int* component_count);
+void list_cycles(HashTable* user_table, char* account, int max_length, int max_count, int top_n, double time_limit);
+
+// 中心性分析
+PullGraph* get_pull_graph(HashTable* user_table);
+void pagerank(HashTable* user_table, int k, double damping, double tolerance, int max_iterations);
+void betweenness(HashTable* user_table, int k, int samples);
+
+// 弱连通分量
+void component_reserve(int n);
+int component_find(int v);
+int component_union(int a, int b);
+void component_summary(HashTable* user_table, int k);
+void same_component(HashTable* user_table, char* a, char* b);
+
+// 交易模式检测
+void select_intersect_kernel();
+int find_arc(Graph* graph, int from, int to);
+void motif_analysis(HashTable* user_table, char* account, double min_amount, int min_degree, int min_chain, int k);
+
+// k跳邻域和可达性
+Graph* get_reverse_graph(HashTable* user_table);
+void hop_search_init(HopSearch* search, HashTable* user_table, int direction, int limit);
+void hop_search_run(HopSearch* search, int source, int max_depth, int target);
+void hop_search_free(HopSearch* search);
+void ego_network(HashTable* user_table, char* account, int hops, int direction, int limit);
+void reachability(HashTable* user_table, char* from, char* to, int direction);
+
+// 时态路径和资金追踪
+TemporalStream* get_temporal_stream();
+void earliest_arrival(HashTable* user_table, char* from, char* to, unsigned time_start);
+void temporal_reach(HashTable* user_table, char* from, unsigned time_start, unsigned time_end, int k);
+void taint_trace(HashTable* user_table, char* account, unsigned time_start, unsigned time_end, double amount, int k);
+
+// 滚动窗口统计
+void window_configure(int max_blocks, unsigned max_seconds);
+void window_apply(int from, int to, double amount, int sign);
+void window_advance();
+void window_leaders(HashTable* user_table, int k);
+
+// 时间桶汇总
+void rollup_record(unsigned time_stamp, int from, int to, double amount);
+int rollup_lower_bound(RollupSeries* series, unsigned bucket);
+RollupCell* rollup_series_cell(RollupSeries* series, unsigned bucket);
+RollupCell* rollup_cell(int uid, unsigned bucket);
+void rollup_configure(unsigned width);
+int rollup_split(unsigned time_start, unsigned time_end, unsigned* full_begin, unsigned* full_end, int* edge);
+void rollup_scan(int block_begin, int block_end, int account, RollupTotals* totals);
+void rollup_network(unsigned time_start, unsigned time_end);
+void rollup_account(HashTable* user_table, char* account, unsigned time_start, unsigned time_end);
+
+// 流式概率摘要
+unsigned long long account_hash(char* account);
+void sketch_record(int from_uid, int to_uid, char* from, char* to, double amount);
+double hll_estimate(unsigned char* registers);
+double count_min_estimate(StreamSketch* sketch, unsigned long long hash);
+void stream_sketch_merge(StreamSketch* into, StreamSketch* from);
+int heavy_hitter_capacity(int accounts);
+void heavy_hitter_configure(HashTable* user_table, int budget);
+void account_sketch(HashTable* user_table, char* account);
+void heavy_hitters(HashTable* user_table, int k);
+
+// 并行运行时
+int cpu_count();
+double now_seconds();
+void runtime_init();
+int runtime_threads();
+int default_grain(int n);
+void parallel_for(int begin, int end, int grain, RangeBody body, void* ctx);
+void parallel_reduce(int begin, int end, int grain, size_t partial_size,
+    ReduceInit init, ReduceBody body, ReduceMerge merge, void* result, void* ctx);
+TopK* topk_create(int k);
+void topk_push(TopK* top, int uid, double value);
+void topk_merge(TopK* into, TopK* from);
+void topk_free(TopK* top);
+
+// 列式聚合
+void select_aggregate_kernel();
+int block_lower_bound(unsigned time_stamp);
+int block_upper_bound(unsigned time_stamp);
+void aggregate_amount(AmountFilter* filter, AmountStats* stats);
+
+// 跟踪数据文件的追加
+void start_follow(Block* head, HashTable* user_table);
+void stop_follow();
+void follow_status();
+int file_status(char* path, long* size, double* mtime);
+void sleep_ms(int ms);
+double wall_seconds();
+void follow_defer(FollowState* state, int tx_id, int blockID, char* from, double amount, char* to);
+void follow_resolve_pending(FollowState* state, HashTable* user_table);
+
+// 预写日志和快照
+unsigned crc32_update(unsigned crc, const void* data, size_t length);
+void wal_log_block(int blockID, char* hash, unsigned time_stamp);
+void wal_log_transaction(int kind, int tx_id, int blockID, char* from, double amount, char* to);
+void wal_commit();
+void wal_base_offsets(long* block_limit, long* transaction_limit);
+void wal_replay(Block* head, HashTable* user_table);
+int load_snapshot(Block* head, HashTable* user_table);
+void compact_wal(HashTable* user_table);
 
 // 查询函数
-void account_in_out(unsigned time_start, unsigned time_end, int k, char* account, Block* head);
-void account_amount(unsigned time_end, char* account, Block* head);
-HashTable* time_wealth_rank(Block* head, unsigned time_stamp, int k);
+void account_in_out(unsigned time_start, unsigned time_end, int k, char* account, Block* head, HashTable* user_table);
+void account_amount(unsigned time_end, char* account, Block* head, HashTable* user_table);
+void network_volume(unsigned time_start, unsigned time_end, double threshold);
+void lookup_transaction(HashTable* user_table, int tx_id);
+void lookup_block(HashTable* user_table, char* hash);
+void time_wealth_rank(HashTable* user_table, unsigned time_stamp, int k);
+void net_change_rank(HashTable* user_table, unsigned time_start, unsigned time_end, int k);
 void data_lookup(Block* head, HashTable* user_table);
 void data_analysis(Block* head, HashTable* user_table);
 void add_file(Block* head, HashTable* user_table);
+void follow_menu(Block* head, HashTable* user_table);
+void settings(HashTable* user_table);
 void operation(Block* head, HashTable* user_table);
 
-int main()
+int main(int argc, char* argv[])
 {
     start_time = clock();
+    // -m <MB>: 以外存模式启动，常驻内存超过上限时让出映射页
+    // -s <N>: 以分片模式启动，账户按哈希分到N个工作进程
+    // -d <清单>: 按数据清单加载分区；-w <开始>,<结束>: 只加载与该时间段相交的交易分区
+    // -H <N>: 金额最高账户摘要使用N个计数器，默认HEAVY_HITTERS个；-H -<k>: 每k个账户一个计数器
+    // -b <轮数>: 加载完后运行邻接表基准并退出
+    for (int i = 1; i + 1 < argc; i++)
+    {
+        if (strcmp(argv[i], "-m") == 0 && atol(argv[i + 1]) > 0)
+        {
+            set_out_of_core(1, atol(argv[i + 1]));
+        }
+        else if (strcmp(argv[i], "-s") == 0)
+        {
+            shard_count = atoi(argv[i + 1]);
+            shard_count = shard_count > MAX_SHARDS ? MAX_SHARDS : shard_count;
+        }
+        else if (strcmp(argv[i], "-d") == 0)
+        {
+            manifest_file = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "-w") == 0)
+        {
+            sscanf(argv[i + 1], "%u,%u", &manifest_time_start, &manifest_time_end);
+        }
+        else if (strcmp(argv[i], "-b") == 0)
+        {
+            benchmark_rounds = atoi(argv[i + 1]);
+        }
+        else if (strcmp(argv[i], "-H") == 0)
+        {
+            heavy_hitter_budget = atoi(argv[i + 1]);
+        }
+    }
+    if (manifest_file != 0 && shard_count > 1)
+    {
+        printf("分片模式下不支持数据清单，忽略 -d\n");
+        manifest_file = 0;
+    }
+    // fork只复制调用的线程，工作进程要在创建线程池之前启动
+    if (shard_count > 1)
+    {
+        start_shards();
+    }
+    runtime_init();
+    select_aggregate_kernel();
+    select_intersect_kernel();
+    if (shard_count > 1)
+    {
+        operation(0, 0);
+        stop_shards();
+        return 0;
+    }
     HashTable* userTable = initHashTable(HashTableSize);
     Block* head = createLinkedList(userTable);
+    if (benchmark_rounds > 0)
+    {
+        wait_load_finished();
+        adjacency_benchmark(userTable, benchmark_rounds);
+        return 0;
+    }
 
     operation(head, userTable);
 
     /* 下列注释用于各个函数的快速演示 */
     // add_new_transaction(head, userTable, "tx_data_part2.csv");
-    // check_ring(userTable);
-    // shortest_path(userTable, "1HNzxjHeAjDJ47KvQdYcsrsPUWhYWrAF4p", "1HxW4owufY8ujzwav7xbVW84FZabRV6rWt");
-    // time_wealth_rank(head, 1354268787, 20);
-    // wealth_rank(userTable, 50);
-    // max_in_out(userTable, 3);
-    // pathHashtable(userTable);
-    // account_in_out(1284753029, 1358886914, 5, "1Mw6FCSvf81NxkC1B6u8djW1rXMQSv1VTv", head);
-    // account_amount(1358886914, "1Mw6FCSvf81NxkC1B6u8djW1rXMQSv1VTv", head);
+    // check_ring(userTable, UINT_MAX);
+    // shortest_path(userTable, "1HNzxjHeAjDJ47KvQdYcsrsPUWhYWrAF4p", "1HxW4owufY8ujzwav7xbVW84FZabRV6rWt", UINT_MAX);
+    // time_wealth_rank(userTable, 1354268787, 20);
+    // wealth_rank(userTable, 50, UINT_MAX);
+    // max_in_out(userTable, 3, UINT_MAX);
+    // pathHashtable(userTable, UINT_MAX);
+    // account_in_out(1284753029, 1358886914, 5, "1Mw6FCSvf81NxkC1B6u8djW1rXMQSv1VTv", head, userTable);
+    // account_amount(1358886914, "1Mw6FCSvf81NxkC1B6u8djW1rXMQSv1VTv", head, userTable);
+    // network_volume(1284753029, 1358886914, 0);
 
     return 0;
 }
 
-// 去除末尾\n
-void removeNewline(char* str)
+// 机器的逻辑处理器数
+int cpu_count()
 {
-    int len = strlen(str);
-    
-    // 检查字符串是否为空
-    if (len > 0)
-    {
-        // 检查最后一个字符是否为换行符
-        if (str[len - 1] == '\n')
-        {
-            // 将换行符替换为字符串结束符'\0'
-            str[len - 1] = '\0';
-        }
-    }
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    int count = (int)info.dwNumberOfProcessors;
+#else
+    int count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return count > 0 ? count : 1;
 }
 
-// 根据csv文件组构建链表
-Block* createLinkedList(HashTable* userTable)
+// 单调时钟（秒），多线程下clock()统计的是所有线程的CPU时间，计时用这个
+double now_seconds()
 {
-    Block* head = (Block*)malloc(sizeof(Block));
-    head->blockID = 0;
-    head->block_timestamp = 0;
-    head->hash = 0;
-    head->next = head;
-    head->prev = head; 
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
 
-    printf("初始化区块链和交易网络中，请稍等...\n");
-    readBlock(head);
-    readTransaction(head, userTable);
-    end_time = clock();
-    printf("区块链和交易网络初始化已完成!\n");
-    printf("区块数: %d\n交易数: %d\n用户数: %d\n", calc_block, calc_transaction, calc_user);
-    double elapsed_time = (double)(end_time - start_time) / CLOCKS_PER_SEC;
-    printf("运行时间: %.3f 秒\n", elapsed_time);
+/*
+ * 并行运行时：固定大小的线程池，任务按块划分，每个线程先处理自己区间内的块，
+ * 做完后从其他线程的区间尾部偷取一半。块的划分只取决于区间和粒度，与线程数无关，
+ * parallel_reduce按块号顺序合并部分结果，所以结果不受调度影响。
+ */
+typedef struct ChunkQueue
+{
+    pthread_mutex_t lock;
+    int next;  // 待处理的块为 [next, end)
+    int end;
+} ChunkQueue;
 
-    return head;
+typedef struct Runtime
+{
+    int thread_count;  // 池中线程数（含调用线程）
+    pthread_t* threads;
+    ChunkQueue* queues;
+    pthread_mutex_t lock;
+    pthread_mutex_t submit_lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    int generation;
+    int active;    // 本次任务参与的线程数
+    int running;   // 仍在领取任务的线程数，为0时所有块都已完成
+    void (*run_chunk)(int chunk, void* job);
+    void* job;
+} Runtime;
+
+Runtime runtime;
+int runtime_ready = 0;
+__thread int in_parallel = 0;  // 当前线程是否在执行并行任务（嵌套调用时串行执行）
+
+// 线程数上限，0表示跟随机器
+int max_threads = 0;
+
+int runtime_threads()
+{
+    if (max_threads > 0 && max_threads < runtime.thread_count)
+    {
+        return max_threads;
+    }
+    return runtime.thread_count;
 }
 
-// 读取区块信息
-void readBlock(Block* list)
+// 领取一个块：先取自己的，没有则偷取其他线程剩余块的后一半
+int take_chunk(int id)
 {
-    int blockID;
-    char hash_str[64] = {0};
-    char* hash = hash_str;
-    unsigned time_stamp;
-
-    FILE* file = fopen("block_part1.csv", "r");
+    ChunkQueue* own = &runtime.queues[id];
+    pthread_mutex_lock(&own->lock);
+    if (own->next < own->end)
+    {
+        int chunk = own->next++;
+        pthread_mutex_unlock(&own->lock);
+        return chunk;
+    }
+    pthread_mutex_unlock(&own->lock);
 
-    // 逐行读取CSV文件
-    char line[1024];
-    int lineCount = 0;
-    while (fgets(line, sizeof(line), file))
+    for (int i = 1; i < runtime.active; i++)
     {
-        lineCount++;
-        if (lineCount == 1)
+        ChunkQueue* victim = &runtime.queues[(id + i) % runtime.active];
+        pthread_mutex_lock(&victim->lock);
+        int left = victim->end - victim->next;
+        if (left <= 0)
         {
+            pthread_mutex_unlock(&victim->lock);
             continue;
         }
-        // 使用strtok函数拆分CSV行
-        char* token = strtok(line, ",");
-        if (token == NULL) {
-            continue; // 忽略空行
-        }
-
-        // 解析CSV列数据
-        blockID = atoi(token);
-        token = strtok(NULL, ",");
-        hash = token;
-        token = strtok(NULL, ",");
-        time_stamp = (unsigned)atoi(token);
-        
-        // 调用insertBlock函数将块数据插入
-        insertBlock(list, blockID, hash, time_stamp);
+        int steal_begin = victim->end - (left + 1) / 2;
+        int steal_end = victim->end;
+        victim->end = steal_begin;
+        pthread_mutex_unlock(&victim->lock);
+
+        pthread_mutex_lock(&own->lock);
+        own->next = steal_begin + 1;
+        own->end = steal_end;
+        pthread_mutex_unlock(&own->lock);
+        return steal_begin;
     }
-
-    // 关闭文件
-    fclose(file);  
+    return -1;
 }
 
-// 读取交易信息
-void readTransaction(Block* list, HashTable* user_list)
+void run_chunks(int id)
 {
-    int prev_blockID;
-    int tx_id;
-    int blockID;
-    char from_str[34];
-    char to_str[34];
-    char* from = from_str;
-    char* to = to_str;
-    double amount;
-
-    prev_blockID = blockID;
+    in_parallel = 1;
+    int chunk;
+    while ((chunk = take_chunk(id)) >= 0)
+    {
+        runtime.run_chunk(chunk, runtime.job);
+    }
+    in_parallel = 0;
 
-    FILE* file = fopen("tx_data_part1_v2.csv", "r");
+    pthread_mutex_lock(&runtime.lock);
+    if (--runtime.running == 0)
+    {
+        pthread_cond_broadcast(&runtime.done);
+    }
+    pthread_mutex_unlock(&runtime.lock);
+}
 
-    // 逐行读取CSV文件
-    char line[512];
-    int lineCount = 0;
-    while (fgets(line, sizeof(line), file))
+void* runtime_worker(void* arg)
+{
+    int id = (int)(long)arg;
+    int seen = 0;
+    while (1)
     {
-        lineCount++;
-        if (lineCount == 1)
+        pthread_mutex_lock(&runtime.lock);
+        while (runtime.generation == seen)
         {
-            continue;
-        }
-        // 使用strtok函数拆分CSV行
-        char* token = strtok(line, ",");
-        if (token == NULL) {
-            continue; // 忽略空行
+            pthread_cond_wait(&runtime.wake, &runtime.lock);
         }
-
-        // 解析CSV列数据
-        tx_id = atoi(token);
-        token = strtok(NULL, ",");
-        blockID = atoi(token);
-        token = strtok(NULL, ",");
-        from = token;
-        token = strtok(NULL, ",");
-        amount = strtod(token, NULL);
-        token = strtok(NULL, ",");
-        to = token;
-        removeNewline(to);
-
-        // 调用函数将块数据插入
-        char* from_copy = strdup(from);
-        char* to_copy = strdup(to);
-
-        insertTransaction(list, tx_id, blockID, from_copy, amount, to_copy);
-
-
-        // 插入user
-        insert(user_list, from_copy, 1);
-        insert(user_list, to_copy, 1);
-        insert_edge(user_list, tx_id, blockID, from_copy, amount, to_copy);
-
-        if (prev_blockID != blockID)
+        seen = runtime.generation;
+        int joined = id < runtime.active;
+        pthread_mutex_unlock(&runtime.lock);
+        if (joined)
         {
-            // 指针迁移，降低时间复杂度
-            while (list->blockID != blockID)
-            {
-                list = list->next;
-            }
+            run_chunks(id);
         }
-        prev_blockID = blockID;
     }
-
-    // 关闭文件
-    fclose(file);
+    return 0;
 }
 
-// 插入单条区块信息
-void insertBlock(Block* list, int blockID, char* hash, unsigned time_stamp)
+// 创建线程池，线程数跟随机器
+void runtime_init()
 {
-    Block* newblock = (Block*)malloc(sizeof(Block));
-
-    newblock->blockID = blockID;
-    newblock->hash = strdup(hash);  //原来要这么复制指针指向的字符串
-    newblock->block_timestamp = time_stamp;
-    newblock->transaction_count = 0;
-
-    // 初始化交易头结点
-    newblock->transaction_head = (Transaction*)malloc(sizeof(Transaction));
-    newblock->transaction_head->blockID = blockID;
-    newblock->transaction_head->tx_id = 0;
-    newblock->transaction_head->next = newblock->transaction_head;
-    newblock->transaction_head->prev = newblock->transaction_head;
-
-    // 尾插
-    newblock->next = list;
-    newblock->prev = list->prev;
-    list->prev->next = newblock;
-    list->prev = newblock;
-
-    newblock->transaction_count = 0;
-    
-    calc_block++;
-    if (calc_block % 1000 == 0)
+    runtime.thread_count = cpu_count();
+    runtime.threads = (pthread_t*)malloc(sizeof(pthread_t) * runtime.thread_count);
+    runtime.queues = (ChunkQueue*)malloc(sizeof(ChunkQueue) * runtime.thread_count);
+    pthread_mutex_init(&runtime.lock, 0);
+    pthread_mutex_init(&runtime.submit_lock, 0);
+    pthread_cond_init(&runtime.wake, 0);
+    pthread_cond_init(&runtime.done, 0);
+    runtime.generation = 0;
+    for (int i = 0; i < runtime.thread_count; i++)
     {
-        printf("block: %d\n", calc_block);
+        pthread_mutex_init(&runtime.queues[i].lock, 0);
+        runtime.queues[i].next = runtime.queues[i].end = 0;
     }
+    // 0号线程就是提交任务的线程
+    for (int i = 1; i < runtime.thread_count; i++)
+    {
+        pthread_create(&runtime.threads[i], 0, runtime_worker, (void*)(long)i);
+    }
+    runtime_ready = 1;
 }
 
-// 插入单条交易信息
-void insertTransaction(Block* list, int tx_id, int blockID, char* from, double amount, char* to)
+// 执行chunk_count个块，返回时全部完成
+void run_parallel(int chunk_count, void (*run_chunk)(int chunk, void* job), void* job)
 {
-    Block* temp_list = list;
-    while (temp_list->blockID != blockID)
+    if (chunk_count <= 0)
     {
-        temp_list = temp_list->next;
+        return;
+    }
+    // 嵌套调用或池正被其他线程占用时直接串行执行
+    if (!runtime_ready || in_parallel || chunk_count == 1 || runtime_threads() == 1
+        || pthread_mutex_trylock(&runtime.submit_lock) != 0)
+    {
+        for (int chunk = 0; chunk < chunk_count; chunk++)
+        {
+            run_chunk(chunk, job);
+        }
+        return;
     }
 
-    temp_list->transaction_count++;
-    Transaction* newTransaction = (Transaction*)malloc(sizeof(Transaction));
-    newTransaction->blockID = blockID;
-    newTransaction->tx_id = tx_id;
-    newTransaction->amount = amount;
-    newTransaction->from = strdup(from);
-    newTransaction->to = strdup(to);
-
-    // 插入新的交易到区块上的交易链
-    newTransaction->prev = temp_list->transaction_head->prev;
-    newTransaction->next = temp_list->transaction_head;
-    temp_list->transaction_head->prev->next = newTransaction;
-    temp_list->transaction_head->prev = newTransaction;
+    int active = runtime_threads();
+    if (active > chunk_count)
+    {
+        active = chunk_count;
+    }
+    for (int i = 0; i < active; i++)
+    {
+        runtime.queues[i].next = (int)((long)chunk_count * i / active);
+        runtime.queues[i].end = (int)((long)chunk_count * (i + 1) / active);
+    }
 
-    calc_transaction++;
+    pthread_mutex_lock(&runtime.lock);
+    runtime.run_chunk = run_chunk;
+    runtime.job = job;
+    runtime.active = active;
+    runtime.running = active;
+    runtime.generation++;
+    pthread_cond_broadcast(&runtime.wake);
+    pthread_mutex_unlock(&runtime.lock);
+
+    run_chunks(0);
 
-    if (calc_transaction % 100000 == 0)
+    pthread_mutex_lock(&runtime.lock);
+    while (runtime.running > 0)
     {
-        printf("transaction: %d\n", calc_transaction);
+        pthread_cond_wait(&runtime.done, &runtime.lock);
     }
+    pthread_mutex_unlock(&runtime.lock);
+    pthread_mutex_unlock(&runtime.submit_lock);
 }
 
-// 计算一段时间内账户的交易出入
-void account_in_out(unsigned time_start, unsigned time_end, int k, char* account, Block* head)
+// 不依赖线程数的默认粒度，保证块划分固定
+int default_grain(int n)
 {
-    if (time_start > time_end)
+    int grain = n / 256;
+    return grain < 1024 ? 1024 : grain;
+}
+
+typedef struct ForJob
+{
+    int begin;
+    int end;
+    int grain;
+    RangeBody body;
+    void* ctx;
+} ForJob;
+
+void run_for_chunk(int chunk, void* arg)
+{
+    ForJob* job = (ForJob*)arg;
+    int begin = job->begin + chunk * job->grain;
+    int end = begin + job->grain < job->end ? begin + job->grain : job->end;
+    job->body(begin, end, job->ctx);
+}
+
+// 对 [begin, end) 按grain分块并行执行body
+void parallel_for(int begin, int end, int grain, RangeBody body, void* ctx)
+{
+    if (end <= begin)
     {
-        printf("起始时间必须小于终止时间\n");
         return;
     }
+    ForJob job = {begin, end, grain > 0 ? grain : 1, body, ctx};
+    run_parallel((end - begin + job.grain - 1) / job.grain, run_for_chunk, &job);
+}
+
+typedef struct ReduceJob
+{
+    int begin;
+    int end;
+    int grain;
+    char* partials;
+    size_t partial_size;
+    ReduceInit init;
+    ReduceBody body;
+    void* ctx;
+} ReduceJob;
+
+void run_reduce_chunk(int chunk, void* arg)
+{
+    ReduceJob* job = (ReduceJob*)arg;
+    int begin = job->begin + chunk * job->grain;
+    int end = begin + job->grain < job->end ? begin + job->grain : job->end;
+    void* partial = job->partials + job->partial_size * chunk;
+    job->init(partial, job->ctx);
+    job->body(begin, end, partial, job->ctx);
+}
 
-    Block* temp_block = head;
-    while (temp_block->block_timestamp < time_start)
+// 每块得到一个部分结果，最后按块号顺序并入result
+void parallel_reduce(int begin, int end, int grain, size_t partial_size,
+    ReduceInit init, ReduceBody body, ReduceMerge merge, void* result, void* ctx)
+{
+    if (end <= begin)
     {
-        temp_block = temp_block->next;
+        return;
     }
-    // 已找到时间起始的交易区块
-    Transaction* transaction_list = (Transaction*)malloc(sizeof(Transaction));
-    transaction_list->next = transaction_list;
-    transaction_list->prev = transaction_list;
-    int transaction_count = 0;
-    double transaction_in = 0;
-    double transaction_out = 0;
-    while (temp_block->block_timestamp <= time_end && temp_block->next != head)
+    ReduceJob job;
+    job.begin = begin;
+    job.end = end;
+    job.grain = grain > 0 ? grain : 1;
+    job.partial_size = partial_size;
+    job.init = init;
+    job.body = body;
+    job.ctx = ctx;
+    int chunk_count = (end - begin + job.grain - 1) / job.grain;
+    job.partials = (char*)malloc(partial_size * chunk_count);
+    run_parallel(chunk_count, run_reduce_chunk, &job);
+    for (int chunk = 0; chunk < chunk_count; chunk++)
     {
-        Transaction* temp_transaction = temp_block->transaction_head->next;
+        merge(result, job.partials + partial_size * chunk, ctx);
+    }
+    free(job.partials);
+}
 
-        while (temp_transaction != temp_block->transaction_head)
-        {
-            if (strcmp(temp_transaction->from, account) == 0 || strcmp(temp_transaction->to, account) == 0)
-            {
-
-                if (transaction_list->next == transaction_list)
-                {
-                    Transaction* transaction_copy = copy_transaction(temp_transaction);
-
-                    transaction_copy->next = transaction_list;
-                    transaction_copy->prev = transaction_list;
-                    transaction_list->next = transaction_copy;
-                    transaction_list->prev = transaction_copy;
-                }
-                else
-                {
-                    Transaction* temp_transaction_list = transaction_list;
-                    while (temp_transaction_list->next->amount > temp_transaction->amount && temp_transaction_list->next != transaction_list)
-                    {
-                        temp_transaction_list = temp_transaction_list->next;
-                    }
-
-                    Transaction* transaction_copy = copy_transaction(temp_transaction);
-
-                    temp_transaction_list->next->prev = transaction_copy;
-                    transaction_copy->next = temp_transaction_list->next;
-                    transaction_copy->prev = temp_transaction_list;
-                    temp_transaction_list->next = transaction_copy;
-                }
-                if (strcmp(temp_transaction->from, account) == 0)
-                {
-                    transaction_out += temp_transaction->amount;
-                }
-                else
-                {
-                    transaction_in += temp_transaction->amount;
-                }
-                transaction_count++;
-            }
-            temp_transaction = temp_transaction->next;
-        }
-        // 更新查找区块
-        temp_block = temp_block->next;
-    }
-    printf("总交易数: %d\n", transaction_count);
-    printf("总支出: %.2lf\n", transaction_out);
-    printf("总收入: %.2lf\n", transaction_in);
-    printf("交易金额最大的%d笔交易:\n", k);
-    Transaction* temp_list = transaction_list->next;
-    for (int i = 0; i < k && temp_list != transaction_list; i++)
-    {
-        printf("txid: %d\nblockID: %d\nadd_in: %s\nadd_out: %s\namount: %.2lf\n\n", 
-        temp_list->tx_id, temp_list->blockID, temp_list->from, temp_list->to, temp_list->amount);
-        temp_list = temp_list->next;
-        if (temp_list == transaction_list) break;
-    }
-    // printf("\n");
-}
-
-// 复制交易节点
-Transaction* copy_transaction(Transaction* source)
-{  
-    Transaction* transaction_copy = (Transaction*)malloc(sizeof(Transaction));
-    transaction_copy->amount = source->amount;
-    transaction_copy->blockID = source->blockID;
-    transaction_copy->tx_id = source->tx_id;
-    transaction_copy->from = strdup(source->from);
-    transaction_copy->to = strdup(source->to);
-    return transaction_copy;
+// 前k名：按value降序、uid升序排列，保证并列时结果确定
+TopK* topk_create(int k)
+{
+    TopK* top = (TopK*)malloc(sizeof(TopK));
+    top->k = k > 0 ? k : 0;
+    top->count = 0;
+    top->uid = (int*)malloc(sizeof(int) * (top->k + 1));
+    top->value = (double*)malloc(sizeof(double) * (top->k + 1));
+    return top;
 }
 
-// 统计结余
-void account_amount(unsigned time_end, char* account, Block* head)
+void topk_push(TopK* top, int uid, double value)
 {
-    Block* temp_block = head->next;
-
-    // 已找到时间起始的交易区块
-    int transaction_count = 0;
-    double transaction_in = 0;
-    double transaction_out = 0;
-    while (temp_block->block_timestamp <= time_end && temp_block->next != head)
+    if (top->k == 0)
+    {
+        return;
+    }
+    if (top->count == top->k)
     {
-        Transaction* temp_transaction = temp_block->transaction_head->next;
-        while (temp_transaction != temp_block->transaction_head)
+        double last = top->value[top->count - 1];
+        if (value < last || (value == last && uid > top->uid[top->count - 1]))
         {
-            if (strcmp(temp_transaction->from, account) == 0)
-            {
-                transaction_out += temp_transaction->amount;
-                transaction_count++;      
-            }
-            else if (strcmp(temp_transaction->to, account) == 0)
-            {
-                transaction_in += temp_transaction->amount;
-                transaction_count++;
-            }
-            temp_transaction = temp_transaction->next;
+            return;
         }
-        // 更新查找区块
-        temp_block = temp_block->next;
+        top->count--;
+    }
+    int i = top->count++;
+    while (i > 0 && (top->value[i - 1] < value || (top->value[i - 1] == value && top->uid[i - 1] > uid)))
+    {
+        top->uid[i] = top->uid[i - 1];
+        top->value[i] = top->value[i - 1];
+        i--;
     }
-    printf("总交易数: %d\n", transaction_count);
-    printf("总支出: %.2lf\n", transaction_out);
-    printf("总收入: %.2lf\n", transaction_in);
-    printf("结余: %.2lf\n", transaction_in - transaction_out);
+    top->uid[i] = uid;
+    top->value[i] = value;
 }
 
-// 初始化哈希表
-HashTable* initHashTable(int size)
+void topk_merge(TopK* into, TopK* from)
 {
-    HashTable* hashTable = (HashTable*)malloc(sizeof(HashTable));
-    hashTable->size = size;
-    hashTable->table = (user**)malloc(sizeof(user*) * size);
-
-    for (int i = 0; i < size; i++)
+    for (int i = 0; i < from->count; i++)
     {
-        hashTable->table[i] = (user*)malloc(sizeof(user));
-        hashTable->table[i]->next_user = 0;
+        topk_push(into, from->uid[i], from->value[i]);
     }
-
-    return hashTable;
 }
 
-// 哈希函数
-int hashFunction(char* key, int size)
+void topk_free(TopK* top)
 {
-    unsigned int hash = 5381; // 一个常用的初始哈希值
-    int c;
+    free(top->uid);
+    free(top->value);
+    free(top);
+}
 
-    while ((c = *key++))
+/*
+ * 外存模式的存储管理。大数组都通过Region分配：平时在堆上，外存模式下放在spill_dir中的映射文件里
+ * （文件建好后立即删除，进程退出后不留下文件）。映射页由页缓存管理，常驻内存超过上限时
+ * storage_trim让出所有映射页，之后访问再从页缓存或磁盘读回。
+ */
+void region_register(Region* region)
+{
+    if (!region->registered)
     {
-        hash = ((hash << 5) + hash) + c; // 乘以33并加上字符的ASCII值
+        // 每个图缓存、段和临时数组都会登记，数目不固定，满了就扩容，不能漏掉任何一个
+        if (region_count == region_capacity)
+        {
+            region_capacity = region_capacity > 0 ? region_capacity * 2 : 32;
+            regions = (Region**)realloc(regions, sizeof(Region*) * region_capacity);
+        }
+        regions[region_count++] = region;
+        region->registered = 1;
     }
-
-    return hash % size;
 }
 
-// 插入操作
-void insert(HashTable* hashTable, char* key, int sign)
+// 在堆上或映射文件中分配bytes字节，复制原有内容
+void region_allocate(Region* region, size_t bytes, int mapped)
 {
-    int index = hashFunction(key, hashTable->size);
-    user* new_user = (user*)malloc(sizeof(user));
-    new_user->user_id = key;
-    new_user->in_count = 0;
-    new_user->out_count = 0;
-    new_user->in_list_head = (Transaction*)malloc(sizeof(Transaction));
-    new_user->out_list_head = (Transaction*)malloc(sizeof(Transaction));
-    new_user->in_list_head->next = 0;
-    new_user->out_list_head->next = 0;
-    new_user->in_list_head->amount = 0;
-    new_user->out_list_head->amount = 0;
-
-    user* temp_user = hashTable->table[index]->next_user;
-    while (temp_user != 0)
+    void* data = 0;
+    int fd = -1;
+#ifndef _WIN32
+    if (mapped)
     {
-        if (strcmp(temp_user->user_id, new_user->user_id) == 0)
+        char path[256];
+        snprintf(path, sizeof(path), "%s/regionXXXXXX", spill_dir);
+        mkdir(spill_dir, 0755);
+        fd = mkstemp(path);
+        if (fd >= 0)
         {
-            return;
+            unlink(path);
+            if (ftruncate(fd, bytes) == 0)
+            {
+                data = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            }
+            if (data == MAP_FAILED)
+            {
+                data = 0;
+            }
+        }
+        if (data == 0)
+        {
+            printf("无法在 %s 中建立映射文件，改用内存\n", spill_dir);
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            fd = -1;
+            mapped = 0;
         }
-        temp_user = temp_user->next_user;
     }
-    new_user->next_user = hashTable->table[index]->next_user;
-    hashTable->table[index]->next_user = new_user;
-
-    if (sign == 1)
+#else
+    mapped = 0;
+#endif
+    if (!mapped)
     {
-        calc_user++;
+        data = malloc(bytes);
     }
 
-    if (calc_user % 100000 == 0)
+    if (region->capacity > 0)
     {
-        printf("insert user: %d\n", calc_user);
+        memcpy(data, region->data, region->capacity < bytes ? region->capacity : bytes);
     }
+    region_free(region);
+    region->data = data;
+    region->capacity = bytes;
+    region->mapped = mapped;
+    region->fd = fd;
+    region_register(region);
 }
 
-// 将交易插入邻接图和逆邻接图
-void insert_edge(HashTable* hashTable, int tx_id, int blockID, char* from, double amount, char* to)
+// 保证容量至少为bytes字节，返回新的起始地址
+void* region_reserve(Region* region, size_t bytes)
 {
-    Transaction* new_transaction_in = (Transaction*)malloc(sizeof(Transaction));
-    new_transaction_in->amount = amount;
-    new_transaction_in->blockID = blockID;
-    new_transaction_in->tx_id = tx_id;
-    new_transaction_in->from = strdup(from);
-    new_transaction_in->to = strdup(to);
-    Transaction* new_transaction_out = copy_transaction(new_transaction_in);
-    
-    int index_from = hashFunction(from, hashTable->size);
-    int index_to = hashFunction(to, hashTable->size);
-    user* temp_user = hashTable->table[index_from]->next_user;
-    while (temp_user != 0)
+    if (bytes <= region->capacity)
     {
-        if (strcmp(temp_user->user_id, from) == 0)
-        {
-            new_transaction_in->next = temp_user->out_list_head->next;
-            temp_user->out_list_head->next = new_transaction_in;
-            temp_user->out_count++;
-            temp_user->out_list_head->amount += new_transaction_in->amount;
-            break;
-        }
-        temp_user = temp_user->next_user;
+        return region->data;
     }
-    temp_user = hashTable->table[index_to]->next_user;
-    while (temp_user != 0)
+    if (!region->mapped && !out_of_core)
+    {
+        region->data = realloc(region->data, bytes);
+        region->capacity = bytes;
+        region_register(region);
+        return region->data;
+    }
+#ifndef _WIN32
+    if (region->mapped && ftruncate(region->fd, bytes) == 0)
     {
-        if (strcmp(temp_user->user_id, to) == 0)
+        // 映射文件变长后重新映射，内容保留在文件中
+        void* data = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, region->fd, 0);
+        if (data != MAP_FAILED)
         {
-            new_transaction_out->next = temp_user->in_list_head->next;
-            temp_user->in_list_head->next = new_transaction_out;
-            temp_user->in_count++;
-            temp_user->in_list_head->amount += new_transaction_out->amount;
-            break;
+            munmap(region->data, region->capacity);
+            region->data = data;
+            region->capacity = bytes;
+            return data;
         }
-        temp_user = temp_user->next_user;
     }
+#endif
+    region_allocate(region, bytes, out_of_core);
+    return region->data;
 }
 
-// 遍历哈希表并统计平均入度出度
-void pathHashtable(HashTable* user_table)
+// 释放存储并取消登记
+void region_free(Region* region)
 {
-    int index;
-    int total_in = 0;
-    int total_out = 0;
-    double total_in_amount = 0;
-    double total_out_amount = 0;
-
-    for (index = 0; index < user_table->size; index++)
+    if (region->capacity > 0)
     {
-        user* temp_user = user_table->table[index];
-        if (temp_user->next_user == 0)
+#ifndef _WIN32
+        if (region->mapped)
         {
-            continue;
+            munmap(region->data, region->capacity);
+            close(region->fd);
         }
-        temp_user = temp_user->next_user;
-        while (temp_user != 0)
+        else
+#endif
         {
-            total_in += temp_user->in_count;
-            total_out += temp_user->in_count;
-            total_in_amount += temp_user->in_list_head->amount;
-            total_out_amount += temp_user->out_list_head->amount;
-            temp_user = temp_user->next_user;
+            free(region->data);
         }
     }
-    double average_in, average_out, average_in_amount, average_out_amount;
-    average_in = ((double)total_in) / ((double)calc_user);
-    average_out = ((double)total_out) / ((double)calc_user);
-    average_out_amount = total_out_amount / ((double)calc_user);
-    average_in_amount = total_in_amount / ((double)calc_user);
-
-    printf("平均入度为: %.2lf\n平均出度为: %.2lf\n加权平均入度为: %.2lf\n加权平均出度为: %.2lf\n", 
-    average_in, average_out, average_in_amount, average_out_amount);
+    region->data = 0;
+    region->capacity = 0;
+    region->mapped = 0;
 }
 
-// 遍历哈希表并统计最大出度和最大入度
-void max_in_out(HashTable* user_table, int k)
+void region_unregister(Region* region)
 {
-    int index;
-    user_max* max_in = (user_max*)malloc(sizeof(user));
-    max_in->amount = 0;
-    max_in->next = 0;
-    max_in->user_id = "";
-    user_max* max_out = (user_max*)malloc(sizeof(user));
-    max_out->amount = 0;
-    max_out->next = 0;
-    max_out->user_id = "";
-    user_max* max_in_amount = (user_max*)malloc(sizeof(user));
-    max_in_amount->amount = 0;
-    max_in_amount->next = 0;
-    max_in_amount->user_id = "";
-    user_max* max_out_amount = (user_max*)malloc(sizeof(user));
-    max_out_amount->amount = 0;
-    max_out_amount->next = 0;
-    max_out_amount->user_id = "";
-
-    for (index = 0; index < user_table->size; index++)
-    {
-        user* temp_user = user_table->table[index];
-        if (temp_user->next_user == 0)
-        {
-            continue;
-        }
-        temp_user = temp_user->next_user;
-        while (temp_user != 0)
-        {
-            int i = 0;
-            user_max* temp;
-
-            user_max* user_in = (user_max*)malloc(sizeof(user_max));
-            user_in->user_id = strdup(temp_user->user_id);
-            user_in->amount = (double)temp_user->in_count;
-            temp = max_in;
-            for (i = 0; i < k; i++)
-            {
-                if (temp->next == 0)
-                {
-                    user_in->next = temp->next;
-                    temp->next = user_in;
-                    break;
-                }
-                if (temp->next->amount < temp_user->in_count)
-                {
-                    user_in->next = temp->next;
-                    temp->next = user_in;
-                    break;
-                }
-                temp = temp->next;
-            }
-
-            user_max* user_out = (user_max*)malloc(sizeof(user_max));
-            user_out->user_id = strdup(temp_user->user_id);
-            user_out->amount = (double)temp_user->out_count;
-            temp = max_out;
-            for (i = 0; i < k; i++)
-            {
-                if (temp->next == 0)
-                {
-                    user_out->next = temp->next;
-                    temp->next = user_out;
-                    break;
-                }
-                if (temp->next->amount < temp_user->out_count)
-                {
-                    user_out->next = temp->next;
-                    temp->next = user_out;
-                    break;
-                }
-                temp = temp->next;
-            }
-
-            user_max* user_in_amount = (user_max*)malloc(sizeof(user_max));
-            user_in_amount->user_id = strdup(temp_user->user_id);
-            user_in_amount->amount = temp_user->in_list_head->amount;
-            temp = max_in_amount;
-            for (i = 0; i < k; i++)
-            {
-                if (temp->next == 0)
-                {
-                    user_in_amount->next = temp->next;
-                    temp->next = user_in_amount;
-                    break;
-                }
-                if (temp->next->amount < temp_user->in_list_head->amount)
-                {
-                    user_in_amount->next = temp->next;
-                    temp->next = user_in_amount;
-                    break;
-                }
-                temp = temp->next;
-            }
-
-            user_max* user_out_amount = (user_max*)malloc(sizeof(user_max));
-            user_out_amount->user_id = strdup(temp_user->user_id);
-            user_out_amount->amount = temp_user->out_list_head->amount;
-            temp = max_out_amount;
-            for (i = 0; i < k; i++)
-            {
-                if (temp->next == 0)
-                {
-                    user_out_amount->next = temp->next;
-                    temp->next = user_out_amount;
-                    break;
-                }
-                if (temp->next->amount < temp_user->out_list_head->amount)
-                {
-                    user_out_amount->next = temp->next;
-                    temp->next = user_out_amount;
-                    break;
-                }
-                temp = temp->next;
-            }
-
-            temp_user = temp_user->next_user;
-        }
-    }
-
-    user_max* temp;
-
-    temp = max_in;
-    printf("入度排行前%d名\n", k);
-    for (int i = 0; i < k; i++)
+    for (int i = 0; i < region_count; i++)
     {
-        temp = temp->next;
-        printf("入度 NO.%d: %s, %d\n", i + 1, temp->user_id, (int)temp->amount);
-        if (temp == 0)
+        if (regions[i] == region)
         {
+            regions[i] = regions[--region_count];
             break;
         }
     }
+    region->registered = 0;
+}
 
-    temp = max_out;
-    printf("出度排行前%d名\n", k);
-    for (int i = 0; i < k; i++)
+// 存储搬动后更新各处的数组指针
+void storage_bind()
+{
+    tx_columns.tx_id = (int*)tx_columns.regions[0].data;
+    tx_columns.block = (int*)tx_columns.regions[1].data;
+    tx_columns.from = (int*)tx_columns.regions[2].data;
+    tx_columns.to = (int*)tx_columns.regions[3].data;
+    tx_columns.amount = (double*)tx_columns.regions[4].data;
+    segment_arena.data = (unsigned char*)segment_arena.region.data;
+    tx_adjacency.target = (int*)tx_adjacency.target_region.data;
+    tx_adjacency.amount = (double*)tx_adjacency.amount_region.data;
+    tx_adjacency.block = (int*)tx_adjacency.block_region.data;
+    compact_adjacency.bytes = (unsigned char*)compact_adjacency.bytes_region.data;
+    compact_adjacency.amount = (double*)compact_adjacency.amount_region.data;
+    compact_adjacency.block = (int*)compact_adjacency.block_region.data;
+    temporal_stream.row = (int*)temporal_stream.row_region.data;
+    temporal_stream.time = (unsigned*)temporal_stream.time_region.data;
+    if (user_graph != 0)
     {
-        temp = temp->next;
-        printf("出度 NO.%d: %s, %d\n", i + 1, temp->user_id, (int)temp->amount);
-        if (temp == 0)
-        {
-            break;
-        }
+        user_graph->target = (int*)user_graph->target_region.data;
+        user_graph->weight = (double*)user_graph->weight_region.data;
     }
-
-    temp = max_in_amount;
-    printf("加权入度排行前%d名\n", k);
-    for (int i = 0; i < k; i++)
+    if (reverse_graph != 0)
     {
-        temp = temp->next;
-        printf("加权入度 NO.%d: %s, %.2lf\n", i + 1, temp->user_id, temp->amount);
-        if (temp == 0)
-        {
-            break;
-        }
+        reverse_graph->target = (int*)reverse_graph->target_region.data;
+        reverse_graph->weight = (double*)reverse_graph->weight_region.data;
     }
+    pull_graph.source = (int*)pull_graph.source_region.data;
+    pull_graph.share = (double*)pull_graph.share_region.data;
+}
 
-    temp = max_out_amount;
-    printf("加权出度排行前%d名\n", k);
-    for (int i = 0; i < k; i++)
+// 开关外存模式（持写锁调用），已有的数据搬到映射文件或搬回内存
+void set_out_of_core(int enable, long limit_mb)
+{
+#ifdef _WIN32
+    if (enable)
     {
-        temp = temp->next;
-        printf("加权出度 NO.%d: %s, %.2lf\n", i + 1, temp->user_id, temp->amount);
-        if (temp == 0)
+        printf("当前平台不支持外存模式\n");
+        return;
+    }
+#endif
+    out_of_core = enable;
+    memory_limit_mb = enable ? limit_mb : 0;
+    for (int i = 0; i < region_count; i++)
+    {
+        if (regions[i]->capacity > 0 && regions[i]->mapped != enable)
         {
-            break;
+            region_allocate(regions[i], regions[i]->capacity, enable);
         }
     }
+    storage_bind();
+    storage_trim();
 }
 
-// 计算财富排行
-void wealth_rank(HashTable* user_table, int k)
+// 进程的常驻内存（字节），无法获取时返回0
+long resident_bytes()
 {
-    int index;
-    user_max* max_wealth = (user_max*)malloc(sizeof(user));
-    max_wealth->amount = 0;
-    max_wealth->next = 0;
-    max_wealth->user_id = "";
-
-    for (index = 0; index < user_table->size; index++)
+#ifdef __linux__
+    long pages = 0, resident = 0;
+    FILE* file = fopen("/proc/self/statm", "r");
+    if (file != 0)
     {
-        user* temp_user = user_table->table[index];
-        if (temp_user->next_user == 0)
-        {
-            continue;
-        }
-        temp_user = temp_user->next_user;
-        while (temp_user != 0)
+        if (fscanf(file, "%ld %ld", &pages, &resident) != 2)
         {
-            int i = 0;
-            user_max* temp;
-
-            user_max* user_wealth = (user_max*)malloc(sizeof(user_max));
-            user_wealth->user_id = strdup(temp_user->user_id);
-            double temp_user_wealth = temp_user->in_list_head->amount - temp_user->out_list_head->amount;
-            user_wealth->amount = temp_user_wealth;
-            temp = max_wealth;
-            for (i = 0; i < k; i++)
-            {
-                if (temp->next == 0)
-                {
-                    user_wealth->next = temp->next;
-                    temp->next = user_wealth;
-                    break;
-                }
-                if (temp->next->amount < temp_user_wealth)
-                {
-                    user_wealth->next = temp->next;
-                    temp->next = user_wealth;
-                    break;
-                }
-                temp = temp->next;
-            }
-
-            temp_user = temp_user->next_user;
+            resident = 0;
         }
+        fclose(file);
     }
+    return resident * sysconf(_SC_PAGESIZE);
+#else
+    return 0;
+#endif
+}
 
-    user_max* temp;
-
-    temp = max_wealth;
-    printf("财富排行前%d名\n", k);
-    for (int i = 0; i < k; i++)
+// 常驻内存超过上限时让出映射页（至少持读锁调用，映射不会在此期间变化）
+void storage_trim()
+{
+#ifndef _WIN32
+    if (!out_of_core || memory_limit_mb <= 0 || resident_bytes() <= memory_limit_mb * 1048576)
     {
-        temp = temp->next;
-        printf("财富 NO.%d: %s, %.2lf\n", i + 1, temp->user_id, temp->amount);
-        if (temp == 0)
+        return;
+    }
+    for (int i = 0; i < region_count; i++)
+    {
+        if (regions[i]->mapped)
         {
-            break;
+            // 先开始回写脏页，共享映射让出后内容仍在页缓存和文件中
+            msync(regions[i]->data, regions[i]->capacity, MS_ASYNC);
+            madvise(regions[i]->data, regions[i]->capacity, MADV_DONTNEED);
         }
     }
+    storage_trims++;
+#endif
 }
 
-// 在某时间上的交易网络
-HashTable* time_wealth_rank(Block* head, unsigned time_stamp, int k)
+// 外存模式下大扫描分段进行，每段约占内存上限的四分之一，段间调用storage_trim
+int storage_window(int count, int bytes_per_item)
 {
-    HashTable* user_table = initHashTable(10000);
-    
-    Block* temp_block = head->next;
-    while (temp_block->block_timestamp <= time_stamp)
+    if (!out_of_core || memory_limit_mb <= 0 || count <= 0)
     {
-        Transaction* temp_transaction = temp_block->transaction_head->next;
-        while (temp_transaction->next != temp_block->transaction_head)
-        {
-            insert(user_table, temp_transaction->from, 0);
-            insert(user_table, temp_transaction->to, 0);
-            insert_edge(user_table, temp_transaction->tx_id, temp_transaction->blockID, 
-            temp_transaction->from, temp_transaction->amount, temp_transaction->to);
-            
-            temp_transaction = temp_transaction->next;
-        }
-        
-        temp_block = temp_block->next;
+        return count > 0 ? count : 1;
     }
-
-    wealth_rank(user_table, k);
-    free_hashTable(user_table);
+    long window = memory_limit_mb * 1048576 / 4 / (bytes_per_item > 0 ? bytes_per_item : 1);
+    if (window < 65536)
+    {
+        window = 65536;
+    }
+    return window < count ? (int)window : count;
 }
 
-// 释放哈希表内存
-void free_hashTable(HashTable* HashTable)
+// 提示内核接下来的访问方式：顺序扫描时加大预读，随机访问时关闭预读
+void storage_advise(Region* region, int sequential)
 {
-    for (int i = 0; i < HashTable->size; i++)
+#ifndef _WIN32
+    if (region->mapped)
     {
-        user* temp_user = HashTable->table[i]->next_user;
-        user* free_user = HashTable->table[i];
-        free(free_user);
-
-        do
-        {
-            Transaction* temp_transaction = temp_user->in_list_head;
-            Transaction* free_transaction;
-            do
-            {
-                free_transaction = temp_transaction;
-                temp_transaction = temp_transaction->next;
-                free(free_transaction);
-            } while (temp_transaction != 0);
+        madvise(region->data, region->capacity, sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+    }
+#endif
+}
 
-            temp_transaction = temp_user->out_list_head;
-            do
-            {
-                free_transaction = temp_transaction;
-                temp_transaction = temp_transaction->next;
-                free(free_transaction);
-            } while (temp_transaction != 0);
-            
+/*
+ * 后台加载线程：有快照时从快照恢复，否则先读区块再分批读交易，最后重放预写日志。
+ * 没有快照时只读到日志第一条记录之前的文件位置，之后的部分由日志重放，避免重复。
+ */
+void* load_worker(void* arg)
+{
+    LoadState* state = (LoadState*)arg;
+    show_progress = 0;
+    if (shard_id >= 0)
+    {
+        // 分片的工作进程只读数据文件，快照和预写日志属于单进程模式；完成后不输出，以免混进查询结果
+        readBlock(state->head);
+        readTransaction(state->head, state->user_table);
+    }
+    else if (manifest_file != 0)
+    {
+        // 有快照时先恢复，清单中已在快照里的区块和交易加载时跳过
+        load_snapshot(state->head, state->user_table);
+        load_manifest(manifest_file, state->head, state->user_table, manifest_time_start, manifest_time_end);
+    }
+    else if (!load_snapshot(state->head, state->user_table))
+    {
+        wal_base_offsets(&state->block_limit, &state->transaction_limit);
+        readBlock(state->head);
+        readTransaction(state->head, state->user_table);
+    }
 
-            free_user = temp_user;
-            temp_user = temp_user->next_user;
-            free(free_user);
-        } while (temp_user->next_user != 0);
+    pthread_rwlock_wrlock(&data_lock);
+    if (shard_id < 0)
+    {
+        wal_replay(state->head, state->user_table);
     }
-    
-    free(HashTable);
+    pthread_mutex_lock(&state->lock);
+    state->done = 1;
+    pthread_mutex_unlock(&state->lock);
+    publish_load_progress(block_index.count, state->bytes_read);
+    pthread_rwlock_unlock(&data_lock);
+    if (shard_id >= 0)
+    {
+        return 0;
+    }
+
+    pthread_rwlock_rdlock(&data_lock);
+    printf("\n区块链和交易网络初始化已完成!\n");
+    printf("区块数: %d\n交易数: %d\n用户数: %d\n", calc_block, calc_transaction, calc_user);
+    printf("运行时间: %.3f 秒\n\n", now_seconds() - state->started);
+    pthread_rwlock_unlock(&data_lock);
+    return 0;
 }
 
-// 检查交易网络是否有环
-void check_ring(HashTable* user_table)
+// 根据csv文件组构建链表，数据在后台加载，菜单可以立即使用
+Block* createLinkedList(HashTable* userTable)
 {
-    init_ring(user_table);
-    int calc = 0;
+    Block* head = (Block*)malloc(sizeof(Block));
+    head->blockID = 0;
+    head->block_timestamp = 0;
+    head->hash = 0;
+    head->next = head;
+    head->prev = head; 
 
-    for (int i = 0; i < user_table->size; i++)
-    {
-        if (user_table->table[i]->next_user == 0)
-        {
-            continue;
-        }
-        user* temp_user = user_table->table[i]->next_user;
-        while (temp_user != 0)
-        {
-            // 进入user的遍历层
-            if (temp_user->in_count != 0 && temp_user->out_count != 0)
-            {
-                int status = check_ring_by_key(user_table, temp_user->user_id);
-                if (status == 1)
-                {
-                    printf("YES\n（交易网络中存在环）\n");
-                    return;
-                }
-            }
-            
-            calc++;
-            if (calc % 10000 == 0)
-            {
-                printf("unring-user: %d\n", calc);
-            }
+    printf("初始化区块链和交易网络中，数据在后台加载，可以直接开始查询...\n");
+    load_state.head = head;
+    load_state.user_table = userTable;
+    load_state.started = now_seconds();
+    long wal_size = 0;
+    double mtime;
+    load_state.wal_pending = file_status(wal_file, &wal_size, &mtime) && wal_size > 0;
+    pthread_create(&load_state.thread, 0, load_worker, &load_state);
+    pthread_detach(load_state.thread);
 
-            temp_user = temp_user->next_user;
-        }
-    }
-    printf("NO\n（交易网络中不存在环）\n");
+    return head;
 }
 
-// 对于单个user检查是否成环
-int check_ring_by_key(HashTable* user_table, char* from)
+// 发布加载进度并唤醒等待数据的查询（在写锁内调用）
+void publish_load_progress(int loaded_blocks, long bytes_read)
 {
-    init_path(user_table);
-
-    user* head_user = find_user(user_table, from);
-    head_user->sign = -1;  // 首节点的sign设置-1，已参加计算的节点是1，未参加是0
-    
-    user_max* contained_user = (user_max*)malloc(sizeof(user_max));
-    contained_user->user_id = strdup(from);
-    contained_user->next = contained_user;
-    contained_user->prev = contained_user;
+    load_state.loaded_blocks = loaded_blocks;
+    load_state.bytes_read = bytes_read;
+    data_version++;
+    storage_trim();
+    pthread_mutex_lock(&load_state.lock);
+    pthread_cond_broadcast(&load_state.progress);
+    pthread_mutex_unlock(&load_state.lock);
+}
 
+void print_load_progress()
+{
+    double percent = load_state.file_size > 0 ? 100.0 * load_state.bytes_read / load_state.file_size : 0;
+    if (!load_state.blocks_done)
+    {
+        printf("数据加载中: 正在读取区块（已读 %d 个）\n", block_index.count);
+    }
+    else
+    {
+        printf("数据加载中: 已加载 %d/%d 个区块的交易（%.1f%%）\n", load_state.loaded_blocks, block_index.count, percent);
+    }
+}
 
-    // 寻径函数
-    user_max* temp_user_brief = contained_user;
-    user* temp_user = find_user(user_table, temp_user_brief->user_id);
+// 等待后台加载全部完成（插入交易和跟踪模式要接在初始数据之后）
+void wait_load_finished()
+{
+    pthread_mutex_lock(&load_state.lock);
+    if (!load_state.done)
+    {
+        printf("等待初始数据加载完成...\n");
+    }
+    while (!load_state.done)
+    {
+        pthread_cond_wait(&load_state.progress, &load_state.lock);
+    }
+    pthread_mutex_unlock(&load_state.lock);
+}
 
-    do
+/*
+ * 保证时间戳不晚于time_stamp的区块交易已加载（UINT_MAX表示需要全部数据）。
+ * 已加载则立即返回1；否则按设置等待这部分数据，或提示进度后返回0，由调用者在已加载的数据上给出部分结果。
+ */
+int wait_until_loaded(unsigned time_stamp)
+{
+    double last_report = 0;
+    while (1)
     {
-        Transaction* temp_transaction = temp_user->out_list_head->next;
-        while (temp_transaction != 0)
+        pthread_rwlock_rdlock(&data_lock);
+        int ready = load_state.done;
+        if (!ready && !load_state.wal_pending && (load_state.blocks_done || time_stamp != UINT_MAX))
         {
-            user* next_user = find_user(user_table, temp_transaction->to);
-            
-            if (next_user->sign == 0 && next_user->out_count != 0)
-            {
-                next_user->sign = 1;
-                next_user->ring_sign = 1;
-                
-                user_max* new_user = (user_max*)malloc(sizeof(user_max));
-                new_user->user_id = strdup(next_user->user_id);
-                temp_user_brief->prev->next = new_user;
-                new_user->prev = temp_user_brief->prev;
-                new_user->next = temp_user_brief;
-                temp_user_brief->prev = new_user;
-
-            }
-            else if (next_user->sign == -1)
-            {
-                user_max* current_p = contained_user;
-                if (current_p->next = current_p)
-                {
-                    free(current_p);
-                }
-                else
-                {
-                    current_p = current_p->next;
-                    user_max* prev_p = current_p;
-                    while(current_p != contained_user)
-                    {
-                        current_p = current_p->next;
-                        free(prev_p);
-                        prev_p = current_p;
-                    }
-                    free(prev_p);
-                }
-                return 1;
-            }
-
-            temp_transaction = temp_transaction->next;
+            // 顺序遍历停下的位置在已读入的区块之内时，这一范围的区块不会再变化
+            int needed = block_upper_bound(time_stamp);
+            ready = (load_state.blocks_done || needed < block_index.count) && load_state.loaded_blocks >= needed;
+        }
+        if (!ready && (partial_results || now_seconds() - last_report >= 1))
+        {
+            print_load_progress();
+            last_report = now_seconds();
         }
+        pthread_rwlock_unlock(&data_lock);
 
-        temp_user_brief = temp_user_brief->next;
-        temp_user = find_user(user_table, temp_user_brief->user_id);
-    } while (temp_user_brief != contained_user);
+        if (ready)
+        {
+            return 1;
+        }
+        if (partial_results)
+        {
+            printf("所需数据尚未加载完，以下为已加载部分的结果\n");
+            return 0;
+        }
 
+        pthread_mutex_lock(&load_state.lock);
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += 200000000;
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&load_state.progress, &load_state.lock, &deadline);
+        pthread_mutex_unlock(&load_state.lock);
+    }
+}
 
-    user_max* current_p = contained_user;
-    if (current_p->next = current_p)
+// 取出下一个逗号分隔的字段（strtok不可重入，跟踪线程与主线程会同时解析）
+char* next_field(char** cursor)
+{
+    char* field = *cursor;
+    if (field == 0)
+    {
+        return 0;
+    }
+    char* comma = strchr(field, ',');
+    if (comma != 0)
     {
-        free(current_p);
+        *comma = '\0';
+        *cursor = comma + 1;
     }
     else
     {
-        current_p = current_p->next;
-        user_max* prev_p = current_p;
-        while(current_p != contained_user)
-        {
-            current_p = current_p->next;
-            free(prev_p);
-            prev_p = current_p;
-        }
-        free(prev_p);
+        *cursor = 0;
     }
+    return field;
+}
 
-    return 0;
+// 解析一行区块CSV，字段不全时返回0
+int parse_block_line(char* line, int* blockID, char** hash, unsigned* time_stamp)
+{
+    char* cursor = line;
+    char* id_field = next_field(&cursor);
+    char* hash_field = next_field(&cursor);
+    char* time_field = next_field(&cursor);
+    if (id_field == 0 || hash_field == 0 || time_field == 0)
+    {
+        return 0;
+    }
+    *blockID = atoi(id_field);
+    *hash = hash_field;
+    *time_stamp = (unsigned)strtoul(time_field, NULL, 10);
+    return 1;
 }
 
-// 计算两个节点之间的最短路径
-void shortest_path(HashTable* user_table, char* from, char* to)
+// 解析一行交易CSV，字段不全时返回0
+int parse_transaction_line(char* line, int* tx_id, int* blockID, char** from, double* amount, char** to)
 {
-    init_path(user_table);
+    char* cursor = line;
+    char* id_field = next_field(&cursor);
+    char* block_field = next_field(&cursor);
+    char* from_field = next_field(&cursor);
+    char* amount_field = next_field(&cursor);
+    char* to_field = next_field(&cursor);
+    if (id_field == 0 || block_field == 0 || from_field == 0 || amount_field == 0 || to_field == 0)
+    {
+        return 0;
+    }
+    to_field[strcspn(to_field, "\r\n")] = '\0';
+    *tx_id = atoi(id_field);
+    *blockID = atoi(block_field);
+    *from = from_field;
+    *amount = strtod(amount_field, NULL);
+    *to = to_field;
+    return 1;
+}
 
-    user* head_user = find_user(user_table, from);
-    head_user->sign = -1;  // 首节点的sign设置-1，已参加计算的节点是1，未参加是0
-    
-    // 寻径函数
-    int update_calc = 1;
-    
-    while(update_calc)
+// 按开头的魔数判断文件的压缩格式，文件不存在时返回-1
+int input_format(char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == 0)
     {
-        update_calc = 0;
+        return -1;
+    }
+    unsigned char magic[4] = {0, 0, 0, 0};
+    size_t got = fread(magic, 1, sizeof(magic), file);
+    fclose(file);
+    if (got >= 2 && magic[0] == 0x1F && magic[1] == 0x8B)
+    {
+        return INPUT_GZIP;
+    }
+    if (got == 4 && magic[0] == 0x28 && magic[1] == 0xB5 && magic[2] == 0x2F && magic[3] == 0xFD)
+    {
+        return INPUT_ZSTD;
+    }
+    return INPUT_PLAIN;
+}
 
-        for (int i = 0; i < user_table->size; i++)
+// 读入下一段压缩数据，文件读完时返回0
+size_t input_read_source(InputStream* in)
+{
+    size_t got = fread(in->source, 1, INPUT_CHUNK, in->file);
+    pthread_mutex_lock(&in->lock);
+    in->compressed += got;
+    pthread_mutex_unlock(&in->lock);
+    return got;
+}
+
+// 解压出至多capacity字节，压缩数据读完或出错时置*finished
+int input_inflate(InputStream* in, char* out, int capacity, int* finished)
+{
+#ifdef HAVE_ZLIB
+    if (in->format == INPUT_GZIP)
+    {
+        z_stream* z = &in->zlib;
+        z->next_out = (Bytef*)out;
+        z->avail_out = capacity;
+        while (z->avail_out > 0)
         {
-            if (user_table->table[i]->next_user == 0)
+            if (z->avail_in == 0)
             {
-                continue;
+                size_t got = input_read_source(in);
+                if (got == 0)
+                {
+                    *finished = 1;
+                    break;
+                }
+                z->next_in = in->source;
+                z->avail_in = (uInt)got;
+            }
+            int status = inflate(z, Z_NO_FLUSH);
+            if (status == Z_STREAM_END)
+            {
+                // 多个gzip成员首尾相接时接着解下一个
+                in->partial = 0;
+                inflateReset(z);
+            }
+            else if (status == Z_OK || status == Z_BUF_ERROR)
+            {
+                in->partial = 1;
+            }
+            else
+            {
+                in->error = 1;
+                *finished = 1;
+                break;
             }
-            user* temp_user = user_table->table[i]->next_user;
-            while (temp_user != 0)
+        }
+        return capacity - (int)z->avail_out;
+    }
+#endif
+#ifdef HAVE_ZSTD
+    if (in->format == INPUT_ZSTD)
+    {
+        ZSTD_outBuffer output = {out, (size_t)capacity, 0};
+        while (output.pos < output.size)
+        {
+            if (in->zstd_in.pos == in->zstd_in.size)
             {
-                // 进入user的遍历层
-                if (temp_user->sign == 0)
+                size_t got = input_read_source(in);
+                if (got == 0)
                 {
-                    temp_user = temp_user->next_user;
-                    continue;
+                    *finished = 1;
+                    break;
                 }
+                in->zstd_in.src = in->source;
+                in->zstd_in.size = got;
+                in->zstd_in.pos = 0;
+            }
+            size_t status = ZSTD_decompressStream(in->zstd, &output, &in->zstd_in);
+            if (ZSTD_isError(status))
+            {
+                in->error = 1;
+                *finished = 1;
+                break;
+            }
+            in->partial = status != 0;
+        }
+        return (int)output.pos;
+    }
+#endif
+    // 没有编入zlib和zstd时这几个参数用不到
+    (void)in;
+    (void)out;
+    (void)capacity;
+    *finished = 1;
+    return 0;
+}
 
-                Transaction* temp_transaction = temp_user->out_list_head->next;
-                while (temp_transaction != 0)
-                {
-                    user* next_user = find_user(user_table, temp_transaction->to);
-                    if (next_user->sign == 0)
-                    {
-                        next_user->path_length = temp_transaction->amount + temp_user->path_length;
-                        next_user->sign = 1;
-                        update_calc++;
-                    }
-                    else if (next_user->sign != -1)
-                    {
-                        double new_path_length = temp_transaction->amount + temp_user->path_length;
-                        if (next_user->path_length > new_path_length)
-                        {
-                            next_user->path_length = new_path_length;
-                            update_calc++;
-                        }
-                    }
-
-                    temp_transaction = temp_transaction->next;
-                }
+// 解压线程：依次填满环中空出的缓冲
+void* input_worker(void* arg)
+{
+    InputStream* in = (InputStream*)arg;
+    int finished = 0;
+    while (!finished)
+    {
+        pthread_mutex_lock(&in->lock);
+        while (in->count == INPUT_RING && !in->stop)
+        {
+            pthread_cond_wait(&in->drained, &in->lock);
+        }
+        int slot = (in->head + in->count) % INPUT_RING;
+        int stop = in->stop;
+        pthread_mutex_unlock(&in->lock);
+        if (stop)
+        {
+            break;
+        }
 
-                temp_user = temp_user->next_user;
-            }
+        int length = input_inflate(in, in->buffer[slot], INPUT_CHUNK, &finished);
+        pthread_mutex_lock(&in->lock);
+        if (length > 0)
+        {
+            in->length[slot] = length;
+            in->count++;
         }
+        pthread_cond_signal(&in->filled);
+        pthread_mutex_unlock(&in->lock);
+    }
+    pthread_mutex_lock(&in->lock);
+    in->error |= finished && in->partial;
+    in->done = 1;
+    pthread_cond_signal(&in->filled);
+    pthread_mutex_unlock(&in->lock);
+    return 0;
+}
 
-        // printf("update: %d\n", update_calc);
+// 打开数据文件，压缩文件同时启动解压线程；文件不存在或未编译对应的解压支持时返回0
+InputStream* input_open(char* path)
+{
+    int format = input_format(path);
+    if (format == -1)
+    {
+        return 0;
+    }
+#ifndef HAVE_ZLIB
+    if (format == INPUT_GZIP)
+    {
+        printf("%s 是gzip压缩文件，需要以 -DHAVE_ZLIB 编译并链接 -lz\n", path);
+        return 0;
+    }
+#endif
+#ifndef HAVE_ZSTD
+    if (format == INPUT_ZSTD)
+    {
+        printf("%s 是zstd压缩文件，需要以 -DHAVE_ZSTD 编译并链接 -lzstd\n", path);
+        return 0;
+    }
+#endif
+    InputStream* in = (InputStream*)calloc(1, sizeof(InputStream));
+    in->path = strdup(path);
+    in->format = format;
+    in->file = fopen(path, format == INPUT_PLAIN ? "r" : "rb");
+    if (format == INPUT_PLAIN)
+    {
+        return in;
     }
 
-    user* target_user = find_user(user_table, to);
-    if (target_user->path_length != 0)
+#ifdef HAVE_ZLIB
+    if (format == INPUT_GZIP)
     {
-        printf("用户: %s\n到\n用户: %s\n最短路径为: %.2lf\n", from, to, target_user->path_length);
+        inflateInit2(&in->zlib, 15 + 16);
     }
-    else
+#endif
+#ifdef HAVE_ZSTD
+    if (format == INPUT_ZSTD)
     {
-        printf("用户: %s\n到\n用户: %s\n不存在路径\n", from, to);
+        in->zstd = ZSTD_createDStream();
+        ZSTD_initDStream(in->zstd);
+    }
+#endif
+    in->source = (unsigned char*)malloc(INPUT_CHUNK);
+    for (int i = 0; i < INPUT_RING; i++)
+    {
+        in->buffer[i] = (char*)malloc(INPUT_CHUNK);
     }
+    pthread_mutex_init(&in->lock, 0);
+    pthread_cond_init(&in->filled, 0);
+    pthread_cond_init(&in->drained, 0);
+    pthread_create(&in->thread, 0, input_worker, in);
+    return in;
 }
 
-// 在哈希表中找到user
-user* find_user(HashTable* user_table, char* key)
+// 保证head中还有没读的字节：读完的缓冲还给解压线程，再等下一个缓冲，全部读完时返回0
+int input_fill(InputStream* in)
 {
-    int index = hashFunction(key, user_table->size);
-    user* temp_user = user_table->table[index]->next_user;
-    while (strcmp(temp_user->user_id, key) != 0)
+    if (in->holding && in->position < in->length[in->head])
     {
-        temp_user = temp_user->next_user;
+        return 1;
     }
-    return temp_user;
+    pthread_mutex_lock(&in->lock);
+    if (in->holding)
+    {
+        in->head = (in->head + 1) % INPUT_RING;
+        in->count--;
+        in->holding = 0;
+        in->position = 0;
+        pthread_cond_signal(&in->drained);
+    }
+    while (in->count == 0 && !in->done)
+    {
+        pthread_cond_wait(&in->filled, &in->lock);
+    }
+    in->holding = in->count > 0;
+    pthread_mutex_unlock(&in->lock);
+    return in->holding;
 }
 
-// 将哈希表中user的sign和path_length初始化为0
-void init_path(HashTable* user_table)
+// 与fgets相同：读一行（含换行符），至多size - 1个字节
+char* input_gets(char* line, int size, InputStream* in)
 {
-    for (int i = 0; i < user_table->size; i++)
+    if (in->format == INPUT_PLAIN)
     {
-        if (user_table->table[i]->next_user == 0)
-        {
-            continue;
-        }
-        user* temp_user = user_table->table[i]->next_user;
-        while (temp_user != 0)
+        return fgets(line, size, in->file);
+    }
+    int n = 0;
+    while (n < size - 1 && input_fill(in))
+    {
+        char* data = in->buffer[in->head] + in->position;
+        int available = in->length[in->head] - in->position;
+        int want = size - 1 - n < available ? size - 1 - n : available;
+        char* newline = (char*)memchr(data, '\n', want);
+        int take = newline != 0 ? (int)(newline - data) + 1 : want;
+        memcpy(line + n, data, take);
+        n += take;
+        in->position += take;
+        in->offset += take;
+        if (newline != 0)
         {
-            temp_user->sign = 0;
-            temp_user->path_length = 0;
-            temp_user = temp_user->next_user;
+            break;
         }
     }
+    if (n == 0)
+    {
+        return 0;
+    }
+    line[n] = '\0';
+    return line;
+}
+
+// 读取位置（解压后的字节数）
+long input_tell(InputStream* in)
+{
+    return in->format == INPUT_PLAIN ? ftell(in->file) : in->offset;
+}
+
+// 已读的文件字节数，与文件大小比较算加载进度
+long input_progress(InputStream* in)
+{
+    if (in->format == INPUT_PLAIN)
+    {
+        return ftell(in->file);
+    }
+    pthread_mutex_lock(&in->lock);
+    long compressed = in->compressed;
+    pthread_mutex_unlock(&in->lock);
+    return compressed;
 }
 
-// 将哈希表中user的ring_sing初始化为0
-void init_ring(HashTable* user_table)
+void input_close(InputStream* in)
 {
-    for (int i = 0; i < user_table->size; i++)
+    if (in->format != INPUT_PLAIN)
     {
-        if (user_table->table[i]->next_user == 0)
+        pthread_mutex_lock(&in->lock);
+        in->stop = 1;
+        pthread_cond_signal(&in->drained);
+        pthread_mutex_unlock(&in->lock);
+        pthread_join(in->thread, 0);
+        if (in->error)
         {
-            continue;
+            printf("%s 的压缩数据损坏或不完整，之后的内容未读取\n", in->path);
         }
-        user* temp_user = user_table->table[i]->next_user;
-        while (temp_user != 0)
+#ifdef HAVE_ZLIB
+        if (in->format == INPUT_GZIP)
         {
-            temp_user->ring_sign = 0;
-            temp_user = temp_user->next_user;
+            inflateEnd(&in->zlib);
+        }
+#endif
+#ifdef HAVE_ZSTD
+        if (in->format == INPUT_ZSTD)
+        {
+            ZSTD_freeDStream(in->zstd);
+        }
+#endif
+        for (int i = 0; i < INPUT_RING; i++)
+        {
+            free(in->buffer[i]);
         }
+        free(in->source);
+        pthread_mutex_destroy(&in->lock);
+        pthread_cond_destroy(&in->filled);
+        pthread_cond_destroy(&in->drained);
     }
+    fclose(in->file);
+    free(in->path);
+    free(in);
 }
 
-// 增加新的交易
-void add_new_transaction(Block* list, HashTable* user_list, char* file_name)
+// 读取区块信息
+void readBlock(Block* list)
 {
-    printf("更新区块链和交易网络中，请稍等...\n");
-
-    int prev_blockID;
-    int tx_id;
     int blockID;
-    char from_str[34];
-    char to_str[34];
-    char* from = from_str;
-    char* to = to_str;
-    double amount;
-
-    prev_blockID = blockID;
+    char* hash;
+    unsigned time_stamp;
 
-    FILE* file = fopen(file_name, "r");
+    InputStream* file = input_open(block_file);
+    pthread_rwlock_wrlock(&data_lock);
 
     // 逐行读取CSV文件
-    char line[512];
+    char line[1024];
     int lineCount = 0;
-    while (fgets(line, sizeof(line), file))
+    while (file != 0 && (load_state.block_limit == 0 || input_tell(file) < load_state.block_limit) && input_gets(line, sizeof(line), file))
     {
         lineCount++;
         if (lineCount == 1)
         {
             continue;
         }
-        // 使用strtok函数拆分CSV行
-        char* token = strtok(line, ",");
-        if (token == NULL) {
+        if (!parse_block_line(line, &blockID, &hash, &time_stamp))
+        {
             continue; // 忽略空行
         }
+        
+        // 调用insertBlock函数将块数据插入
+        insertBlock(list, blockID, hash, time_stamp);
 
-        // 解析CSV列数据
-        tx_id = atoi(token);
-        token = strtok(NULL, ",");
-        blockID = atoi(token);
-        token = strtok(NULL, ",");
-        from = token;
-        token = strtok(NULL, ",");
-        amount = strtod(token, NULL);
-        token = strtok(NULL, ",");
-        to = token;
-        removeNewline(to);
-
-        // 调用函数将块数据插入
-        char* from_copy = strdup(from);
-        char* to_copy = strdup(to);
+        // 分批释放写锁
+        if (lineCount % LOAD_BATCH == 0)
+        {
+            pthread_rwlock_unlock(&data_lock);
+            pthread_rwlock_wrlock(&data_lock);
+        }
+    }
 
-        insertTransaction(list, tx_id, blockID, from_copy, amount, to_copy);
+    // 记录读到的位置并关闭文件
+    if (file != 0)
+    {
+        block_file_offset = input_tell(file);
+        input_close(file);
+    }
+    load_state.blocks_done = 1;
+    pthread_rwlock_unlock(&data_lock);
+}
 
+// 读取交易信息
+void readTransaction(Block* list, HashTable* user_list)
+{
+    long file_size = 0;
+    double mtime;
+    file_status(transaction_file, &file_size, &mtime);
+    InputStream* file = input_open(transaction_file);
+    pthread_rwlock_wrlock(&data_lock);
+    load_state.file_size = file_size;
+
+    // 逐行读取CSV文件，每攒够INGEST_BATCH行一起插入
+    IngestRow* rows = (IngestRow*)malloc(sizeof(IngestRow) * INGEST_BATCH);
+    int row_count = 0;
+    int lineCount = 0;
+    int loaded_blocks = 0;
+    while (file != 0 && (load_state.transaction_limit == 0 || input_tell(file) < load_state.transaction_limit)
+        && input_gets(rows[row_count].line, sizeof(rows[row_count].line), file))
+    {
+        lineCount++;
+        if (lineCount == 1)
+        {
+            continue;
+        }
+        IngestRow* row = &rows[row_count];
+        if (!parse_transaction_line(row->line, &row->tx_id, &row->blockID, &row->from, &row->amount, &row->to))
+        {
+            continue; // 忽略空行
+        }
+        row->row = lineCount;
+        row_count++;
 
-        // 插入user
-        insert(user_list, from_copy, 1);
-        insert(user_list, to_copy, 1);
-        insert_edge(user_list, tx_id, blockID, from_copy, amount, to_copy);
+        // 插入交易，返回的区块作为下一批交易的查找起点，降低时间复杂度
+        if (row_count == INGEST_BATCH || lineCount % LOAD_BATCH == 0)
+        {
+            list = ingest_batch(list, user_list, rows, row_count);
+            row_count = 0;
+        }
 
-        if (prev_blockID != blockID)
+        // 交易按区块顺序排列，当前区块之前的区块都已加载完
+        if (lineCount % LOAD_BATCH == 0)
         {
-            // 指针迁移，降低时间复杂度
-            while (list->blockID != blockID)
+            if (list->index > loaded_blocks)
             {
-                list = list->next;
+                loaded_blocks = list->index;
             }
+            publish_load_progress(loaded_blocks, input_progress(file));
+            pthread_rwlock_unlock(&data_lock);
+            pthread_rwlock_wrlock(&data_lock);
         }
-        prev_blockID = blockID;
     }
 
-    // 关闭文件
-    fclose(file);
+    list = ingest_batch(list, user_list, rows, row_count);
+    free(rows);
 
-    printf("区块链和交易网络更新已完成!\n");
-    printf("区块数: %d\n交易数: %d\n用户数: %d\n", calc_block, calc_transaction, calc_user);
-    
-    end_time = clock();
-    double elapsed_time = (double)(end_time - start_time) / CLOCKS_PER_SEC;
-    printf("运行时间: %.3f 秒\n", elapsed_time);
+    // 记录读到的位置并关闭文件
+    long bytes_read = 0;
+    if (file != 0)
+    {
+        transaction_file_offset = input_tell(file);
+        bytes_read = input_progress(file);
+        input_close(file);
+    }
+    publish_load_progress(loaded_blocks, bytes_read);
+    pthread_rwlock_unlock(&data_lock);
 }
 
-// 数据查询界面操作
-void data_lookup(Block* head, HashTable* user_table)
+/*
+ * 批量插入交易行：第一遍算出所有地址的桶号并预取桶数组，第二遍预取各桶的哨兵，
+ * 第三遍预取链表的第一个账户，最后按行的顺序对每个地址查找或插入一次，账户编号和逐行插入时相同。
+ * 分片的工作进程只保存至少一方属于本分片的交易。
+ */
+Block* ingest_batch(Block* list, HashTable* user_list, IngestRow* rows, int count)
 {
-    int operator;
-    while (1)
+    user** table = user_list->table;
+    for (int i = 0; i < count; i++)
     {
-        operator = 0;
-        printf("请输入需要进行的查询操作: \n  0: 返回上一级操作\n");
-        printf("  1: 查找指定账号在一个时间段内的所有转入或转出记录，返回总记录数，交易金额最大的前k条记录\n");
+        rows[i].from_index = hashFunction(rows[i].from, user_list->size);
+        rows[i].to_index = hashFunction(rows[i].to, user_list->size);
+        __builtin_prefetch(&table[rows[i].from_index]);
+        __builtin_prefetch(&table[rows[i].to_index]);
+    }
+    for (int i = 0; i < count; i++)
+    {
+        __builtin_prefetch(table[rows[i].from_index]);
+        __builtin_prefetch(table[rows[i].to_index]);
+    }
+    for (int i = 0; i < count; i++)
+    {
+        __builtin_prefetch(table[rows[i].from_index]->next_user);
+        __builtin_prefetch(table[rows[i].to_index]->next_user);
+    }
+    for (int i = 0; i < count; i++)
+    {
+        IngestRow* row = &rows[i];
+        if (shard_id >= 0 && shard_of(row->from) != shard_id && shard_of(row->to) != shard_id)
+        {
+            continue;
+        }
+        ingest_row = row->row;
+        user* from_user = resolve_account(user_list, row->from, row->from_index, ingest_row * 2);
+        user* to_user = resolve_account(user_list, row->to, row->to_index, ingest_row * 2 + 1);
+        list = apply_resolved(list, user_list, row->tx_id, row->blockID, from_user, row->amount, to_user);
+    }
+    return list;
+}
+
+// 将一笔交易插入区块链、交易图和交易列，返回交易所在的区块
+Block* apply_transaction(Block* list, HashTable* user_list, int tx_id, int blockID, char* from, double amount, char* to)
+{
+    user* from_user = resolve_account(user_list, from, hashFunction(from, user_list->size), ingest_row * 2);
+    user* to_user = resolve_account(user_list, to, hashFunction(to, user_list->size), ingest_row * 2 + 1);
+    return apply_resolved(list, user_list, tx_id, blockID, from_user, amount, to_user);
+}
+
+// 插入两端账户已经查到的交易
+Block* apply_resolved(Block* list, HashTable* user_list, int tx_id, int blockID, user* from_user, double amount, user* to_user)
+{
+    insert_edge(from_user, amount, to_user);
+    int from_uid = from_user->uid;
+    int to_uid = to_user->uid;
+    Block* block = insertTransaction(list, tx_id, blockID, from_uid, amount, to_uid);
+    append_tx_column(block, tx_id, from_uid, to_uid, amount);
+    sketch_record(from_uid, to_uid, from_user->user_id, to_user->user_id, amount);
+    component_reserve(user_list->user_count);
+    component_union(from_uid, to_uid);
+    query_cache_touch(block->index);
+    if (rolling_window.enabled && block->index >= rolling_window.begin)
+    {
+        window_apply(from_uid, to_uid, amount, 1);
+    }
+    rollup_record(block_index.max_timestamp[block->index], from_uid, to_uid, amount);
+    return block;
+}
+
+// 插入单条区块信息
+void insertBlock(Block* list, int blockID, char* hash, unsigned time_stamp)
+{
+    Block* newblock = (Block*)malloc(sizeof(Block));
+
+    newblock->blockID = blockID;
+    newblock->hash = strdup(hash);  //原来要这么复制指针指向的字符串
+    newblock->block_timestamp = time_stamp;
+    newblock->transaction_count = 0;
+    memset(&newblock->segment, 0, sizeof(TxSegment));
+
+    // 尾插
+    newblock->next = list;
+    newblock->prev = list->prev;
+    list->prev->next = newblock;
+    list->prev = newblock;
+
+    newblock->transaction_count = 0;
+
+    // 加入区块索引
+    if (block_index.count == block_index.capacity)
+    {
+        block_index.capacity = block_index.capacity == 0 ? 1024 : block_index.capacity * 2;
+        block_index.blocks = (Block**)realloc(block_index.blocks, sizeof(Block*) * block_index.capacity);
+        block_index.max_timestamp = (unsigned*)realloc(block_index.max_timestamp, sizeof(unsigned) * block_index.capacity);
+    }
+    newblock->index = block_index.count;
+    block_index.blocks[block_index.count] = newblock;
+    block_index.max_timestamp[block_index.count] = time_stamp;
+    if (block_index.count > 0 && block_index.max_timestamp[block_index.count - 1] > time_stamp)
+    {
+        block_index.max_timestamp[block_index.count] = block_index.max_timestamp[block_index.count - 1];
+    }
+    block_index.count++;
+    block_hash_add(newblock);
+    window_advance();
+    
+    calc_block++;
+    if (show_progress && calc_block % 1000 == 0)
+    {
+        printf("block: %d\n", calc_block);
+    }
+}
+
+// 插入单条交易信息（账户用编号表示），返回交易所在的区块
+Block* insertTransaction(Block* list, int tx_id, int blockID, int from, double amount, int to)
+{
+    Block* temp_list = list;
+    while (temp_list->blockID != blockID)
+    {
+        temp_list = temp_list->next;
+    }
+
+    temp_list->transaction_count++;
+    segment_append(&temp_list->segment, tx_id, from, to, amount);
+
+    calc_transaction++;
+
+    if (show_progress && calc_transaction % 100000 == 0)
+    {
+        printf("transaction: %d\n", calc_transaction);
+    }
+    return temp_list;
+}
+
+// 有符号数按zigzag映射，绝对值小的负数也只占一两个字节
+unsigned long long zigzag_encode(long long value)
+{
+    return ((unsigned long long)value << 1) ^ (unsigned long long)(value >> 63);
+}
+
+long long zigzag_decode(unsigned long long value)
+{
+    return (long long)(value >> 1) ^ -(long long)(value & 1);
+}
+
+// 存下value最少需要的字节数
+int value_bytes(unsigned long long value)
+{
+    int bytes = 1;
+    while (bytes < 8 && (value >> (8 * bytes)) != 0)
+    {
+        bytes++;
+    }
+    return bytes;
+}
+
+// 从p开始按小端读8字节，调用者按字段宽度截取
+unsigned long long load_le64(unsigned char* p)
+{
+    unsigned long long value;
+    memcpy(&value, p, sizeof(value));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap64(value);
+#endif
+    return value;
+}
+
+void store_le(unsigned char* p, unsigned long long value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+    {
+        p[i] = (unsigned char)value;
+        value >>= 8;
+    }
+}
+
+void segment_open(TxSegment* segment, SegmentReader* reader)
+{
+    reader->data = segment_arena.data + segment->offset;
+    reader->count = segment->count;
+    reader->base_tx_id = segment->base_tx_id;
+    reader->size = 0;
+    for (int field = 0; field < 4; field++)
+    {
+        reader->offset[field] = reader->size;
+        reader->size += segment->width[field];
+        reader->mask[field] = segment->width[field] == 8 ? ~0ULL : (1ULL << (8 * segment->width[field])) - 1;
+    }
+}
+
+// 第i条记录的字段原始值
+unsigned long long segment_field(SegmentReader* reader, int i, int field)
+{
+    return load_le64(reader->data + (long)i * reader->size + reader->offset[field]) & reader->mask[field];
+}
+
+int segment_tx_id(SegmentReader* reader, int i)
+{
+    return reader->base_tx_id + (int)zigzag_decode(segment_field(reader, i, SEGMENT_TX));
+}
+
+/*
+ * 金额字段：最低位为0时其余位是定点数的zigzag，为1时其余位是amount_escapes中的下标。
+ * 定点数只在除回去与原值完全相等时使用，解码出的金额与交易列中的逐位相同
+ */
+unsigned long long amount_encode(double amount)
+{
+    double scaled = amount * AMOUNT_SCALE;
+    if (scaled > -4.6e18 && scaled < 4.6e18)
+    {
+        long long fixed = llround(scaled);
+        if ((double)fixed / AMOUNT_SCALE == amount)
+        {
+            return zigzag_encode(fixed) << 1;
+        }
+    }
+    AmountEscapes* escapes = &amount_escapes;
+    if (escapes->count == escapes->capacity)
+    {
+        escapes->capacity = escapes->capacity == 0 ? 64 : escapes->capacity * 2;
+        escapes->values = (double*)realloc(escapes->values, sizeof(double) * escapes->capacity);
+    }
+    escapes->values[escapes->count] = amount;
+    return ((unsigned long long)escapes->count++ << 1) | 1;
+}
+
+double segment_amount(SegmentReader* reader, int i)
+{
+    unsigned long long value = segment_field(reader, i, SEGMENT_AMOUNT);
+    if (value & 1)
+    {
+        return amount_escapes.values[value >> 1];
+    }
+    return (double)zigzag_decode(value >> 1) / AMOUNT_SCALE;
+}
+
+// 确保存储区还能追加bytes字节
+void segment_arena_grow(long bytes)
+{
+    if (segment_arena.length + bytes + 8 > segment_arena.capacity)
+    {
+        segment_arena.capacity = (segment_arena.length + bytes + 8) * 2;
+        segment_arena.data = (unsigned char*)region_reserve(&segment_arena.region, segment_arena.capacity);
+    }
+}
+
+// 按区块顺序重新排列各段，去掉空位
+void segment_arena_compact()
+{
+    long length = segment_arena.length - segment_arena.garbage;
+    Region fresh = {0, 0, 0, -1, 0};
+    unsigned char* data = (unsigned char*)region_reserve(&fresh, length + 8);
+    region_unregister(&fresh);
+    long offset = 0;
+    for (int i = 0; i < block_index.count; i++)
+    {
+        TxSegment* segment = &block_index.blocks[i]->segment;
+        memcpy(data + offset, segment_arena.data + segment->offset, segment->capacity);
+        segment->offset = offset;
+        offset += segment->capacity;
+    }
+    region_free(&segment_arena.region);
+    fresh.registered = segment_arena.region.registered;
+    segment_arena.region = fresh;
+    segment_arena.data = data;
+    segment_arena.length = offset;
+    segment_arena.capacity = length + 8;
+    segment_arena.garbage = 0;
+}
+
+// 让段的占用至少为bytes字节：末尾的段原地变长，否则搬到末尾
+void segment_reserve(TxSegment* segment, int bytes)
+{
+    if (bytes <= segment->capacity)
+    {
+        return;
+    }
+    if (segment->offset + segment->capacity == segment_arena.length)
+    {
+        segment_arena_grow(bytes - segment->capacity);
+        segment_arena.length += bytes - segment->capacity;
+        segment->capacity = bytes;
+        return;
+    }
+    if (segment_arena.garbage > segment_arena.length / 2)
+    {
+        segment_arena_compact();
+        segment_reserve(segment, bytes);
+        return;
+    }
+    // 搬动时留出余量，交替追加到多个旧区块时不会每次都搬
+    if (bytes < segment->capacity * 2)
+    {
+        bytes = segment->capacity * 2;
+    }
+    segment_arena_grow(bytes);
+    memcpy(segment_arena.data + segment_arena.length, segment_arena.data + segment->offset, segment->capacity);
+    segment_arena.garbage += segment->capacity;
+    segment->offset = segment_arena.length;
+    segment->capacity = bytes;
+    segment_arena.length += bytes;
+}
+
+// 将交易编码追加到区块的压缩段，字段放不下时先按新宽度重写整段
+void segment_append(TxSegment* segment, int tx_id, int from, int to, double amount)
+{
+    if (segment->count == 0)
+    {
+        segment->base_tx_id = tx_id;
+    }
+    unsigned long long values[4];
+    values[SEGMENT_TX] = zigzag_encode((long long)tx_id - segment->base_tx_id);
+    values[SEGMENT_FROM] = (unsigned)from;
+    values[SEGMENT_TO] = (unsigned)to;
+    values[SEGMENT_AMOUNT] = amount_encode(amount);
+
+    unsigned char width[4];
+    int widen = 0;
+    for (int field = 0; field < 4; field++)
+    {
+        int bytes = value_bytes(values[field]);
+        width[field] = segment->width[field] > bytes ? segment->width[field] : bytes;
+        widen |= width[field] != segment->width[field];
+    }
+    int size = width[0] + width[1] + width[2] + width[3];
+
+    if (widen)
+    {
+        // 按新宽度重写已有的记录
+        SegmentReader reader;
+        segment_open(segment, &reader);
+        unsigned char* data = (unsigned char*)malloc((long)segment->count * size + 1);
+        for (int i = 0; i < segment->count; i++)
+        {
+            unsigned char* p = data + (long)i * size;
+            for (int field = 0; field < 4; field++)
+            {
+                store_le(p, segment_field(&reader, i, field), width[field]);
+                p += width[field];
+            }
+        }
+        segment_reserve(segment, (segment->count + 1) * size);
+        memcpy(segment_arena.data + segment->offset, data, (long)segment->count * size);
+        memcpy(segment->width, width, sizeof(width));
+        free(data);
+    }
+    else
+    {
+        segment_reserve(segment, (segment->count + 1) * size);
+    }
+
+    unsigned char* p = segment_arena.data + segment->offset + (long)segment->count * size;
+    for (int field = 0; field < 4; field++)
+    {
+        store_le(p, values[field], width[field]);
+        p += width[field];
+    }
+    segment->count++;
+}
+
+// 输出交易存储占用：区块压缩段与原来每笔交易一个链表节点加两个字符串副本的对比
+void print_storage_stats(HashTable* user_table)
+{
+    long segment_bytes = 0;
+    for (int i = 0; i < block_index.count; i++)
+    {
+        TxSegment* segment = &block_index.blocks[i]->segment;
+        segment_bytes += (long)segment->count * (segment->width[0] + segment->width[1] + segment->width[2] + segment->width[3]);
+    }
+    long segment_capacity = segment_arena.capacity;
+    long node_bytes = 0;
+    for (int row = 0; row < tx_columns.count; row++)
+    {
+        node_bytes += sizeof(Transaction) + strlen(user_table->users[tx_columns.from[row]]->user_id) + 1
+        + strlen(user_table->users[tx_columns.to[row]]->user_id) + 1;
+    }
+    long count = tx_columns.count > 0 ? tx_columns.count : 1;
+    printf("区块内交易存储: %.1f 字节/笔（已分配 %.1f 字节/笔），按交易链表节点计为 %.1f 字节/笔\n",
+    (double)segment_bytes / count, (double)segment_capacity / count, (double)node_bytes / count);
+    if (amount_escapes.count > 0)
+    {
+        printf("不能按定点数无损存放的金额: %d 笔（%.1f KB）\n", amount_escapes.count, amount_escapes.count * sizeof(double) / 1024.0);
+    }
+    // 交易列与压缩段同时常驻：聚合内核扫描交易列，需要tx_id的逐笔输出解码压缩段
+    long column_bytes = 4 * sizeof(int) + sizeof(double);
+    printf("交易列存储: %ld 字节/笔\n", column_bytes);
+    printf("每笔交易合计（压缩段 + 交易列，不含tx_id索引）: %.1f 字节/笔\n", (double)segment_bytes / count + column_bytes);
+    if (compact_adjacency.version != -1 && compact_adjacency.edge_count > 0)
+    {
+        double target_bytes = (double)compact_adjacency.byte_count / compact_adjacency.edge_count;
+        printf("压缩出弧: 终点 %.2f 字节/弧（未压缩为 %d），连同金额和区块序号共 %.2f 字节/弧\n",
+        target_bytes, (int)sizeof(int), target_bytes + sizeof(int) + sizeof(double));
+    }
+    if (tx_adjacency.version != -1 && tx_adjacency.edge_count > 0)
+    {
+        printf("逐笔出弧表（建交易图时生成，与压缩出弧互不依赖）: %d 字节/弧\n", (int)(2 * sizeof(int) + sizeof(double)));
+    }
+    printf("时间桶汇总: 桶宽 %u 秒，全网 %d 个桶，账户有交易的桶 %ld 个（%.1f MB）\n", rollup.width, rollup.network.count, rollup.cell_count,
+    (rollup.network.capacity * sizeof(RollupCell) + rollup.account_capacity * sizeof(RollupSeries) + rollup.cell_count * sizeof(RollupCell)) / 1048576.0);
+    if (out_of_core)
+    {
+        printf("外存模式: 常驻内存 %.1f MB / 上限 %ld MB，已让出映射页 %ld 次\n",
+        resident_bytes() / 1048576.0, memory_limit_mb, storage_trims);
+    }
+}
+
+// 将交易追加到列式存储
+void append_tx_column(Block* block, int tx_id, int from, int to, double amount)
+{
+    if (tx_columns.count == tx_columns.capacity)
+    {
+        tx_columns.capacity = tx_columns.capacity == 0 ? 65536 : tx_columns.capacity * 2;
+        tx_columns.tx_id = (int*)region_reserve(&tx_columns.regions[0], sizeof(int) * tx_columns.capacity);
+        tx_columns.block = (int*)region_reserve(&tx_columns.regions[1], sizeof(int) * tx_columns.capacity);
+        tx_columns.from = (int*)region_reserve(&tx_columns.regions[2], sizeof(int) * tx_columns.capacity);
+        tx_columns.to = (int*)region_reserve(&tx_columns.regions[3], sizeof(int) * tx_columns.capacity);
+        tx_columns.amount = (double*)region_reserve(&tx_columns.regions[4], sizeof(double) * tx_columns.capacity);
+    }
+    int row = tx_columns.count++;
+    tx_columns.tx_id[row] = tx_id;
+    tx_columns.block[row] = block->index;
+    tx_columns.from[row] = from;
+    tx_columns.to[row] = to;
+    tx_columns.amount[row] = amount;
+    tx_index_add(tx_id, row);
+
+    // 交易晚于后面区块的交易到达时，区块范围不再对应连续的行
+    if (row > 0 && tx_columns.block[row - 1] > block->index)
+    {
+        tx_columns.block_ordered = 0;
+    }
+}
+
+// 把溢出表中偏移落在[old_span, span)的tx_id搬到数组，其余的重新散列
+void tx_index_migrate(TxIdIndex* index, int old_span)
+{
+    int capacity = index->overflow_capacity;
+    int* old_key = index->overflow_key;
+    int* old_row = index->overflow_row;
+    index->overflow_key = (int*)malloc(sizeof(int) * capacity);
+    index->overflow_row = (int*)malloc(sizeof(int) * capacity);
+    for (int i = 0; i < capacity; i++)
+    {
+        index->overflow_row[i] = -1;
+    }
+    index->overflow_count = 0;
+    for (int i = 0; i < capacity; i++)
+    {
+        if (old_row[i] == -1)
+        {
+            continue;
+        }
+        long offset = (long)old_key[i] - index->base;
+        if (offset >= old_span && offset < index->span)
+        {
+            index->row[offset] = old_row[i];
+            continue;
+        }
+        unsigned slot = ((unsigned)old_key[i] * 2654435761u) & (capacity - 1);
+        while (index->overflow_row[slot] != -1)
+        {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        index->overflow_key[slot] = old_key[i];
+        index->overflow_row[slot] = old_row[i];
+        index->overflow_count++;
+    }
+    free(old_key);
+    free(old_row);
+}
+
+// 记录tx_id所在的行，重复的tx_id保留最先插入的一笔
+void tx_index_add(int tx_id, int row)
+{
+    TxIdIndex* index = &tx_id_index;
+    if (index->span == 0 && index->overflow_count == 0)
+    {
+        index->base = tx_id;
+    }
+    long offset = (long)tx_id - index->base;
+    if (offset >= 0 && offset >= index->span && offset < 2L * tx_columns.count + 65536)
+    {
+        int span = index->span == 0 ? 65536 : index->span;
+        while (span <= offset)
+        {
+            span *= 2;
+        }
+        index->row = (int*)realloc(index->row, sizeof(int) * span);
+        for (int i = index->span; i < span; i++)
+        {
+            index->row[i] = -1;
+        }
+        int old_span = index->span;
+        index->span = span;
+        // 之前落在范围外、存进溢出表的tx_id现在可能落在范围内，搬进数组，否则之后重复的tx_id会占住数组的位置
+        if (index->overflow_count > 0)
+        {
+            tx_index_migrate(index, old_span);
+        }
+    }
+    if (offset >= 0 && offset < index->span)
+    {
+        if (index->row[offset] == -1)
+        {
+            index->row[offset] = row;
+        }
+        return;
+    }
+
+    if (2 * (index->overflow_count + 1) > index->overflow_capacity)
+    {
+        int old_capacity = index->overflow_capacity;
+        int* old_key = index->overflow_key;
+        int* old_row = index->overflow_row;
+        index->overflow_capacity = old_capacity == 0 ? 1024 : old_capacity * 2;
+        index->overflow_key = (int*)malloc(sizeof(int) * index->overflow_capacity);
+        index->overflow_row = (int*)malloc(sizeof(int) * index->overflow_capacity);
+        for (int i = 0; i < index->overflow_capacity; i++)
+        {
+            index->overflow_row[i] = -1;
+        }
+        index->overflow_count = 0;
+        for (int i = 0; i < old_capacity; i++)
+        {
+            if (old_row[i] != -1)
+            {
+                unsigned slot = ((unsigned)old_key[i] * 2654435761u) & (index->overflow_capacity - 1);
+                while (index->overflow_row[slot] != -1)
+                {
+                    slot = (slot + 1) & (index->overflow_capacity - 1);
+                }
+                index->overflow_key[slot] = old_key[i];
+                index->overflow_row[slot] = old_row[i];
+                index->overflow_count++;
+            }
+        }
+        free(old_key);
+        free(old_row);
+    }
+    unsigned slot = ((unsigned)tx_id * 2654435761u) & (index->overflow_capacity - 1);
+    while (index->overflow_row[slot] != -1)
+    {
+        if (index->overflow_key[slot] == tx_id)
+        {
+            return;
+        }
+        slot = (slot + 1) & (index->overflow_capacity - 1);
+    }
+    index->overflow_key[slot] = tx_id;
+    index->overflow_row[slot] = row;
+    index->overflow_count++;
+}
+
+// tx_id所在的行，不存在时返回-1
+int tx_index_find(int tx_id)
+{
+    TxIdIndex* index = &tx_id_index;
+    long offset = (long)tx_id - index->base;
+    if (offset >= 0 && offset < index->span && index->row[offset] != -1)
+    {
+        return index->row[offset];
+    }
+    if (index->overflow_count == 0)
+    {
+        return -1;
+    }
+    unsigned slot = ((unsigned)tx_id * 2654435761u) & (index->overflow_capacity - 1);
+    while (index->overflow_row[slot] != -1)
+    {
+        if (index->overflow_key[slot] == tx_id)
+        {
+            return index->overflow_row[slot];
+        }
+        slot = (slot + 1) & (index->overflow_capacity - 1);
+    }
+    return -1;
+}
+
+// 把64位十六进制的区块哈希转成32字节，格式不对时返回0
+int parse_block_hash(char* text, unsigned char* key)
+{
+    for (int i = 0; i < BLOCK_HASH_BYTES * 2; i++)
+    {
+        char c = text[i];
+        int digit;
+        if (c >= '0' && c <= '9')
+        {
+            digit = c - '0';
+        }
+        else if (c >= 'a' && c <= 'f')
+        {
+            digit = c - 'a' + 10;
+        }
+        else if (c >= 'A' && c <= 'F')
+        {
+            digit = c - 'A' + 10;
+        }
+        else
+        {
+            return 0;
+        }
+        if (i % 2 == 0)
+        {
+            key[i / 2] = (unsigned char)(digit << 4);
+        }
+        else
+        {
+            key[i / 2] |= (unsigned char)digit;
+        }
+    }
+    return text[BLOCK_HASH_BYTES * 2] == '\0';
+}
+
+// 区块哈希本身是均匀的，取前4字节作散列值
+unsigned block_hash_slot(unsigned char* key, int capacity)
+{
+    unsigned value;
+    memcpy(&value, key, sizeof(unsigned));
+    return value & (capacity - 1);
+}
+
+// 把新区块加入哈希索引（区块已在block_index中），哈希格式不对的区块不建索引
+void block_hash_add(Block* block)
+{
+    BlockHashIndex* index = &block_hash_index;
+    if (block->index >= index->key_capacity)
+    {
+        index->key_capacity = index->key_capacity == 0 ? 1024 : index->key_capacity * 2;
+        index->key = (unsigned char*)realloc(index->key, (size_t)index->key_capacity * BLOCK_HASH_BYTES);
+    }
+    unsigned char* key = index->key + (long)block->index * BLOCK_HASH_BYTES;
+    if (!parse_block_hash(block->hash, key))
+    {
+        memset(key, 0, BLOCK_HASH_BYTES);
+        return;
+    }
+
+    if (2 * (index->count + 1) > index->capacity)
+    {
+        index->capacity = index->capacity == 0 ? 2048 : index->capacity * 2;
+        index->slot = (int*)realloc(index->slot, sizeof(int) * index->capacity);
+        memset(index->slot, 0, sizeof(int) * index->capacity);
+        index->count = 0;
+        for (int i = 0; i < block->index; i++)
+        {
+            unsigned char* other = index->key + (long)i * BLOCK_HASH_BYTES;
+            if (!parse_block_hash(block_index.blocks[i]->hash, other))
+            {
+                continue;
+            }
+            unsigned slot = block_hash_slot(other, index->capacity);
+            while (index->slot[slot] != 0 && memcmp(index->key + (long)(index->slot[slot] - 1) * BLOCK_HASH_BYTES, other, BLOCK_HASH_BYTES) != 0)
+            {
+                slot = (slot + 1) & (index->capacity - 1);
+            }
+            if (index->slot[slot] == 0)
+            {
+                index->slot[slot] = i + 1;
+                index->count++;
+            }
+        }
+    }
+    unsigned slot = block_hash_slot(key, index->capacity);
+    while (index->slot[slot] != 0)
+    {
+        // 重复的哈希保留最先插入的区块
+        if (memcmp(index->key + (long)(index->slot[slot] - 1) * BLOCK_HASH_BYTES, key, BLOCK_HASH_BYTES) == 0)
+        {
+            return;
+        }
+        slot = (slot + 1) & (index->capacity - 1);
+    }
+    index->slot[slot] = block->index + 1;
+    index->count++;
+}
+
+// 按哈希查找区块，不存在或哈希格式不对时返回0
+Block* find_block_by_hash(char* hash)
+{
+    BlockHashIndex* index = &block_hash_index;
+    unsigned char key[BLOCK_HASH_BYTES];
+    if (index->count == 0 || !parse_block_hash(hash, key))
+    {
+        return 0;
+    }
+    unsigned slot = block_hash_slot(key, index->capacity);
+    while (index->slot[slot] != 0)
+    {
+        if (memcmp(index->key + (long)(index->slot[slot] - 1) * BLOCK_HASH_BYTES, key, BLOCK_HASH_BYTES) == 0)
+        {
+            return block_index.blocks[index->slot[slot] - 1];
+        }
+        slot = (slot + 1) & (index->capacity - 1);
+    }
+    return 0;
+}
+
+// 按区块号二分查找区块（区块按区块号递增追加），不存在时返回0
+Block* find_block(int blockID)
+{
+    int low = 0, high = block_index.count;
+    while (low < high)
+    {
+        int mid = (low + high) / 2;
+        if (block_index.blocks[mid]->blockID < blockID)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    if (low < block_index.count && block_index.blocks[low]->blockID == blockID)
+    {
+        return block_index.blocks[low];
+    }
+    return 0;
+}
+
+// 第一个前缀最大时间戳不小于time_stamp的区块，即顺序遍历时第一个时间戳不小于time_stamp的区块
+int block_lower_bound(unsigned time_stamp)
+{
+    int low = 0, high = block_index.count;
+    while (low < high)
+    {
+        int mid = (low + high) / 2;
+        if (block_index.max_timestamp[mid] < time_stamp)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// 第一个前缀最大时间戳大于time_stamp的区块，顺序遍历到这里停止
+int block_upper_bound(unsigned time_stamp)
+{
+    int low = 0, high = block_index.count;
+    while (low < high)
+    {
+        int mid = (low + high) / 2;
+        if (block_index.max_timestamp[mid] <= time_stamp)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// 第一个所在区块不小于block的行，要求行按区块顺序排列
+int row_lower_bound(int block)
+{
+    int low = 0, high = tx_columns.count;
+    while (low < high)
+    {
+        int mid = (low + high) / 2;
+        if (tx_columns.block[mid] < block)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+void amount_stats_init(void* partial, void* ctx)
+{
+    (void)ctx;
+    AmountStats* stats = (AmountStats*)partial;
+    stats->count = 0;
+    stats->sum = 0;
+    stats->min = INFINITY;
+    stats->max = -INFINITY;
+}
+
+void amount_stats_merge(void* result, void* partial, void* ctx)
+{
+    (void)ctx;
+    AmountStats* into = (AmountStats*)result;
+    AmountStats* from = (AmountStats*)partial;
+    into->count += from->count;
+    into->sum += from->sum;
+    if (from->min < into->min)
+    {
+        into->min = from->min;
+    }
+    if (from->max > into->max)
+    {
+        into->max = from->max;
+    }
+}
+
+// 标量版本，也用于处理向量版本剩下的尾部
+void aggregate_scalar(int begin, int end, AmountFilter* filter, AmountStats* stats)
+{
+    for (int row = begin; row < end; row++)
+    {
+        int block = tx_columns.block[row];
+        double amount = tx_columns.amount[row];
+        if (block < filter->block_begin || block >= filter->block_end || !(amount >= filter->threshold))
+        {
+            continue;
+        }
+        if (filter->side == SIDE_FROM && tx_columns.from[row] != filter->account)
+        {
+            continue;
+        }
+        if (filter->side == SIDE_TO && (tx_columns.to[row] != filter->account || tx_columns.from[row] == filter->account))
+        {
+            continue;
+        }
+        stats->count++;
+        stats->sum += amount;
+        if (amount < stats->min)
+        {
+            stats->min = amount;
+        }
+        if (amount > stats->max)
+        {
+            stats->max = amount;
+        }
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+// SSE2版本，每次处理2行
+__attribute__((target("sse2")))
+void aggregate_sse2(int begin, int end, AmountFilter* filter, AmountStats* stats)
+{
+    __m128i account = _mm_set1_epi32(filter->account);
+    __m128i block_low = _mm_set1_epi32(filter->block_begin - 1);
+    __m128i block_high = _mm_set1_epi32(filter->block_end);
+    __m128d threshold = _mm_set1_pd(filter->threshold);
+    __m128d sum = _mm_setzero_pd();
+    __m128d min = _mm_set1_pd(INFINITY);
+    __m128d max = _mm_set1_pd(-INFINITY);
+    int count = 0;
+    int row = begin;
+    for (; row + 2 <= end; row += 2)
+    {
+        __m128i block = _mm_loadl_epi64((__m128i*)(tx_columns.block + row));
+        __m128i mask = _mm_and_si128(_mm_cmpgt_epi32(block, block_low), _mm_cmpgt_epi32(block_high, block));
+        if (filter->side != SIDE_ANY)
+        {
+            __m128i from = _mm_cmpeq_epi32(_mm_loadl_epi64((__m128i*)(tx_columns.from + row)), account);
+            if (filter->side == SIDE_FROM)
+            {
+                mask = _mm_and_si128(mask, from);
+            }
+            else
+            {
+                __m128i to = _mm_cmpeq_epi32(_mm_loadl_epi64((__m128i*)(tx_columns.to + row)), account);
+                mask = _mm_and_si128(mask, _mm_andnot_si128(from, to));
+            }
+        }
+        // 32位掩码扩展为64位
+        __m128d lane = _mm_castsi128_pd(_mm_unpacklo_epi32(mask, mask));
+        __m128d amount = _mm_loadu_pd(tx_columns.amount + row);
+        lane = _mm_and_pd(lane, _mm_cmpge_pd(amount, threshold));
+
+        sum = _mm_add_pd(sum, _mm_and_pd(lane, amount));
+        min = _mm_min_pd(min, _mm_or_pd(_mm_and_pd(lane, amount), _mm_andnot_pd(lane, _mm_set1_pd(INFINITY))));
+        max = _mm_max_pd(max, _mm_or_pd(_mm_and_pd(lane, amount), _mm_andnot_pd(lane, _mm_set1_pd(-INFINITY))));
+        count += __builtin_popcount(_mm_movemask_pd(lane));
+    }
+
+    double lanes[2];
+    _mm_storeu_pd(lanes, sum);
+    stats->sum += lanes[0] + lanes[1];
+    _mm_storeu_pd(lanes, min);
+    stats->min = fmin(stats->min, fmin(lanes[0], lanes[1]));
+    _mm_storeu_pd(lanes, max);
+    stats->max = fmax(stats->max, fmax(lanes[0], lanes[1]));
+    stats->count += count;
+    aggregate_scalar(row, end, filter, stats);
+}
+
+// AVX2版本，每次处理4行
+__attribute__((target("avx2")))
+void aggregate_avx2(int begin, int end, AmountFilter* filter, AmountStats* stats)
+{
+    __m128i account = _mm_set1_epi32(filter->account);
+    __m128i block_low = _mm_set1_epi32(filter->block_begin - 1);
+    __m128i block_high = _mm_set1_epi32(filter->block_end);
+    __m256d threshold = _mm256_set1_pd(filter->threshold);
+    __m256d positive_infinity = _mm256_set1_pd(INFINITY);
+    __m256d negative_infinity = _mm256_set1_pd(-INFINITY);
+    __m256d sum = _mm256_setzero_pd();
+    __m256d min = positive_infinity;
+    __m256d max = negative_infinity;
+    int count = 0;
+    int row = begin;
+    for (; row + 4 <= end; row += 4)
+    {
+        __m128i block = _mm_loadu_si128((__m128i*)(tx_columns.block + row));
+        __m128i mask = _mm_and_si128(_mm_cmpgt_epi32(block, block_low), _mm_cmpgt_epi32(block_high, block));
+        if (filter->side != SIDE_ANY)
+        {
+            __m128i from = _mm_cmpeq_epi32(_mm_loadu_si128((__m128i*)(tx_columns.from + row)), account);
+            if (filter->side == SIDE_FROM)
+            {
+                mask = _mm_and_si128(mask, from);
+            }
+            else
+            {
+                __m128i to = _mm_cmpeq_epi32(_mm_loadu_si128((__m128i*)(tx_columns.to + row)), account);
+                mask = _mm_and_si128(mask, _mm_andnot_si128(from, to));
+            }
+        }
+        __m256d lane = _mm256_castsi256_pd(_mm256_cvtepi32_epi64(mask));
+        __m256d amount = _mm256_loadu_pd(tx_columns.amount + row);
+        lane = _mm256_and_pd(lane, _mm256_cmp_pd(amount, threshold, _CMP_GE_OQ));
+
+        sum = _mm256_add_pd(sum, _mm256_and_pd(lane, amount));
+        min = _mm256_min_pd(min, _mm256_blendv_pd(positive_infinity, amount, lane));
+        max = _mm256_max_pd(max, _mm256_blendv_pd(negative_infinity, amount, lane));
+        count += __builtin_popcount(_mm256_movemask_pd(lane));
+    }
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, sum);
+    stats->sum += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    _mm256_storeu_pd(lanes, min);
+    stats->min = fmin(stats->min, fmin(fmin(lanes[0], lanes[1]), fmin(lanes[2], lanes[3])));
+    _mm256_storeu_pd(lanes, max);
+    stats->max = fmax(stats->max, fmax(fmax(lanes[0], lanes[1]), fmax(lanes[2], lanes[3])));
+    stats->count += count;
+    aggregate_scalar(row, end, filter, stats);
+}
+#endif
+
+// 运行时根据CPU选择的聚合内核
+void (*aggregate_kernel)(int begin, int end, AmountFilter* filter, AmountStats* stats) = aggregate_scalar;
+const char* aggregate_kernel_name = "scalar";
+
+void select_aggregate_kernel()
+{
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        aggregate_kernel = aggregate_avx2;
+        aggregate_kernel_name = "avx2";
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+        aggregate_kernel = aggregate_sse2;
+        aggregate_kernel_name = "sse2";
+    }
+#endif
+}
+
+void aggregate_body(int begin, int end, void* partial, void* ctx)
+{
+    aggregate_kernel(begin, end, (AmountFilter*)ctx, (AmountStats*)partial);
+}
+
+// 对满足过滤条件的交易金额求笔数、总和、最小值和最大值
+void aggregate_amount(AmountFilter* filter, AmountStats* stats)
+{
+    amount_stats_init(stats, 0);
+    if (filter->block_begin >= filter->block_end)
+    {
+        return;
+    }
+    int row_begin = 0, row_end = tx_columns.count;
+    if (tx_columns.block_ordered)
+    {
+        row_begin = row_lower_bound(filter->block_begin);
+        row_end = row_lower_bound(filter->block_end);
+    }
+    // 外存模式下分段扫描，段间让出映射页
+    int window = storage_window(row_end - row_begin, 4 * sizeof(int) + sizeof(double));
+    for (int begin = row_begin; begin < row_end; begin += window)
+    {
+        int end = begin + window < row_end ? begin + window : row_end;
+        AmountStats part;
+        amount_stats_init(&part, 0);
+        parallel_reduce(begin, end, default_grain(end - begin), sizeof(AmountStats),
+        amount_stats_init, aggregate_body, amount_stats_merge, &part, filter);
+        amount_stats_merge(stats, &part, 0);
+        storage_trim();
+    }
+}
+
+// 账户扫描中选出的一笔交易
+typedef struct TxPick
+{
+    int tx_id;
+    int block;
+    int from;
+    int to;
+    double amount;
+} TxPick;
+
+// 账户在一段区块内的收支，以及金额最大的k笔交易（按金额降序，金额相同按tx_id升序）
+typedef struct AccountScan
+{
+    int account;
+    int k;
+    AmountStats out;
+    AmountStats in;  // 自己转给自己的交易只算支出
+    int count;
+    TxPick* picks;
+} AccountScan;
+
+void account_scan_init(void* partial, void* ctx)
+{
+    AccountScan* scan = (AccountScan*)partial;
+    scan->account = ((AccountScan*)ctx)->account;
+    scan->k = ((AccountScan*)ctx)->k;
+    amount_stats_init(&scan->out, 0);
+    amount_stats_init(&scan->in, 0);
+    scan->count = 0;
+    scan->picks = (TxPick*)malloc(sizeof(TxPick) * (scan->k > 0 ? scan->k : 1));
+}
+
+void account_scan_pick(AccountScan* scan, TxPick* pick)
+{
+    int i = scan->count;
+    while (i > 0 && (scan->picks[i - 1].amount < pick->amount
+        || (scan->picks[i - 1].amount == pick->amount && scan->picks[i - 1].tx_id > pick->tx_id)))
+    {
+        i--;
+    }
+    if (i >= scan->k)
+    {
+        return;
+    }
+    int last = scan->count < scan->k ? scan->count : scan->k - 1;
+    memmove(scan->picks + i + 1, scan->picks + i, sizeof(TxPick) * (last - i));
+    scan->picks[i] = *pick;
+    if (scan->count < scan->k)
+    {
+        scan->count++;
+    }
+}
+
+// 解码区块 [begin, end) 的压缩段，选出金额最大的k笔
+void account_scan_body(int begin, int end, void* partial, void* ctx)
+{
+    (void)ctx;
+    AccountScan* scan = (AccountScan*)partial;
+    int account = scan->account;
+    for (int block = begin; block < end; block++)
+    {
+        // 区块结构分散在堆上，提前取后面的区块
+        if (block + 8 < end)
+        {
+            __builtin_prefetch(block_index.blocks[block + 8]);
+        }
+        SegmentReader reader;
+        segment_open(&block_index.blocks[block]->segment, &reader);
+        TxPick pick;
+        pick.block = block;
+        for (int i = 0; i < reader.count; i++)
+        {
+            pick.from = (int)segment_field(&reader, i, SEGMENT_FROM);
+            pick.to = (int)segment_field(&reader, i, SEGMENT_TO);
+            if (pick.from != account && pick.to != account)
+            {
+                continue;
+            }
+            pick.tx_id = segment_tx_id(&reader, i);
+            pick.amount = segment_amount(&reader, i);
+            account_scan_pick(scan, &pick);
+        }
+    }
+}
+
+void account_scan_merge(void* result, void* partial, void* ctx)
+{
+    (void)ctx;
+    AccountScan* into = (AccountScan*)result;
+    AccountScan* from = (AccountScan*)partial;
+    amount_stats_merge(&into->out, &from->out, 0);
+    amount_stats_merge(&into->in, &from->in, 0);
+    for (int i = 0; i < from->count; i++)
+    {
+        account_scan_pick(into, &from->picks[i]);
+    }
+    free(from->picks);
+}
+
+/*
+ * 并行解码区块 [block_begin, block_end) 的压缩段，各段的部分结果按区块顺序归并进result。
+ * 外存模式下按区块分段扫描，段间让出映射页；部分结果要保存解码出的行时（每行row_bytes字节），
+ * 每段另外不超过SCAN_WINDOW_ROWS行
+ */
+void segment_scan(int block_begin, int block_end, int row_bytes, size_t partial_size,
+    ReduceInit init, ReduceBody body, ReduceMerge merge, void* result, void* ctx)
+{
+    storage_advise(&segment_arena.region, 1);
+    int rows_per_block = block_index.count > 0 ? tx_columns.count / block_index.count + 1 : 1;
+    int block_bytes = block_index.count > 0 ? (int)(segment_arena.length / block_index.count) + 1 : 1;
+    int window = storage_window(block_end - block_begin, block_bytes + rows_per_block * row_bytes);
+    if (row_bytes > 0 && window > SCAN_WINDOW_ROWS / rows_per_block)
+    {
+        window = SCAN_WINDOW_ROWS / rows_per_block > 0 ? SCAN_WINDOW_ROWS / rows_per_block : 1;
+    }
+    for (int begin = block_begin; begin < block_end; begin += window)
+    {
+        int end = begin + window < block_end ? begin + window : block_end;
+        parallel_reduce(begin, end, default_grain(end - begin), partial_size, init, body, merge, result, ctx);
+        storage_trim();
+    }
+}
+
+/*
+ * 区块 [block_begin, block_end) 中账户的收支：转出和转入两侧各用一遍列式聚合内核（SIMD）求和，
+ * 前k笔需要tx_id，只在k大于0时并行解码这段区块的压缩段
+ */
+void account_scan(int account, int k, int block_begin, int block_end, AccountScan* result)
+{
+    AccountScan context;
+    context.account = account;
+    context.k = k;
+    account_scan_init(result, &context);
+
+    AmountFilter filter;
+    filter.account = account;
+    filter.block_begin = block_begin;
+    filter.block_end = block_end;
+    filter.threshold = -INFINITY;
+    filter.side = SIDE_FROM;
+    aggregate_amount(&filter, &result->out);
+    filter.side = SIDE_TO;
+    aggregate_amount(&filter, &result->in);
+    if (k <= 0)
+    {
+        return;
+    }
+
+    segment_scan(block_begin, block_end, 0, sizeof(AccountScan),
+    account_scan_init, account_scan_body, account_scan_merge, result, &context);
+}
+
+// 规范化查询串的哈希
+unsigned query_cache_hash(char* key)
+{
+    unsigned hash = 2166136261u;
+    for (char* p = key; *p; p++)
+    {
+        hash = (hash ^ (unsigned char)*p) * 16777619u;
+    }
+    return hash;
+}
+
+void query_cache_unlink(CacheEntry* entry)
+{
+    QueryCache* cache = &query_cache;
+    if (entry->prev != 0)
+    {
+        entry->prev->next = entry->next;
+    }
+    else
+    {
+        cache->head = entry->next;
+    }
+    if (entry->next != 0)
+    {
+        entry->next->prev = entry->prev;
+    }
+    else
+    {
+        cache->tail = entry->prev;
+    }
+}
+
+void query_cache_push_front(CacheEntry* entry)
+{
+    QueryCache* cache = &query_cache;
+    entry->prev = 0;
+    entry->next = cache->head;
+    if (cache->head != 0)
+    {
+        cache->head->prev = entry;
+    }
+    cache->head = entry;
+    if (cache->tail == 0)
+    {
+        cache->tail = entry;
+    }
+}
+
+// 从哈希桶和LRU链表中删除条目（持lock调用）
+void query_cache_remove(CacheEntry* entry)
+{
+    QueryCache* cache = &query_cache;
+    CacheEntry** slot = &cache->buckets[query_cache_hash(entry->key) % cache->bucket_count];
+    while (*slot != entry)
+    {
+        slot = &(*slot)->next_hash;
+    }
+    *slot = entry->next_hash;
+    query_cache_unlink(entry);
+    cache->bytes -= entry->bytes;
+    cache->count--;
+    free(entry->key);
+    free(entry->text);
+    free(entry);
+}
+
+// 插入交易后清理依赖了被改动区块的条目，结果范围在这些区块之前的条目继续有效（持lock调用）
+void query_cache_sweep()
+{
+    QueryCache* cache = &query_cache;
+    if (cache->touched_block == INT_MAX)
+    {
+        return;
+    }
+    CacheEntry* entry = cache->head;
+    while (entry != 0)
+    {
+        CacheEntry* next = entry->next;
+        if (entry->block_end > cache->touched_block)
+        {
+            query_cache_remove(entry);
+            cache->invalidations++;
+        }
+        entry = next;
+    }
+    cache->touched_block = INT_MAX;
+}
+
+// 插入交易时在写锁内调用，只记下区块序号
+void query_cache_touch(int block)
+{
+    if (block < query_cache.touched_block)
+    {
+        query_cache.touched_block = block;
+    }
+}
+
+// 查询结果覆盖到最后一个区块时，之后追加的区块也算在范围内
+int query_cache_horizon(int block_end)
+{
+    return block_end >= block_index.count ? INT_MAX : block_end;
+}
+
+// 查找缓存，命中时直接输出保存的文本并返回1；未命中时开始记录之后的输出，由query_cache_store保存
+int query_cache_replay(char* key)
+{
+    QueryCache* cache = &query_cache;
+    query_capture.capturing = 0;
+    // 分片模式下协调者在临时合并表上调用排行函数，工作进程的数据也只是一部分，都不缓存
+    if (cache->limit == 0 || shard_count > 1)
+    {
+        return 0;
+    }
+    pthread_mutex_lock(&cache->lock);
+    query_cache_sweep();
+    if (cache->bucket_count > 0)
+    {
+        CacheEntry* entry = cache->buckets[query_cache_hash(key) % cache->bucket_count];
+        while (entry != 0 && strcmp(entry->key, key) != 0)
+        {
+            entry = entry->next_hash;
+        }
+        if (entry != 0)
+        {
+            cache->hits++;
+            query_cache_unlink(entry);
+            query_cache_push_front(entry);
+            fputs(entry->text, stdout);
+            pthread_mutex_unlock(&cache->lock);
+            return 1;
+        }
+    }
+    cache->misses++;
+    pthread_mutex_unlock(&cache->lock);
+    query_capture.capturing = 1;
+    query_capture.length = 0;
+    return 0;
+}
+
+// 保存query_cache_replay之后记录的输出，超过上限时从最久未用的条目开始淘汰
+void query_cache_store(char* key, int block_end)
+{
+    QueryCache* cache = &query_cache;
+    QueryCapture* capture = &query_capture;
+    if (!capture->capturing)
+    {
+        return;
+    }
+    capture->capturing = 0;
+    long bytes = sizeof(CacheEntry) + strlen(key) + 1 + capture->length + 1;
+    pthread_mutex_lock(&cache->lock);
+    if (bytes > cache->limit)
+    {
+        pthread_mutex_unlock(&cache->lock);
+        return;
+    }
+    if (cache->bucket_count == 0)
+    {
+        cache->bucket_count = 4096;
+        cache->buckets = (CacheEntry**)calloc(cache->bucket_count, sizeof(CacheEntry*));
+    }
+    CacheEntry* entry = (CacheEntry*)malloc(sizeof(CacheEntry));
+    entry->key = strdup(key);
+    entry->text = (char*)malloc(capture->length + 1);
+    memcpy(entry->text, capture->text, capture->length);
+    entry->text[capture->length] = 0;
+    entry->bytes = bytes;
+    entry->block_end = block_end;
+    CacheEntry** slot = &cache->buckets[query_cache_hash(key) % cache->bucket_count];
+    entry->next_hash = *slot;
+    *slot = entry;
+    query_cache_push_front(entry);
+    cache->bytes += bytes;
+    cache->count++;
+    while (cache->bytes > cache->limit && cache->tail != entry)
+    {
+        query_cache_remove(cache->tail);
+        cache->evictions++;
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+// 可缓存查询的输出：照常打印，未命中时同时记下文本
+void query_print(const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+    QueryCapture* capture = &query_capture;
+    if (!capture->capturing)
+    {
+        return;
+    }
+    va_start(args, format);
+    int length = vsnprintf(0, 0, format, args);
+    va_end(args);
+    if (capture->length + length + 1 > capture->capacity)
+    {
+        capture->capacity = (capture->length + length + 1) * 2;
+        capture->text = (char*)realloc(capture->text, capture->capacity);
+    }
+    va_start(args, format);
+    vsnprintf(capture->text + capture->length, length + 1, format, args);
+    va_end(args);
+    capture->length += length;
+}
+
+// 修改上限，0表示关闭并清空
+void query_cache_configure(long limit_mb)
+{
+    QueryCache* cache = &query_cache;
+    pthread_mutex_lock(&cache->lock);
+    cache->limit = limit_mb > 0 ? limit_mb << 20 : 0;
+    while (cache->tail != 0 && cache->bytes > cache->limit)
+    {
+        query_cache_remove(cache->tail);
+        cache->evictions++;
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void print_query_cache_stats()
+{
+    QueryCache* cache = &query_cache;
+    if (cache->limit == 0)
+    {
+        printf("查询结果缓存: 关闭\n");
+        return;
+    }
+    pthread_mutex_lock(&cache->lock);
+    long lookups = cache->hits + cache->misses;
+    printf("查询结果缓存: %d 条，%.2f MB / 上限 %ld MB，命中 %ld 次，未命中 %ld 次（命中率 %.1f%%），淘汰 %ld 条，因插入交易失效 %ld 条\n",
+    cache->count, cache->bytes / 1048576.0, cache->limit >> 20, cache->hits, cache->misses,
+    lookups > 0 ? cache->hits * 100.0 / lookups : 0.0, cache->evictions, cache->invalidations);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+// 计算一段时间内账户的交易出入
+void account_in_out(unsigned time_start, unsigned time_end, int k, char* account, Block* head, HashTable* user_table)
+{
+    if (time_start > time_end)
+    {
+        printf("起始时间必须小于终止时间\n");
+        return;
+    }
+    user* account_user = find_user(user_table, account);
+    if (account_user == 0)
+    {
+        printf("账户不存在\n");
+        return;
+    }
+
+    int block_begin = block_lower_bound(time_start);
+    int block_end = block_upper_bound(time_end);
+    char key[64];
+    sprintf(key, "in_out %d %d %d %d", account_user->uid, block_begin, block_end, k);
+    if (query_cache_replay(key))
+    {
+        return;
+    }
+
+    AccountScan scan;
+    account_scan(account_user->uid, k, block_begin, block_end, &scan);
+
+    query_print("总交易数: %d\n", scan.out.count + scan.in.count);
+    query_print("总支出: %.2lf\n", scan.out.sum);
+    query_print("总收入: %.2lf\n", scan.in.sum);
+    query_print("交易金额最大的%d笔交易:\n", k);
+    for (int i = 0; i < scan.count; i++)
+    {
+        TxPick* pick = &scan.picks[i];
+        query_print("txid: %d\nblockID: %d\nadd_in: %s\nadd_out: %s\namount: %.2lf\n\n", 
+        pick->tx_id, block_index.blocks[pick->block]->blockID,
+        user_table->users[pick->from]->user_id, user_table->users[pick->to]->user_id, pick->amount);
+    }
+    free(scan.picks);
+    query_cache_store(key, query_cache_horizon(block_end));
+}
+
+// 统计结余
+void account_amount(unsigned time_end, char* account, Block* head, HashTable* user_table)
+{
+    user* account_user = find_user(user_table, account);
+    if (account_user == 0)
+    {
+        printf("账户不存在\n");
+        return;
+    }
+
+    int block_end = block_upper_bound(time_end);
+    char key[64];
+    sprintf(key, "amount %d %d", account_user->uid, block_end);
+    if (query_cache_replay(key))
+    {
+        return;
+    }
+
+    AccountScan scan;
+    account_scan(account_user->uid, 0, 0, block_end, &scan);
+    free(scan.picks);
+
+    query_print("总交易数: %d\n", scan.out.count + scan.in.count);
+    query_print("总支出: %.2lf\n", scan.out.sum);
+    query_print("总收入: %.2lf\n", scan.in.sum);
+    query_print("结余: %.2lf\n", scan.in.sum - scan.out.sum);
+    query_cache_store(key, query_cache_horizon(block_end));
+}
+
+// 统计一段时间内全网金额不低于threshold的交易
+void network_volume(unsigned time_start, unsigned time_end, double threshold)
+{
+    if (time_start > time_end)
+    {
+        printf("起始时间必须小于终止时间\n");
+        return;
+    }
+
+    AmountFilter filter;
+    filter.side = SIDE_ANY;
+    filter.account = -1;
+    filter.block_begin = block_lower_bound(time_start);
+    filter.block_end = block_upper_bound(time_end);
+    filter.threshold = threshold;
+    AmountStats stats;
+    aggregate_amount(&filter, &stats);
+
+    printf("区块数: %d\n", filter.block_end > filter.block_begin ? filter.block_end - filter.block_begin : 0);
+    printf("总交易数: %d\n", stats.count);
+    printf("交易总额: %.2lf\n", stats.sum);
+    if (stats.count > 0)
+    {
+        printf("单笔最大金额: %.2lf\n", stats.max);
+        printf("单笔最小金额: %.2lf\n", stats.min);
+    }
+}
+
+// 按tx_id查找交易，连同所在区块的时间戳
+void lookup_transaction(HashTable* user_table, int tx_id)
+{
+    int row = tx_index_find(tx_id);
+    if (row == -1)
+    {
+        printf("交易不存在\n");
+        return;
+    }
+    Block* block = block_index.blocks[tx_columns.block[row]];
+    printf("txid: %d\nblockID: %d\nblock_timestamp: %u\nadd_in: %s\nadd_out: %s\namount: %.2lf\n",
+    tx_id, block->blockID, block->block_timestamp,
+    user_table->users[tx_columns.from[row]]->user_id, user_table->users[tx_columns.to[row]]->user_id, tx_columns.amount[row]);
+}
+
+// 按哈希查找区块，列出区块内的交易（按插入顺序）
+void lookup_block(HashTable* user_table, char* hash)
+{
+    Block* block = find_block_by_hash(hash);
+    if (block == 0)
+    {
+        printf("区块不存在\n");
+        return;
+    }
+    printf("blockID: %d\nhash: %s\nblock_timestamp: %u\n交易数: %d\n\n",
+    block->blockID, block->hash, block->block_timestamp, block->transaction_count);
+    SegmentReader reader;
+    segment_open(&block->segment, &reader);
+    for (int i = 0; i < reader.count; i++)
+    {
+        printf("txid: %d\nadd_in: %s\nadd_out: %s\namount: %.2lf\n\n", segment_tx_id(&reader, i),
+        user_table->users[segment_field(&reader, i, SEGMENT_FROM)]->user_id,
+        user_table->users[segment_field(&reader, i, SEGMENT_TO)]->user_id, segment_amount(&reader, i));
+    }
+}
+
+// 初始化哈希表
+HashTable* initHashTable(int size)
+{
+    HashTable* hashTable = (HashTable*)malloc(sizeof(HashTable));
+    hashTable->size = size;
+    hashTable->table = (user**)malloc(sizeof(user*) * size);
+
+    for (int i = 0; i < size; i++)
+    {
+        hashTable->table[i] = (user*)malloc(sizeof(user));
+        hashTable->table[i]->next_user = 0;
+    }
+    hashTable->user_count = 0;
+    hashTable->user_capacity = 1024;
+    hashTable->users = (user**)malloc(sizeof(user*) * hashTable->user_capacity);
+
+    return hashTable;
+}
+
+// 哈希函数
+int hashFunction(char* key, int size)
+{
+    unsigned int hash = 5381; // 一个常用的初始哈希值
+    int c;
+
+    while ((c = *key++))
+    {
+        hash = ((hash << 5) + hash) + c; // 乘以33并加上字符的ASCII值
+    }
+
+    return hash % size;
+}
+
+// 插入操作
+void insert(HashTable* hashTable, char* key, int sign)
+{
+    int index = hashFunction(key, hashTable->size);
+    user* temp_user = hashTable->table[index]->next_user;
+    while (temp_user != 0)
+    {
+        if (strcmp(temp_user->user_id, key) == 0)
+        {
+            return;
+        }
+        temp_user = temp_user->next_user;
+    }
+    insert_user(hashTable, key, index, sign);
+}
+
+// 在第index个桶中查找账户，不存在时插入（只有新账户才复制账号字符串），一个地址只探查一次桶链
+user* resolve_account(HashTable* hashTable, char* key, int index, long first_seen)
+{
+    user* temp_user = hashTable->table[index]->next_user;
+    while (temp_user != 0)
+    {
+        if (strcmp(temp_user->user_id, key) == 0)
+        {
+            return temp_user;
+        }
+        temp_user = temp_user->next_user;
+    }
+    temp_user = insert_user(hashTable, strdup(key), index, 1);
+    temp_user->first_seen = first_seen;
+    return temp_user;
+}
+
+// 把确定不在表中的账户插入第index个桶，分配连续编号
+user* insert_user(HashTable* hashTable, char* key, int index, int sign)
+{
+    user* new_user = (user*)malloc(sizeof(user));
+    new_user->user_id = key;
+    new_user->in_count = 0;
+    new_user->out_count = 0;
+    new_user->in_list_head = (Transaction*)malloc(sizeof(Transaction));
+    new_user->out_list_head = (Transaction*)malloc(sizeof(Transaction));
+    new_user->in_list_head->next = 0;
+    new_user->out_list_head->next = 0;
+    new_user->in_list_head->amount = 0;
+    new_user->out_list_head->amount = 0;
+    new_user->next_user = hashTable->table[index]->next_user;
+    hashTable->table[index]->next_user = new_user;
+
+    // 分配连续编号
+    if (hashTable->user_count == hashTable->user_capacity)
+    {
+        hashTable->user_capacity *= 2;
+        hashTable->users = (user**)realloc(hashTable->users, sizeof(user*) * hashTable->user_capacity);
+    }
+    new_user->uid = hashTable->user_count;
+    hashTable->users[hashTable->user_count++] = new_user;
+
+    if (sign == 1)
+    {
+        calc_user++;
+    }
+
+    if (show_progress && calc_user % 100000 == 0)
+    {
+        printf("insert user: %d\n", calc_user);
+    }
+    return new_user;
+}
+
+// 记录交易两端账户的出入度和收支总额（逐笔的出弧在需要时由交易列建成tx_adjacency）
+void insert_edge(user* from_user, double amount, user* to_user)
+{
+    from_user->out_count++;
+    from_user->out_list_head->amount += amount;
+    to_user->in_count++;
+    to_user->in_list_head->amount += amount;
+}
+
+/*
+ * 截止as_of时刻的账户收支。as_of为UINT_MAX时就是各账户当前的统计；
+ * 否则在主交易列上只读截止区块之前的行（行按区块排列时是一段前缀），不另建哈希表。
+ */
+AccountTotals* account_totals(HashTable* user_table, unsigned as_of)
+{
+    int n = user_table->user_count;
+    AccountTotals* totals = (AccountTotals*)malloc(sizeof(AccountTotals));
+    totals->in_count = (int*)calloc(n + 1, sizeof(int));
+    totals->out_count = (int*)calloc(n + 1, sizeof(int));
+    totals->in_amount = (double*)calloc(n + 1, sizeof(double));
+    totals->out_amount = (double*)calloc(n + 1, sizeof(double));
+    totals->seen = (char*)calloc(n + 1, 1);
+    if (as_of == UINT_MAX)
+    {
+        for (int uid = 0; uid < n; uid++)
+        {
+            user* temp_user = user_table->users[uid];
+            totals->in_count[uid] = temp_user->in_count;
+            totals->out_count[uid] = temp_user->out_count;
+            totals->in_amount[uid] = temp_user->in_list_head->amount;
+            totals->out_amount[uid] = temp_user->out_list_head->amount;
+            totals->seen[uid] = 1;
+        }
+        totals->count = n;
+        return totals;
+    }
+
+    int block_end = block_upper_bound(as_of);
+    int row_end = tx_columns.block_ordered ? row_lower_bound(block_end) : tx_columns.count;
+    int window = storage_window(row_end, sizeof(int) * 3 + sizeof(double));
+    for (int begin = 0; begin < row_end; begin += window)
+    {
+        int end = begin + window < row_end ? begin + window : row_end;
+        for (int row = begin; row < end; row++)
+        {
+            if (tx_columns.block[row] >= block_end)
+            {
+                continue;
+            }
+            int from = tx_columns.from[row];
+            int to = tx_columns.to[row];
+            totals->out_count[from]++;
+            totals->out_amount[from] += tx_columns.amount[row];
+            totals->in_count[to]++;
+            totals->in_amount[to] += tx_columns.amount[row];
+            totals->seen[from] = totals->seen[to] = 1;
+        }
+        storage_trim();
+    }
+    totals->count = 0;
+    for (int uid = 0; uid < n; uid++)
+    {
+        totals->count += totals->seen[uid];
+    }
+    return totals;
+}
+
+void free_account_totals(AccountTotals* totals)
+{
+    free(totals->in_count);
+    free(totals->out_count);
+    free(totals->in_amount);
+    free(totals->out_amount);
+    free(totals->seen);
+    free(totals);
+}
+
+void degree_sum_init(void* partial, void* ctx)
+{
+    (void)ctx;
+    memset(partial, 0, sizeof(DegreeSum));
+}
+
+void degree_sum_body(int begin, int end, void* partial, void* ctx)
+{
+    AccountTotals* totals = (AccountTotals*)ctx;
+    DegreeSum* sum = (DegreeSum*)partial;
+    for (int uid = begin; uid < end; uid++)
+    {
+        sum->total_in += totals->in_count[uid];
+        sum->total_out += totals->out_count[uid];
+        sum->total_in_amount += totals->in_amount[uid];
+        sum->total_out_amount += totals->out_amount[uid];
+    }
+}
+
+void degree_sum_merge(void* result, void* partial, void* ctx)
+{
+    (void)ctx;
+    DegreeSum* into = (DegreeSum*)result;
+    DegreeSum* from = (DegreeSum*)partial;
+    into->total_in += from->total_in;
+    into->total_out += from->total_out;
+    into->total_in_amount += from->total_in_amount;
+    into->total_out_amount += from->total_out_amount;
+}
+
+// 遍历所有用户并统计平均入度出度，as_of不为UINT_MAX时只统计该时刻之前出现过的账户和交易
+void pathHashtable(HashTable* user_table, unsigned as_of)
+{
+    AccountTotals* totals = account_totals(user_table, as_of);
+    DegreeSum sum;
+    degree_sum_init(&sum, 0);
+    parallel_reduce(0, user_table->user_count, default_grain(user_table->user_count), sizeof(DegreeSum),
+    degree_sum_init, degree_sum_body, degree_sum_merge, &sum, totals);
+    print_average_degree(&sum, totals->count);
+    free_account_totals(totals);
+}
+
+void print_average_degree(DegreeSum* sum, int count)
+{
+    double user_count = (double)count;
+    double average_in, average_out, average_in_amount, average_out_amount;
+    average_in = ((double)sum->total_in) / user_count;
+    average_out = ((double)sum->total_out) / user_count;
+    average_out_amount = sum->total_out_amount / user_count;
+    average_in_amount = sum->total_in_amount / user_count;
+
+    printf("平均入度为: %.2lf\n平均出度为: %.2lf\n加权平均入度为: %.2lf\n加权平均出度为: %.2lf\n", 
+    average_in, average_out, average_in_amount, average_out_amount);
+}
+
+// 排行扫描的参数
+typedef struct RankContext
+{
+    HashTable* user_table;
+    int k;
+    AccountTotals* totals;
+} RankContext;
+
+// 最大出度入度的部分结果
+typedef struct DegreeRank
+{
+    TopK* in;
+    TopK* out;
+    TopK* in_amount;
+    TopK* out_amount;
+} DegreeRank;
+
+void degree_rank_init(void* partial, void* ctx)
+{
+    DegreeRank* rank = (DegreeRank*)partial;
+    int k = ((RankContext*)ctx)->k;
+    rank->in = topk_create(k);
+    rank->out = topk_create(k);
+    rank->in_amount = topk_create(k);
+    rank->out_amount = topk_create(k);
+}
+
+void degree_rank_body(int begin, int end, void* partial, void* ctx)
+{
+    DegreeRank* rank = (DegreeRank*)partial;
+    AccountTotals* totals = ((RankContext*)ctx)->totals;
+    for (int uid = begin; uid < end; uid++)
+    {
+        if (!totals->seen[uid])
+        {
+            continue;
+        }
+        topk_push(rank->in, uid, (double)totals->in_count[uid]);
+        topk_push(rank->out, uid, (double)totals->out_count[uid]);
+        topk_push(rank->in_amount, uid, totals->in_amount[uid]);
+        topk_push(rank->out_amount, uid, totals->out_amount[uid]);
+    }
+}
+
+void degree_rank_merge(void* result, void* partial, void* ctx)
+{
+    (void)ctx;
+    DegreeRank* into = (DegreeRank*)result;
+    DegreeRank* from = (DegreeRank*)partial;
+    topk_merge(into->in, from->in);
+    topk_merge(into->out, from->out);
+    topk_merge(into->in_amount, from->in_amount);
+    topk_merge(into->out_amount, from->out_amount);
+    topk_free(from->in);
+    topk_free(from->out);
+    topk_free(from->in_amount);
+    topk_free(from->out_amount);
+}
+
+// 遍历所有用户并统计最大出度和最大入度，as_of含义同pathHashtable
+void max_in_out(HashTable* user_table, int k, unsigned as_of)
+{
+    RankContext context = {user_table, k, account_totals(user_table, as_of)};
+    DegreeRank rank;
+    degree_rank_init(&rank, &context);
+    parallel_reduce(0, user_table->user_count, default_grain(user_table->user_count), sizeof(DegreeRank),
+    degree_rank_init, degree_rank_body, degree_rank_merge, &rank, &context);
+
+    printf("入度排行前%d名\n", k);
+    for (int i = 0; i < rank.in->count; i++)
+    {
+        printf("入度 NO.%d: %s, %d\n", i + 1, user_table->users[rank.in->uid[i]]->user_id, (int)rank.in->value[i]);
+    }
+
+    printf("出度排行前%d名\n", k);
+    for (int i = 0; i < rank.out->count; i++)
+    {
+        printf("出度 NO.%d: %s, %d\n", i + 1, user_table->users[rank.out->uid[i]]->user_id, (int)rank.out->value[i]);
+    }
+
+    printf("加权入度排行前%d名\n", k);
+    for (int i = 0; i < rank.in_amount->count; i++)
+    {
+        printf("加权入度 NO.%d: %s, %.2lf\n", i + 1, user_table->users[rank.in_amount->uid[i]]->user_id, rank.in_amount->value[i]);
+    }
+
+    printf("加权出度排行前%d名\n", k);
+    for (int i = 0; i < rank.out_amount->count; i++)
+    {
+        printf("加权出度 NO.%d: %s, %.2lf\n", i + 1, user_table->users[rank.out_amount->uid[i]]->user_id, rank.out_amount->value[i]);
+    }
+
+    topk_free(rank.in);
+    topk_free(rank.out);
+    topk_free(rank.in_amount);
+    topk_free(rank.out_amount);
+    free_account_totals(context.totals);
+}
+
+void wealth_rank_init(void* partial, void* ctx)
+{
+    *(TopK**)partial = topk_create(((RankContext*)ctx)->k);
+}
+
+void wealth_rank_body(int begin, int end, void* partial, void* ctx)
+{
+    TopK* top = *(TopK**)partial;
+    AccountTotals* totals = ((RankContext*)ctx)->totals;
+    for (int uid = begin; uid < end; uid++)
+    {
+        if (totals->seen[uid])
+        {
+            topk_push(top, uid, totals->in_amount[uid] - totals->out_amount[uid]);
+        }
+    }
+}
+
+void wealth_rank_merge(void* result, void* partial, void* ctx)
+{
+    (void)ctx;
+    topk_merge(*(TopK**)result, *(TopK**)partial);
+    topk_free(*(TopK**)partial);
+}
+
+// 计算财富排行，as_of含义同pathHashtable
+void wealth_rank(HashTable* user_table, int k, unsigned as_of)
+{
+    int block_end = as_of == UINT_MAX ? block_index.count : block_upper_bound(as_of);
+    char key[64];
+    sprintf(key, "wealth %d %d", block_end, k);
+    if (query_cache_replay(key))
+    {
+        return;
+    }
+    RankContext context = {user_table, k, account_totals(user_table, as_of)};
+    TopK* top;
+    wealth_rank_init(&top, &context);
+    parallel_reduce(0, user_table->user_count, default_grain(user_table->user_count), sizeof(TopK*),
+    wealth_rank_init, wealth_rank_body, wealth_rank_merge, &top, &context);
+
+    query_print("财富排行前%d名\n", k);
+    for (int i = 0; i < top->count; i++)
+    {
+        query_print("财富 NO.%d: %s, %.2lf\n", i + 1, user_table->users[top->uid[i]]->user_id, top->value[i]);
+    }
+    topk_free(top);
+    free_account_totals(context.totals);
+    query_cache_store(key, query_cache_horizon(block_end));
+}
+
+// 在某时间上的财富排行，直接在主交易列上按区块前缀统计
+void time_wealth_rank(HashTable* user_table, unsigned time_stamp, int k)
+{
+    wealth_rank(user_table, k, time_stamp);
+}
+
+// 一段区块解码出的交易，按区块顺序计入工作区
+typedef struct NetChangeBatch
+{
+    int count;
+    int capacity;
+    int* from;
+    int* to;
+    double* amount;
+} NetChangeBatch;
+
+// 净增加和净减少的前k名，loss中的value是净变化的相反数
+typedef struct NetChangeRank
+{
+    TopK* gain;
+    TopK* loss;
+} NetChangeRank;
+
+// 工作区扩到n个账户并开始新的一轮，之前各轮的值因stamp不等而失效，不用清零
+NetChangeScratch* net_change_begin(int n)
+{
+    NetChangeScratch* scratch = &net_change_scratch;
+    if (n > scratch->capacity)
+    {
+        int capacity = scratch->capacity == 0 ? 1024 : scratch->capacity;
+        while (capacity < n)
+        {
+            capacity *= 2;
+        }
+        scratch->stamp = (int*)realloc(scratch->stamp, sizeof(int) * capacity);
+        scratch->touched = (int*)realloc(scratch->touched, sizeof(int) * capacity);
+        scratch->delta = (double*)realloc(scratch->delta, sizeof(double) * capacity);
+        memset(scratch->stamp + scratch->capacity, 0, sizeof(int) * (capacity - scratch->capacity));
+        scratch->capacity = capacity;
+    }
+    if (++scratch->round == INT_MAX)
+    {
+        memset(scratch->stamp, 0, sizeof(int) * scratch->capacity);
+        scratch->round = 1;
+    }
+    scratch->count = 0;
+    return scratch;
+}
+
+void net_change_add(NetChangeScratch* scratch, int uid, double amount)
+{
+    if (scratch->stamp[uid] != scratch->round)
+    {
+        scratch->stamp[uid] = scratch->round;
+        scratch->delta[uid] = 0;
+        scratch->touched[scratch->count++] = uid;
+    }
+    scratch->delta[uid] += amount;
+}
+
+void net_change_batch_init(void* partial, void* ctx)
+{
+    (void)ctx;
+    memset(partial, 0, sizeof(NetChangeBatch));
+}
+
+// 解码区块 [begin, end) 的压缩段
+void net_change_batch_body(int begin, int end, void* partial, void* ctx)
+{
+    (void)ctx;
+    NetChangeBatch* batch = (NetChangeBatch*)partial;
+    for (int block = begin; block < end; block++)
+    {
+        batch->capacity += block_index.blocks[block]->segment.count;
+    }
+    batch->from = (int*)malloc(sizeof(int) * (batch->capacity + 1));
+    batch->to = (int*)malloc(sizeof(int) * (batch->capacity + 1));
+    batch->amount = (double*)malloc(sizeof(double) * (batch->capacity + 1));
+    for (int block = begin; block < end; block++)
+    {
+        if (block + 8 < end)
+        {
+            __builtin_prefetch(block_index.blocks[block + 8]);
+        }
+        SegmentReader reader;
+        segment_open(&block_index.blocks[block]->segment, &reader);
+        for (int i = 0; i < reader.count; i++)
+        {
+            batch->from[batch->count] = (int)segment_field(&reader, i, SEGMENT_FROM);
+            batch->to[batch->count] = (int)segment_field(&reader, i, SEGMENT_TO);
+            batch->amount[batch->count] = segment_amount(&reader, i);
+            batch->count++;
+        }
+    }
+}
+
+// 按区块顺序把一段解码出的交易计入工作区，累加顺序与逐块扫描相同
+void net_change_batch_merge(void* result, void* partial, void* ctx)
+{
+    (void)ctx;
+    NetChangeScratch* scratch = (NetChangeScratch*)result;
+    NetChangeBatch* batch = (NetChangeBatch*)partial;
+    for (int i = 0; i < batch->count; i++)
+    {
+        net_change_add(scratch, batch->from[i], -batch->amount[i]);
+        net_change_add(scratch, batch->to[i], batch->amount[i]);
+    }
+    free(batch->from);
+    free(batch->to);
+    free(batch->amount);
+}
+
+void net_change_init(void* partial, void* ctx)
+{
+    NetChangeRank* rank = (NetChangeRank*)partial;
+    rank->gain = topk_create(*(int*)ctx);
+    rank->loss = topk_create(*(int*)ctx);
+}
+
+// 在本次出现过的账户上选前k名
+void net_change_body(int begin, int end, void* partial, void* ctx)
+{
+    (void)ctx;
+    NetChangeRank* rank = (NetChangeRank*)partial;
+    NetChangeScratch* scratch = &net_change_scratch;
+    for (int i = begin; i < end; i++)
+    {
+        int uid = scratch->touched[i];
+        double delta = scratch->delta[uid];
+        if (delta > 0)
+        {
+            topk_push(rank->gain, uid, delta);
+        }
+        else if (delta < 0)
+        {
+            topk_push(rank->loss, uid, -delta);
+        }
+    }
+}
+
+void net_change_merge(void* result, void* partial, void* ctx)
+{
+    (void)ctx;
+    NetChangeRank* into = (NetChangeRank*)result;
+    NetChangeRank* from = (NetChangeRank*)partial;
+    topk_merge(into->gain, from->gain);
+    topk_merge(into->loss, from->loss);
+    topk_free(from->gain);
+    topk_free(from->loss);
+}
+
+/*
+ * 时间段内净收入增加 / 减少最多的前k个账户。按时间戳二分出区块范围，并行解码范围内各区块的交易段，
+ * 计入跨查询复用的工作区，再在出现过的账户上并行选前k名，耗时取决于时间段内的交易数而不是全部历史或账户数。
+ */
+void net_change_rank(HashTable* user_table, unsigned time_start, unsigned time_end, int k)
+{
+    if (time_start > time_end)
+    {
+        printf("起始时间必须小于终止时间\n");
+        return;
+    }
+    int block_begin = block_lower_bound(time_start);
+    int block_end = block_upper_bound(time_end);
+    char key[64];
+    sprintf(key, "net_change %d %d %d", block_begin, block_end, k);
+    if (query_cache_replay(key))
+    {
+        return;
+    }
+
+    NetChangeScratch* scratch = net_change_begin(user_table->user_count + 1);
+    segment_scan(block_begin, block_end, 2 * sizeof(int) + sizeof(double), sizeof(NetChangeBatch),
+    net_change_batch_init, net_change_batch_body, net_change_batch_merge, scratch, 0);
+
+    NetChangeRank rank;
+    net_change_init(&rank, &k);
+    parallel_reduce(0, scratch->count, default_grain(scratch->count), sizeof(NetChangeRank),
+    net_change_init, net_change_body, net_change_merge, &rank, &k);
+
+    query_print("区块数: %d\n", block_end > block_begin ? block_end - block_begin : 0);
+    query_print("有收支的账户数: %d\n", scratch->count);
+    query_print("净收入增加最多的前%d名\n", k);
+    for (int i = 0; i < rank.gain->count; i++)
+    {
+        query_print("增加 NO.%d: %s, +%.2lf\n", i + 1, user_table->users[rank.gain->uid[i]]->user_id, rank.gain->value[i]);
+    }
+    query_print("净收入减少最多的前%d名\n", k);
+    for (int i = 0; i < rank.loss->count; i++)
+    {
+        query_print("减少 NO.%d: %s, -%.2lf\n", i + 1, user_table->users[rank.loss->uid[i]]->user_id, rank.loss->value[i]);
+    }
+    topk_free(rank.gain);
+    topk_free(rank.loss);
+    query_cache_store(key, query_cache_horizon(block_end));
+}
+
+// 释放哈希表内存（含各用户的链表头和桶的哨兵）
+void free_hashTable(HashTable* HashTable)
+{
+    for (int i = 0; i < HashTable->size; i++)
+    {
+        user* temp_user = HashTable->table[i]->next_user;
+        while (temp_user != 0)
+        {
+            user* free_user = temp_user;
+            temp_user = temp_user->next_user;
+            free(free_user->in_list_head);
+            free(free_user->out_list_head);
+            free(free_user);
+        }
+        free(HashTable->table[i]);
+    }
+
+    free(HashTable->table);
+    free(HashTable->users);
+    free(HashTable);
+}
+
+// 检查交易网络是否有环，as_of不为UINT_MAX时只看该时刻之前的交易
+void check_ring(HashTable* user_table, unsigned as_of)
+{
+    RingSearch search;
+    search.compact = get_compact_adjacency(user_table);
+    search.block_limit = block_upper_bound(as_of);
+    search.mark = (int*)calloc(search.compact->vertex_count + 1, sizeof(int));
+    search.queue = (int*)malloc(sizeof(int) * (search.compact->vertex_count + 1));
+    search.stamp = 0;
+    int calc = 0;
+    int found = 0;
+
+    for (int i = 0; i < user_table->size && !found; i++)
+    {
+        if (user_table->table[i]->next_user == 0)
+        {
+            continue;
+        }
+        user* temp_user = user_table->table[i]->next_user;
+        while (temp_user != 0)
+        {
+            // 进入user的遍历层
+            if (temp_user->in_count != 0 && temp_user->out_count != 0)
+            {
+                if (check_ring_by_key(&search, search.compact->rank[temp_user->uid]) == 1)
+                {
+                    found = 1;
+                    break;
+                }
+            }
+            
+            calc++;
+            if (calc % 10000 == 0)
+            {
+                printf("unring-user: %d\n", calc);
+            }
+
+            temp_user = temp_user->next_user;
+        }
+    }
+    free(search.mark);
+    free(search.queue);
+    if (found)
+    {
+        printf("YES\n（交易网络中存在环）\n");
+    }
+    else
+    {
+        printf("NO\n（交易网络中不存在环）\n");
+    }
+}
+
+// 对于单个账户（新编号source）检查是否成环，只走区块序号小于block_limit的交易
+int check_ring_by_key(RingSearch* search, int source)
+{
+    CompactAdjacency* compact = search->compact;
+    int block_limit = search->block_limit;
+    int stamp = ++search->stamp;
+    int head = 0;
+    int tail = 0;
+    search->queue[tail++] = source;
+    search->mark[source] = stamp;
+
+    while (head < tail)
+    {
+        ArcCursor cursor;
+        arc_cursor_open(compact, search->queue[head++], &cursor);
+        while (arc_cursor_next(&cursor))
+        {
+            if (block_limit < block_index.count && compact->block[cursor.arc] >= block_limit)
+            {
+                continue;
+            }
+            int next = cursor.target;
+            if (next == source)
+            {
+                return 1;
+            }
+            // 没有出弧的账户不会回到起点，不入队
+            if (search->mark[next] != stamp && compact->arc_offset[next + 1] > compact->arc_offset[next])
+            {
+                search->mark[next] = stamp;
+                search->queue[tail++] = next;
+            }
+        }
+    }
+    return 0;
+}
+
+// 计算两个节点之间的最短路径，as_of含义同check_ring
+void shortest_path(HashTable* user_table, char* from, char* to, unsigned as_of)
+{
+    user* head_user = find_user(user_table, from);
+    user* target_user = find_user(user_table, to);
+    if (head_user == 0 || target_user == 0)
+    {
+        printf("账户不存在\n");
+        return;
+    }
+    int block_limit = block_upper_bound(as_of);
+    char key[64];
+    sprintf(key, "path %d %d %d", head_user->uid, target_user->uid, block_limit);
+    if (query_cache_replay(key))
+    {
+        return;
+    }
+
+    // 寻径函数：按新编号顺序反复松弛出弧，直到不再更新（顺序读出弧数组，相邻账户的状态也相邻）
+    CompactAdjacency* compact = get_compact_adjacency(user_table);
+    storage_advise(&compact->bytes_region, 1);
+    storage_advise(&compact->amount_region, 1);
+    int n = compact->vertex_count;
+    double* length = (double*)calloc(n + 1, sizeof(double));
+    signed char* state = (signed char*)calloc(n + 1, 1);
+    state[compact->rank[head_user->uid]] = -1;  // 首节点设置-1，已参加计算的节点是1，未参加是0
+    int update_calc = 1;
+    
+    while(update_calc)
+    {
+        update_calc = 0;
+
+        for (int v = 0; v < n; v++)
+        {
+            if (state[v] == 0)
+            {
+                continue;
+            }
+
+            ArcCursor cursor;
+            arc_cursor_open(compact, v, &cursor);
+            while (arc_cursor_next(&cursor))
+            {
+                if (block_limit < block_index.count && compact->block[cursor.arc] >= block_limit)
+                {
+                    continue;
+                }
+                int next = cursor.target;
+                double new_path_length = compact->amount[cursor.arc] + length[v];
+                if (state[next] == 0)
+                {
+                    length[next] = new_path_length;
+                    state[next] = 1;
+                    update_calc++;
+                }
+                else if (state[next] != -1 && length[next] > new_path_length)
+                {
+                    length[next] = new_path_length;
+                    update_calc++;
+                }
+            }
+        }
+
+        // printf("update: %d\n", update_calc);
+        storage_trim();
+    }
+
+    double path_length = length[compact->rank[target_user->uid]];
+    free(length);
+    free(state);
+    if (path_length != 0)
+    {
+        query_print("用户: %s\n到\n用户: %s\n最短路径为: %.2lf\n", from, to, path_length);
+    }
+    else
+    {
+        query_print("用户: %s\n到\n用户: %s\n不存在路径\n", from, to);
+    }
+    query_cache_store(key, query_cache_horizon(block_limit));
+}
+
+// 在哈希表中找到user，不存在时返回0
+user* find_user(HashTable* user_table, char* key)
+{
+    int index = hashFunction(key, user_table->size);
+    user* temp_user = user_table->table[index]->next_user;
+    while (temp_user != 0 && strcmp(temp_user->user_id, key) != 0)
+    {
+        temp_user = temp_user->next_user;
+    }
+    return temp_user;
+}
+
+void init_path_body(int begin, int end, void* ctx)
+{
+    HashTable* user_table = (HashTable*)ctx;
+    for (int uid = begin; uid < end; uid++)
+    {
+        user_table->users[uid]->sign = 0;
+        user_table->users[uid]->path_length = 0;
+    }
+}
+
+// 将哈希表中user的sign和path_length初始化为0
+void init_path(HashTable* user_table)
+{
+    parallel_for(0, user_table->user_count, default_grain(user_table->user_count), init_path_body, user_table);
+}
+
+// 用于构建CSR时对出弧排序
+typedef struct Arc
+{
+    int target;
+    double weight;
+} Arc;
+
+int compare_arc(const void* a, const void* b)
+{
+    int x = ((const Arc*)a)->target;
+    int y = ((const Arc*)b)->target;
+    return (x > y) - (x < y);
+}
+
+/*
+ * 由交易列按转出账户计数排序建成逐笔的出弧（账户内按交易插入顺序）。
+ * 读交易列是顺序的；外存模式下分段进行，段间让出映射页。
+ */
+TxAdjacency* get_tx_adjacency(HashTable* user_table)
+{
+    TxAdjacency* adjacency = &tx_adjacency;
+    if (adjacency->version == data_version && adjacency->vertex_count == user_table->user_count)
+    {
+        return adjacency;
+    }
+    int n = user_table->user_count;
+    int m = tx_columns.count;
+    adjacency->offset = (int*)realloc(adjacency->offset, sizeof(int) * (n + 1));
+    for (int u = 0; u <= n; u++)
+    {
+        adjacency->offset[u] = 0;
+    }
+    for (int u = 0; u < n; u++)
+    {
+        adjacency->offset[u + 1] = adjacency->offset[u] + user_table->users[u]->out_count;
+    }
+    adjacency->target = (int*)region_reserve(&adjacency->target_region, sizeof(int) * (m + 1));
+    adjacency->amount = (double*)region_reserve(&adjacency->amount_region, sizeof(double) * (m + 1));
+    adjacency->block = (int*)region_reserve(&adjacency->block_region, sizeof(int) * (m + 1));
+
+    int* cursor = (int*)malloc(sizeof(int) * (n + 1));
+    memcpy(cursor, adjacency->offset, sizeof(int) * (n + 1));
+    int window = storage_window(m, 2 * (sizeof(int) * 4 + sizeof(double) * 2));
+    for (int begin = 0; begin < m; begin += window)
+    {
+        int end = begin + window < m ? begin + window : m;
+        for (int row = begin; row < end; row++)
+        {
+            int position = cursor[tx_columns.from[row]]++;
+            adjacency->target[position] = tx_columns.to[row];
+            adjacency->amount[position] = tx_columns.amount[row];
+            adjacency->block[position] = tx_columns.block[row];
+        }
+        storage_trim();
+    }
+    free(cursor);
+
+    adjacency->vertex_count = n;
+    adjacency->edge_count = m;
+    adjacency->version = data_version;
+    return adjacency;
+}
+
+// 重新编号时按度数从大到小选BFS的起点
+typedef struct SeedOrder
+{
+    int degree;
+    int uid;
+} SeedOrder;
+
+int compare_seed_order(const void* a, const void* b)
+{
+    const SeedOrder* x = (const SeedOrder*)a;
+    const SeedOrder* y = (const SeedOrder*)b;
+    if (x->degree != y->degree)
+    {
+        return (x->degree < y->degree) - (x->degree > y->degree);
+    }
+    return (x->uid > y->uid) - (x->uid < y->uid);
+}
+
+// 账户内的出弧按终点新编号排序，同一终点的交易保持原来的先后
+typedef struct RankedArc
+{
+    int target;
+    int arc;
+} RankedArc;
+
+int compare_ranked_arc(const void* a, const void* b)
+{
+    const RankedArc* x = (const RankedArc*)a;
+    const RankedArc* y = (const RankedArc*)b;
+    if (x->target != y->target)
+    {
+        return (x->target > y->target) - (x->target < y->target);
+    }
+    return (x->arc > y->arc) - (x->arc < y->arc);
+}
+
+unsigned char* varint_put(unsigned char* p, unsigned value)
+{
+    while (value >= 0x80)
+    {
+        *p++ = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    *p++ = (unsigned char)value;
+    return p;
+}
+
+void arc_cursor_open(CompactAdjacency* compact, int v, ArcCursor* cursor)
+{
+    cursor->p = compact->bytes + compact->byte_offset[v];
+    cursor->arc = compact->arc_offset[v] - 1;
+    cursor->end = compact->arc_offset[v + 1];
+    cursor->target = 0;
+}
+
+// 解出下一条弧的终点，没有更多的弧时返回0
+int arc_cursor_next(ArcCursor* cursor)
+{
+    if (++cursor->arc >= cursor->end)
+    {
+        return 0;
+    }
+    unsigned delta = 0;
+    int shift = 0;
+    unsigned char byte;
+    do
+    {
+        byte = *cursor->p++;
+        delta |= (unsigned)(byte & 0x7F) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    cursor->target += delta;
+    return 1;
+}
+
+/*
+ * 由交易列直接建成按局部性重新编号、终点差分压缩的出弧（见CompactAdjacency），数据变化后在下一次遍历时重建。
+ * 建表时按转出账户计数排序的行号只是临时数组，不经过逐笔出弧表，每条弧只存这一份。
+ */
+CompactAdjacency* get_compact_adjacency(HashTable* user_table)
+{
+    CompactAdjacency* compact = &compact_adjacency;
+    if (compact->version == data_version && compact->vertex_count == user_table->user_count)
+    {
+        return compact;
+    }
+    int n = user_table->user_count;
+    int m = tx_columns.count;
+    int* row_offset = (int*)malloc(sizeof(int) * (n + 1));
+    row_offset[0] = 0;
+    for (int u = 0; u < n; u++)
+    {
+        row_offset[u + 1] = row_offset[u] + user_table->users[u]->out_count;
+    }
+    int* rows = (int*)malloc(sizeof(int) * (m + 1));
+    int* cursor = (int*)malloc(sizeof(int) * (n + 1));
+    memcpy(cursor, row_offset, sizeof(int) * (n + 1));
+    int window = storage_window(m, 2 * sizeof(int));
+    for (int begin = 0; begin < m; begin += window)
+    {
+        int end = begin + window < m ? begin + window : m;
+        for (int row = begin; row < end; row++)
+        {
+            rows[cursor[tx_columns.from[row]]++] = row;
+        }
+        storage_trim();
+    }
+    free(cursor);
+
+    // BFS编号：起点按出入度之和从大到小，沿出弧扩展
+    SeedOrder* seeds = (SeedOrder*)malloc(sizeof(SeedOrder) * (n + 1));
+    for (int uid = 0; uid < n; uid++)
+    {
+        seeds[uid].degree = user_table->users[uid]->in_count + user_table->users[uid]->out_count;
+        seeds[uid].uid = uid;
+    }
+    qsort(seeds, n, sizeof(SeedOrder), compare_seed_order);
+    compact->order = (int*)realloc(compact->order, sizeof(int) * (n + 1));
+    compact->rank = (int*)realloc(compact->rank, sizeof(int) * (n + 1));
+    for (int uid = 0; uid < n; uid++)
+    {
+        compact->rank[uid] = -1;
+    }
+    int numbered = 0;
+    for (int i = 0; i < n; i++)
+    {
+        if (compact->rank[seeds[i].uid] != -1)
+        {
+            continue;
+        }
+        int head = numbered;
+        compact->rank[seeds[i].uid] = numbered;
+        compact->order[numbered++] = seeds[i].uid;
+        while (head < numbered)
+        {
+            int u = compact->order[head++];
+            for (int e = row_offset[u]; e < row_offset[u + 1]; e++)
+            {
+                int w = tx_columns.to[rows[e]];
+                if (compact->rank[w] == -1)
+                {
+                    compact->rank[w] = numbered;
+                    compact->order[numbered++] = w;
+                }
+            }
+        }
+        storage_trim();
+    }
+    free(seeds);
+
+    // 按新编号逐个账户排序出弧并编码，终点最多5字节
+    int max_degree = 0;
+    for (int u = 0; u < n; u++)
+    {
+        if (row_offset[u + 1] - row_offset[u] > max_degree)
+        {
+            max_degree = row_offset[u + 1] - row_offset[u];
+        }
+    }
+    RankedArc* arcs = (RankedArc*)malloc(sizeof(RankedArc) * (max_degree + 1));
+    unsigned char* encoded = (unsigned char*)malloc(5L * m + 1);
+    compact->arc_offset = (int*)realloc(compact->arc_offset, sizeof(int) * (n + 1));
+    compact->byte_offset = (long*)realloc(compact->byte_offset, sizeof(long) * (n + 1));
+    compact->amount = (double*)region_reserve(&compact->amount_region, sizeof(double) * (m + 1));
+    compact->block = (int*)region_reserve(&compact->block_region, sizeof(int) * (m + 1));
+    unsigned char* p = encoded;
+    int arc = 0;
+    for (int v = 0; v < n; v++)
+    {
+        int u = compact->order[v];
+        int degree = row_offset[u + 1] - row_offset[u];
+        for (int i = 0; i < degree; i++)
+        {
+            arcs[i].arc = rows[row_offset[u] + i];
+            arcs[i].target = compact->rank[tx_columns.to[arcs[i].arc]];
+        }
+        qsort(arcs, degree, sizeof(RankedArc), compare_ranked_arc);
+        compact->arc_offset[v] = arc;
+        compact->byte_offset[v] = p - encoded;
+        int previous = 0;
+        for (int i = 0; i < degree; i++)
+        {
+            p = varint_put(p, (unsigned)(arcs[i].target - previous));
+            previous = arcs[i].target;
+            compact->amount[arc] = tx_columns.amount[arcs[i].arc];
+            compact->block[arc] = tx_columns.block[arcs[i].arc];
+            arc++;
+        }
+        if (v % 65536 == 65535)
+        {
+            storage_trim();
+        }
+    }
+    compact->arc_offset[n] = arc;
+    compact->byte_offset[n] = p - encoded;
+    compact->byte_count = p - encoded;
+    compact->bytes = (unsigned char*)region_reserve(&compact->bytes_region, compact->byte_count + 1);
+    memcpy(compact->bytes, encoded, compact->byte_count);
+    free(encoded);
+    free(arcs);
+    free(rows);
+    free(row_offset);
+
+    compact->vertex_count = n;
+    compact->edge_count = m;
+    compact->version = data_version;
+    return compact;
+}
+
+int compare_seconds(const void* a, const void* b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * 邻接表基准：分别建逐笔出弧表（按uid编号）和压缩出弧（按BFS重新编号），各做rounds轮覆盖全图的BFS
+ * （未访问的账户依次作为新起点），输出建表时间、每条弧的字节数和每轮遍历的最短 / 中位用时。
+ */
+void adjacency_benchmark(HashTable* user_table, int rounds)
+{
+    pthread_rwlock_rdlock(&data_lock);
+    double begin = now_seconds();
+    TxAdjacency* adjacency = get_tx_adjacency(user_table);
+    double tx_build = now_seconds() - begin;
+    begin = now_seconds();
+    CompactAdjacency* compact = get_compact_adjacency(user_table);
+    double compact_build = now_seconds() - begin;
+    int n = adjacency->vertex_count;
+    long m = adjacency->edge_count > 0 ? adjacency->edge_count : 1;
+
+    int* mark = (int*)calloc(n + 1, sizeof(int));
+    int* queue = (int*)malloc(sizeof(int) * (n + 1));
+    double* times[2];
+    times[0] = (double*)malloc(sizeof(double) * rounds);
+    times[1] = (double*)malloc(sizeof(double) * rounds);
+    long visited_arcs[2] = {0, 0};
+    for (int round = 0; round < rounds; round++)
+    {
+        for (int kind = 0; kind < 2; kind++)
+        {
+            int stamp = 2 * round + kind + 1;
+            long arcs = 0;
+            begin = now_seconds();
+            for (int start = 0; start < n; start++)
+            {
+                if (mark[start] == stamp)
+                {
+                    continue;
+                }
+                int head = 0, tail = 0;
+                mark[start] = stamp;
+                queue[tail++] = start;
+                while (head < tail)
+                {
+                    int v = queue[head++];
+                    if (kind == 0)
+                    {
+                        for (int e = adjacency->offset[v]; e < adjacency->offset[v + 1]; e++)
+                        {
+                            int w = adjacency->target[e];
+                            arcs++;
+                            if (mark[w] != stamp)
+                            {
+                                mark[w] = stamp;
+                                queue[tail++] = w;
+                            }
+                        }
+                    }
+                    else
+                    {
+                        ArcCursor cursor;
+                        arc_cursor_open(compact, v, &cursor);
+                        while (arc_cursor_next(&cursor))
+                        {
+                            arcs++;
+                            if (mark[cursor.target] != stamp)
+                            {
+                                mark[cursor.target] = stamp;
+                                queue[tail++] = cursor.target;
+                            }
+                        }
+                    }
+                }
+            }
+            times[kind][round] = now_seconds() - begin;
+            visited_arcs[kind] = arcs;
+        }
+    }
+    pthread_rwlock_unlock(&data_lock);
+
+    printf("邻接表基准: %d 个账户，%ld 条弧，%d 轮全图BFS\n", n, m, rounds);
+    char* names[2] = {"逐笔出弧表（uid编号）", "压缩出弧（BFS重新编号）"};
+    double builds[2] = {tx_build, compact_build};
+    double bytes[2] = {(double)(2 * sizeof(int) + sizeof(double)), (double)compact->byte_count / m + sizeof(int) + sizeof(double)};
+    for (int kind = 0; kind < 2; kind++)
+    {
+        qsort(times[kind], rounds, sizeof(double), compare_seconds);
+        printf("%s: 建表 %.3f 秒，%.2f 字节/弧，遍历 %ld 条弧，最短 %.3f 毫秒，中位 %.3f 毫秒\n", names[kind], builds[kind], bytes[kind],
+        visited_arcs[kind], times[kind][0] * 1000, times[kind][rounds / 2] * 1000);
+    }
+    free(times[0]);
+    free(times[1]);
+    free(mark);
+    free(queue);
+}
+
+// 由逐笔出弧构建压缩邻接表，同一终点的多笔交易合并为一条弧
+Graph* build_graph(HashTable* user_table)
+{
+    TxAdjacency* adjacency = get_tx_adjacency(user_table);
+    int n = adjacency->vertex_count;
+    Graph* graph = (Graph*)malloc(sizeof(Graph));
+    memset(graph, 0, sizeof(Graph));
+    graph->vertex_count = n;
+    graph->offset = (int*)malloc(sizeof(int) * (n + 1));
+
+    int total = adjacency->edge_count;
+    int max_degree = 0;
+    for (int u = 0; u < n; u++)
+    {
+        if (adjacency->offset[u + 1] - adjacency->offset[u] > max_degree)
+        {
+            max_degree = adjacency->offset[u + 1] - adjacency->offset[u];
+        }
+    }
+    graph->target = (int*)region_reserve(&graph->target_region, sizeof(int) * (total + 1));
+    graph->weight = (double*)region_reserve(&graph->weight_region, sizeof(double) * (total + 1));
+    Arc* arcs = (Arc*)malloc(sizeof(Arc) * (max_degree + 1));
+
+    storage_advise(&adjacency->target_region, 1);
+    storage_advise(&adjacency->amount_region, 1);
+    int edge_count = 0;
+    for (int u = 0; u < n; u++)
+    {
+        graph->offset[u] = edge_count;
+        int degree = 0;
+        for (int e = adjacency->offset[u]; e < adjacency->offset[u + 1]; e++)
+        {
+            arcs[degree].target = adjacency->target[e];
+            arcs[degree].weight = adjacency->amount[e];
+            degree++;
+        }
+        qsort(arcs, degree, sizeof(Arc), compare_arc);
+        for (int i = 0; i < degree; i++)
+        {
+            if (edge_count > graph->offset[u] && graph->target[edge_count - 1] == arcs[i].target)
+            {
+                graph->weight[edge_count - 1] += arcs[i].weight;
+            }
+            else
+            {
+                graph->target[edge_count] = arcs[i].target;
+                graph->weight[edge_count] = arcs[i].weight;
+                edge_count++;
+            }
+        }
+        if ((u & 0xFFFF) == 0xFFFF)
+        {
+            storage_trim();
+        }
+    }
+    graph->offset[n] = edge_count;
+    graph->edge_count = edge_count;
+    free(arcs);
+
+    return graph;
+}
+
+void free_graph(Graph* graph)
+{
+    free(graph->offset);
+    region_unregister(&graph->target_region);
+    region_unregister(&graph->weight_region);
+    region_free(&graph->target_region);
+    region_free(&graph->weight_region);
+    free(graph);
+}
+
+// 取主交易网络的压缩邻接表，数据变化后重建，过期的转置同时释放，不等下一次邻域 / 可达性查询
+Graph* get_user_graph(HashTable* user_table)
+{
+    if (user_graph == 0 || user_graph_version != data_version)
+    {
+        if (user_graph != 0)
+        {
+            free_graph(user_graph);
+        }
+        if (reverse_graph != 0)
+        {
+            free_graph(reverse_graph);
+            reverse_graph = 0;
+        }
+        user_graph = build_graph(user_table);
+        user_graph_version = data_version;
+    }
+    return user_graph;
+}
+
+// 非递归Tarjan算法求强连通分量，返回每个账户所在分量的编号
+int* strongly_connected_components(Graph* graph, int* component_count)
+{
+    int n = graph->vertex_count;
+    int* component = (int*)malloc(sizeof(int) * n);
+    int* index = (int*)malloc(sizeof(int) * n);
+    int* low = (int*)malloc(sizeof(int) * n);
+    int* stack = (int*)malloc(sizeof(int) * n);
+    int* call_vertex = (int*)malloc(sizeof(int) * n);
+    int* call_edge = (int*)malloc(sizeof(int) * n);
+    char* on_stack = (char*)calloc(n, 1);
+    int next_index = 0, stack_top = 0, count = 0;
+
+    for (int i = 0; i < n; i++)
+    {
+        index[i] = -1;
+    }
+
+    for (int root = 0; root < n; root++)
+    {
+        if (index[root] != -1)
+        {
+            continue;
+        }
+        int depth = 0;
+        call_vertex[0] = root;
+        call_edge[0] = graph->offset[root];
+        index[root] = low[root] = next_index++;
+        stack[stack_top++] = root;
+        on_stack[root] = 1;
+
+        while (depth >= 0)
+        {
+            int v = call_vertex[depth];
+            if (call_edge[depth] < graph->offset[v + 1])
+            {
+                int w = graph->target[call_edge[depth]++];
+                if (index[w] == -1)
+                {
+                    // 下探一层
+                    depth++;
+                    call_vertex[depth] = w;
+                    call_edge[depth] = graph->offset[w];
+                    index[w] = low[w] = next_index++;
+                    stack[stack_top++] = w;
+                    on_stack[w] = 1;
+                }
+                else if (on_stack[w] && index[w] < low[v])
+                {
+                    low[v] = index[w];
+                }
+                continue;
+            }
+
+            // v的出弧已遍历完，回溯
+            if (low[v] == index[v])
+            {
+                int w;
+                do
+                {
+                    w = stack[--stack_top];
+                    on_stack[w] = 0;
+                    component[w] = count;
+                } while (w != v);
+                count++;
+            }
+            depth--;
+            if (depth >= 0 && low[v] < low[call_vertex[depth]])
+            {
+                low[call_vertex[depth]] = low[v];
+            }
+        }
+    }
+
+    free(index);
+    free(low);
+    free(stack);
+    free(call_vertex);
+    free(call_edge);
+    free(on_stack);
+    *component_count = count;
+    return component;
+}
+
+// 一个强连通分量的局部子图，顶点按账户编号升序重新编号
+typedef struct Component
+{
+    int size;
+    int* members;     // 局部编号 -> 账户编号
+    int* offset;
+    int* target;      // 局部编号
+    double* weight;
+    int* rev_offset;  // 逆邻接，用于求到起点的距离
+    int* rev_target;
+} Component;
+
+// 枚举任务的共享参数
+typedef struct CycleJob
+{
+    CycleQuery* query;
+    Component** components;
+    int* local_index;   // 账户编号 -> 所在分量内的局部编号
+} CycleJob;
+
+// 每块分量的枚举结果
+typedef struct CycleWorker
+{
+    CycleQuery* query;
+    Cycle** top;        // 全图模式下按总金额降序保留的前N个环
+    int top_count;
+    long steps;
+} CycleWorker;
+
+Component* build_component(Graph* graph, int* component, int* local_index, int* members, int size)
+{
+    Component* comp = (Component*)malloc(sizeof(Component));
+    comp->size = size;
+    comp->members = members;
+    comp->offset = (int*)malloc(sizeof(int) * (size + 1));
+    comp->rev_offset = (int*)calloc(size + 1, sizeof(int));
+
+    int c = component[members[0]];
+    int edge_count = 0;
+    for (int i = 0; i < size; i++)
+    {
+        int u = members[i];
+        for (int e = graph->offset[u]; e < graph->offset[u + 1]; e++)
+        {
+            if (component[graph->target[e]] == c)
+            {
+                edge_count++;
+            }
+        }
+    }
+    comp->target = (int*)malloc(sizeof(int) * (edge_count + 1));
+    comp->weight = (double*)malloc(sizeof(double) * (edge_count + 1));
+    comp->rev_target = (int*)malloc(sizeof(int) * (edge_count + 1));
+
+    edge_count = 0;
+    for (int i = 0; i < size; i++)
+    {
+        int u = members[i];
+        comp->offset[i] = edge_count;
+        for (int e = graph->offset[u]; e < graph->offset[u + 1]; e++)
+        {
+            int w = graph->target[e];
+            if (component[w] == c)
+            {
+                comp->target[edge_count] = local_index[w];
+                comp->weight[edge_count] = graph->weight[e];
+                comp->rev_offset[local_index[w] + 1]++;
+                edge_count++;
+            }
+        }
+    }
+    comp->offset[size] = edge_count;
+
+    for (int i = 0; i < size; i++)
+    {
+        comp->rev_offset[i + 1] += comp->rev_offset[i];
+    }
+    int* fill = (int*)malloc(sizeof(int) * size);
+    memcpy(fill, comp->rev_offset, sizeof(int) * size);
+    for (int i = 0; i < size; i++)
+    {
+        for (int e = comp->offset[i]; e < comp->offset[i + 1]; e++)
+        {
+            comp->rev_target[fill[comp->target[e]]++] = i;
+        }
+    }
+    free(fill);
+
+    return comp;
+}
+
+void free_component(Component* comp)
+{
+    free(comp->members);
+    free(comp->offset);
+    free(comp->target);
+    free(comp->weight);
+    free(comp->rev_offset);
+    free(comp->rev_target);
+    free(comp);
+}
+
+// 环的比较：总金额降序，其次按长度、账户编号序列，保证多线程下结果确定
+int compare_cycle(const void* a, const void* b)
+{
+    const Cycle* x = *(const Cycle**)a;
+    const Cycle* y = *(const Cycle**)b;
+    if (x->total != y->total)
+    {
+        return x->total < y->total ? 1 : -1;
+    }
+    if (x->length != y->length)
+    {
+        return x->length - y->length;
+    }
+    for (int i = 0; i < x->length; i++)
+    {
+        if (x->nodes[i] != y->nodes[i])
+        {
+            return x->nodes[i] - y->nodes[i];
+        }
+    }
+    return 0;
+}
+
+void free_cycle(Cycle* cycle)
+{
+    free(cycle->nodes);
+    free(cycle->amounts);
+    free(cycle);
+}
+
+void print_cycle(HashTable* user_table, Cycle* cycle, int number)
+{
+    printf("环 #%d（长度 %d，总金额 %.2lf）:\n", number, cycle->length, cycle->total);
+    for (int i = 0; i < cycle->length; i++)
+    {
+        int to = cycle->nodes[(i + 1) % cycle->length];
+        printf("  %s -> %s: %.2lf\n", user_table->users[cycle->nodes[i]]->user_id,
+        user_table->users[to]->user_id, cycle->amounts[i]);
+    }
+}
+
+// 插入有序的前N名
+void cycle_top_push(CycleWorker* worker, Cycle* cycle)
+{
+    if (worker->top_count == worker->query->top_n)
+    {
+        if (compare_cycle(&cycle, &worker->top[worker->top_count - 1]) >= 0)
+        {
+            free_cycle(cycle);
+            return;
+        }
+        free_cycle(worker->top[--worker->top_count]);
+    }
+    int i = worker->top_count++;
+    while (i > 0 && compare_cycle(&cycle, &worker->top[i - 1]) < 0)
+    {
+        worker->top[i] = worker->top[i - 1];
+        i--;
+    }
+    worker->top[i] = cycle;
+}
+
+// 记入steps步工作量后是否应停止：别的线程已置停止标志，或工作量每跨过4096步时已过截止时间
+int cycle_should_stop(CycleWorker* worker, int steps)
+{
+    CycleQuery* query = worker->query;
+    if (__atomic_load_n(&query->stop, __ATOMIC_RELAXED))
+    {
+        return 1;
+    }
+    long before = worker->steps;
+    worker->steps += steps;
+    if ((before >> 12) != (worker->steps >> 12) && now_seconds() > query->deadline)
+    {
+        __atomic_store_n(&query->stop, 1, __ATOMIC_RELAXED);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * 记录一个找到的环：单账户模式直接输出，达到环数上限后停止；全图模式放入线程自己的前N名。
+ * 全图模式不按环数停止，否则前N名只在先找到的环中选出，上限生效时结果随线程调度变化。
+ */
+void emit_cycle(CycleWorker* worker, Component* comp, int* path, double* amounts, int length)
+{
+    CycleQuery* query = worker->query;
+    int number = __sync_add_and_fetch(&query->found, 1);
+    if (query->top_n == 0 && number > query->max_count)
+    {
+        __atomic_store_n(&query->stop, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    Cycle* cycle = (Cycle*)malloc(sizeof(Cycle));
+    cycle->length = length;
+    cycle->total = 0;
+    cycle->nodes = (int*)malloc(sizeof(int) * length);
+    cycle->amounts = (double*)malloc(sizeof(double) * length);
+    for (int i = 0; i < length; i++)
+    {
+        cycle->nodes[i] = comp->members[path[i]];
+        cycle->amounts[i] = amounts[i];
+        cycle->total += amounts[i];
+    }
+
+    if (query->top_n == 0)
+    {
+        pthread_mutex_lock(&query->lock);
+        print_cycle(query->user_table, cycle, number);
+        pthread_mutex_unlock(&query->lock);
+        free_cycle(cycle);
+        return;
+    }
+
+    cycle_top_push(worker, cycle);
+}
+
+/*
+ * 在分量comp内枚举经过start、长度不超过L的简单环。
+ * 全图模式下只允许经过局部编号大于start的顶点（Johnson算法的起点顺序），每个环恰好在其最小顶点处被找到一次；
+ * 另外先在逆邻接上做BFS求各顶点回到start的距离，路径长度加上该距离超过L时剪枝。
+ */
+void enumerate_from(CycleWorker* worker, Component* comp, int start, int min_vertex,
+    int* dist, char* on_path, int* queue, int* path, int* cursor, double* amounts)
+{
+    CycleQuery* query = worker->query;
+    int L = query->max_length;
+
+    // 到start的距离。全图模式下每个起点都要重置整个分量，大分量上这一步也计入工作量并检查截止时间
+    for (int i = 0; i < comp->size; i++)
+    {
+        dist[i] = -1;
+        if ((i & 4095) == 4095 && cycle_should_stop(worker, 4096))
+        {
+            return;
+        }
+    }
+    int head = 0, tail = 0;
+    dist[start] = 0;
+    queue[tail++] = start;
+    while (head < tail)
+    {
+        if ((head & 4095) == 4095 && cycle_should_stop(worker, 4096))
+        {
+            return;
+        }
+        int v = queue[head++];
+        if (dist[v] >= L)
+        {
+            continue;
+        }
+        for (int e = comp->rev_offset[v]; e < comp->rev_offset[v + 1]; e++)
+        {
+            int w = comp->rev_target[e];
+            if (w >= min_vertex && dist[w] == -1)
+            {
+                dist[w] = dist[v] + 1;
+                queue[tail++] = w;
+            }
+        }
+    }
+
+    int depth = 0;
+    path[0] = start;
+    cursor[0] = comp->offset[start];
+    on_path[start] = 1;
+    while (depth >= 0)
+    {
+        if (cycle_should_stop(worker, 1))
+        {
+            break;
+        }
+
+        int v = path[depth];
+        if (cursor[depth] == comp->offset[v + 1])
+        {
+            on_path[v] = 0;
+            depth--;
+            continue;
+        }
+        int e = cursor[depth]++;
+        int w = comp->target[e];
+        if (w == start)
+        {
+            amounts[depth] = comp->weight[e];
+            emit_cycle(worker, comp, path, amounts, depth + 1);
+            continue;
+        }
+        if (w < min_vertex || on_path[w] || dist[w] == -1 || depth + 1 + dist[w] > L)
+        {
+            continue;
+        }
+        amounts[depth] = comp->weight[e];
+        depth++;
+        path[depth] = w;
+        cursor[depth] = comp->offset[w];
+        on_path[w] = 1;
+    }
+    for (int i = 0; i <= depth; i++)
+    {
+        on_path[path[i]] = 0;
+    }
+}
+
+void cycle_worker_init(void* partial, void* ctx)
+{
+    CycleWorker* worker = (CycleWorker*)partial;
+    worker->query = ((CycleJob*)ctx)->query;
+    worker->top = (Cycle**)malloc(sizeof(Cycle*) * (worker->query->top_n + 1));
+    worker->top_count = 0;
+    worker->steps = 0;
+}
+
+// 枚举一段分量，分量内逐个起点
+void cycle_worker_body(int begin, int end, void* partial, void* ctx)
+{
+    CycleWorker* worker = (CycleWorker*)partial;
+    CycleJob* job = (CycleJob*)ctx;
+    CycleQuery* query = worker->query;
+    int L = query->max_length;
+    double* amounts = (double*)malloc(sizeof(double) * (L + 1));
+    int* path = (int*)malloc(sizeof(int) * (L + 1));
+    int* cursor = (int*)malloc(sizeof(int) * (L + 1));
+
+    for (int c = begin; c < end && !__atomic_load_n(&query->stop, __ATOMIC_RELAXED); c++)
+    {
+        Component* comp = job->components[c];
+        int* dist = (int*)malloc(sizeof(int) * comp->size);
+        int* queue = (int*)malloc(sizeof(int) * comp->size);
+        char* on_path = (char*)calloc(comp->size, 1);
+
+        if (query->start >= 0)
+        {
+            int start = job->local_index[query->start];
+            enumerate_from(worker, comp, start, 0, dist, on_path, queue, path, cursor, amounts);
+        }
+        else
+        {
+            for (int s = 0; s < comp->size && !__atomic_load_n(&query->stop, __ATOMIC_RELAXED); s++)
+            {
+                enumerate_from(worker, comp, s, s, dist, on_path, queue, path, cursor, amounts);
+            }
+        }
+        free(dist);
+        free(queue);
+        free(on_path);
+    }
+
+    free(path);
+    free(cursor);
+    free(amounts);
+}
+
+void cycle_worker_merge(void* result, void* partial, void* ctx)
+{
+    (void)ctx;
+    CycleWorker* into = (CycleWorker*)result;
+    CycleWorker* from = (CycleWorker*)partial;
+    for (int i = 0; i < from->top_count; i++)
+    {
+        cycle_top_push(into, from->top[i]);
+    }
+    free(from->top);
+}
+
+int compare_component_size(const void* a, const void* b)
+{
+    const Component* x = *(const Component**)a;
+    const Component* y = *(const Component**)b;
+    if (x->size != y->size)
+    {
+        return y->size - x->size;
+    }
+    return x->members[0] - y->members[0];
+}
+
+/*
+ * 列出长度不超过max_length的环：account非0时流式输出经过该账户的环，最多max_count个；
+ * 否则输出全图总金额最大的前top_n个，此时不用max_count。
+ */
+void list_cycles(HashTable* user_table, char* account, int max_length, int max_count, int top_n, double time_limit)
+{
+    if (max_length < 1 || (account != 0 && max_count < 1))
+    {
+        printf("L和枚举上限必须大于0\n");
+        return;
+    }
+    user* start_user = 0;
+    if (account != 0)
+    {
+        start_user = find_user(user_table, account);
+        if (start_user == 0)
+        {
+            printf("账户不存在\n");
+            return;
+        }
+    }
+    else if (top_n < 1)
+    {
+        printf("N必须大于0\n");
+        return;
+    }
+
+    Graph* graph = get_user_graph(user_table);
+    int n = graph->vertex_count;
+    int component_count;
+    int* component = strongly_connected_components(graph, &component_count);
+
+    // 统计各分量大小，自环的单点分量也算非平凡
+    int* component_size = (int*)calloc(component_count, sizeof(int));
+    char* self_loop = (char*)calloc(component_count, 1);
+    for (int u = 0; u < n; u++)
+    {
+        component_size[component[u]]++;
+        for (int e = graph->offset[u]; e < graph->offset[u + 1]; e++)
+        {
+            if (graph->target[e] == u)
+            {
+                self_loop[component[u]] = 1;
+            }
+        }
+    }
+
+    // 收集非平凡分量的成员（按账户编号升序）
+    int** members = (int**)calloc(component_count, sizeof(int*));
+    int* filled = (int*)calloc(component_count, sizeof(int));
+    int* local_index = (int*)malloc(sizeof(int) * n);
+    int selected = start_user != 0 ? component[start_user->uid] : -1;
+    for (int u = 0; u < n; u++)
+    {
+        int c = component[u];
+        if ((component_size[c] < 2 && !self_loop[c]) || (selected >= 0 && c != selected))
+        {
+            continue;
+        }
+        if (members[c] == 0)
+        {
+            members[c] = (int*)malloc(sizeof(int) * component_size[c]);
+        }
+        local_index[u] = filled[c];
+        members[c][filled[c]++] = u;
+    }
+
+    Component** components = (Component**)malloc(sizeof(Component*) * (component_count + 1));
+    int component_total = 0;
+    int largest = 0;
+    for (int c = 0; c < component_count; c++)
+    {
+        if (members[c] != 0)
+        {
+            components[component_total++] = build_component(graph, component, local_index, members[c], component_size[c]);
+            if (component_size[c] > largest)
+            {
+                largest = component_size[c];
+            }
+        }
+    }
+    qsort(components, component_total, sizeof(Component*), compare_component_size);
+    printf("非平凡强连通分量: %d 个，最大分量 %d 个账户\n", component_total, largest);
+
+    CycleQuery query;
+    query.graph = graph;
+    query.user_table = user_table;
+    query.start = start_user != 0 ? start_user->uid : -1;
+    query.max_length = max_length;
+    query.max_count = max_count;
+    query.top_n = start_user != 0 ? 0 : top_n;
+    query.deadline = now_seconds() + time_limit;
+    query.found = 0;
+    query.stop = 0;
+    pthread_mutex_init(&query.lock, 0);
+
+    // 每个分量一块并行枚举，大分量排在前面先被领取
+    CycleJob job = {&query, components, local_index};
+    CycleWorker result;
+    cycle_worker_init(&result, &job);
+    parallel_reduce(0, component_total, 1, sizeof(CycleWorker),
+    cycle_worker_init, cycle_worker_body, cycle_worker_merge, &result, &job);
+
+    if (query.top_n > 0)
+    {
+        printf("总金额最大的%d个环:\n", query.top_n);
+        for (int i = 0; i < result.top_count; i++)
+        {
+            print_cycle(user_table, result.top[i], i + 1);
+            free_cycle(result.top[i]);
+        }
+    }
+    free(result.top);
+
+    int found = query.top_n > 0 || query.found < query.max_count ? query.found : query.max_count;
+    printf("共枚举到 %d 个环\n", found);
+    if (query.stop && query.top_n > 0)
+    {
+        printf("已达到时间上限，前%d个环只在已枚举的环中选出，结果不完整\n", query.top_n);
+    }
+    else if (query.stop)
+    {
+        printf("已达到环数或时间上限，结果不完整\n");
+    }
+    else if (found == 0)
+    {
+        printf("不存在长度不超过%d的环\n", max_length);
+    }
+
+    for (int c = 0; c < component_total; c++)
+    {
+        free_component(components[c]);
+    }
+    free(components);
+    free(members);
+    free(filled);
+    free(local_index);
+    free(component_size);
+    free(self_loop);
+    free(component);
+    pthread_mutex_destroy(&query.lock);
+}
+
+// 由user_graph建出拉取式邻接表：按终点计数排序，入弧保持转出方编号递增
+PullGraph* get_pull_graph(HashTable* user_table)
+{
+    Graph* graph = get_user_graph(user_table);
+    PullGraph* pull = &pull_graph;
+    if (pull->version == user_graph_version && pull->vertex_count == graph->vertex_count)
+    {
+        return pull;
+    }
+    int n = graph->vertex_count;
+    int m = graph->offset[n];
+    pull->offset = (int*)realloc(pull->offset, sizeof(int) * (n + 1));
+    pull->dangling = (char*)realloc(pull->dangling, n + 1);
+    pull->source = (int*)region_reserve(&pull->source_region, sizeof(int) * (m + 1));
+    pull->share = (double*)region_reserve(&pull->share_region, sizeof(double) * (m + 1));
+    memset(pull->offset, 0, sizeof(int) * (n + 1));
+    for (int e = 0; e < m; e++)
+    {
+        pull->offset[graph->target[e] + 1]++;
+    }
+    for (int v = 0; v < n; v++)
+    {
+        pull->offset[v + 1] += pull->offset[v];
+    }
+
+    int* cursor = (int*)malloc(sizeof(int) * (n + 1));
+    memcpy(cursor, pull->offset, sizeof(int) * (n + 1));
+    for (int u = 0; u < n; u++)
+    {
+        double total = 0;
+        for (int e = graph->offset[u]; e < graph->offset[u + 1]; e++)
+        {
+            total += graph->weight[e];
+        }
+        pull->dangling[u] = total <= 0;
+        for (int e = graph->offset[u]; e < graph->offset[u + 1]; e++)
+        {
+            int position = cursor[graph->target[e]]++;
+            pull->source[position] = u;
+            pull->share[position] = total > 0 ? graph->weight[e] / total : 0;
+        }
+        if ((u & 0xFFFF) == 0xFFFF)
+        {
+            storage_trim();
+        }
+    }
+    free(cursor);
+    pull->vertex_count = n;
+    pull->version = user_graph_version;
+    return pull;
+}
+
+// 一轮PageRank迭代的参数和部分结果
+typedef struct PagerankStep
+{
+    PullGraph* pull;
+    double* rank;
+    double* next;
+    double base;      // 每个账户得到的随机跳转和悬挂分值
+    double damping;
+} PagerankStep;
+
+typedef struct PagerankPartial
+{
+    double change;    // 新旧分值差的绝对值之和
+    double dangling;  // 新分值中悬挂账户的总和，用于下一轮
+} PagerankPartial;
+
+void pagerank_init(void* partial, void* ctx)
+{
+    (void)ctx;
+    memset(partial, 0, sizeof(PagerankPartial));
+}
+
+// 稀疏矩阵乘向量：每个账户从入弧拉取分值，只写自己的next
+void pagerank_body(int begin, int end, void* partial, void* ctx)
+{
+    PagerankStep* step = (PagerankStep*)ctx;
+    PagerankPartial* result = (PagerankPartial*)partial;
+    PullGraph* pull = step->pull;
+    for (int v = begin; v < end; v++)
+    {
+        double sum = 0;
+        for (int e = pull->offset[v]; e < pull->offset[v + 1]; e++)
+        {
+            sum += pull->share[e] * step->rank[pull->source[e]];
+        }
+        double value = step->base + step->damping * sum;
+        step->next[v] = value;
+        result->change += fabs(value - step->rank[v]);
+        if (pull->dangling[v])
+        {
+            result->dangling += value;
+        }
+    }
+}
+
+void pagerank_merge(void* result, void* partial, void* ctx)
+{
+    (void)ctx;
+    PagerankPartial* into = (PagerankPartial*)result;
+    PagerankPartial* from = (PagerankPartial*)partial;
+    into->change += from->change;
+    into->dangling += from->dangling;
+}
+
+// 输出分值最高的前k个账户
+void print_top_scores(HashTable* user_table, double* score, int n, int k, char* title)
+{
+    TopK* top = topk_create(k);
+    for (int v = 0; v < n; v++)
+    {
+        topk_push(top, v, score[v]);
+    }
+    printf("%s排行前%d名\n", title, k);
+    for (int i = 0; i < top->count; i++)
+    {
+        printf("%s NO.%d: %s, %.6lf\n", title, i + 1, user_table->users[top->uid[i]]->user_id, top->value[i]);
+    }
+    topk_free(top);
+}
+
+/*
+ * 按转账金额加权的PageRank：账户把分值按各条转出弧的金额比例分给对手，没有转出的账户均摊给所有账户。
+ * 分值总和为1，各轮新旧分值差的总和小于tolerance或达到max_iterations时停止。
+ */
+void pagerank(HashTable* user_table, int k, double damping, double tolerance, int max_iterations)
+{
+    PullGraph* pull = get_pull_graph(user_table);
+    int n = pull->vertex_count;
+    if (n == 0)
+    {
+        printf("交易网络为空\n");
+        return;
+    }
+    PagerankStep step;
+    step.pull = pull;
+    step.damping = damping;
+    step.rank = (double*)malloc(sizeof(double) * n);
+    step.next = (double*)malloc(sizeof(double) * n);
+    double dangling = 0;
+    for (int v = 0; v < n; v++)
+    {
+        step.rank[v] = 1.0 / n;
+        dangling += pull->dangling[v] ? step.rank[v] : 0;
+    }
+
+    double begin = now_seconds();
+    int iterations = 0;
+    PagerankPartial result = {0, 0};
+    do
+    {
+        step.base = (1 - damping) / n + damping * dangling / n;
+        pagerank_init(&result, 0);
+        parallel_reduce(0, n, default_grain(n), sizeof(PagerankPartial),
+        pagerank_init, pagerank_body, pagerank_merge, &result, &step);
+        double* temp = step.rank;
+        step.rank = step.next;
+        step.next = temp;
+        dangling = result.dangling;
+        iterations++;
+        storage_trim();
+    } while (result.change > tolerance && iterations < max_iterations);
+    double elapsed = now_seconds() - begin;
+
+    printf("%d 个账户，%d 条弧，迭代 %d 轮（最后一轮变化 %.3e），平均每轮 %.3f 毫秒\n",
+    n, pull->offset[n], iterations, result.change, elapsed * 1000 / iterations);
+    print_top_scores(user_table, step.rank, n, k, "PageRank");
+    free(step.rank);
+    free(step.next);
+}
+
+// 采样源点的Brandes算法，每个分块的线程有自己的BFS数组和中心性累计
+typedef struct BetweennessContext
+{
+    Graph* graph;
+    int* sources;
+} BetweennessContext;
+
+typedef struct BetweennessPartial
+{
+    double* centrality;
+    int* distance;
+    double* sigma;    // 源点到各账户的最短路径条数
+    double* delta;    // 各账户对源点的依赖
+    int* order;       // BFS访问顺序，兼作队列
+} BetweennessPartial;
+
+void betweenness_init(void* partial, void* ctx)
+{
+    int n = ((BetweennessContext*)ctx)->graph->vertex_count;
+    BetweennessPartial* state = (BetweennessPartial*)malloc(sizeof(BetweennessPartial));
+    state->centrality = (double*)calloc(n + 1, sizeof(double));
+    state->distance = (int*)malloc(sizeof(int) * (n + 1));
+    state->sigma = (double*)calloc(n + 1, sizeof(double));
+    state->delta = (double*)calloc(n + 1, sizeof(double));
+    state->order = (int*)malloc(sizeof(int) * (n + 1));
+    for (int v = 0; v < n; v++)
+    {
+        state->distance[v] = -1;
+    }
+    *(BetweennessPartial**)partial = state;
+}
+
+void betweenness_body(int begin, int end, void* partial, void* ctx)
+{
+    BetweennessContext* context = (BetweennessContext*)ctx;
+    BetweennessPartial* state = *(BetweennessPartial**)partial;
+    Graph* graph = context->graph;
+    for (int i = begin; i < end; i++)
+    {
+        int source = context->sources[i];
+        int head = 0, tail = 0;
+        state->order[tail++] = source;
+        state->distance[source] = 0;
+        state->sigma[source] = 1;
+        while (head < tail)
+        {
+            int v = state->order[head++];
+            for (int e = graph->offset[v]; e < graph->offset[v + 1]; e++)
+            {
+                int w = graph->target[e];
+                if (state->distance[w] < 0)
+                {
+                    state->distance[w] = state->distance[v] + 1;
+                    state->order[tail++] = w;
+                }
+                if (state->distance[w] == state->distance[v] + 1)
+                {
+                    state->sigma[w] += state->sigma[v];
+                }
+            }
+        }
+
+        // 按BFS的逆序回传依赖，只访问本轮到达的账户，顺便复位
+        for (int j = tail - 1; j >= 0; j--)
+        {
+            int v = state->order[j];
+            for (int e = graph->offset[v]; e < graph->offset[v + 1]; e++)
+            {
+                int w = graph->target[e];
+                if (state->distance[w] == state->distance[v] + 1)
+                {
+                    state->delta[v] += state->sigma[v] / state->sigma[w] * (1 + state->delta[w]);
+                }
+            }
+            if (v != source)
+            {
+                state->centrality[v] += state->delta[v];
+            }
+        }
+        for (int j = 0; j < tail; j++)
+        {
+            int v = state->order[j];
+            state->distance[v] = -1;
+            state->sigma[v] = 0;
+            state->delta[v] = 0;
+        }
+    }
+}
+
+void betweenness_merge(void* result, void* partial, void* ctx)
+{
+    int n = ((BetweennessContext*)ctx)->graph->vertex_count;
+    BetweennessPartial* into = *(BetweennessPartial**)result;
+    BetweennessPartial* from = *(BetweennessPartial**)partial;
+    for (int v = 0; v < n; v++)
+    {
+        into->centrality[v] += from->centrality[v];
+    }
+    free(from->centrality);
+    free(from->distance);
+    free(from->sigma);
+    free(from->delta);
+    free(from->order);
+    free(from);
+}
+
+/*
+ * 近似介数中心性（按跳数计最短路径）：从有转出的账户中固定种子抽samples个源点，
+ * 各源点的依赖之和乘以 有转出的账户数 / samples 作为估计；samples不少于这些账户时即为精确值。
+ */
+void betweenness(HashTable* user_table, int k, int samples)
+{
+    Graph* graph = get_user_graph(user_table);
+    int n = graph->vertex_count;
+    int* candidates = (int*)malloc(sizeof(int) * (n + 1));
+    int candidate_count = 0;
+    for (int v = 0; v < n; v++)
+    {
+        if (graph->offset[v + 1] > graph->offset[v])
+        {
+            candidates[candidate_count++] = v;
+        }
+    }
+    if (samples > candidate_count)
+    {
+        samples = candidate_count;
+    }
+    if (samples <= 0)
+    {
+        printf("交易网络中没有可作为源点的账户\n");
+        free(candidates);
+        return;
+    }
+    // 部分Fisher-Yates洗牌，种子固定，结果可复现
+    unsigned long long seed = 88172645463325252ULL;
+    for (int i = 0; i < samples; i++)
+    {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        int j = i + (int)(seed % (unsigned long long)(candidate_count - i));
+        int temp = candidates[i];
+        candidates[i] = candidates[j];
+        candidates[j] = temp;
+    }
+
+    double begin = now_seconds();
+    BetweennessContext context = {graph, candidates};
+    BetweennessPartial* result;
+    betweenness_init(&result, &context);
+    int threads = runtime_threads();
+    parallel_reduce(0, samples, (samples + threads - 1) / threads, sizeof(BetweennessPartial*),
+    betweenness_init, betweenness_body, betweenness_merge, &result, &context);
+    double scale = (double)candidate_count / samples;
+    for (int v = 0; v < n; v++)
+    {
+        result->centrality[v] *= scale;
+    }
+    printf("%d 个账户，%d 条弧，采样 %d / %d 个源点，用时 %.3f 秒\n", n, graph->offset[n], samples, candidate_count, now_seconds() - begin);
+    print_top_scores(user_table, result->centrality, n, k, "介数中心性");
+
+    free(candidates);
+    free(result->centrality);
+    free(result->distance);
+    free(result->sigma);
+    free(result->delta);
+    free(result->order);
+    free(result);
+}
+
+// 登记前n个账户，新账户各自成为一个分量
+void component_reserve(int n)
+{
+    ComponentForest* forest = &component_forest;
+    if (n > forest->capacity)
+    {
+        int capacity = forest->capacity == 0 ? 1024 : forest->capacity;
+        while (capacity < n)
+        {
+            capacity *= 2;
+        }
+        forest->parent = (int*)realloc(forest->parent, sizeof(int) * capacity);
+        forest->size = (int*)realloc(forest->size, sizeof(int) * capacity);
+        forest->capacity = capacity;
+    }
+    for (int v = forest->vertex_count; v < n; v++)
+    {
+        forest->parent[v] = v;
+        forest->size[v] = 1;
+        forest->component_count++;
+    }
+    if (n > forest->vertex_count)
+    {
+        forest->vertex_count = n;
+    }
+}
+
+// 查找分量的根，沿途把父节点改成祖父节点（折半压缩），CAS失败说明别的线程已经改过，不影响正确性
+int component_find(int v)
+{
+    int* parent = component_forest.parent;
+    while (1)
+    {
+        int p = parent[v];
+        if (p == v)
+        {
+            return v;
+        }
+        int grand = parent[p];
+        if (grand != p)
+        {
+            __sync_bool_compare_and_swap(&parent[v], p, grand);
+        }
+        v = grand;
+    }
+}
+
+/*
+ * 合并两个账户所在的分量，小分量的根挂到大分量的根下面（一样大时挂到编号小的根下），树高不超过log n。
+ * 查找只会改非根节点的父指针，根的父指针只有这里会改，CAS总能成功，失败时重新查找只是保险。返回是否发生了合并
+ */
+int component_union(int a, int b)
+{
+    int* parent = component_forest.parent;
+    int* size = component_forest.size;
+    while (1)
+    {
+        a = component_find(a);
+        b = component_find(b);
+        if (a == b)
+        {
+            return 0;
+        }
+        if (size[a] > size[b] || (size[a] == size[b] && a < b))
+        {
+            int temp = a;
+            a = b;
+            b = temp;
+        }
+        if (__sync_bool_compare_and_swap(&parent[a], a, b))
+        {
+            size[b] += size[a];
+            __sync_sub_and_fetch(&component_forest.component_count, 1);
+            return 1;
+        }
+    }
+}
+
+// 并行统计各分量的大小，size按根的编号计数
+void component_size_body(int begin, int end, void* ctx)
+{
+    int* size = (int*)ctx;
+    for (int v = begin; v < end; v++)
+    {
+        __sync_fetch_and_add(&size[component_find(v)], 1);
+    }
+}
+
+// 弱连通分量概况：分量数、最大的k个分量、按大小分档（1, 2~3, 4~7, ...）的分布
+void component_summary(HashTable* user_table, int k)
+{
+    int n = component_forest.vertex_count;
+    if (n == 0)
+    {
+        printf("交易网络为空\n");
+        return;
+    }
+    int* size = (int*)calloc(n, sizeof(int));
+    parallel_for(0, n, default_grain(n), component_size_body, size);
+
+    TopK* top = topk_create(k);
+    int buckets[32] = {0};
+    long accounts[32] = {0};
+    for (int v = 0; v < n; v++)
+    {
+        if (size[v] == 0)
+        {
+            continue;
+        }
+        topk_push(top, v, size[v]);
+        int bucket = 0;
+        while ((2 << bucket) <= size[v])
+        {
+            bucket++;
+        }
+        buckets[bucket]++;
+        accounts[bucket] += size[v];
+    }
+
+    printf("%d 个账户，%d 个弱连通分量\n", n, component_forest.component_count);
+    printf("最大的%d个分量\n", top->count);
+    for (int i = 0; i < top->count; i++)
+    {
+        printf("分量 NO.%d: 编号 %d（%s），%d 个账户，占 %.2lf%%\n", i + 1, top->uid[i],
+        user_table->users[top->uid[i]]->user_id, (int)top->value[i], top->value[i] * 100 / n);
+    }
+    printf("分量大小分布\n");
+    for (int bucket = 0; bucket < 32; bucket++)
+    {
+        if (buckets[bucket] > 0)
+        {
+            printf("  %d ~ %d: %d 个分量，%ld 个账户\n", 1 << bucket, (2 << bucket) - 1, buckets[bucket], accounts[bucket]);
+        }
+    }
+    topk_free(top);
+    free(size);
+}
+
+// 判断两个账户是否在同一个弱连通分量，分量编号为根账户的uid
+void same_component(HashTable* user_table, char* a, char* b)
+{
+    user* user_a = find_user(user_table, a);
+    user* user_b = find_user(user_table, b);
+    if (user_a == 0 || user_b == 0)
+    {
+        printf("账户不存在\n");
+        return;
+    }
+    int root_a = component_find(user_a->uid);
+    int root_b = component_find(user_b->uid);
+    printf("%s 所在分量: %d\n", a, root_a);
+    printf("%s 所在分量: %d\n", b, root_b);
+    printf(root_a == root_b ? "两个账户在同一个弱连通分量\n" : "两个账户不在同一个弱连通分量\n");
+}
+
+// 两个递增的账户列表求交集，把a中公共元素的位置写入common，返回个数
+int intersect_scalar(int* a, int na, int* b, int nb, int* common)
+{
+    int i = 0, j = 0, count = 0;
+    while (i < na && j < nb)
+    {
+        if (a[i] < b[j])
+        {
+            i++;
+        }
+        else if (a[i] > b[j])
+        {
+            j++;
+        }
+        else
+        {
+            common[count++] = i;
+            i++;
+            j++;
+        }
+    }
+    return count;
+}
+
+#ifdef HAVE_X86_SIMD
+// SSE2版本：a和b各取4个，b轮转3次和a逐位比较，块尾较小的一侧前进4个，剩下的部分交给标量版本
+__attribute__((target("sse2")))
+int intersect_sse2(int* a, int na, int* b, int nb, int* common)
+{
+    int i = 0, j = 0, count = 0;
+    while (i + 4 <= na && j + 4 <= nb)
+    {
+        __m128i va = _mm_loadu_si128((__m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((__m128i*)(b + j));
+        __m128i match = _mm_cmpeq_epi32(va, vb);
+        match = _mm_or_si128(match, _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1))));
+        match = _mm_or_si128(match, _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(1, 0, 3, 2))));
+        match = _mm_or_si128(match, _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(2, 1, 0, 3))));
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(match));
+        while (mask)
+        {
+            common[count++] = i + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+        int a_last = a[i + 3], b_last = b[j + 3];
+        if (a_last <= b_last)
+        {
+            i += 4;
+        }
+        if (b_last <= a_last)
+        {
+            j += 4;
+        }
+    }
+    int tail = intersect_scalar(a + i, na - i, b + j, nb - j, common + count);
+    for (int t = count; t < count + tail; t++)
+    {
+        common[t] += i;
+    }
+    return count + tail;
+}
+#endif
+
+// 运行时根据CPU选择的求交集内核
+int (*intersect_kernel)(int* a, int na, int* b, int nb, int* common) = intersect_scalar;
+
+void select_intersect_kernel()
+{
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+    {
+        intersect_kernel = intersect_sse2;
+    }
+#endif
+}
+
+// 在from的出弧中二分查找to，返回弧的编号，不存在时返回-1
+int find_arc(Graph* graph, int from, int to)
+{
+    int low = graph->offset[from], high = graph->offset[from + 1];
+    while (low < high)
+    {
+        int middle = (low + high) / 2;
+        if (graph->target[middle] < to)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low < graph->offset[from + 1] && graph->target[low] == to ? low : -1;
+}
+
+// 弧编号所属的转出账户
+int arc_source(Graph* graph, int e)
+{
+    int low = 0, high = graph->vertex_count - 1;
+    while (low < high)
+    {
+        int middle = (low + high + 1) / 2;
+        if (graph->offset[middle] <= e)
+        {
+            low = middle;
+        }
+        else
+        {
+            high = middle - 1;
+        }
+    }
+    return low;
+}
+
+// 剥离链的中间账户：只有一个转入方和一个转出对象（不是自己），两条弧的金额都不低于阈值
+int is_relay(MotifQuery* query, int v)
+{
+    Graph* graph = query->graph;
+    PullGraph* pull = query->pull;
+    if (graph->offset[v + 1] - graph->offset[v] != 1 || pull->offset[v + 1] - pull->offset[v] != 1)
+    {
+        return 0;
+    }
+    int before = pull->source[pull->offset[v]];
+    int e = graph->offset[v];
+    if (before == v || graph->target[e] == v || graph->weight[e] < query->min_amount)
+    {
+        return 0;
+    }
+    return graph->weight[find_arc(graph, before, v)] >= query->min_amount;
+}
+
+// 剥离链首：中间账户，且它的转入方不是中间账户
+int is_chain_head(MotifQuery* query, int v)
+{
+    return is_relay(query, v) && !is_relay(query, query->pull->source[query->pull->offset[v]]);
+}
+
+// 从链首向后数中间账户的个数，链的跳数为它加1。全是中间账户的环没有链首，不会走到这里
+int chain_relays(MotifQuery* query, int head)
+{
+    int relays = 0;
+    int v = head;
+    while (is_relay(query, v) && relays < query->graph->vertex_count)
+    {
+        relays++;
+        v = query->graph->target[query->graph->offset[v]];
+    }
+    return relays;
+}
+
+// 只从v收过款的账户（新开出来接收资金的账户）中，v转出金额不低于阈值的个数
+int fresh_fan_out(MotifQuery* query, int v)
+{
+    Graph* graph = query->graph;
+    PullGraph* pull = query->pull;
+    int count = 0;
+    for (int e = graph->offset[v]; e < graph->offset[v + 1]; e++)
+    {
+        int w = graph->target[e];
+        if (w != v && pull->offset[w + 1] - pull->offset[w] == 1 && graph->weight[e] >= query->min_amount)
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+// 转入金额不低于阈值的转入方个数
+int heavy_fan_in(MotifQuery* query, int v)
+{
+    Graph* graph = query->graph;
+    PullGraph* pull = query->pull;
+    int count = 0;
+    for (int e = pull->offset[v]; e < pull->offset[v + 1]; e++)
+    {
+        int u = pull->source[e];
+        if (u != v && graph->weight[find_arc(graph, u, v)] >= query->min_amount)
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+// 账户u的往返对手：出弧目标和入弧来源求交集，两个方向金额都不低于阈值。返回个数，common中是出弧编号
+int round_trip_partners(MotifQuery* query, int u, int* common)
+{
+    Graph* graph = query->graph;
+    PullGraph* pull = query->pull;
+    int begin = graph->offset[u];
+    int found = intersect_kernel(graph->target + begin, graph->offset[u + 1] - begin,
+    pull->source + pull->offset[u], pull->offset[u + 1] - pull->offset[u], common);
+    int count = 0;
+    for (int i = 0; i < found; i++)
+    {
+        int e = begin + common[i];
+        int v = graph->target[e];
+        if (v != u && graph->weight[e] >= query->min_amount && graph->weight[find_arc(graph, v, u)] >= query->min_amount)
+        {
+            common[count++] = e;
+        }
+    }
+    return count;
+}
+
+void motif_init(void* partial, void* ctx)
+{
+    MotifQuery* query = (MotifQuery*)ctx;
+    MotifPartial* state = (MotifPartial*)partial;
+    memset(state, 0, sizeof(MotifPartial));
+    state->round_trip_top = topk_create(query->k);
+    state->fan_out_top = topk_create(query->k);
+    state->fan_in_top = topk_create(query->k);
+    state->chain_top = topk_create(query->k);
+    state->common = (int*)malloc(sizeof(int) * (query->max_degree + 1));
+}
+
+void motif_body(int begin, int end, void* partial, void* ctx)
+{
+    MotifQuery* query = (MotifQuery*)ctx;
+    MotifPartial* state = (MotifPartial*)partial;
+    Graph* graph = query->graph;
+    for (int u = begin; u < end; u++)
+    {
+        // 每对往返只在编号小的一方计一次，排行按较小一侧的金额
+        int count = round_trip_partners(query, u, state->common);
+        for (int i = 0; i < count; i++)
+        {
+            int e = state->common[i];
+            int v = graph->target[e];
+            if (u < v)
+            {
+                double back = graph->weight[find_arc(graph, v, u)];
+                state->round_trips++;
+                topk_push(state->round_trip_top, e, graph->weight[e] < back ? graph->weight[e] : back);
+            }
+        }
+
+        int fan_out = fresh_fan_out(query, u);
+        if (fan_out >= query->min_degree)
+        {
+            state->fan_out++;
+            topk_push(state->fan_out_top, u, fan_out);
+        }
+        int fan_in = heavy_fan_in(query, u);
+        if (fan_in >= query->min_degree)
+        {
+            state->fan_in++;
+            topk_push(state->fan_in_top, u, fan_in);
+        }
+        if (is_chain_head(query, u))
+        {
+            int hops = chain_relays(query, u) + 1;
+            if (hops >= query->min_chain)
+            {
+                state->chains++;
+                topk_push(state->chain_top, u, hops);
+            }
+        }
+    }
+}
+
+void motif_free(MotifPartial* state)
+{
+    topk_free(state->round_trip_top);
+    topk_free(state->fan_out_top);
+    topk_free(state->fan_in_top);
+    topk_free(state->chain_top);
+    free(state->common);
+}
+
+void motif_merge(void* result, void* partial, void* ctx)
+{
+    (void)ctx;
+    MotifPartial* into = (MotifPartial*)result;
+    MotifPartial* from = (MotifPartial*)partial;
+    into->round_trips += from->round_trips;
+    into->fan_out += from->fan_out;
+    into->fan_in += from->fan_in;
+    into->chains += from->chains;
+    topk_merge(into->round_trip_top, from->round_trip_top);
+    topk_merge(into->fan_out_top, from->fan_out_top);
+    topk_merge(into->fan_in_top, from->fan_in_top);
+    topk_merge(into->chain_top, from->chain_top);
+    motif_free(from);
+}
+
+// 输出一条往返交易
+void print_round_trip(HashTable* user_table, Graph* graph, int e, int number)
+{
+    int u = arc_source(graph, e);
+    int v = graph->target[e];
+    printf("  NO.%d: %s <-> %s, 转出 %.2lf, 转回 %.2lf\n", number, user_table->users[u]->user_id,
+    user_table->users[v]->user_id, graph->weight[e], graph->weight[find_arc(graph, v, u)]);
+}
+
+// 输出一条剥离链：链首的转入方、各中间账户和最后的转出对象，超过8跳时中间省略
+void print_chain(HashTable* user_table, MotifQuery* query, int head, int number)
+{
+    Graph* graph = query->graph;
+    int hops = chain_relays(query, head) + 1;
+    int previous = query->pull->source[query->pull->offset[head]];
+    printf("  NO.%d: %d 跳, %s", number, hops, user_table->users[previous]->user_id);
+    int v = head;
+    for (int step = 1; step <= hops; step++)
+    {
+        // 中间账户只有一条出弧，第一跳要在链首转入方的出弧里查找
+        double amount = step == 1 ? graph->weight[find_arc(graph, previous, head)] : graph->weight[graph->offset[previous]];
+        if (hops <= 8 || step <= 3 || step > hops - 3)
+        {
+            printf(" -(%.2lf)-> %s", amount, user_table->users[v]->user_id);
+        }
+        else if (step == 4)
+        {
+            printf(" -> ...");
+        }
+        previous = v;
+        if (step < hops)
+        {
+            v = graph->target[graph->offset[v]];
+        }
+    }
+    printf("\n");
+}
+
+// 单个账户周围的模式：往返对手、扇出 / 扇入、所在的或由它发起的剥离链
+void account_motifs(HashTable* user_table, MotifQuery* query, int u)
+{
+    Graph* graph = query->graph;
+    int* common = (int*)malloc(sizeof(int) * (query->max_degree + 1));
+    int count = round_trip_partners(query, u, common);
+    printf("往返交易对手 %d 个\n", count);
+    for (int i = 0; i < count && i < query->k; i++)
+    {
+        print_round_trip(user_table, graph, common[i], i + 1);
+    }
+    free(common);
+
+    int fan_out = fresh_fan_out(query, u);
+    int fan_in = heavy_fan_in(query, u);
+    printf("扇出: 向 %d 个只从它收款的账户转账%s\n", fan_out, fan_out >= query->min_degree ? "（达到阈值）" : "");
+    printf("扇入: %d 个账户向它转账%s\n", fan_in, fan_in >= query->min_degree ? "（达到阈值）" : "");
+
+    int chains = 0;
+    if (is_relay(query, u))
+    {
+        // 向前找到链首，遇到全是中间账户的环时停下
+        int head = u, steps = 0;
+        while (!is_chain_head(query, head) && steps++ < graph->vertex_count)
+        {
+            head = query->pull->source[query->pull->offset[head]];
+        }
+        if (is_chain_head(query, head))
+        {
+            printf("所在的剥离链\n");
+            print_chain(user_table, query, head, ++chains);
+        }
+    }
+    else
+    {
+        for (int e = graph->offset[u]; e < graph->offset[u + 1] && chains < query->k; e++)
+        {
+            int head = graph->target[e];
+            if (is_chain_head(query, head) && chain_relays(query, head) + 1 >= query->min_chain)
+            {
+                if (chains == 0)
+                {
+                    printf("由它发起的剥离链\n");
+                }
+                print_chain(user_table, query, head, ++chains);
+            }
+        }
+    }
+    if (chains == 0)
+    {
+        printf("没有经过它的剥离链\n");
+    }
+}
+
+/*
+ * 交易模式检测：A->B->A往返交易、向多个新账户扇出、多个账户扇入、一进一出的剥离链。
+ * account为0时按账户并行扫描全图，输出各类模式的个数和前k个；否则只看这个账户周围。
+ */
+void motif_analysis(HashTable* user_table, char* account, double min_amount, int min_degree, int min_chain, int k)
+{
+    MotifQuery query;
+    query.graph = get_user_graph(user_table);
+    query.pull = get_pull_graph(user_table);
+    query.min_amount = min_amount;
+    query.min_degree = min_degree;
+    query.min_chain = min_chain;
+    query.k = k;
+    query.max_degree = 0;
+    Graph* graph = query.graph;
+    int n = graph->vertex_count;
+    for (int u = 0; u < n; u++)
+    {
+        if (graph->offset[u + 1] - graph->offset[u] > query.max_degree)
+        {
+            query.max_degree = graph->offset[u + 1] - graph->offset[u];
+        }
+    }
+
+    if (account != 0)
+    {
+        user* target = find_user(user_table, account);
+        if (target == 0 || target->uid >= n)
+        {
+            printf("账户不存在\n");
+            return;
+        }
+        account_motifs(user_table, &query, target->uid);
+        return;
+    }
+
+    MotifPartial result;
+    motif_init(&result, &query);
+    parallel_reduce(0, n, default_grain(n), sizeof(MotifPartial), motif_init, motif_body, motif_merge, &result, &query);
+
+    printf("往返交易（双向金额都不低于 %.2lf）: %ld 对，按较小一侧金额排前%d\n", min_amount, result.round_trips, result.round_trip_top->count);
+    for (int i = 0; i < result.round_trip_top->count; i++)
+    {
+        print_round_trip(user_table, graph, result.round_trip_top->uid[i], i + 1);
+    }
+    printf("扇出（向至少 %d 个只从它收款的账户转账）: %d 个账户\n", min_degree, result.fan_out);
+    for (int i = 0; i < result.fan_out_top->count; i++)
+    {
+        printf("  NO.%d: %s, %d 个\n", i + 1, user_table->users[result.fan_out_top->uid[i]]->user_id, (int)result.fan_out_top->value[i]);
+    }
+    printf("扇入（至少 %d 个账户转入）: %d 个账户\n", min_degree, result.fan_in);
+    for (int i = 0; i < result.fan_in_top->count; i++)
+    {
+        printf("  NO.%d: %s, %d 个\n", i + 1, user_table->users[result.fan_in_top->uid[i]]->user_id, (int)result.fan_in_top->value[i]);
+    }
+    printf("剥离链（至少 %d 跳）: %d 条\n", min_chain, result.chains);
+    for (int i = 0; i < result.chain_top->count; i++)
+    {
+        print_chain(user_table, &query, result.chain_top->uid[i], i + 1);
+    }
+    motif_free(&result);
+}
+
+// user_graph的转置：账户v的入弧为 [offset[v], offset[v + 1])，target为转出方，权值为累计转账金额
+Graph* get_reverse_graph(HashTable* user_table)
+{
+    Graph* graph = get_user_graph(user_table);
+    if (reverse_graph != 0 && reverse_graph_version == user_graph_version)
+    {
+        return reverse_graph;
+    }
+    if (reverse_graph != 0)
+    {
+        free_graph(reverse_graph);
+    }
+    int n = graph->vertex_count;
+    int m = graph->edge_count;
+    Graph* reverse = (Graph*)malloc(sizeof(Graph));
+    memset(reverse, 0, sizeof(Graph));
+    reverse->vertex_count = n;
+    reverse->edge_count = m;
+    reverse->offset = (int*)calloc(n + 1, sizeof(int));
+    reverse->target = (int*)region_reserve(&reverse->target_region, sizeof(int) * (m + 1));
+    reverse->weight = (double*)region_reserve(&reverse->weight_region, sizeof(double) * (m + 1));
+    for (int e = 0; e < m; e++)
+    {
+        reverse->offset[graph->target[e] + 1]++;
+    }
+    for (int v = 0; v < n; v++)
+    {
+        reverse->offset[v + 1] += reverse->offset[v];
+    }
+
+    int* cursor = (int*)malloc(sizeof(int) * (n + 1));
+    memcpy(cursor, reverse->offset, sizeof(int) * (n + 1));
+    for (int u = 0; u < n; u++)
+    {
+        for (int e = graph->offset[u]; e < graph->offset[u + 1]; e++)
+        {
+            int position = cursor[graph->target[e]]++;
+            reverse->target[position] = u;
+            reverse->weight[position] = graph->weight[e];
+        }
+        if ((u & 0xFFFF) == 0xFFFF)
+        {
+            storage_trim();
+        }
+    }
+    free(cursor);
+    reverse_graph = reverse;
+    reverse_graph_version = user_graph_version;
+    return reverse;
+}
+
+int hop_degree(HopSearch* search, int v)
+{
+    int degree = 0;
+    for (int g = 0; g < search->graph_count; g++)
+    {
+        degree += search->forward[g]->offset[v + 1] - search->forward[g]->offset[v];
+    }
+    return degree;
+}
+
+// 按方向准备遍历用的弧和位图
+void hop_search_init(HopSearch* search, HashTable* user_table, int direction, int limit)
+{
+    memset(search, 0, sizeof(HopSearch));
+    Graph* out = get_user_graph(user_table);
+    Graph* in = get_reverse_graph(user_table);
+    if (direction != HOP_IN)
+    {
+        search->forward[search->graph_count] = out;
+        search->backward[search->graph_count] = in;
+        search->graph_count++;
+    }
+    if (direction != HOP_OUT)
+    {
+        search->forward[search->graph_count] = in;
+        search->backward[search->graph_count] = out;
+        search->graph_count++;
+    }
+    int n = out->vertex_count;
+    search->vertex_count = n;
+    search->words = (n + 63) / 64;
+    search->visited = (unsigned long long*)calloc(search->words + 1, sizeof(unsigned long long));
+    search->frontier = (unsigned long long*)calloc(search->words + 1, sizeof(unsigned long long));
+    search->next = (unsigned long long*)calloc(search->words + 1, sizeof(unsigned long long));
+    search->parent = (int*)malloc(sizeof(int) * (n + 1));
+    search->depth = (int*)malloc(sizeof(int) * (n + 1));
+    search->reached = (int*)malloc(sizeof(int) * (n + 1));
+    search->limit = limit < n ? limit : n;
+}
+
+void hop_search_free(HopSearch* search)
+{
+    free(search->visited);
+    free(search->frontier);
+    free(search->next);
+    free(search->parent);
+    free(search->depth);
+    free(search->reached);
+}
+
+// 自顶向下扩展一层，达到limit时停止
+void hop_top_down(HopSearch* search)
+{
+    int begin = search->reached_count - search->frontier_count;
+    int end = search->reached_count;
+    for (int i = begin; i < end && !search->truncated; i++)
+    {
+        int u = search->reached[i];
+        for (int g = 0; g < search->graph_count; g++)
+        {
+            Graph* graph = search->forward[g];
+            for (int e = graph->offset[u]; e < graph->offset[u + 1]; e++)
+            {
+                int v = graph->target[e];
+                unsigned long long bit = 1ULL << (v & 63);
+                if (search->visited[v >> 6] & bit)
+                {
+                    continue;
+                }
+                if (search->reached_count == search->limit)
+                {
+                    search->truncated = 1;
+                    return;
+                }
+                search->visited[v >> 6] |= bit;
+                search->next[v >> 6] |= bit;
+                search->parent[v] = u;
+                search->depth[v] = search->level;
+                search->reached[search->reached_count++] = v;
+            }
+        }
+    }
+}
+
+// 自底向上处理位图的字 [begin, end)：字内每个未访问的账户找一个在边界中的前驱
+void hop_bottom_up_range(int begin, int end, void* ctx)
+{
+    HopSearch* search = (HopSearch*)ctx;
+    for (int w = begin; w < end; w++)
+    {
+        unsigned long long unvisited = ~search->visited[w];
+        if (w == search->words - 1 && (search->vertex_count & 63) != 0)
+        {
+            unvisited &= (1ULL << (search->vertex_count & 63)) - 1;
+        }
+        while (unvisited != 0)
+        {
+            int v = w * 64 + __builtin_ctzll(unvisited);
+            unvisited &= unvisited - 1;
+            int found = -1;
+            for (int g = 0; g < search->graph_count && found < 0; g++)
+            {
+                Graph* graph = search->backward[g];
+                for (int e = graph->offset[v]; e < graph->offset[v + 1]; e++)
+                {
+                    int u = graph->target[e];
+                    if (search->frontier[u >> 6] & (1ULL << (u & 63)))
+                    {
+                        found = u;
+                        break;
+                    }
+                }
+            }
+            if (found >= 0)
+            {
+                search->next[w] |= 1ULL << (v & 63);
+                search->parent[v] = found;
+                search->depth[v] = search->level;
+            }
+        }
+    }
+}
+
+// 自底向上扩展一层，再按编号顺序把新访问的账户排进reached，超出limit的部分撤销
+void hop_bottom_up(HopSearch* search)
+{
+    parallel_for(0, search->words, default_grain(search->words), hop_bottom_up_range, search);
+    for (int w = 0; w < search->words; w++)
+    {
+        unsigned long long bits = search->next[w];
+        while (bits != 0)
+        {
+            unsigned long long bit = bits & -bits;
+            bits &= bits - 1;
+            if (search->reached_count == search->limit)
+            {
+                search->next[w] &= ~bit;
+                search->truncated = 1;
+                continue;
+            }
+            search->reached[search->reached_count++] = w * 64 + __builtin_ctzll(bit);
+        }
+        search->visited[w] |= search->next[w];
+    }
+}
+
+// 从source出发遍历至多max_depth层，target不为-1时访问到target即停
+void hop_search_run(HopSearch* search, int source, int max_depth, int target)
+{
+    int n = search->vertex_count;
+    long total_edges = 0;
+    for (int g = 0; g < search->graph_count; g++)
+    {
+        total_edges += search->forward[g]->edge_count;
+    }
+    search->visited[source >> 6] |= 1ULL << (source & 63);
+    search->frontier[source >> 6] |= 1ULL << (source & 63);
+    search->parent[source] = source;
+    search->depth[source] = 0;
+    search->reached[0] = source;
+    search->reached_count = 1;
+    search->frontier_count = 1;
+    long frontier_edges = hop_degree(search, source);
+    long explored_edges = frontier_edges;
+    int bottom_up = 0;
+
+    for (search->level = 1; search->level <= max_depth && search->frontier_count > 0 && !search->truncated; search->level++)
+    {
+        if (target >= 0 && (search->visited[target >> 6] & (1ULL << (target & 63))))
+        {
+            break;
+        }
+        if (!bottom_up && frontier_edges > (total_edges - explored_edges) / HOP_ALPHA)
+        {
+            bottom_up = 1;
+        }
+        else if (bottom_up && search->frontier_count < n / HOP_BETA)
+        {
+            bottom_up = 0;
+        }
+
+        int before = search->reached_count;
+        if (bottom_up)
+        {
+            hop_bottom_up(search);
+            search->bottom_up_levels++;
+        }
+        else
+        {
+            hop_top_down(search);
+            search->top_down_levels++;
+        }
+        search->frontier_count = search->reached_count - before;
+        frontier_edges = 0;
+        for (int i = before; i < search->reached_count; i++)
+        {
+            frontier_edges += hop_degree(search, search->reached[i]);
+        }
+        explored_edges += frontier_edges;
+
+        unsigned long long* swap = search->frontier;
+        search->frontier = search->next;
+        search->next = swap;
+        memset(search->next, 0, sizeof(unsigned long long) * search->words);
+    }
+}
+
+char* hop_direction_name(int direction)
+{
+    return direction == HOP_OUT ? "沿转出方向" : direction == HOP_IN ? "沿转入方向" : "不分方向";
+}
+
+// 账号的k跳邻域：列出k跳内的账户（至多limit个）和它们之间的边，边权为两账户间的累计转账金额
+void ego_network(HashTable* user_table, char* account, int hops, int direction, int limit)
+{
+    user* center = find_user(user_table, account);
+    if (center == 0)
+    {
+        printf("账户不存在\n");
+        return;
+    }
+    HopSearch search;
+    hop_search_init(&search, user_table, direction, limit < 1 ? 1 : limit);
+    hop_search_run(&search, center->uid, hops, -1);
+
+    printf("%s %d跳内（%s）的账户: %d 个%s\n", account, hops, hop_direction_name(direction), search.reached_count,
+    search.truncated ? "（达到账户数上限，结果被截断）" : "");
+    int level_begin = 1;
+    for (int level = 1; level_begin < search.reached_count; level++)
+    {
+        int level_end = level_begin;
+        while (level_end < search.reached_count && search.depth[search.reached[level_end]] == level)
+        {
+            level_end++;
+        }
+        printf("第%d跳: %d 个\n", level, level_end - level_begin);
+        level_begin = level_end;
+    }
+    printf("遍历: 自顶向下 %d 层，自底向上 %d 层\n", search.top_down_levels, search.bottom_up_levels);
+
+    // 邻域内账户之间的边，按账户汇总子图内的转出和转入
+    Graph* graph = get_user_graph(user_table);
+    double* out_weight = (double*)calloc(search.vertex_count + 1, sizeof(double));
+    double* in_weight = (double*)calloc(search.vertex_count + 1, sizeof(double));
+    int edge_count = 0;
+    double edge_weight = 0;
+    for (int i = 0; i < search.reached_count; i++)
+    {
+        int u = search.reached[i];
+        for (int e = graph->offset[u]; e < graph->offset[u + 1]; e++)
+        {
+            int v = graph->target[e];
+            if (search.visited[v >> 6] & (1ULL << (v & 63)))
+            {
+                out_weight[u] += graph->weight[e];
+                in_weight[v] += graph->weight[e];
+                edge_count++;
+                edge_weight += graph->weight[e];
+            }
+        }
+    }
+
+    printf("\n账户（跳数，子图内转出 / 转入）\n");
+    for (int i = 0; i < search.reached_count; i++)
+    {
+        int u = search.reached[i];
+        printf("%d: %s, %.2lf / %.2lf\n", search.depth[u], user_table->users[u]->user_id, out_weight[u], in_weight[u]);
+    }
+    printf("\n子图的边: %d 条，金额合计 %.2lf\n", edge_count, edge_weight);
+    for (int i = 0; i < search.reached_count; i++)
+    {
+        int u = search.reached[i];
+        for (int e = graph->offset[u]; e < graph->offset[u + 1]; e++)
+        {
+            int v = graph->target[e];
+            if (search.visited[v >> 6] & (1ULL << (v & 63)))
+            {
+                printf("%s -> %s: %.2lf\n", user_table->users[u]->user_id, user_table->users[v]->user_id, graph->weight[e]);
+            }
+        }
+    }
+    free(out_weight);
+    free(in_weight);
+    hop_search_free(&search);
+}
+
+// 判断账号from能否到达账号to，能到达时输出一条跳数最少的路径
+void reachability(HashTable* user_table, char* from, char* to, int direction)
+{
+    user* from_user = find_user(user_table, from);
+    user* to_user = find_user(user_table, to);
+    if (from_user == 0 || to_user == 0)
+    {
+        printf("账户不存在\n");
+        return;
+    }
+    HopSearch search;
+    hop_search_init(&search, user_table, direction, user_table->user_count);
+    hop_search_run(&search, from_user->uid, INT_MAX, to_user->uid);
+    int target = to_user->uid;
+    printf("遍历: 访问账户 %d 个，自顶向下 %d 层，自底向上 %d 层\n", search.reached_count, search.top_down_levels, search.bottom_up_levels);
+    if (!(search.visited[target >> 6] & (1ULL << (target & 63))))
+    {
+        printf("%s %s不能到达 %s\n", from, hop_direction_name(direction), to);
+        hop_search_free(&search);
+        return;
+    }
+
+    printf("%s %s可以到达 %s，最少 %d 跳\n", from, hop_direction_name(direction), to, search.depth[target]);
+    Graph* graph = get_user_graph(user_table);
+    int* path = (int*)malloc(sizeof(int) * (search.depth[target] + 1));
+    for (int v = target, i = search.depth[target]; i >= 0; v = search.parent[v], i--)
+    {
+        path[i] = v;
+    }
+    printf("%s", user_table->users[path[0]]->user_id);
+    for (int i = 1; i <= search.depth[target]; i++)
+    {
+        // 每一跳按实际的转账方向标出箭头和金额
+        int e = find_arc(graph, path[i - 1], path[i]);
+        if (e >= 0)
+        {
+            printf(" -(%.2lf)-> %s", graph->weight[e], user_table->users[path[i]]->user_id);
+        }
+        else
+        {
+            e = find_arc(graph, path[i], path[i - 1]);
+            printf(" <-(%.2lf)- %s", graph->weight[e], user_table->users[path[i]]->user_id);
+        }
+    }
+    printf("\n");
+    free(path);
+    hop_search_free(&search);
+}
+
+// 区块按时间戳排序时的键
+typedef struct BlockTime
+{
+    unsigned time_stamp;
+    int index;
+} BlockTime;
+
+int compare_block_time(const void* a, const void* b)
+{
+    const BlockTime* x = (const BlockTime*)a;
+    const BlockTime* y = (const BlockTime*)b;
+    if (x->time_stamp != y->time_stamp)
+    {
+        return x->time_stamp < y->time_stamp ? -1 : 1;
+    }
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+/*
+ * 按时间排序的交易流：区块按时间戳稳定排序，交易按所在区块的名次计数排序，同一区块内保持插入顺序。
+ * 区块时间戳本来就不减时省去排序。插入交易后按data_version重建。
+ */
+TemporalStream* get_temporal_stream()
+{
+    TemporalStream* stream = &temporal_stream;
+    if (stream->version == data_version && stream->count == tx_columns.count)
+    {
+        return stream;
+    }
+    int b = block_index.count;
+    int m = tx_columns.count;
+    stream->row = (int*)region_reserve(&stream->row_region, sizeof(int) * (m + 1));
+    stream->time = (unsigned*)region_reserve(&stream->time_region, sizeof(unsigned) * (m + 1));
+
+    // 各区块在时间顺序中的名次
+    int* rank = (int*)malloc(sizeof(int) * (b + 1));
+    int sorted = 1;
+    for (int i = 0; i < b; i++)
+    {
+        rank[i] = i;
+        sorted = sorted && block_index.blocks[i]->block_timestamp == block_index.max_timestamp[i];
+    }
+    if (!sorted)
+    {
+        BlockTime* order = (BlockTime*)malloc(sizeof(BlockTime) * (b + 1));
+        for (int i = 0; i < b; i++)
+        {
+            order[i].time_stamp = block_index.blocks[i]->block_timestamp;
+            order[i].index = i;
+        }
+        qsort(order, b, sizeof(BlockTime), compare_block_time);
+        for (int i = 0; i < b; i++)
+        {
+            rank[order[i].index] = i;
+        }
+        free(order);
+    }
+
+    if (sorted && tx_columns.block_ordered)
+    {
+        for (int row = 0; row < m; row++)
+        {
+            stream->row[row] = row;
+        }
+    }
+    else
+    {
+        int* cursor = (int*)calloc(b + 1, sizeof(int));
+        for (int row = 0; row < m; row++)
+        {
+            cursor[rank[tx_columns.block[row]] + 1]++;
+        }
+        for (int i = 0; i < b; i++)
+        {
+            cursor[i + 1] += cursor[i];
+        }
+        for (int row = 0; row < m; row++)
+        {
+            stream->row[cursor[rank[tx_columns.block[row]]]++] = row;
+        }
+        free(cursor);
+    }
+    for (int i = 0; i < m; i++)
+    {
+        stream->time[i] = block_index.blocks[tx_columns.block[stream->row[i]]]->block_timestamp;
+    }
+    free(rank);
+
+    stream->count = m;
+    stream->version = data_version;
+    return stream;
+}
+
+// 交易流中第一笔时间不早于time_stamp的位置
+int stream_lower_bound(TemporalStream* stream, unsigned time_stamp)
+{
+    int low = 0, high = stream->count;
+    while (low < high)
+    {
+        int mid = (low + high) / 2;
+        if (stream->time[mid] < time_stamp)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// 交易流中第一笔时间晚于time_stamp的位置
+int stream_upper_bound(TemporalStream* stream, unsigned time_stamp)
+{
+    int low = 0, high = stream->count;
+    while (low < high)
+    {
+        int mid = (low + high) / 2;
+        if (stream->time[mid] <= time_stamp)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/*
+ * 沿时间顺序扩散一遍：资金time_start时在source，一笔交易只有在转出方收到资金之后（同一时刻按交易流顺序）
+ * 才能继续传递。arrival记最早到达时间，via记到达所经的交易行，hops记跳数，reached按到达顺序记下账户。
+ * stop_at不为-1时，该账户的到达时间早于之后的交易即可停止。返回到达的账户数（不含source）。
+ */
+int temporal_spread(int source, unsigned time_start, unsigned time_end, int stop_at,
+    unsigned* arrival, int* via, int* hops, int* reached)
+{
+    TemporalStream* stream = get_temporal_stream();
+    storage_advise(&stream->row_region, 1);
+    storage_advise(&stream->time_region, 1);
+    arrival[source] = time_start;
+    hops[source] = 0;
+    int count = 0;
+    int end = stream_upper_bound(stream, time_end);
+    for (int i = stream_lower_bound(stream, time_start); i < end; i++)
+    {
+        unsigned time = stream->time[i];
+        if (stop_at >= 0 && arrival[stop_at] <= time)
+        {
+            break;
+        }
+        int row = stream->row[i];
+        int from = tx_columns.from[row];
+        int to = tx_columns.to[row];
+        if (arrival[from] <= time && time < arrival[to])
+        {
+            arrival[to] = time;
+            via[to] = row;
+            hops[to] = hops[from] + 1;
+            reached[count++] = to;
+        }
+        if ((i & 0xFFFF) == 0xFFFF)
+        {
+            storage_trim();
+        }
+    }
+    return count;
+}
+
+// 从账号from在time_start时刻出发，资金沿时间顺序最早何时能到达账号to，并给出经过的交易
+void earliest_arrival(HashTable* user_table, char* from, char* to, unsigned time_start)
+{
+    user* source = find_user(user_table, from);
+    user* target = find_user(user_table, to);
+    if (source == 0 || target == 0)
+    {
+        printf("账户不存在\n");
+        return;
+    }
+
+    int n = user_table->user_count;
+    unsigned* arrival = (unsigned*)malloc(sizeof(unsigned) * (n + 1));
+    int* via = (int*)malloc(sizeof(int) * (n + 1));
+    int* hops = (int*)malloc(sizeof(int) * (n + 1));
+    int* reached = (int*)malloc(sizeof(int) * (n + 1));
+    for (int u = 0; u < n; u++)
+    {
+        arrival[u] = UINT_MAX;
+    }
+    temporal_spread(source->uid, time_start, UINT_MAX, target->uid, arrival, via, hops, reached);
+
+    if (target == source || arrival[target->uid] == UINT_MAX)
+    {
+        printf("用户: %s\n到\n用户: %s\n在时刻 %u 之后不存在按时间顺序的路径\n", from, to, time_start);
+    }
+    else
+    {
+        printf("用户: %s\n到\n用户: %s\n最早到达时间: %u（经过 %d 笔交易）\n", from, to, arrival[target->uid], hops[target->uid]);
+        // 从终点沿via倒推，逆序输出
+        int length = hops[target->uid];
+        int* path = (int*)malloc(sizeof(int) * (length + 1));
+        int u = target->uid;
+        for (int i = length - 1; i >= 0; i--)
+        {
+            path[i] = via[u];
+            u = tx_columns.from[via[u]];
+        }
+        for (int i = 0; i < length; i++)
+        {
+            int row = path[i];
+            printf("  %u: %s -> %s, 金额 %.2lf, 交易 %d\n", block_index.blocks[tx_columns.block[row]]->block_timestamp,
+            user_table->users[tx_columns.from[row]]->user_id, user_table->users[tx_columns.to[row]]->user_id,
+            tx_columns.amount[row], tx_columns.tx_id[row]);
+        }
+        free(path);
+    }
+    free(arrival);
+    free(via);
+    free(hops);
+    free(reached);
+}
+
+// 时间段内从账号from出发沿时间顺序可达的账户，按到达时间输出前k个
+void temporal_reach(HashTable* user_table, char* from, unsigned time_start, unsigned time_end, int k)
+{
+    user* source = find_user(user_table, from);
+    if (source == 0)
+    {
+        printf("账户不存在\n");
+        return;
+    }
+
+    int n = user_table->user_count;
+    unsigned* arrival = (unsigned*)malloc(sizeof(unsigned) * (n + 1));
+    int* via = (int*)malloc(sizeof(int) * (n + 1));
+    int* hops = (int*)malloc(sizeof(int) * (n + 1));
+    int* reached = (int*)malloc(sizeof(int) * (n + 1));
+    for (int u = 0; u < n; u++)
+    {
+        arrival[u] = UINT_MAX;
+    }
+    int count = temporal_spread(source->uid, time_start, time_end, -1, arrival, via, hops, reached);
+
+    printf("时间段内从该账户出发按时间顺序可达的账户数: %d\n", count);
+    for (int i = 0; i < count && i < k; i++)
+    {
+        int u = reached[i];
+        printf("NO.%d: %s, 最早到达时间 %u, 经过 %d 笔交易\n", i + 1, user_table->users[u]->user_id, arrival[u], hops[u]);
+    }
+    free(arrival);
+    free(via);
+    free(hops);
+    free(reached);
+}
+
+/*
+ * 资金流向追踪：account在time_start时刻持有的amount（为0时取当时的全部余额）记为污点，之后每笔转出
+ * 按污点占余额的比例带走污点。余额从交易流开头累计；余额不够支付时，差额视为数据之外的干净资金。
+ * 顺序扫描一遍交易流到time_end，输出持有污点最多的前k个账户。
+ */
+void taint_trace(HashTable* user_table, char* account, unsigned time_start, unsigned time_end, double amount, int k)
+{
+    user* source = find_user(user_table, account);
+    if (source == 0)
+    {
+        printf("账户不存在\n");
+        return;
+    }
+
+    TemporalStream* stream = get_temporal_stream();
+    storage_advise(&stream->row_region, 1);
+    int n = user_table->user_count;
+    double* balance = (double*)calloc(n + 1, sizeof(double));
+    double* taint = (double*)calloc(n + 1, sizeof(double));
+    int begin = stream_lower_bound(stream, time_start);
+    int end = stream_upper_bound(stream, time_end);
+    for (int i = 0; i < end; i++)
+    {
+        if (i == begin)
+        {
+            // 到达起始时刻，标记污点
+            taint[source->uid] = amount > 0 ? amount : (balance[source->uid] > 0 ? balance[source->uid] : 0);
+            if (balance[source->uid] < taint[source->uid])
+            {
+                balance[source->uid] = taint[source->uid];
+            }
+        }
+        int row = stream->row[i];
+        int from = tx_columns.from[row];
+        int to = tx_columns.to[row];
+        double value = tx_columns.amount[row];
+        if (balance[from] < value)
+        {
+            balance[from] = value;
+        }
+        if (taint[from] > 0)
+        {
+            double moved = taint[from] * value / balance[from];
+            taint[from] -= moved;
+            taint[to] += moved;
+        }
+        balance[from] -= value;
+        balance[to] += value;
+        if ((i & 0xFFFF) == 0xFFFF)
+        {
+            storage_trim();
+        }
+    }
+    if (begin >= end)
+    {
+        taint[source->uid] = amount > 0 ? amount : (balance[source->uid] > 0 ? balance[source->uid] : 0);
+    }
+
+    TopK* top = topk_create(k);
+    int tainted = 0;
+    double total = 0;
+    for (int u = 0; u < n; u++)
+    {
+        if (taint[u] > 1e-9)
+        {
+            tainted++;
+            total += taint[u];
+            topk_push(top, u, taint[u]);
+        }
+    }
+    printf("追踪的金额: %.2lf，到结束时刻分布在 %d 个账户中\n", total, tainted);
+    for (int i = 0; i < top->count; i++)
+    {
+        int u = top->uid[i];
+        double share = balance[u] > 0 ? top->value[i] / balance[u] * 100 : 100;
+        printf("NO.%d: %s, 污点金额 %.2lf（占其余额 %.1lf%%）\n", i + 1, user_table->users[u]->user_id, top->value[i], share);
+    }
+    topk_free(top);
+    free(balance);
+    free(taint);
+}
+
+double window_value(int metric, int uid)
+{
+    if (metric == 0)
+    {
+        return (double)rolling_window.in_count[uid];
+    }
+    else if (metric == 1)
+    {
+        return (double)rolling_window.out_count[uid];
+    }
+    else if (metric == 2)
+    {
+        return rolling_window.in_amount[uid];
+    }
+    return rolling_window.out_amount[uid];
+}
+
+// 账户a是否排在b之前：指标大的在前，相同时编号小的在前（与TopK一致）
+int window_before(int metric, int a, int b)
+{
+    double x = window_value(metric, a);
+    double y = window_value(metric, b);
+    return x > y || (x == y && a < b);
+}
+
+void window_heap_swap(int metric, int i, int j)
+{
+    int* heap = rolling_window.heap[metric];
+    int temp = heap[i];
+    heap[i] = heap[j];
+    heap[j] = temp;
+    rolling_window.position[metric][heap[i]] = i;
+    rolling_window.position[metric][heap[j]] = j;
+}
+
+// 堆中位置i的账户指标变化后恢复堆序
+void window_heap_fix(int metric, int i)
+{
+    int* heap = rolling_window.heap[metric];
+    while (i > 0 && window_before(metric, heap[i], heap[(i - 1) / 2]))
+    {
+        window_heap_swap(metric, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    while (1)
+    {
+        int best = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+        if (left < rolling_window.heap_size && window_before(metric, heap[left], heap[best]))
+        {
+            best = left;
+        }
+        if (right < rolling_window.heap_size && window_before(metric, heap[right], heap[best]))
+        {
+            best = right;
+        }
+        if (best == i)
+        {
+            break;
+        }
+        window_heap_swap(metric, i, best);
+        i = best;
+    }
+}
+
+// 账户数组扩到至少n个账户
+void window_reserve(int n)
+{
+    RollingWindow* window = &rolling_window;
+    if (n <= window->capacity)
+    {
+        return;
+    }
+    int capacity = window->capacity == 0 ? 1024 : window->capacity;
+    while (capacity < n)
+    {
+        capacity *= 2;
+    }
+    window->in_count = (int*)realloc(window->in_count, sizeof(int) * capacity);
+    window->out_count = (int*)realloc(window->out_count, sizeof(int) * capacity);
+    window->in_amount = (double*)realloc(window->in_amount, sizeof(double) * capacity);
+    window->out_amount = (double*)realloc(window->out_amount, sizeof(double) * capacity);
+    for (int metric = 0; metric < WINDOW_METRICS; metric++)
+    {
+        window->heap[metric] = (int*)realloc(window->heap[metric], sizeof(int) * capacity);
+        window->position[metric] = (int*)realloc(window->position[metric], sizeof(int) * capacity);
+    }
+    for (int uid = window->capacity; uid < capacity; uid++)
+    {
+        window->in_count[uid] = 0;
+        window->out_count[uid] = 0;
+        window->in_amount[uid] = 0;
+        window->out_amount[uid] = 0;
+        for (int metric = 0; metric < WINDOW_METRICS; metric++)
+        {
+            window->position[metric][uid] = -1;
+        }
+    }
+    window->capacity = capacity;
+}
+
+// 账户的窗口统计变化后调整各个堆：窗口内有交易的账户在堆中，没有的移出
+void window_update(int uid)
+{
+    RollingWindow* window = &rolling_window;
+    int active = window->in_count[uid] + window->out_count[uid] > 0;
+    if (!active)
+    {
+        // 交易全部移出后清掉金额加减留下的舍入误差
+        window->in_amount[uid] = 0;
+        window->out_amount[uid] = 0;
+    }
+
+    if (active && window->position[0][uid] < 0)
+    {
+        int last = window->heap_size++;
+        for (int metric = 0; metric < WINDOW_METRICS; metric++)
+        {
+            window->heap[metric][last] = uid;
+            window->position[metric][uid] = last;
+            window_heap_fix(metric, last);
+        }
+    }
+    else if (!active && window->position[0][uid] >= 0)
+    {
+        int last = --window->heap_size;
+        for (int metric = 0; metric < WINDOW_METRICS; metric++)
+        {
+            int i = window->position[metric][uid];
+            window_heap_swap(metric, i, last);
+            window->position[metric][uid] = -1;
+            if (i < last)
+            {
+                window_heap_fix(metric, i);
+            }
+        }
+    }
+    else if (active)
+    {
+        for (int metric = 0; metric < WINDOW_METRICS; metric++)
+        {
+            window_heap_fix(metric, window->position[metric][uid]);
+        }
+    }
+}
+
+// 一笔交易进入（sign为1）或移出（sign为-1）窗口
+void window_apply(int from, int to, double amount, int sign)
+{
+    RollingWindow* window = &rolling_window;
+    window_reserve((from > to ? from : to) + 1);
+    window->out_count[from] += sign;
+    window->out_amount[from] += sign * amount;
+    window->in_count[to] += sign;
+    window->in_amount[to] += sign * amount;
+    window->transactions += sign;
+    window->amount += sign * amount;
+    window_update(from);
+    if (to != from)
+    {
+        window_update(to);
+    }
+}
+
+// 区块的全部交易进入或移出窗口
+void window_apply_block(int index, int sign)
+{
+    SegmentReader reader;
+    segment_open(&block_index.blocks[index]->segment, &reader);
+    for (int i = 0; i < reader.count; i++)
+    {
+        window_apply(segment_field(&reader, i, SEGMENT_FROM), segment_field(&reader, i, SEGMENT_TO), segment_amount(&reader, i), sign);
+    }
+}
+
+// 区块是否已在窗口之外：超出区块数，或比最新的区块早了max_seconds以上
+int window_outdated(int index)
+{
+    RollingWindow* window = &rolling_window;
+    unsigned newest = block_index.max_timestamp[block_index.count - 1];
+    return (window->max_blocks > 0 && block_index.count - index > window->max_blocks)
+    || (window->max_seconds > 0 && newest - block_index.blocks[index]->block_timestamp > window->max_seconds);
+}
+
+// 追加区块后移出窗口之外的最旧区块，每个区块只进出一次
+void window_advance()
+{
+    RollingWindow* window = &rolling_window;
+    if (!window->enabled)
+    {
+        return;
+    }
+    while (window->begin < block_index.count && window_outdated(window->begin))
+    {
+        window_apply_block(window->begin, -1);
+        window->begin++;
+    }
+}
+
+// 设置窗口大小（持写锁调用），两项都为0时关闭；按现有区块重新建立窗口
+void window_configure(int max_blocks, unsigned max_seconds)
+{
+    RollingWindow* window = &rolling_window;
+    free(window->in_count);
+    free(window->out_count);
+    free(window->in_amount);
+    free(window->out_amount);
+    for (int metric = 0; metric < WINDOW_METRICS; metric++)
+    {
+        free(window->heap[metric]);
+        free(window->position[metric]);
+    }
+    memset(window, 0, sizeof(RollingWindow));
+    window->max_blocks = max_blocks > 0 ? max_blocks : 0;
+    window->max_seconds = max_seconds;
+    window->enabled = window->max_blocks > 0 || window->max_seconds > 0;
+    if (!window->enabled)
+    {
+        return;
+    }
+
+    while (window->begin < block_index.count && window_outdated(window->begin))
+    {
+        window->begin++;
+    }
+    for (int b = window->begin; b < block_index.count; b++)
+    {
+        window_apply_block(b, 1);
+    }
+}
+
+// 某项指标的前k名：从堆顶按最佳优先展开，只访问O(k)个堆节点
+void window_top(int metric, TopK* top)
+{
+    int* heap = rolling_window.heap[metric];
+    int* frontier = (int*)malloc(sizeof(int) * (2 * top->k + 2));
+    int frontier_size = 0;
+    if (rolling_window.heap_size > 0 && top->k > 0)
+    {
+        frontier[frontier_size++] = 0;
+    }
+    while (top->count < top->k && frontier_size > 0)
+    {
+        // 取出候选中最靠前的堆节点
+        int best = 0;
+        for (int i = 1; i < frontier_size; i++)
+        {
+            if (window_before(metric, heap[frontier[i]], heap[frontier[best]]))
+            {
+                best = i;
+            }
+        }
+        int node = frontier[best];
+        frontier[best] = frontier[--frontier_size];
+        topk_push(top, heap[node], window_value(metric, heap[node]));
+        for (int child = 2 * node + 1; child <= 2 * node + 2 && child < rolling_window.heap_size; child++)
+        {
+            frontier[frontier_size++] = child;
+        }
+    }
+    free(frontier);
+}
+
+// 滚动窗口内的交易概况和出度入度排行
+void window_leaders(HashTable* user_table, int k)
+{
+    RollingWindow* window = &rolling_window;
+    if (!window->enabled)
+    {
+        printf("滚动窗口未开启，请先在系统设置中设置窗口大小\n");
+        return;
+    }
+    if (window->begin >= block_index.count)
+    {
+        printf("滚动窗口内没有区块\n");
+        return;
+    }
+    Block* first = block_index.blocks[window->begin];
+    Block* last = block_index.blocks[block_index.count - 1];
+    printf("滚动窗口: 区块 %d ~ %d（%d个区块，时间 %u ~ %u）\n", first->blockID, last->blockID,
+    block_index.count - window->begin, first->block_timestamp, last->block_timestamp);
+    printf("窗口内交易数: %ld，交易总额: %.2lf，有交易的账户数: %d\n", window->transactions, window->amount, window->heap_size);
+
+    char* titles[WINDOW_METRICS] = {"入度", "出度", "加权入度", "加权出度"};
+    for (int metric = 0; metric < WINDOW_METRICS; metric++)
+    {
+        TopK* top = topk_create(k);
+        window_top(metric, top);
+        printf("窗口内%s排行前%d名\n", titles[metric], k);
+        for (int i = 0; i < top->count; i++)
+        {
+            if (metric < 2)
+            {
+                printf("%s NO.%d: %s, %d\n", titles[metric], i + 1, user_table->users[top->uid[i]]->user_id, (int)top->value[i]);
+            }
+            else
+            {
+                printf("%s NO.%d: %s, %.2lf\n", titles[metric], i + 1, user_table->users[top->uid[i]]->user_id, top->value[i]);
+            }
+        }
+        topk_free(top);
+    }
+}
+
+// 序列中第一个桶号不小于bucket的位置
+int rollup_lower_bound(RollupSeries* series, unsigned bucket)
+{
+    int low = 0, high = series->count;
+    while (low < high)
+    {
+        int mid = (low + high) / 2;
+        if (series->cells[mid].bucket < bucket)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// 序列在某个桶的汇总，没有时按桶号顺序插入一个空的。交易大致按时间到达，通常只是追加到末尾
+RollupCell* rollup_series_cell(RollupSeries* series, unsigned bucket)
+{
+    int low = series->count;
+    if (series->count > 0 && series->cells[series->count - 1].bucket >= bucket)
+    {
+        if (series->cells[series->count - 1].bucket == bucket)
+        {
+            return &series->cells[series->count - 1];
+        }
+        low = rollup_lower_bound(series, bucket);
+        if (series->cells[low].bucket == bucket)
+        {
+            return &series->cells[low];
+        }
+    }
+
+    if (series->count == series->capacity)
+    {
+        series->capacity = series->capacity == 0 ? 4 : series->capacity * 2;
+        series->cells = (RollupCell*)realloc(series->cells, sizeof(RollupCell) * series->capacity);
+    }
+    memmove(series->cells + low + 1, series->cells + low, sizeof(RollupCell) * (series->count - low));
+    RollupCell cell = {bucket, 0, 0, 0, 0};
+    series->cells[low] = cell;
+    series->count++;
+    return &series->cells[low];
+}
+
+// 账户在某个桶的汇总
+RollupCell* rollup_cell(int uid, unsigned bucket)
+{
+    Rollup* r = &rollup;
+    if (uid >= r->account_capacity)
+    {
+        int capacity = r->account_capacity == 0 ? 1024 : r->account_capacity;
+        while (capacity <= uid)
+        {
+            capacity *= 2;
+        }
+        r->accounts = (RollupSeries*)realloc(r->accounts, sizeof(RollupSeries) * capacity);
+        memset(r->accounts + r->account_capacity, 0, sizeof(RollupSeries) * (capacity - r->account_capacity));
+        r->account_capacity = capacity;
+    }
+
+    RollupSeries* series = &r->accounts[uid];
+    int before = series->count;
+    RollupCell* cell = rollup_series_cell(series, bucket);
+    r->cell_count += series->count - before;
+    return cell;
+}
+
+// 一笔交易计入所在时间桶（time_stamp为所在区块的前缀最大时间戳）
+void rollup_record(unsigned time_stamp, int from, int to, double amount)
+{
+    Rollup* r = &rollup;
+    unsigned bucket = time_stamp / r->width;
+    RollupCell* cell = rollup_series_cell(&r->network, bucket);
+    cell->out_count++;
+    cell->out_amount += amount;
+
+    cell = rollup_cell(from, bucket);
+    cell->out_count++;
+    cell->out_amount += amount;
+    cell = rollup_cell(to, bucket);
+    cell->in_count++;
+    cell->in_amount += amount;
+}
+
+// 修改桶宽（持写锁调用），按交易列重新建立汇总
+void rollup_configure(unsigned width)
+{
+    Rollup* r = &rollup;
+    for (int uid = 0; uid < r->account_capacity; uid++)
+    {
+        free(r->accounts[uid].cells);
+    }
+    free(r->accounts);
+    free(r->network.cells);
+    memset(r, 0, sizeof(Rollup));
+    r->width = width > ROLLUP_MIN_WIDTH ? width : ROLLUP_MIN_WIDTH;
+    for (int row = 0; row < tx_columns.count; row++)
+    {
+        rollup_record(block_index.max_timestamp[tx_columns.block[row]], tx_columns.from[row], tx_columns.to[row], tx_columns.amount[row]);
+    }
+}
+
+// 直接扫描区块范围内的交易，累加到totals；account为-1时统计全网
+void rollup_scan(int block_begin, int block_end, int account, RollupTotals* totals)
+{
+    for (int block = block_begin; block < block_end; block++)
+    {
+        SegmentReader reader;
+        segment_open(&block_index.blocks[block]->segment, &reader);
+        for (int i = 0; i < reader.count; i++)
+        {
+            double amount = segment_amount(&reader, i);
+            if (account < 0)
+            {
+                totals->count++;
+                totals->volume += amount;
+                continue;
+            }
+            if ((int)segment_field(&reader, i, SEGMENT_FROM) == account)
+            {
+                totals->out_count++;
+                totals->out_amount += amount;
+            }
+            if ((int)segment_field(&reader, i, SEGMENT_TO) == account)
+            {
+                totals->in_count++;
+                totals->in_amount += amount;
+            }
+        }
+    }
+}
+
+/*
+ * 时间段 [time_start, time_end] 拆成中间的整桶和两端不足一桶的部分：整桶直接读汇总，
+ * 两端按时间二分出区块范围后扫描。整桶为 [full_begin, full_end)，两端的区块范围写入edge
+ */
+int rollup_split(unsigned time_start, unsigned time_end, unsigned* full_begin, unsigned* full_end, int* edge)
+{
+    unsigned long long width = rollup.width;
+    unsigned long long first = (time_start + width - 1) / width;
+    unsigned long long last = ((unsigned long long)time_end + 1) / width;
+    edge[0] = block_lower_bound(time_start);
+    edge[3] = block_upper_bound(time_end);
+    if (first >= last)
+    {
+        // 不足一个整桶，全部扫描
+        edge[1] = edge[2] = edge[3];
+        *full_begin = *full_end = 0;
+        return 0;
+    }
+    edge[1] = block_lower_bound((unsigned)(first * width));
+    edge[2] = last * width > UINT_MAX ? edge[3] : block_lower_bound((unsigned)(last * width));
+    *full_begin = (unsigned)first;
+    *full_end = (unsigned)last;
+    return 1;
+}
+
+// 按时间桶列出一段时间内全网的交易数和交易额
+void rollup_network(unsigned time_start, unsigned time_end)
+{
+    if (time_start > time_end)
+    {
+        printf("起始时间必须小于终止时间\n");
+        return;
+    }
+    Rollup* r = &rollup;
+    unsigned full_begin, full_end;
+    int edge[4];
+    int full = rollup_split(time_start, time_end, &full_begin, &full_end, edge);
+
+    printf("按%u秒的时间桶汇总\n", r->width);
+    RollupTotals totals;
+    memset(&totals, 0, sizeof(RollupTotals));
+    RollupTotals part;
+    memset(&part, 0, sizeof(RollupTotals));
+    rollup_scan(edge[0], edge[1], -1, &part);
+    if (part.count > 0)
+    {
+        printf("%u ~ %u（不足一桶）: 交易数 %d，交易额 %.2lf\n", time_start, full ? full_begin * r->width - 1 : time_end, part.count, part.volume);
+    }
+    totals.count += part.count;
+    totals.volume += part.volume;
+
+    RollupSeries* network = &r->network;
+    for (int i = rollup_lower_bound(network, full_begin); i < network->count && network->cells[i].bucket < full_end; i++)
+    {
+        RollupCell* cell = &network->cells[i];
+        printf("%u ~ %u: 交易数 %d，交易额 %.2lf\n", cell->bucket * r->width, cell->bucket * r->width + r->width - 1,
+        cell->out_count, cell->out_amount);
+        totals.count += cell->out_count;
+        totals.volume += cell->out_amount;
+    }
+
+    memset(&part, 0, sizeof(RollupTotals));
+    rollup_scan(edge[2], edge[3], -1, &part);
+    if (part.count > 0)
+    {
+        printf("%u ~ %u（不足一桶）: 交易数 %d，交易额 %.2lf\n", full_end * r->width, time_end, part.count, part.volume);
+    }
+    totals.count += part.count;
+    totals.volume += part.volume;
+
+    printf("合计: 交易数 %d，交易额 %.2lf\n", totals.count, totals.volume);
+    printf("读取汇总的整桶 %u 个，两端扫描的区块 %d 个\n", full_end - full_begin, (edge[1] - edge[0]) + (edge[3] - edge[2]));
+}
+
+// 按时间桶列出某个账号一段时间内的转入和转出
+void rollup_account(HashTable* user_table, char* account, unsigned time_start, unsigned time_end)
+{
+    if (time_start > time_end)
+    {
+        printf("起始时间必须小于终止时间\n");
+        return;
+    }
+    user* account_user = find_user(user_table, account);
+    if (account_user == 0)
+    {
+        printf("账户不存在\n");
+        return;
+    }
+    Rollup* r = &rollup;
+    int uid = account_user->uid;
+    unsigned full_begin, full_end;
+    int edge[4];
+    int full = rollup_split(time_start, time_end, &full_begin, &full_end, edge);
+
+    printf("按%u秒的时间桶汇总\n", r->width);
+    RollupTotals totals;
+    memset(&totals, 0, sizeof(RollupTotals));
+    RollupTotals part;
+    memset(&part, 0, sizeof(RollupTotals));
+    rollup_scan(edge[0], edge[1], uid, &part);
+    if (part.in_count + part.out_count > 0)
+    {
+        printf("%u ~ %u（不足一桶）: 转入 %d 笔 %.2lf，转出 %d 笔 %.2lf\n", time_start, full ? full_begin * r->width - 1 : time_end,
+        part.in_count, part.in_amount, part.out_count, part.out_amount);
+    }
+    totals = part;
+
+    RollupSeries* series = uid < r->account_capacity ? &r->accounts[uid] : 0;
+    int low = series != 0 ? rollup_lower_bound(series, full_begin) : 0;
+    for (int i = low; series != 0 && i < series->count && series->cells[i].bucket < full_end; i++)
+    {
+        RollupCell* cell = &series->cells[i];
+        printf("%u ~ %u: 转入 %d 笔 %.2lf，转出 %d 笔 %.2lf\n", cell->bucket * r->width, cell->bucket * r->width + r->width - 1,
+        cell->in_count, cell->in_amount, cell->out_count, cell->out_amount);
+        totals.in_count += cell->in_count;
+        totals.in_amount += cell->in_amount;
+        totals.out_count += cell->out_count;
+        totals.out_amount += cell->out_amount;
+    }
+
+    memset(&part, 0, sizeof(RollupTotals));
+    rollup_scan(edge[2], edge[3], uid, &part);
+    if (part.in_count + part.out_count > 0)
+    {
+        printf("%u ~ %u（不足一桶）: 转入 %d 笔 %.2lf，转出 %d 笔 %.2lf\n", full_end * r->width, time_end,
+        part.in_count, part.in_amount, part.out_count, part.out_amount);
+    }
+    totals.in_count += part.in_count;
+    totals.in_amount += part.in_amount;
+    totals.out_count += part.out_count;
+    totals.out_amount += part.out_amount;
+
+    printf("合计: 转入 %d 笔 %.2lf，转出 %d 笔 %.2lf，净收入 %.2lf\n",
+    totals.in_count, totals.in_amount, totals.out_count, totals.out_amount, totals.in_amount - totals.out_amount);
+    printf("读取汇总的整桶 %u 个，两端扫描的区块 %d 个\n", full_end - full_begin, (edge[1] - edge[0]) + (edge[3] - edge[2]));
+}
+
+// 账号的64位哈希（FNV-1a再打散），各分片对同一账号得到相同的值，摘要才能合并
+unsigned long long account_hash(char* account)
+{
+    unsigned long long hash = 14695981039346656037ULL;
+    while (*account)
+    {
+        hash ^= (unsigned char)*account++;
+        hash *= 1099511628211ULL;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+void hll_add(unsigned char* registers, unsigned long long hash)
+{
+    int index = (int)(hash >> (64 - HLL_BITS));
+    unsigned long long rest = hash << HLL_BITS;
+    int rank = 1;
+    while (rank <= 64 - HLL_BITS && (rest & (1ULL << 63)) == 0)
+    {
+        rest <<= 1;
+        rank++;
+    }
+    if (registers[index] < rank)
+    {
+        registers[index] = (unsigned char)rank;
+    }
+}
+
+// 基数估计，小基数时改用空寄存器数做线性计数
+double hll_estimate(unsigned char* registers)
+{
+    double sum = 0;
+    int zeros = 0;
+    for (int i = 0; i < HLL_REGISTERS; i++)
+    {
+        sum += ldexp(1.0, -registers[i]);
+        zeros += registers[i] == 0;
+    }
+    double estimate = 0.709 * HLL_REGISTERS * HLL_REGISTERS / sum;
+    if (estimate <= 2.5 * HLL_REGISTERS && zeros > 0)
+    {
+        estimate = HLL_REGISTERS * log((double)HLL_REGISTERS / zeros);
+    }
+    return estimate;
+}
+
+// 第row行的计数器位置，由哈希的高低两半组合出各行独立的位置
+int count_min_slot(unsigned long long hash, int row)
+{
+    unsigned low = (unsigned)hash;
+    unsigned high = (unsigned)(hash >> 32) | 1;
+    return (int)((low + (unsigned)row * high) % SKETCH_WIDTH);
+}
+
+double count_min_estimate(StreamSketch* sketch, unsigned long long hash)
+{
+    double estimate = sketch->count_min[0][count_min_slot(hash, 0)];
+    for (int row = 1; row < SKETCH_DEPTH; row++)
+    {
+        double value = sketch->count_min[row][count_min_slot(hash, row)];
+        if (value < estimate)
+        {
+            estimate = value;
+        }
+    }
+    return estimate;
+}
+
+int space_saving_home(SpaceSaving* summary, int uid)
+{
+    return (int)(((unsigned)uid * 2654435761u) >> 8) & (2 * summary->capacity - 1);
+}
+
+// uid所在的索引槽，不在表中时返回它应放入的空槽
+int space_saving_find(SpaceSaving* summary, int uid)
+{
+    int h = space_saving_home(summary, uid);
+    while (summary->slot[h] != 0 && summary->items[summary->slot[h] - 1].uid != uid)
+    {
+        h = (h + 1) & (2 * summary->capacity - 1);
+    }
+    return h;
+}
+
+// 删除索引槽h，后面同一探测链上的槽前移补位
+void space_saving_unlink(SpaceSaving* summary, int h)
+{
+    int mask = 2 * summary->capacity - 1;
+    int hole = h;
+    summary->slot[hole] = 0;
+    for (int next = (hole + 1) & mask; summary->slot[next] != 0; next = (next + 1) & mask)
+    {
+        int home = space_saving_home(summary, summary->items[summary->slot[next] - 1].uid);
+        // home不在 (hole, next] 之间时，这一项可以移到hole
+        int between = hole < next ? (home > hole && home <= next) : (home > hole || home <= next);
+        if (!between)
+        {
+            summary->slot[hole] = summary->slot[next];
+            summary->items[summary->slot[hole] - 1].slot = hole;
+            summary->slot[next] = 0;
+            hole = next;
+        }
+    }
+}
+
+void space_saving_swap(SpaceSaving* summary, int i, int j)
+{
+    HeavyHitter temp = summary->items[i];
+    summary->items[i] = summary->items[j];
+    summary->items[j] = temp;
+    summary->slot[summary->items[i].slot] = i + 1;
+    summary->slot[summary->items[j].slot] = j + 1;
+}
+
+void space_saving_sift_up(SpaceSaving* summary, int i)
+{
+    while (i > 0 && summary->items[i].weight < summary->items[(i - 1) / 2].weight)
+    {
+        space_saving_swap(summary, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+void space_saving_sift_down(SpaceSaving* summary, int i)
+{
+    while (1)
+    {
+        int smallest = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+        if (left < summary->count && summary->items[left].weight < summary->items[smallest].weight)
+        {
+            smallest = left;
+        }
+        if (right < summary->count && summary->items[right].weight < summary->items[smallest].weight)
+        {
+            smallest = right;
+        }
+        if (smallest == i)
+        {
+            break;
+        }
+        space_saving_swap(summary, i, smallest);
+        i = smallest;
+    }
+}
+
+/*
+ * 加权的Space-Saving：已在表中的账户直接累加；表满时替换堆顶（估计值最小）的账户并把它的值记为误差。
+ * 计数器数增加后表未满时，新账户可能是之前被替换出去的，同样按evicted记入误差
+ */
+void space_saving_add(SpaceSaving* summary, int uid, double weight)
+{
+    int h = space_saving_find(summary, uid);
+    if (summary->slot[h] != 0)
+    {
+        int i = summary->slot[h] - 1;
+        summary->items[i].weight += weight;
+        space_saving_sift_down(summary, i);
+        return;
+    }
+    if (summary->count < summary->capacity)
+    {
+        HeavyHitter item = {uid, summary->evicted + weight, summary->evicted, h};
+        int i = summary->count++;
+        summary->items[i] = item;
+        summary->slot[h] = i + 1;
+        space_saving_sift_up(summary, i);
+        return;
+    }
+    HeavyHitter* top = &summary->items[0];
+    space_saving_unlink(summary, top->slot);
+    summary->evicted = top->weight;
+    top->uid = uid;
+    top->error = top->weight;
+    top->weight += weight;
+    top->slot = space_saving_find(summary, uid);
+    summary->slot[top->slot] = 1;
+    space_saving_sift_down(summary, 0);
+}
+
+// 按items重建堆和索引
+void space_saving_rebuild(SpaceSaving* summary)
+{
+    memset(summary->slot, 0, sizeof(int) * 2 * summary->capacity);
+    for (int i = 0; i < summary->count; i++)
+    {
+        summary->items[i].slot = space_saving_find(summary, summary->items[i].uid);
+        summary->slot[summary->items[i].slot] = i + 1;
+    }
+    for (int i = summary->count / 2 - 1; i >= 0; i--)
+    {
+        space_saving_sift_down(summary, i);
+    }
+}
+
+int compare_heavy_hitter(const void* a, const void* b)
+{
+    const HeavyHitter* x = (const HeavyHitter*)a;
+    const HeavyHitter* y = (const HeavyHitter*)b;
+    if (x->weight != y->weight)
+    {
+        return x->weight < y->weight ? 1 : -1;
+    }
+    return (x->uid > y->uid) - (x->uid < y->uid);
+}
+
+// 改为capacity个计数器（2的幂）。减少时保留估计值最大的账户，丢掉的账户计入evicted
+void space_saving_resize(SpaceSaving* summary, int capacity)
+{
+    if (summary->count > capacity)
+    {
+        qsort(summary->items, summary->count, sizeof(HeavyHitter), compare_heavy_hitter);
+        if (summary->items[capacity].weight > summary->evicted)
+        {
+            summary->evicted = summary->items[capacity].weight;
+        }
+        summary->count = capacity;
+    }
+    summary->capacity = capacity;
+    summary->items = (HeavyHitter*)realloc(summary->items, sizeof(HeavyHitter) * capacity);
+    summary->slot = (int*)realloc(summary->slot, sizeof(int) * 2 * capacity);
+    space_saving_rebuild(summary);
+}
+
+void space_saving_free(SpaceSaving* summary)
+{
+    free(summary->items);
+    free(summary->slot);
+    memset(summary, 0, sizeof(SpaceSaving));
+}
+
+// 不在表中的账户真实值的上界：表满时是最小估计值（堆顶），未满时是被替换出去的最大估计值
+double space_saving_floor(SpaceSaving* summary)
+{
+    return summary->count < summary->capacity || summary->count == 0 ? summary->evicted : summary->items[0].weight;
+}
+
+/*
+ * 账户数为accounts时使用的计数器数，向上取2的幂。默认固定为HEAVY_HITTERS个；
+ * 按账户数设置（budget为-k，每k个账户一个）时内存随账户数线性增长，只在显式指定时使用。
+ */
+int heavy_hitter_capacity(int accounts)
+{
+    int target = heavy_hitter_budget > 0 ? heavy_hitter_budget
+               : heavy_hitter_budget < 0 ? accounts / -heavy_hitter_budget : HEAVY_HITTERS;
+    int capacity = 1;
+    while (capacity < target && capacity < (1 << 28))
+    {
+        capacity *= 2;
+    }
+    return capacity;
+}
+
+void stream_sketch_add(StreamSketch* sketch, int uid, unsigned long long hash, double amount)
+{
+    sketch->total += amount;
+    for (int row = 0; row < SKETCH_DEPTH; row++)
+    {
+        sketch->count_min[row][count_min_slot(hash, row)] += amount;
+    }
+    space_saving_add(&sketch->heavy, uid, amount);
+}
+
+/*
+ * 合并两个摘要（两边的uid须指同一张表）：Count-Min逐项相加；Space-Saving取两表的并，
+ * 一边没有的账户按那一边的上界补上，再按两边中较大的计数器数保留估计值最大的账户。
+ */
+void stream_sketch_merge(StreamSketch* into, StreamSketch* from)
+{
+    into->total += from->total;
+    for (int row = 0; row < SKETCH_DEPTH; row++)
+    {
+        for (int i = 0; i < SKETCH_WIDTH; i++)
+        {
+            into->count_min[row][i] += from->count_min[row][i];
+        }
+    }
+
+    double into_floor = space_saving_floor(&into->heavy);
+    double from_floor = space_saving_floor(&from->heavy);
+    if (into->heavy.capacity < from->heavy.capacity)
+    {
+        space_saving_resize(&into->heavy, from->heavy.capacity);
+    }
+    HeavyHitter* merged = (HeavyHitter*)malloc(sizeof(HeavyHitter) * (into->heavy.count + from->heavy.count + 1));
+    int count = 0;
+    for (int i = 0; i < into->heavy.count; i++)
+    {
+        HeavyHitter item = into->heavy.items[i];
+        int slot = from->heavy.slot[space_saving_find(&from->heavy, item.uid)];
+        item.weight += slot != 0 ? from->heavy.items[slot - 1].weight : from_floor;
+        item.error += slot != 0 ? from->heavy.items[slot - 1].error : from_floor;
+        merged[count++] = item;
+    }
+    for (int j = 0; j < from->heavy.count; j++)
+    {
+        if (into->heavy.slot[space_saving_find(&into->heavy, from->heavy.items[j].uid)] == 0)
+        {
+            HeavyHitter item = from->heavy.items[j];
+            item.weight += into_floor;
+            item.error += into_floor;
+            merged[count++] = item;
+        }
+    }
+    qsort(merged, count, sizeof(HeavyHitter), compare_heavy_hitter);
+    // 两边都不在表中的账户不超过两个上界之和，截掉的账户不超过截断处的估计值
+    into->heavy.evicted = into_floor + from_floor;
+    into->heavy.count = count < into->heavy.capacity ? count : into->heavy.capacity;
+    if (count > into->heavy.count && merged[into->heavy.count].weight > into->heavy.evicted)
+    {
+        into->heavy.evicted = merged[into->heavy.count].weight;
+    }
+    memcpy(into->heavy.items, merged, sizeof(HeavyHitter) * into->heavy.count);
+    space_saving_rebuild(&into->heavy);
+    free(merged);
+}
+
+// HLL数组扩到至少n个账户，新账户的寄存器为0
+void sketch_reserve(int n)
+{
+    SketchState* sketch = &sketch_state;
+    if (n <= sketch->capacity)
+    {
+        return;
+    }
+    int capacity = sketch->capacity == 0 ? 1024 : sketch->capacity;
+    while (capacity < n)
+    {
+        capacity *= 2;
+    }
+    sketch->hll_in = (unsigned char*)realloc(sketch->hll_in, (size_t)capacity * HLL_REGISTERS);
+    sketch->hll_out = (unsigned char*)realloc(sketch->hll_out, (size_t)capacity * HLL_REGISTERS);
+    size_t old_bytes = (size_t)sketch->capacity * HLL_REGISTERS;
+    memset(sketch->hll_in + old_bytes, 0, (size_t)capacity * HLL_REGISTERS - old_bytes);
+    memset(sketch->hll_out + old_bytes, 0, (size_t)capacity * HLL_REGISTERS - old_bytes);
+    sketch->capacity = capacity;
+}
+
+// 加载和插入交易时更新摘要。分片的工作进程只统计本分片账户作为转出方 / 转入方的一侧，各分片的交易流互不重叠
+void sketch_record(int from_uid, int to_uid, char* from, char* to, double amount)
+{
+    SketchState* sketch = &sketch_state;
+    if (sketch->frozen)
+    {
+        return;
+    }
+    sketch_reserve((from_uid > to_uid ? from_uid : to_uid) + 1);
+    int capacity = heavy_hitter_capacity((from_uid > to_uid ? from_uid : to_uid) + 1);
+    if (capacity > sketch->senders.heavy.capacity)
+    {
+        space_saving_resize(&sketch->senders.heavy, capacity);
+        space_saving_resize(&sketch->receivers.heavy, capacity);
+    }
+    unsigned long long from_hash = account_hash(from);
+    unsigned long long to_hash = account_hash(to);
+    hll_add(sketch->hll_out + (size_t)from_uid * HLL_REGISTERS, to_hash);
+    hll_add(sketch->hll_in + (size_t)to_uid * HLL_REGISTERS, from_hash);
+    if (shard_id < 0 || shard_of(from) == shard_id)
+    {
+        stream_sketch_add(&sketch->senders, from_uid, from_hash, amount);
+    }
+    if (shard_id < 0 || shard_of(to) == shard_id)
+    {
+        stream_sketch_add(&sketch->receivers, to_uid, to_hash, amount);
+    }
+}
+
+/*
+ * 修改Space-Saving的计数器数（取值同heavy_hitter_budget），按tx_columns中的交易重建两侧的表，Count-Min不变。
+ * 滚动窗口不从tx_columns中删除行，重建后的表和增量维护时一样覆盖全部已加载的交易。调用方持写锁
+ */
+void heavy_hitter_configure(HashTable* user_table, int budget)
+{
+    SketchState* sketch = &sketch_state;
+    heavy_hitter_budget = budget;
+    int capacity = heavy_hitter_capacity(user_table->user_count);
+    space_saving_free(&sketch->senders.heavy);
+    space_saving_free(&sketch->receivers.heavy);
+    space_saving_resize(&sketch->senders.heavy, capacity);
+    space_saving_resize(&sketch->receivers.heavy, capacity);
+    for (int row = 0; row < tx_columns.count; row++)
+    {
+        int from = tx_columns.from[row];
+        int to = tx_columns.to[row];
+        if (shard_id < 0 || shard_of(user_table->users[from]->user_id) == shard_id)
+        {
+            space_saving_add(&sketch->senders.heavy, from, tx_columns.amount[row]);
+        }
+        if (shard_id < 0 || shard_of(user_table->users[to]->user_id) == shard_id)
+        {
+            space_saving_add(&sketch->receivers.heavy, to, tx_columns.amount[row]);
+        }
+    }
+}
+
+// 单个账户的摘要：不同对手数的HLL估计和Count-Min估计的转出 / 转入总额，都是O(1)
+void account_sketch(HashTable* user_table, char* account)
+{
+    user* account_user = find_user(user_table, account);
+    if (account_user == 0 || account_user->uid >= sketch_state.capacity)
+    {
+        printf("账号 %s 不存在\n", account);
+        return;
+    }
+    SketchState* sketch = &sketch_state;
+    unsigned long long hash = account_hash(account);
+    printf("账号: %s\n", account);
+    printf("不同转入对手约 %.0lf 个（转入交易 %d 笔），不同转出对手约 %.0lf 个（转出交易 %d 笔），误差约13%%\n",
+    hll_estimate(sketch->hll_in + (size_t)account_user->uid * HLL_REGISTERS), account_user->in_count,
+    hll_estimate(sketch->hll_out + (size_t)account_user->uid * HLL_REGISTERS), account_user->out_count);
+    printf("转出总额不超过 %.2lf，转入总额不超过 %.2lf（高估上界分别为 %.2lf、%.2lf）\n",
+    count_min_estimate(&sketch->senders, hash), count_min_estimate(&sketch->receivers, hash),
+    sketch->senders.total * M_E / SKETCH_WIDTH, sketch->receivers.total * M_E / SKETCH_WIDTH);
+}
+
+/*
+ * 按摘要输出一侧的前k名：Space-Saving和Count-Min都只会高估，取两者较小的作为估计值排序，下界不变。
+ * 第k名以外的账户真实值不超过第k+1名的估计值和表外上界中较大的一个，下界不超过它的账户不一定真在前k名，标出来
+ */
+void print_heavy_hitters(HashTable* table, StreamSketch* sketch, char* title, int k)
+{
+    int count = sketch->heavy.count;
+    HeavyHitter* items = (HeavyHitter*)malloc(sizeof(HeavyHitter) * (count + 1));
+    memcpy(items, sketch->heavy.items, sizeof(HeavyHitter) * count);
+    for (int i = 0; i < count; i++)
+    {
+        double lower = items[i].weight - items[i].error;
+        double upper = count_min_estimate(sketch, account_hash(table->users[items[i].uid]->user_id));
+        if (upper < items[i].weight)
+        {
+            items[i].weight = upper;
+        }
+        items[i].error = items[i].weight - lower;
+    }
+    qsort(items, count, sizeof(HeavyHitter), compare_heavy_hitter);
+    if (k > count)
+    {
+        k = count;
+    }
+    double floor = space_saving_floor(&sketch->heavy);
+    double outside = k < count && items[k].weight > floor ? items[k].weight : floor;
+    int capacity = sketch->heavy.capacity > 0 ? sketch->heavy.capacity : 1;
+    printf("%s最高的前%d个账户（共 %.2lf，%d个计数器，误差不超过 N/m = %.2lf，表外账户不超过 %.2lf）\n", title, k,
+    sketch->total, sketch->heavy.capacity, sketch->total / capacity, floor);
+    int uncertain = 0;
+    for (int i = 0; i < k; i++)
+    {
+        double lower = items[i].weight - items[i].error;
+        printf("%s NO.%d: %s, 约 %.2lf（真实值在 %.2lf ~ %.2lf 之间）%s\n", title, i + 1, table->users[items[i].uid]->user_id,
+        items[i].weight, lower, items[i].weight, lower <= outside ? " *" : "");
+        uncertain += lower <= outside;
+    }
+    if (uncertain > 0)
+    {
+        printf("标*的 %d 个账户下界不超过前%d名以外账户可能的最大值 %.2lf，排名不确定，可在系统设置中增加计数器数\n",
+        uncertain, k, outside);
+    }
+    free(items);
+}
+
+// 全网转出和转入金额最高的账户，k不超过计数器数
+void heavy_hitters(HashTable* user_table, int k)
+{
+    print_heavy_hitters(user_table, &sketch_state.senders, "转出金额", k);
+    print_heavy_hitters(user_table, &sketch_state.receivers, "转入金额", k);
+}
+
+// 读取数据清单，已加载过的分区（按类型和路径）保留标记，格式有误时返回-1
+int read_manifest(char* path)
+{
+    FILE* file = fopen(path, "r");
+    if (file == 0)
+    {
+        printf("清单 %s 不存在\n", path);
+        return -1;
+    }
+    char* slash = strrchr(path, '/');
+    int directory_length = slash == 0 ? 0 : (int)(slash - path) + 1;
+
+    Manifest result = {0, 0};
+    int capacity = 0;
+    char line[1024];
+    int line_count = 0;
+    while (fgets(line, sizeof(line), file))
+    {
+        line_count++;
+        char kind[16], name[768];
+        Partition partition;
+        memset(&partition, 0, sizeof(Partition));
+        partition.first_time = 0;
+        partition.last_time = UINT_MAX;
+        int fields = sscanf(line, "%15s %767s %d %d %u %u", kind, name, &partition.first_block, &partition.last_block,
+        &partition.first_time, &partition.last_time);
+        if (fields <= 0 || kind[0] == '#')
+        {
+            continue;
+        }
+        if ((fields != 4 && fields != 6) || (strcmp(kind, "block") != 0 && strcmp(kind, "tx") != 0)
+            || partition.first_block > partition.last_block)
+        {
+            printf("清单 %s 第%d行格式不正确\n", path, line_count);
+            fclose(file);
+            for (int i = 0; i < result.count; i++)
+            {
+                free(result.partitions[i].path);
+            }
+            free(result.partitions);
+            return -1;
+        }
+        partition.kind = strcmp(kind, "block") == 0 ? PARTITION_BLOCK : PARTITION_TX;
+        partition.path = (char*)malloc(directory_length + strlen(name) + 1);
+        if (name[0] == '/')
+        {
+            strcpy(partition.path, name);
+        }
+        else
+        {
+            memcpy(partition.path, path, directory_length);
+            strcpy(partition.path + directory_length, name);
+        }
+        for (int i = 0; i < manifest.count; i++)
+        {
+            if (manifest.partitions[i].loaded && manifest.partitions[i].kind == partition.kind
+                && strcmp(manifest.partitions[i].path, partition.path) == 0)
+            {
+                partition.loaded = 1;
+            }
+        }
+        if (result.count == capacity)
+        {
+            capacity = capacity == 0 ? 16 : capacity * 2;
+            result.partitions = (Partition*)realloc(result.partitions, sizeof(Partition) * capacity);
+        }
+        result.partitions[result.count++] = partition;
+    }
+    fclose(file);
+
+    for (int i = 0; i < manifest.count; i++)
+    {
+        free(manifest.partitions[i].path);
+    }
+    free(manifest.partitions);
+    manifest = result;
+    return manifest.count;
+}
+
+// 把字符串存入分区的文本区，返回位置
+long partition_text(Partition* partition, char* text)
+{
+    long length = strlen(text) + 1;
+    if (partition->text_length + length > partition->text_capacity)
+    {
+        partition->text_capacity = (partition->text_length + length) * 2;
+        partition->text = (char*)realloc(partition->text, partition->text_capacity);
+    }
+    long position = partition->text_length;
+    memcpy(partition->text + position, text, length);
+    partition->text_length += length;
+    return position;
+}
+
+// 读取线程：把分区文件解析到内存（不碰共享数据），文件不存在时返回0
+int partition_read(Partition* partition)
+{
+    InputStream* in = input_open(partition->path);
+    if (in == 0)
+    {
+        printf("分区 %s 不存在或无法读取\n", partition->path);
+        return 0;
+    }
+    char line[1024];
+    int line_count = 0;
+    while (input_gets(line, sizeof(line), in))
+    {
+        line_count++;
+        if (line_count == 1)
+        {
+            continue;
+        }
+        if (partition->count == partition->capacity)
+        {
+            partition->capacity = partition->capacity == 0 ? 4096 : partition->capacity * 2;
+            partition->rows = (PartitionRow*)realloc(partition->rows, sizeof(PartitionRow) * partition->capacity);
+        }
+        PartitionRow* row = &partition->rows[partition->count];
+        if (partition->kind == PARTITION_BLOCK)
+        {
+            char* hash;
+            if (!parse_block_line(line, &row->id, &hash, &row->time))
+            {
+                continue;
+            }
+            row->from = partition_text(partition, hash);
+        }
+        else
+        {
+            char* from;
+            char* to;
+            if (!parse_transaction_line(line, &row->id, &row->block, &from, &row->amount, &to))
+            {
+                continue;
+            }
+            row->from = partition_text(partition, from);
+            row->to = partition_text(partition, to);
+        }
+        partition->count++;
+    }
+    input_close(in);
+    return 1;
+}
+
+/*
+ * 按行的顺序插入一个已读入的分区（分批持写锁）。区块号不大于已有最大区块号的区块、
+ * tx_id已存在的交易视为已加载，所在区块不存在的交易无法插入，都计入skipped。
+ */
+void partition_apply(Partition* partition, Block* head, HashTable* user_table, long* added, long* skipped)
+{
+    IngestRow* rows = (IngestRow*)malloc(sizeof(IngestRow) * INGEST_BATCH);
+    int row_count = 0;
+    pthread_rwlock_wrlock(&data_lock);
+    for (int i = 0; i < partition->count; i++)
+    {
+        PartitionRow* row = &partition->rows[i];
+        if (partition->kind == PARTITION_BLOCK)
+        {
+            int last_block = block_index.count > 0 ? block_index.blocks[block_index.count - 1]->blockID : 0;
+            if (row->id <= last_block)
+            {
+                (*skipped)++;
+            }
+            else
+            {
+                insertBlock(head, row->id, partition->text + row->from, row->time);
+                (*added)++;
+            }
+        }
+        else if (tx_index_find(row->id) != -1 || find_block(row->block) == 0)
+        {
+            (*skipped)++;
+        }
+        else
+        {
+            IngestRow* ingest = &rows[row_count++];
+            ingest->row = tx_columns.count + row_count;
+            ingest->tx_id = row->id;
+            ingest->blockID = row->block;
+            ingest->from = partition->text + row->from;
+            ingest->to = partition->text + row->to;
+            ingest->amount = row->amount;
+            (*added)++;
+        }
+
+        if (row_count == INGEST_BATCH || i + 1 == partition->count)
+        {
+            if (row_count > 0)
+            {
+                ingest_batch(find_block(rows[0].blockID), user_table, rows, row_count);
+                row_count = 0;
+            }
+        }
+        if ((i + 1) % LOAD_BATCH == 0)
+        {
+            storage_trim();
+            data_version++;
+            pthread_rwlock_unlock(&data_lock);
+            pthread_rwlock_wrlock(&data_lock);
+        }
+    }
+    data_version++;
+    pthread_rwlock_unlock(&data_lock);
+    free(rows);
+}
+
+void* partition_reader(void* arg)
+{
+    ManifestLoad* load = (ManifestLoad*)arg;
+    while (1)
+    {
+        pthread_mutex_lock(&load->lock);
+        while (load->next < load->count && load->next >= load->applied + load->readers + 1)
+        {
+            pthread_cond_wait(&load->changed, &load->lock);
+        }
+        if (load->next >= load->count)
+        {
+            pthread_mutex_unlock(&load->lock);
+            break;
+        }
+        Partition* partition = load->order[load->next++];
+        pthread_mutex_unlock(&load->lock);
+
+        partition->failed = !partition_read(partition);
+        pthread_mutex_lock(&load->lock);
+        partition->ready = 1;
+        pthread_cond_broadcast(&load->changed);
+        pthread_mutex_unlock(&load->lock);
+    }
+    return 0;
+}
+
+// 按区块顺序比较分区，同一区块范围保持清单中的顺序
+int compare_partition(const void* a, const void* b)
+{
+    Partition* x = *(Partition**)a;
+    Partition* y = *(Partition**)b;
+    if (x->first_block != y->first_block)
+    {
+        return (x->first_block > y->first_block) - (x->first_block < y->first_block);
+    }
+    return (x > y) - (x < y);
+}
+
+// 读取线程并行读入各分区，调用线程按区块顺序插入，插入完的分区随即释放
+void load_partitions(Partition** order, int count, Block* head, HashTable* user_table, long* added, long* skipped)
+{
+    if (count == 0)
+    {
+        return;
+    }
+    qsort(order, count, sizeof(Partition*), compare_partition);
+    for (int i = 1; i < count; i++)
+    {
+        if (order[i]->first_block <= order[i - 1]->last_block)
+        {
+            printf("分区 %s 与 %s 的区块范围重叠，按区块号较小的先插入\n", order[i - 1]->path, order[i]->path);
+        }
+    }
+
+    ManifestLoad load;
+    load.order = order;
+    load.count = count;
+    load.next = 0;
+    load.applied = 0;
+    load.readers = runtime_threads() < count ? runtime_threads() : count;
+    pthread_mutex_init(&load.lock, 0);
+    pthread_cond_init(&load.changed, 0);
+    pthread_t* readers = (pthread_t*)malloc(sizeof(pthread_t) * load.readers);
+    for (int i = 0; i < load.readers; i++)
+    {
+        pthread_create(&readers[i], 0, partition_reader, &load);
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        Partition* partition = order[i];
+        pthread_mutex_lock(&load.lock);
+        while (!partition->ready)
+        {
+            pthread_cond_wait(&load.changed, &load.lock);
+        }
+        pthread_mutex_unlock(&load.lock);
+
+        if (!partition->failed)
+        {
+            partition_apply(partition, head, user_table, added, skipped);
+            partition->loaded = 1;
+        }
+        free(partition->rows);
+        free(partition->text);
+        partition->rows = 0;
+        partition->text = 0;
+        partition->count = partition->capacity = 0;
+        partition->text_length = partition->text_capacity = 0;
+        partition->ready = 0;
+
+        pthread_mutex_lock(&load.lock);
+        load.applied++;
+        pthread_cond_broadcast(&load.changed);
+        pthread_mutex_unlock(&load.lock);
+
+        // 交易分区按区块顺序插入，下一个分区之前的区块都已加载完
+        if (partition->kind == PARTITION_TX && load_state.head != 0 && !load_state.done)
+        {
+            pthread_rwlock_wrlock(&data_lock);
+            Block* next = i + 1 < count ? find_block(order[i + 1]->first_block) : 0;
+            publish_load_progress(next != 0 ? next->index : block_index.count, load_state.bytes_read + partition->file_size);
+            pthread_rwlock_unlock(&data_lock);
+        }
+    }
+
+    for (int i = 0; i < load.readers; i++)
+    {
+        pthread_join(readers[i], 0);
+    }
+    free(readers);
+    pthread_mutex_destroy(&load.lock);
+    pthread_cond_destroy(&load.changed);
+}
+
+/*
+ * 按清单加载未加载过的分区：先加载全部区块分区，再加载与 [time_start, time_end] 相交的交易分区
+ * （没有给出时间的交易分区按其首末区块的时间戳判断）。重复加载同一清单只会插入新增的分区和行。
+ * 区块只能按区块号递增追加，区块号不大于已有区块的新区块分区不加载，也不标记为已加载。
+ */
+void load_manifest(char* path, Block* head, HashTable* user_table, unsigned time_start, unsigned time_end)
+{
+    if (read_manifest(path) < 0)
+    {
+        pthread_rwlock_wrlock(&data_lock);
+        load_state.blocks_done = 1;
+        pthread_rwlock_unlock(&data_lock);
+        return;
+    }
+    Partition** order = (Partition**)malloc(sizeof(Partition*) * (manifest.count + 1));
+    long added[2] = {0, 0};
+    long skipped = 0;
+    int loaded = 0;
+    int out_of_range = 0;
+
+    int count = 0;
+    for (int i = 0; i < manifest.count; i++)
+    {
+        Partition* partition = &manifest.partitions[i];
+        if (partition->kind != PARTITION_BLOCK || partition->loaded)
+        {
+            continue;
+        }
+        pthread_rwlock_rdlock(&data_lock);
+        int last_block = block_index.count > 0 ? block_index.blocks[block_index.count - 1]->blockID : 0;
+        pthread_rwlock_unlock(&data_lock);
+        if (partition->first_block <= last_block)
+        {
+            printf("区块分区 %s 的区块号不大于已加载的区块 %d，不加载\n", partition->path, last_block);
+            continue;
+        }
+        order[count++] = partition;
+    }
+    loaded += count;
+    load_partitions(order, count, head, user_table, &added[0], &skipped);
+    pthread_rwlock_wrlock(&data_lock);
+    load_state.blocks_done = 1;
+    pthread_rwlock_unlock(&data_lock);
+
+    count = 0;
+    long total_size = 0;
+    pthread_rwlock_rdlock(&data_lock);
+    for (int i = 0; i < manifest.count; i++)
+    {
+        Partition* partition = &manifest.partitions[i];
+        if (partition->kind != PARTITION_TX || partition->loaded)
+        {
+            continue;
+        }
+        unsigned first_time = partition->first_time;
+        unsigned last_time = partition->last_time;
+        Block* first = find_block(partition->first_block);
+        Block* last = find_block(partition->last_block);
+        if (first_time == 0 && last_time == UINT_MAX && first != 0 && last != 0)
+        {
+            first_time = first->block_timestamp;
+            last_time = block_index.max_timestamp[last->index];
+        }
+        if (last_time < time_start || first_time > time_end)
+        {
+            out_of_range++;
+            continue;
+        }
+        double mtime;
+        partition->file_size = 0;
+        file_status(partition->path, &partition->file_size, &mtime);
+        total_size += partition->file_size;
+        order[count++] = partition;
+    }
+    pthread_rwlock_unlock(&data_lock);
+    load_state.file_size += total_size;
+    loaded += count;
+    load_partitions(order, count, head, user_table, &added[1], &skipped);
+    free(order);
+
+    if (show_progress)
+    {
+        printf("已按清单 %s 加载 %d 个分区（时间段外跳过 %d 个），新增 %ld 个区块、%ld 笔交易，跳过已有或无法插入的 %ld 行\n",
+        path, loaded, out_of_range, added[0], added[1], skipped);
+    }
+}
+
+// 按清单加载新的分区，可只加载某个时间段（数据插入的批量版本）
+void manifest_menu(Block* head, HashTable* user_table)
+{
+    char path[512];
+    unsigned start, end;
+    printf("输入数据清单文件: \n");
+    scanf("%511s", path);
+    printf("请输入开始时间（0表示不限）: \n");
+    scanf("%u", &start);
+    printf("请输入结束时间（0表示不限）: \n");
+    scanf("%u", &end);
+    wait_load_finished();
+    double begin = now_seconds();
+    load_manifest(path, head, user_table, start, end == 0 ? UINT_MAX : end);
+    printf("区块数: %d\n交易数: %d\n用户数: %d\n", calc_block, calc_transaction, calc_user);
+    printf("运行时间: %.3f 秒\n\n", now_seconds() - begin);
+}
+
+// 增加新的交易
+void add_new_transaction(Block* list, HashTable* user_list, char* file_name)
+{
+    printf("更新区块链和交易网络中，请稍等...\n");
+
+    int tx_id;
+    int blockID;
+    char* from;
+    char* to;
+    double amount;
+
+    InputStream* file = input_open(file_name);
+    if (file == 0)
+    {
+        return;
+    }
+    pthread_rwlock_wrlock(&data_lock);
+
+    // 逐行读取CSV文件
+    char line[512];
+    int lineCount = 0;
+    while (input_gets(line, sizeof(line), file))
+    {
+        lineCount++;
+        if (lineCount == 1)
+        {
+            continue;
+        }
+        if (!parse_transaction_line(line, &tx_id, &blockID, &from, &amount, &to))
+        {
+            continue; // 忽略空行
+        }
+
+        list = apply_transaction(list, user_list, tx_id, blockID, from, amount, to);
+        wal_log_transaction(WAL_ROW_TRANSACTION, tx_id, blockID, from, amount, to);
+
+        // 每批提交一次日志再释放写锁，查询能看到的交易都已落盘
+        if (lineCount % LOAD_BATCH == 0)
+        {
+            wal_commit();
+            storage_trim();
+            data_version++;
+            pthread_rwlock_unlock(&data_lock);
+            pthread_rwlock_wrlock(&data_lock);
+        }
+    }
+
+    // 关闭文件
+    input_close(file);
+    wal_commit();
+    data_version++;
+    pthread_rwlock_unlock(&data_lock);
+
+    printf("区块链和交易网络更新已完成!\n");
+    printf("区块数: %d\n交易数: %d\n用户数: %d\n", calc_block, calc_transaction, calc_user);
+    
+    end_time = clock();
+    double elapsed_time = (double)(end_time - start_time) / CLOCKS_PER_SEC;
+    printf("运行时间: %.3f 秒\n", elapsed_time);
+}
+
+void sleep_ms(int ms)
+{
+#ifdef _WIN32
+    Sleep(ms);
+#else
+    usleep(ms * 1000);
+#endif
+}
+
+// 墙上时钟（秒），与文件修改时间比较用
+double wall_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// 文件大小和修改时间，文件不存在时返回0
+int file_status(char* path, long* size, double* mtime)
+{
+    struct stat st;
+    if (stat(path, &st) != 0)
+    {
+        return 0;
+    }
+    *size = (long)st.st_size;
+#ifdef __linux__
+    *mtime = (double)st.st_mtim.tv_sec + (double)st.st_mtim.tv_nsec / 1e9;
+#else
+    *mtime = (double)st.st_mtime;
+#endif
+    return 1;
+}
+
+// 从offset开始读取至多max_lines个完整的行，末尾没有换行符的半行留到下次。超过缓冲区的行不是合法记录，读完整行后跳过
+int follow_read(char* path, long* offset, char** lines, int max_lines)
+{
+    FILE* file = fopen(path, "r");
+    if (file == 0)
+    {
+        return 0;
+    }
+    fseek(file, *offset, SEEK_SET);
+
+    char line[1024];
+    int count = 0;
+    while (count < max_lines && fgets(line, sizeof(line), file))
+    {
+        int len = strlen(line);
+        if (len == (int)sizeof(line) - 1 && line[len - 1] != '\n')
+        {
+            int c;
+            while ((c = fgetc(file)) != EOF && c != '\n')
+            {
+            }
+            if (c == EOF)
+            {
+                break;
+            }
+            printf("%s 偏移 %ld 处的行过长，已跳过\n", path, *offset);
+            *offset = ftell(file);
+            continue;
+        }
+        if (len == 0 || line[len - 1] != '\n')
+        {
+            break;
+        }
+        *offset = ftell(file);
+        lines[count++] = strdup(line);
+    }
+    fclose(file);
+    return count;
+}
+
+// 所在区块尚未到达时先挂起交易
+void follow_defer(FollowState* state, int tx_id, int blockID, char* from, double amount, char* to)
+{
+    if (state->pending_count == state->pending_capacity)
+    {
+        state->pending_capacity = state->pending_capacity == 0 ? 256 : state->pending_capacity * 2;
+        state->pending = (PendingTransaction*)realloc(state->pending, sizeof(PendingTransaction) * state->pending_capacity);
+    }
+    PendingTransaction* pending = &state->pending[state->pending_count++];
+    pending->tx_id = tx_id;
+    pending->blockID = blockID;
+    pending->from = strdup(from);
+    pending->amount = amount;
+    pending->to = strdup(to);
+}
+
+// 补上所在区块已到达的挂起交易（在写锁内调用）
+void follow_resolve_pending(FollowState* state, HashTable* user_table)
+{
+    int kept = 0;
+    for (int i = 0; i < state->pending_count; i++)
+    {
+        PendingTransaction* pending = &state->pending[i];
+        Block* block = find_block(pending->blockID);
+        if (block == 0)
+        {
+            state->pending[kept++] = *pending;
+            continue;
+        }
+        apply_transaction(block, user_table, pending->tx_id, pending->blockID, pending->from, pending->amount, pending->to);
+        state->applied_transactions++;
+        free(pending->from);
+        free(pending->to);
+    }
+    state->pending_count = kept;
+}
+
+/*
+ * 在写锁内应用一批新行：先区块，再补上之前挂起的交易，最后是新交易。
+ * 同时提交读到的文件位置和预写日志，并记录文件最近一次写入（written）到数据可查询的延迟。
+ */
+void follow_apply(FollowState* state, char** block_lines, int block_count, char** tx_lines, int tx_count,
+    long block_offset, long tx_offset, double written)
+{
+    int blockID, tx_id;
+    char *hash, *from, *to;
+    unsigned time_stamp;
+    double amount;
+
+    pthread_rwlock_wrlock(&data_lock);
+    for (int i = 0; i < block_count; i++)
+    {
+        if (parse_block_line(block_lines[i], &blockID, &hash, &time_stamp))
+        {
+            hash[strcspn(hash, "\r\n")] = '\0';
+            insertBlock(state->head, blockID, hash, time_stamp);
+            wal_log_block(blockID, hash, time_stamp);
+            state->applied_blocks++;
+        }
+    }
+
+    follow_resolve_pending(state, state->user_table);
+
+    for (int i = 0; i < tx_count; i++)
+    {
+        if (!parse_transaction_line(tx_lines[i], &tx_id, &blockID, &from, &amount, &to))
+        {
+            continue;
+        }
+        Block* block = find_block(blockID);
+        if (block == 0)
+        {
+            follow_defer(state, tx_id, blockID, from, amount, to);
+            wal_log_transaction(WAL_ROW_DEFERRED, tx_id, blockID, from, amount, to);
+            continue;
+        }
+        apply_transaction(block, state->user_table, tx_id, blockID, from, amount, to);
+        wal_log_transaction(WAL_ROW_TRANSACTION, tx_id, blockID, from, amount, to);
+        state->applied_transactions++;
+    }
+
+    block_file_offset = block_offset;
+    transaction_file_offset = tx_offset;
+    wal_commit();
+    storage_trim();
+    data_version++;
+    state->batches++;
+    double lag = wall_seconds() - written;
+    state->last_lag = lag > 0 ? lag : 0;
+    if (state->last_lag > state->max_lag)
+    {
+        state->max_lag = state->last_lag;
+    }
+    pthread_rwlock_unlock(&data_lock);
+}
+
+// 跟踪线程：有inotify时等待文件修改事件，否则定时轮询文件大小
+void* follow_worker(void* arg)
+{
+    FollowState* state = (FollowState*)arg;
+    show_progress = 0;
+    char** block_lines = (char**)malloc(sizeof(char*) * FOLLOW_BATCH);
+    char** tx_lines = (char**)malloc(sizeof(char*) * FOLLOW_BATCH);
+
+    int watch_fd = -1;
+#ifdef __linux__
+    watch_fd = inotify_init1(IN_NONBLOCK);
+    if (watch_fd >= 0 && (inotify_add_watch(watch_fd, block_file, IN_MODIFY | IN_CLOSE_WRITE) < 0
+        || inotify_add_watch(watch_fd, transaction_file, IN_MODIFY | IN_CLOSE_WRITE) < 0))
+    {
+        close(watch_fd);
+        watch_fd = -1;
+    }
+#endif
+    state->use_inotify = watch_fd >= 0;
+
+    // 读取位置只由本线程推进，批次应用时再提交到全局
+    long block_offset = block_file_offset;
+    long tx_offset = transaction_file_offset;
+    while (!__atomic_load_n(&state->stop, __ATOMIC_ACQUIRE))
+    {
+        long block_size = 0, tx_size = 0;
+        double block_mtime = 0, tx_mtime = 0;
+        file_status(block_file, &block_size, &block_mtime);
+        file_status(transaction_file, &tx_size, &tx_mtime);
+        int block_count = 0, tx_count = 0;
+        if (block_size > block_offset)
+        {
+            block_count = follow_read(block_file, &block_offset, block_lines, FOLLOW_BATCH);
+        }
+        if (tx_size > tx_offset)
+        {
+            tx_count = follow_read(transaction_file, &tx_offset, tx_lines, FOLLOW_BATCH);
+        }
+
+        if (block_count > 0 || tx_count > 0)
+        {
+            // 以本批涉及文件中较晚的一次写入计算延迟
+            double written = 0;
+            if (block_count > 0 && block_mtime > written)
+            {
+                written = block_mtime;
+            }
+            if (tx_count > 0 && tx_mtime > written)
+            {
+                written = tx_mtime;
+            }
+            follow_apply(state, block_lines, block_count, tx_lines, tx_count, block_offset, tx_offset, written);
+            for (int i = 0; i < block_count; i++)
+            {
+                free(block_lines[i]);
+            }
+            for (int i = 0; i < tx_count; i++)
+            {
+                free(tx_lines[i]);
+            }
+            if (block_count == FOLLOW_BATCH || tx_count == FOLLOW_BATCH)
+            {
+                continue;  // 还有没读完的行
+            }
+        }
+
+#ifdef __linux__
+        if (watch_fd >= 0)
+        {
+            struct pollfd descriptor = {watch_fd, POLLIN, 0};
+            if (poll(&descriptor, 1, FOLLOW_POLL_MS) > 0)
+            {
+                char events[4096];
+                while (read(watch_fd, events, sizeof(events)) > 0)
+                {
+                }
+            }
+            continue;
+        }
+#endif
+        sleep_ms(FOLLOW_POLL_MS);
+    }
+
+#ifdef __linux__
+    if (watch_fd >= 0)
+    {
+        close(watch_fd);
+    }
+#endif
+    free(block_lines);
+    free(tx_lines);
+    return 0;
+}
+
+void start_follow(Block* head, HashTable* user_table)
+{
+    if (follow_state.running)
+    {
+        printf("已在跟踪中\n");
+        return;
+    }
+    // 跟踪从默认数据文件上次读到的偏移继续读，按清单启动时没有读过这两个文件，从头读会重复插入区块
+    if (manifest_file != 0)
+    {
+        printf("按数据清单加载时不支持跟踪，请用清单加载新的分区\n");
+        return;
+    }
+    // 跟踪按文件偏移读取追加的行，压缩文件做不到
+    if (input_format(block_file) > INPUT_PLAIN || input_format(transaction_file) > INPUT_PLAIN)
+    {
+        printf("压缩的数据文件不支持跟踪\n");
+        return;
+    }
+    wait_load_finished();
+    follow_state.head = head;
+    follow_state.user_table = user_table;
+    follow_state.stop = 0;
+    follow_state.running = 1;
+    follow_state.started = now_seconds();
+    pthread_create(&follow_state.thread, 0, follow_worker, &follow_state);
+    printf("开始跟踪 %s 和 %s 的追加内容\n", block_file, transaction_file);
+}
+
+void stop_follow()
+{
+    if (!follow_state.running)
+    {
+        printf("当前未在跟踪\n");
+        return;
+    }
+    __atomic_store_n(&follow_state.stop, 1, __ATOMIC_RELEASE);
+    pthread_join(follow_state.thread, 0);
+    follow_state.running = 0;
+    printf("已停止跟踪\n");
+}
+
+void follow_status()
+{
+    pthread_rwlock_rdlock(&data_lock);
+    printf("跟踪状态: %s", follow_state.running ? "运行中" : "已停止");
+    if (follow_state.running)
+    {
+        printf("（%s，已运行 %.0f 秒）", follow_state.use_inotify ? "inotify" : "轮询", now_seconds() - follow_state.started);
+    }
+    printf("\n已应用: %ld 批，%ld 个区块，%ld 笔交易\n", follow_state.batches, follow_state.applied_blocks, follow_state.applied_transactions);
+    printf("等待所在区块的交易: %d 笔\n", follow_state.pending_count);
+    printf("数据可查询延迟: 最近 %.3f 秒，最大 %.3f 秒\n", follow_state.last_lag, follow_state.max_lag);
+    printf("读取位置: %s %ld 字节，%s %ld 字节\n", block_file, block_file_offset, transaction_file, transaction_file_offset);
+    printf("区块数: %d\n交易数: %d\n用户数: %d\n", calc_block, calc_transaction, calc_user);
+    pthread_rwlock_unlock(&data_lock);
+}
+
+// CRC32（IEEE多项式），用于校验预写日志和快照
+unsigned crc32_update(unsigned crc, const void* data, size_t length)
+{
+    static unsigned table[256];
+    static int table_ready = 0;
+    if (!table_ready)
+    {
+        for (unsigned i = 0; i < 256; i++)
+        {
+            unsigned c = i;
+            for (int k = 0; k < 8; k++)
+            {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+        table_ready = 1;
+    }
+    const unsigned char* bytes = (const unsigned char*)data;
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++)
+    {
+        crc = table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+// 将文件内容刷到磁盘，失败时返回0
+int sync_file(FILE* file)
+{
+    if (fflush(file) != 0)
+    {
+        return 0;
+    }
+#ifdef _WIN32
+    return _commit(_fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+void truncate_file(char* path, long size)
+{
+#ifdef _WIN32
+    FILE* file = fopen(path, "r+b");
+    if (file != 0)
+    {
+        _chsize(_fileno(file), size);
+        fclose(file);
+    }
+#else
+    if (truncate(path, size) != 0)
+    {
+        printf("截断文件 %s 失败\n", path);
+    }
+#endif
+}
+
+// 向日志缓冲追加字节
+void wal_put(void* data, int length)
+{
+    if (wal_batch.length + length > wal_batch.capacity)
+    {
+        wal_batch.capacity = (wal_batch.length + length) * 2;
+        wal_batch.data = (char*)realloc(wal_batch.data, wal_batch.capacity);
+    }
+    memcpy(wal_batch.data + wal_batch.length, data, length);
+    wal_batch.length += length;
+}
+
+void wal_put_string(char* text)
+{
+    unsigned short length = (unsigned short)strlen(text);
+    wal_put(&length, sizeof(unsigned short));
+    wal_put(text, length);
+}
+
+// 批次的第一行记下应用前的文件位置
+void wal_begin_row()
+{
+    if (wal_batch.rows == 0)
+    {
+        wal_batch.base_block_offset = block_file_offset;
+        wal_batch.base_transaction_offset = transaction_file_offset;
+    }
+    wal_batch.rows++;
+}
+
+// 记录一个已应用的区块（在写锁内调用）
+void wal_log_block(int blockID, char* hash, unsigned time_stamp)
+{
+    unsigned char kind = WAL_ROW_BLOCK;
+    wal_begin_row();
+    wal_put(&kind, 1);
+    wal_put(&blockID, sizeof(int));
+    wal_put(&time_stamp, sizeof(unsigned));
+    wal_put_string(hash);
+}
+
+// 记录一笔已应用（WAL_ROW_TRANSACTION）或挂起（WAL_ROW_DEFERRED）的交易（在写锁内调用）
+void wal_log_transaction(int kind, int tx_id, int blockID, char* from, double amount, char* to)
+{
+    unsigned char row_kind = (unsigned char)kind;
+    wal_begin_row();
+    wal_put(&row_kind, 1);
+    wal_put(&tx_id, sizeof(int));
+    wal_put(&blockID, sizeof(int));
+    wal_put(&amount, sizeof(double));
+    wal_put_string(from);
+    wal_put_string(to);
+}
+
+/*
+ * 组提交：把一个写锁批次中的行作为一条带校验的记录追加到日志，每批只fsync一次。
+ * 写者在释放写锁前提交，所以查询能看到的数据在崩溃后都能恢复。
+ */
+void wal_commit()
+{
+    if (wal_batch.rows == 0)
+    {
+        return;
+    }
+    if (wal_handle == 0)
+    {
+        wal_handle = fopen(wal_file, "ab");
+        if (wal_handle == 0)
+        {
+            printf("无法打开预写日志 %s\n", wal_file);
+            wal_batch.rows = 0;
+            wal_batch.length = 0;
+            return;
+        }
+    }
+
+    WalHeader header;
+    header.magic = WAL_MAGIC;
+    header.length = wal_batch.length;
+    header.rows = wal_batch.rows;
+    header.crc = crc32_update(0, wal_batch.data, wal_batch.length);
+    header.sequence = ++wal_sequence;
+    header.base_block_offset = wal_batch.base_block_offset;
+    header.base_transaction_offset = wal_batch.base_transaction_offset;
+    header.block_offset = block_file_offset;
+    header.transaction_offset = transaction_file_offset;
+    long committed = ftell(wal_handle);
+    if (fwrite(&header, sizeof(WalHeader), 1, wal_handle) != 1
+        || fwrite(wal_batch.data, 1, wal_batch.length, wal_handle) != (size_t)wal_batch.length
+        || !sync_file(wal_handle))
+    {
+        // 截掉写了一半的记录，否则重放停在这里，之后追加的记录都会丢失
+        printf("写入预写日志 %s 失败，本批 %d 行修改没有持久化\n", wal_file, wal_batch.rows);
+        fclose(wal_handle);
+        wal_handle = 0;
+        if (committed >= 0)
+        {
+            truncate_file(wal_file, committed);
+        }
+        wal_sequence--;
+    }
+
+    wal_batch.rows = 0;
+    wal_batch.length = 0;
+}
+
+// 从缓冲中读取长度前缀的字符串，超出记录末尾或放不进缓冲时返回0
+char* wal_get_string(char** cursor, char* end, char* buffer, int size)
+{
+    unsigned short length;
+    if (end - *cursor < (long)sizeof(unsigned short))
+    {
+        return 0;
+    }
+    memcpy(&length, *cursor, sizeof(unsigned short));
+    if (length >= size || end - *cursor - (long)sizeof(unsigned short) < length)
+    {
+        return 0;
+    }
+    memcpy(buffer, *cursor + sizeof(unsigned short), length);
+    buffer[length] = '\0';
+    *cursor += sizeof(unsigned short) + length;
+    return buffer;
+}
+
+/*
+ * 重放一条日志记录，顺序与follow_apply相同：先区块，再补上挂起的交易，最后按原顺序处理交易行。
+ * 补上挂起交易的结果是确定的，所以日志中不再单独记录它们。
+ * 先检查整条记录的长度，有越界的行时整条拒绝、一行也不应用，返回0。
+ */
+int wal_replay_record(char* data, int length, Block* head, HashTable* user_table)
+{
+    char* end = data + length;
+    char hash[1024], from[1024], to[1024];
+    int tx_id, blockID;
+    unsigned time_stamp;
+    double amount;
+
+    char* cursor = data;
+    while (cursor < end)
+    {
+        int block_row = *cursor == WAL_ROW_BLOCK;
+        long fixed = block_row ? 1 + sizeof(int) + sizeof(unsigned) : 1 + 2 * sizeof(int) + sizeof(double);
+        if (end - cursor < fixed)
+        {
+            return 0;
+        }
+        cursor += fixed;
+        if (wal_get_string(&cursor, end, from, sizeof(from)) == 0
+            || (!block_row && wal_get_string(&cursor, end, to, sizeof(to)) == 0))
+        {
+            return 0;
+        }
+    }
+
+    int has_blocks = 0;
+    cursor = data;
+    while (cursor < end && *cursor == WAL_ROW_BLOCK)
+    {
+        memcpy(&blockID, cursor + 1, sizeof(int));
+        memcpy(&time_stamp, cursor + 1 + sizeof(int), sizeof(unsigned));
+        cursor += 1 + sizeof(int) + sizeof(unsigned);
+        insertBlock(head, blockID, wal_get_string(&cursor, end, hash, sizeof(hash)), time_stamp);
+        has_blocks = 1;
+    }
+    if (has_blocks)
+    {
+        follow_resolve_pending(&follow_state, user_table);
+    }
+
+    while (cursor < end)
+    {
+        int kind = *cursor;
+        memcpy(&tx_id, cursor + 1, sizeof(int));
+        memcpy(&blockID, cursor + 1 + sizeof(int), sizeof(int));
+        memcpy(&amount, cursor + 1 + 2 * sizeof(int), sizeof(double));
+        cursor += 1 + 2 * sizeof(int) + sizeof(double);
+        wal_get_string(&cursor, end, from, sizeof(from));
+        wal_get_string(&cursor, end, to, sizeof(to));
+        if (kind == WAL_ROW_DEFERRED)
+        {
+            follow_defer(&follow_state, tx_id, blockID, from, amount, to);
+            continue;
+        }
+        Block* block = find_block(blockID);
+        if (block == 0)
+        {
+            printf("预写日志中的交易 %d 所在区块 %d 不存在，已跳过\n", tx_id, blockID);
+            continue;
+        }
+        apply_transaction(block, user_table, tx_id, blockID, from, amount, to);
+    }
+    return 1;
+}
+
+// 读取日志第一条完整记录应用前的文件位置，没有日志时两者为0
+void wal_base_offsets(long* block_limit, long* transaction_limit)
+{
+    *block_limit = 0;
+    *transaction_limit = 0;
+    FILE* file = fopen(wal_file, "rb");
+    if (file == 0)
+    {
+        return;
+    }
+    WalHeader header;
+    if (fread(&header, sizeof(WalHeader), 1, file) == 1 && header.magic == WAL_MAGIC)
+    {
+        *block_limit = (long)header.base_block_offset;
+        *transaction_limit = (long)header.base_transaction_offset;
+    }
+    fclose(file);
+}
+
+/*
+ * 重放快照之后的日志记录（在写锁内调用）。遇到不完整或校验失败的记录说明上次在写日志时崩溃，
+ * 从这里截断日志，后续追加从干净的位置开始。
+ */
+void wal_replay(Block* head, HashTable* user_table)
+{
+    FILE* file = fopen(wal_file, "rb");
+    if (file == 0)
+    {
+        return;
+    }
+
+    int records = 0;
+    long rows = 0;
+    long good_size = 0;
+    char* data = 0;
+    WalHeader header;
+    while (fread(&header, sizeof(WalHeader), 1, file) == 1)
+    {
+        if (header.magic != WAL_MAGIC)
+        {
+            break;
+        }
+        data = (char*)realloc(data, header.length + 1);
+        if (fread(data, 1, header.length, file) != header.length
+            || crc32_update(0, data, header.length) != header.crc)
+        {
+            break;
+        }
+        if (header.sequence <= wal_sequence)
+        {
+            good_size = ftell(file);
+            continue;  // 已包含在快照中
+        }
+        if (!wal_replay_record(data, header.length, head, user_table))
+        {
+            printf("预写日志第 %d 条记录中的字符串长度越界，从这里起不再重放\n", records + 1);
+            break;
+        }
+        good_size = ftell(file);
+        wal_sequence = header.sequence;
+        block_file_offset = header.block_offset;
+        transaction_file_offset = header.transaction_offset;
+        records++;
+        rows += header.rows;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+    free(data);
+
+    if (size > good_size)
+    {
+        printf("预写日志末尾有 %ld 字节不完整的记录，已截断\n", size - good_size);
+        truncate_file(wal_file, good_size);
+    }
+    if (records > 0)
+    {
+        printf("已重放预写日志: %d 批，%ld 行\n", records, rows);
+    }
+}
+
+// 带CRC的顺序读写，用于快照
+void snapshot_write(FILE* file, unsigned* crc, void* data, size_t length)
+{
+    fwrite(data, 1, length, file);
+    *crc = crc32_update(*crc, data, length);
+}
+
+int snapshot_read(FILE* file, unsigned* crc, void* data, size_t length)
+{
+    if (fread(data, 1, length, file) != length)
+    {
+        return 0;
+    }
+    *crc = crc32_update(*crc, data, length);
+    return 1;
+}
+
+void snapshot_write_string(FILE* file, unsigned* crc, char* text)
+{
+    unsigned short length = (unsigned short)strlen(text);
+    snapshot_write(file, crc, &length, sizeof(unsigned short));
+    snapshot_write(file, crc, text, length);
+}
+
+/*
+ * 读取长度前缀的字符串。长度放不进缓冲时快照已无法使用：前面的部分已经加载，
+ * 不能再退回从CSV初始化，只能报错退出，让用户删掉快照重新启动。
+ */
+int snapshot_read_string(FILE* file, unsigned* crc, char* buffer, int size)
+{
+    unsigned short length;
+    if (!snapshot_read(file, crc, &length, sizeof(unsigned short)))
+    {
+        return 0;
+    }
+    if (length >= size)
+    {
+        printf("快照 %s 中有长度为 %d 的字符串，超出缓冲，请删除快照后重新启动\n", snapshot_file, length);
+        exit(1);
+    }
+    if (!snapshot_read(file, crc, buffer, length))
+    {
+        return 0;
+    }
+    buffer[length] = '\0';
+    return 1;
+}
+
+// 流式摘要：总额、Count-Min，Space-Saving只写计数器数、被替换的上界和表中的账户，索引读回后重建
+void snapshot_write_sketch(FILE* file, unsigned* crc, StreamSketch* sketch)
+{
+    snapshot_write(file, crc, &sketch->total, sizeof(double));
+    snapshot_write(file, crc, sketch->count_min, sizeof(sketch->count_min));
+    snapshot_write(file, crc, &sketch->heavy.capacity, sizeof(int));
+    snapshot_write(file, crc, &sketch->heavy.count, sizeof(int));
+    snapshot_write(file, crc, &sketch->heavy.evicted, sizeof(double));
+    snapshot_write(file, crc, sketch->heavy.items, sizeof(HeavyHitter) * sketch->heavy.count);
+}
+
+void snapshot_read_sketch(FILE* file, unsigned* crc, StreamSketch* sketch)
+{
+    int capacity = 0, count = 0;
+    snapshot_read(file, crc, &sketch->total, sizeof(double));
+    snapshot_read(file, crc, sketch->count_min, sizeof(sketch->count_min));
+    snapshot_read(file, crc, &capacity, sizeof(int));
+    snapshot_read(file, crc, &count, sizeof(int));
+    space_saving_free(&sketch->heavy);
+    if (capacity <= 0 || capacity > (1 << 28) || (capacity & (capacity - 1)) != 0 || count < 0 || count > capacity)
+    {
+        return;
+    }
+    space_saving_resize(&sketch->heavy, capacity);
+    snapshot_read(file, crc, &sketch->heavy.evicted, sizeof(double));
+    if (snapshot_read(file, crc, sketch->heavy.items, sizeof(HeavyHitter) * count))
+    {
+        sketch->heavy.count = count;
+    }
+    space_saving_rebuild(&sketch->heavy);
+}
+
+/*
+ * 把当前数据写成新快照（持读锁调用，写者被挡在外面）：先写临时文件并落盘，再改名替换，
+ * 最后清空日志。改名后、清空前崩溃也没关系，重放时会跳过序号不大于快照的记录。
+ */
+void compact_wal(HashTable* user_table)
+{
+    double begin = now_seconds();
+    char temp_path[256];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", snapshot_file);
+    FILE* file = fopen(temp_path, "wb");
+    if (file == 0)
+    {
+        printf("无法创建快照 %s\n", temp_path);
+        return;
+    }
+
+    SnapshotHeader header;
+    header.magic = SNAPSHOT_MAGIC;
+    header.sequence = wal_sequence;
+    header.block_offset = block_file_offset;
+    header.transaction_offset = transaction_file_offset;
+    header.user_count = user_table->user_count;
+    header.block_count = block_index.count;
+    header.transaction_count = tx_columns.count;
+    header.pending_count = follow_state.pending_count;
+    header.block_ordered = tx_columns.block_ordered;
+    unsigned crc = 0;
+    snapshot_write(file, &crc, &header, sizeof(SnapshotHeader));
+
+    for (int uid = 0; uid < user_table->user_count; uid++)
+    {
+        snapshot_write_string(file, &crc, user_table->users[uid]->user_id);
+    }
+    for (int i = 0; i < block_index.count; i++)
+    {
+        Block* block = block_index.blocks[i];
+        snapshot_write(file, &crc, &block->blockID, sizeof(int));
+        snapshot_write(file, &crc, &block->block_timestamp, sizeof(unsigned));
+        snapshot_write_string(file, &crc, block->hash);
+    }
+    for (int row = 0; row < tx_columns.count; row++)
+    {
+        SnapshotRow record = {tx_columns.tx_id[row], tx_columns.block[row], tx_columns.from[row], tx_columns.to[row], tx_columns.amount[row]};
+        snapshot_write(file, &crc, &record, sizeof(SnapshotRow));
+    }
+    for (int i = 0; i < follow_state.pending_count; i++)
+    {
+        PendingTransaction* pending = &follow_state.pending[i];
+        snapshot_write(file, &crc, &pending->tx_id, sizeof(int));
+        snapshot_write(file, &crc, &pending->blockID, sizeof(int));
+        snapshot_write(file, &crc, &pending->amount, sizeof(double));
+        snapshot_write_string(file, &crc, pending->from);
+        snapshot_write_string(file, &crc, pending->to);
+    }
+    int sketch_accounts = sketch_state.capacity < user_table->user_count ? sketch_state.capacity : user_table->user_count;
+    snapshot_write(file, &crc, &sketch_accounts, sizeof(int));
+    snapshot_write(file, &crc, sketch_state.hll_in, (size_t)sketch_accounts * HLL_REGISTERS);
+    snapshot_write(file, &crc, sketch_state.hll_out, (size_t)sketch_accounts * HLL_REGISTERS);
+    snapshot_write_sketch(file, &crc, &sketch_state.senders);
+    snapshot_write_sketch(file, &crc, &sketch_state.receivers);
+    fwrite(&crc, sizeof(unsigned), 1, file);
+    sync_file(file);
+    fclose(file);
+
+    remove(snapshot_file);
+    if (rename(temp_path, snapshot_file) != 0)
+    {
+        printf("无法替换快照 %s\n", snapshot_file);
+        return;
+    }
+
+    long wal_size = 0;
+    double mtime;
+    file_status(wal_file, &wal_size, &mtime);
+    if (wal_handle != 0)
+    {
+        fclose(wal_handle);
+        wal_handle = 0;
+    }
+    truncate_file(wal_file, 0);
+
+    long snapshot_size = 0;
+    file_status(snapshot_file, &snapshot_size, &mtime);
+    printf("快照已写入 %s: %d 个区块，%d 笔交易，%d 个用户，%.1f MB\n", snapshot_file,
+    block_index.count, tx_columns.count, user_table->user_count, snapshot_size / 1048576.0);
+    printf("预写日志已压缩: 释放 %.1f KB\n", wal_size / 1024.0);
+    printf("运行时间: %.3f 秒\n", now_seconds() - begin);
+}
+
+/*
+ * 从快照恢复（后台加载线程调用）。先顺序读一遍校验CRC，通过后再加载，
+ * 快照损坏时返回0，改从CSV初始化。
+ */
+int load_snapshot(Block* head, HashTable* user_table)
+{
+    FILE* file = fopen(snapshot_file, "rb");
+    if (file == 0)
+    {
+        return 0;
+    }
+
+    SnapshotHeader header;
+    unsigned crc = 0, stored_crc = 0;
+    char buffer[65536];
+    size_t got;
+    long body = 0;
+    long size = 0;
+    double mtime;
+    file_status(snapshot_file, &size, &mtime);
+    if (fread(&header, sizeof(SnapshotHeader), 1, file) != 1 || header.magic != SNAPSHOT_MAGIC || size < (long)(sizeof(SnapshotHeader) + sizeof(unsigned)))
+    {
+        printf("快照 %s 格式不正确，改从CSV初始化\n", snapshot_file);
+        fclose(file);
+        return 0;
+    }
+    crc = crc32_update(0, &header, sizeof(SnapshotHeader));
+    body = size - sizeof(SnapshotHeader) - sizeof(unsigned);
+    while (body > 0 && (got = fread(buffer, 1, body < (long)sizeof(buffer) ? body : (long)sizeof(buffer), file)) > 0)
+    {
+        crc = crc32_update(crc, buffer, got);
+        body -= got;
+    }
+    if (body != 0 || fread(&stored_crc, sizeof(unsigned), 1, file) != 1 || stored_crc != crc)
+    {
+        printf("快照 %s 校验失败，改从CSV初始化\n", snapshot_file);
+        fclose(file);
+        return 0;
+    }
+
+    // 校验通过，正式加载
+    fseek(file, sizeof(SnapshotHeader), SEEK_SET);
+    crc = 0;
+    char text[1024], to[1024];
+    pthread_rwlock_wrlock(&data_lock);
+    load_state.file_size = size;
+    for (int uid = 0; uid < header.user_count; uid++)
+    {
+        snapshot_read_string(file, &crc, text, sizeof(text));
+        insert(user_table, strdup(text), 1);
+    }
+    for (int i = 0; i < header.block_count; i++)
+    {
+        int blockID;
+        unsigned time_stamp;
+        snapshot_read(file, &crc, &blockID, sizeof(int));
+        snapshot_read(file, &crc, &time_stamp, sizeof(unsigned));
+        snapshot_read_string(file, &crc, text, sizeof(text));
+        insertBlock(head, blockID, text, time_stamp);
+    }
+    load_state.blocks_done = 1;
+
+    // 摘要在文件末尾直接读回，重放交易时不再重复统计
+    sketch_state.frozen = 1;
+    for (int row = 0; row < header.transaction_count; row++)
+    {
+        SnapshotRow record;
+        snapshot_read(file, &crc, &record, sizeof(SnapshotRow));
+        Block* block = block_index.blocks[record.block];
+        apply_transaction(block, user_table, record.tx_id, block->blockID,
+        user_table->users[record.from]->user_id, record.amount, user_table->users[record.to]->user_id);
+        if ((row + 1) % LOAD_BATCH == 0)
+        {
+            // 行按区块顺序排列时，当前区块之前的区块都已加载完
+            publish_load_progress(header.block_ordered ? record.block : 0, ftell(file));
+            pthread_rwlock_unlock(&data_lock);
+            pthread_rwlock_wrlock(&data_lock);
+        }
+    }
+    for (int i = 0; i < header.pending_count; i++)
+    {
+        int tx_id, blockID;
+        double amount;
+        snapshot_read(file, &crc, &tx_id, sizeof(int));
+        snapshot_read(file, &crc, &blockID, sizeof(int));
+        snapshot_read(file, &crc, &amount, sizeof(double));
+        snapshot_read_string(file, &crc, text, sizeof(text));
+        snapshot_read_string(file, &crc, to, sizeof(to));
+        follow_defer(&follow_state, tx_id, blockID, text, amount, to);
+    }
+    int sketch_accounts;
+    snapshot_read(file, &crc, &sketch_accounts, sizeof(int));
+    sketch_reserve(sketch_accounts);
+    snapshot_read(file, &crc, sketch_state.hll_in, (size_t)sketch_accounts * HLL_REGISTERS);
+    snapshot_read(file, &crc, sketch_state.hll_out, (size_t)sketch_accounts * HLL_REGISTERS);
+    snapshot_read_sketch(file, &crc, &sketch_state.senders);
+    snapshot_read_sketch(file, &crc, &sketch_state.receivers);
+    sketch_state.frozen = 0;
+    // 快照按当时的计数器数写入，启动参数指定了不同的计数器数时重建
+    if (sketch_state.senders.heavy.capacity != heavy_hitter_capacity(user_table->user_count))
+    {
+        heavy_hitter_configure(user_table, heavy_hitter_budget);
+    }
+    fclose(file);
+
+    wal_sequence = header.sequence;
+    block_file_offset = header.block_offset;
+    transaction_file_offset = header.transaction_offset;
+    pthread_rwlock_unlock(&data_lock);
+    printf("\n已从快照 %s 恢复 %d 个区块、%d 笔交易\n", snapshot_file, header.block_count, header.transaction_count);
+    return 1;
+}
+
+/*
+ * 分片模式。协调者在创建线程之前fork出各工作进程，工作进程各自加载全部区块和与本分片账户有关的交易，
+ * 加载完后在套接字上逐条处理请求：收一条消息，回一条消息。工作进程的标准输出指向临时文件，
+ * 单账户查询直接调用原来的查询函数，把输出收集起来发回协调者打印。
+ */
+int shard_of(char* account)
+{
+    // 哈希表的桶也由hashFunction取模决定，再乘一次打散，否则每个分片只用到一部分桶
+    unsigned hash = (unsigned)hashFunction(account, INT_MAX) * 2654435761u;
+    return (int)((hash >> 16) % (unsigned)shard_count);
+}
+
+void shard_put(ShardMessage* message, void* data, int length)
+{
+    if (message->length + length > message->capacity)
+    {
+        message->capacity = (message->length + length) * 2;
+        message->data = (char*)realloc(message->data, message->capacity);
+    }
+    memcpy(message->data + message->length, data, length);
+    message->length += length;
+}
+
+void shard_put_string(ShardMessage* message, char* text)
+{
+    unsigned short length = (unsigned short)strlen(text);
+    shard_put(message, &length, sizeof(unsigned short));
+    shard_put(message, text, length);
+}
+
+void shard_get(char** cursor, void* data, int length)
+{
+    memcpy(data, *cursor, length);
+    *cursor += length;
+}
+
+char* shard_get_string(char** cursor, char* buffer)
+{
+    unsigned short length;
+    shard_get(cursor, &length, sizeof(unsigned short));
+    shard_get(cursor, buffer, length);
+    buffer[length] = '\0';
+    return buffer;
+}
+
+// 读写满length字节，连接断开时返回0
+int shard_io(int fd, void* data, long length, int writing)
+{
+    char* cursor = (char*)data;
+    while (length > 0)
+    {
+        long done = writing ? (long)write(fd, cursor, length) : (long)read(fd, cursor, length);
+        if (done <= 0)
+        {
+            return 0;
+        }
+        cursor += done;
+        length -= done;
+    }
+    return 1;
+}
+
+int shard_send(int fd, int op, ShardMessage* message)
+{
+    int header[2] = {op, message->length};
+    return shard_io(fd, header, sizeof(header), 1) && shard_io(fd, message->data, message->length, 1);
+}
+
+int shard_receive(int fd, int* op, ShardMessage* message)
+{
+    int header[2];
+    if (!shard_io(fd, header, sizeof(header), 0))
+    {
+        return 0;
+    }
+    *op = header[0];
+    message->length = 0;
+    if (header[1] > message->capacity)
+    {
+        message->capacity = header[1];
+        message->data = (char*)realloc(message->data, message->capacity);
+    }
+    message->length = header[1];
+    return shard_io(fd, message->data, header[1], 0);
+}
+
+// 协调者收一个分片的回复，工作进程退出时协调者也无法继续
+void shard_reply(int shard, ShardMessage* reply)
+{
+    int op;
+    if (!shard_receive(shard_fd[shard], &op, reply))
+    {
+        printf("分片 %d 的工作进程已退出\n", shard);
+        exit(1);
+    }
+}
+
+// 协调者向一个分片发请求，写失败说明工作进程已退出，同收不到回复一样无法继续
+void shard_request(int shard, int op, ShardMessage* request)
+{
+    if (!shard_send(shard_fd[shard], op, request))
+    {
+        printf("分片 %d 的工作进程已退出\n", shard);
+        exit(1);
+    }
+}
+
+// 向一个分片发送请求并等待回复
+void shard_call(int shard, int op, ShardMessage* request, ShardMessage* reply)
+{
+    shard_request(shard, op, request);
+    shard_reply(shard, reply);
+}
+
+// 把同一个请求发给所有分片，各分片并行处理，再按分片顺序收回复
+void shard_scatter(int op, ShardMessage* request, ShardMessage* replies)
+{
+    for (int i = 0; i < shard_count; i++)
+    {
+        shard_request(i, op, request);
+    }
+    for (int i = 0; i < shard_count; i++)
+    {
+        shard_reply(i, &replies[i]);
+    }
+}
+
+// 启动各分片的工作进程，工作进程不从这里返回
+void start_shards()
+{
+#ifdef _WIN32
+    printf("当前平台不支持分片模式\n");
+    shard_count = 0;
+#else
+    fflush(stdout);
+    for (int i = 0; i < shard_count; i++)
+    {
+        int pair[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0)
+        {
+            printf("创建分片连接失败\n");
+            exit(1);
+        }
+        int pid = (int)fork();
+        if (pid == 0)
+        {
+            close(pair[0]);
+            for (int j = 0; j < i; j++)
+            {
+                close(shard_fd[j]);
+            }
+            shard_id = i;
+            shard_worker(pair[1]);
+            exit(0);
+        }
+        close(pair[1]);
+        shard_fd[i] = pair[0];
+        shard_pid[i] = pid;
+    }
+    // 工作进程崩溃后往它的套接字写会收到SIGPIPE，忽略它，由shard_request报告是哪个分片
+    signal(SIGPIPE, SIG_IGN);
+    printf("已启动 %d 个分片工作进程，各自在后台加载数据\n", shard_count);
+    show_progress = 0;  // 协调者只在合并排行时往小表里插入账户，不输出进度
+#endif
+}
+
+void stop_shards()
+{
+#ifndef _WIN32
+    ShardMessage request = {0, 0, 0};
+    for (int i = 0; i < shard_count; i++)
+    {
+        shard_send(shard_fd[i], SHARD_EXIT, &request);
+        close(shard_fd[i]);
+        waitpid(shard_pid[i], 0, 0);
+    }
+#endif
+}
+
+// 清空工作进程的标准输出，之后查询函数的输出由shard_capture_end收进回复
+void shard_capture_begin()
+{
+    fflush(stdout);
+    if (ftruncate(STDOUT_FILENO, 0) == 0)
+    {
+        lseek(STDOUT_FILENO, 0, SEEK_SET);
+    }
+}
+
+void shard_capture_end(ShardMessage* reply)
+{
+    fflush(stdout);
+    long length = (long)lseek(STDOUT_FILENO, 0, SEEK_CUR);
+    char* text = (char*)malloc(length + 1);
+    if (length > 0 && pread(STDOUT_FILENO, text, length, 0) == length)
+    {
+        shard_put(reply, text, (int)length);
+    }
+    free(text);
+}
+
+// 本分片账户的一个排行候选，数值只有在账户所在的分片上才是完整的
+void shard_put_candidate(ShardMessage* reply, user* account, double in_amount, double out_amount)
+{
+    shard_put(reply, &account->first_seen, sizeof(long));
+    shard_put(reply, &account->in_count, sizeof(int));
+    shard_put(reply, &account->out_count, sizeof(int));
+    shard_put(reply, &in_amount, sizeof(double));
+    shard_put(reply, &out_amount, sizeof(double));
+    shard_put_string(reply, account->user_id);
+}
+
+// 工作进程：本分片账户的出度入度各项排行前k名，去重后作为候选
+void shard_rank_candidates(int k, ShardMessage* reply)
+{
+    RankContext context = {&shard_view, k, account_totals(&shard_view, UINT_MAX)};
+    DegreeRank rank;
+    degree_rank_init(&rank, &context);
+    parallel_reduce(0, shard_view.user_count, default_grain(shard_view.user_count), sizeof(DegreeRank),
+    degree_rank_init, degree_rank_body, degree_rank_merge, &rank, &context);
+
+    TopK* lists[4] = {rank.in, rank.out, rank.in_amount, rank.out_amount};
+    int* picked = (int*)malloc(sizeof(int) * (4 * rank.in->k + 1));
+    int count = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        for (int j = 0; j < lists[i]->count; j++)
+        {
+            int seen = 0;
+            for (int p = 0; p < count && !seen; p++)
+            {
+                seen = picked[p] == lists[i]->uid[j];
+            }
+            if (!seen)
+            {
+                picked[count++] = lists[i]->uid[j];
+            }
+        }
+        topk_free(lists[i]);
+    }
+    free_account_totals(context.totals);
+
+    shard_put(reply, &count, sizeof(int));
+    for (int i = 0; i < count; i++)
+    {
+        user* account = shard_view.users[picked[i]];
+        shard_put_candidate(reply, account, account->in_list_head->amount, account->out_list_head->amount);
+    }
+    free(picked);
+}
+
+// 工作进程：time_stamp时刻本分片账户的财富排行前k名，只统计到该时刻为止出现过的账户
+void shard_wealth_candidates(HashTable* user_table, unsigned time_stamp, int k, ShardMessage* reply)
+{
+    int n = user_table->user_count;
+    double* in_amount = (double*)calloc(n + 1, sizeof(double));
+    double* out_amount = (double*)calloc(n + 1, sizeof(double));
+    char* seen = (char*)calloc(n + 1, 1);
+    int block_end = block_upper_bound(time_stamp);
+    for (int b = 0; b < block_end; b++)
+    {
+        SegmentReader reader;
+        segment_open(&block_index.blocks[b]->segment, &reader);
+        for (int i = 0; i < reader.count; i++)
+        {
+            int from = segment_field(&reader, i, SEGMENT_FROM);
+            int to = segment_field(&reader, i, SEGMENT_TO);
+            double amount = segment_amount(&reader, i);
+            out_amount[from] += amount;
+            in_amount[to] += amount;
+            seen[from] = seen[to] = 1;
+        }
+    }
+
+    TopK* top = topk_create(k);
+    for (int i = 0; i < shard_view.user_count; i++)
+    {
+        int uid = shard_view.users[i]->uid;
+        if (seen[uid])
+        {
+            topk_push(top, i, in_amount[uid] - out_amount[uid]);
+        }
+    }
+    shard_put(reply, &top->count, sizeof(int));
+    for (int i = 0; i < top->count; i++)
+    {
+        user* account = shard_view.users[top->uid[i]];
+        shard_put_candidate(reply, account, in_amount[account->uid], out_amount[account->uid]);
+    }
+    topk_free(top);
+    free(in_amount);
+    free(out_amount);
+    free(seen);
+}
+
+// 工作进程：本分片的顶点得到更短的距离时记下，并放进下一层的待松弛顶点
+void shard_path_offer(user* account, double length)
+{
+    if (account->sign == -1 || (account->sign != 0 && account->path_length <= length))
+    {
+        return;
+    }
+    account->sign = 1;
+    account->path_length = length;
+    if (!(shard_flags[account->uid] & SHARD_QUEUED))
+    {
+        shard_flags[account->uid] |= SHARD_QUEUED;
+        shard_frontier[shard_frontier_count++] = account->uid;
+    }
+}
+
+/*
+ * 工作进程：最短路径的一层。先合并其他分片发来的距离，再松弛待松弛顶点的出弧（本分片账户的出弧都在本地）。
+ * 终点属于本分片的直接更新，留到下一层；其余终点在本地记下发出过的最短距离，同一终点只发最短的一个，
+ * 由协调者转给终点所在的分片。回复剩余的待松弛顶点数和发出的距离。
+ */
+void shard_path_step(HashTable* user_table, char** cursor, ShardMessage* reply)
+{
+    char account[1024];
+    int count;
+    double length;
+    shard_get(cursor, &count, sizeof(int));
+    for (int i = 0; i < count; i++)
+    {
+        shard_get(cursor, &length, sizeof(double));
+        user* target = find_user(user_table, shard_get_string(cursor, account));
+        if (target != 0)
+        {
+            shard_path_offer(target, length);
+        }
+    }
+
+    TxAdjacency* adjacency = get_tx_adjacency(user_table);
+    int current_count = shard_frontier_count;
+    int* current = (int*)malloc(sizeof(int) * (current_count + 1));
+    memcpy(current, shard_frontier, sizeof(int) * current_count);
+    shard_frontier_count = 0;
+    for (int i = 0; i < current_count; i++)
+    {
+        shard_flags[current[i]] &= ~SHARD_QUEUED;
+    }
+
+    int* outgoing = (int*)malloc(sizeof(int) * (user_table->user_count + 1));
+    int outgoing_count = 0;
+    for (int i = 0; i < current_count; i++)
+    {
+        user* from_user = user_table->users[current[i]];
+        for (int e = adjacency->offset[from_user->uid]; e < adjacency->offset[from_user->uid + 1]; e++)
+        {
+            user* next_user = user_table->users[adjacency->target[e]];
+            double new_path_length = adjacency->amount[e] + from_user->path_length;
+            if (shard_flags[next_user->uid] & SHARD_OWNED)
+            {
+                shard_path_offer(next_user, new_path_length);
+            }
+            else if (next_user->sign == 0 || next_user->path_length > new_path_length)
+            {
+                next_user->sign = 1;
+                next_user->path_length = new_path_length;
+                if (!(shard_flags[next_user->uid] & SHARD_OUTGOING))
+                {
+                    shard_flags[next_user->uid] |= SHARD_OUTGOING;
+                    outgoing[outgoing_count++] = next_user->uid;
+                }
+            }
+        }
+    }
+
+    shard_put(reply, &shard_frontier_count, sizeof(int));
+    shard_put(reply, &outgoing_count, sizeof(int));
+    for (int i = 0; i < outgoing_count; i++)
+    {
+        user* next_user = user_table->users[outgoing[i]];
+        shard_flags[next_user->uid] &= ~SHARD_OUTGOING;
+        shard_put(reply, &next_user->path_length, sizeof(double));
+        shard_put_string(reply, next_user->user_id);
+    }
+    free(current);
+    free(outgoing);
+}
+
+// 工作进程处理一条请求
+void shard_handle(int op, char* cursor, ShardMessage* reply, Block* head, HashTable* user_table)
+{
+    char account[1024];
+    unsigned time_start, time_end;
+    int k;
+    if (op == SHARD_STATUS)
+    {
+        int counts[4] = {calc_block, calc_transaction, shard_view.user_count, user_table->user_count};
+        shard_put(reply, counts, sizeof(counts));
+    }
+    else if (op == SHARD_IN_OUT)
+    {
+        shard_get(&cursor, &time_start, sizeof(unsigned));
+        shard_get(&cursor, &time_end, sizeof(unsigned));
+        shard_get(&cursor, &k, sizeof(int));
+        shard_get_string(&cursor, account);
+        shard_capture_begin();
+        account_in_out(time_start, time_end, k, account, head, user_table);
+        shard_capture_end(reply);
+    }
+    else if (op == SHARD_AMOUNT)
+    {
+        shard_get(&cursor, &time_end, sizeof(unsigned));
+        shard_get_string(&cursor, account);
+        shard_capture_begin();
+        account_amount(time_end, account, head, user_table);
+        shard_capture_end(reply);
+    }
+    else if (op == SHARD_DEGREE)
+    {
+        AccountTotals* totals = account_totals(&shard_view, UINT_MAX);
+        DegreeSum sum;
+        degree_sum_init(&sum, 0);
+        parallel_reduce(0, shard_view.user_count, default_grain(shard_view.user_count), sizeof(DegreeSum),
+        degree_sum_init, degree_sum_body, degree_sum_merge, &sum, totals);
+        free_account_totals(totals);
+        shard_put(reply, &shard_view.user_count, sizeof(int));
+        shard_put(reply, &sum, sizeof(DegreeSum));
+    }
+    else if (op == SHARD_RANK)
+    {
+        shard_get(&cursor, &k, sizeof(int));
+        shard_rank_candidates(k, reply);
+    }
+    else if (op == SHARD_WEALTH)
+    {
+        shard_get(&cursor, &time_end, sizeof(unsigned));
+        shard_get(&cursor, &k, sizeof(int));
+        shard_wealth_candidates(user_table, time_end, k, reply);
+    }
+    else if (op == SHARD_PATH_RESET)
+    {
+        init_path(user_table);
+        for (int i = 0; i < shard_frontier_count; i++)
+        {
+            shard_flags[shard_frontier[i]] &= ~SHARD_QUEUED;
+        }
+        shard_frontier_count = 0;
+        user* head_user = find_user(user_table, shard_get_string(&cursor, account));
+        if (head_user != 0 && (shard_flags[head_user->uid] & SHARD_OWNED))
+        {
+            head_user->sign = -1;  // 起点不再更新
+            shard_flags[head_user->uid] |= SHARD_QUEUED;
+            shard_frontier[shard_frontier_count++] = head_user->uid;
+        }
+        shard_put(reply, &shard_frontier_count, sizeof(int));
+    }
+    else if (op == SHARD_PATH_STEP)
+    {
+        shard_path_step(user_table, &cursor, reply);
+    }
+    else if (op == SHARD_SKETCH)
+    {
+        shard_get_string(&cursor, account);
+        shard_capture_begin();
+        account_sketch(user_table, account);
+        shard_capture_end(reply);
+    }
+    else if (op == SHARD_HEAVY)
+    {
+        StreamSketch* sides[2] = {&sketch_state.senders, &sketch_state.receivers};
+        for (int side = 0; side < 2; side++)
+        {
+            shard_put(reply, &sides[side]->total, sizeof(double));
+            shard_put(reply, sides[side]->count_min, sizeof(sides[side]->count_min));
+            shard_put(reply, &sides[side]->heavy.capacity, sizeof(int));
+            shard_put(reply, &sides[side]->heavy.count, sizeof(int));
+            shard_put(reply, &sides[side]->heavy.evicted, sizeof(double));
+            for (int i = 0; i < sides[side]->heavy.count; i++)
+            {
+                HeavyHitter* item = &sides[side]->heavy.items[i];
+                shard_put(reply, &item->weight, sizeof(double));
+                shard_put(reply, &item->error, sizeof(double));
+                shard_put_string(reply, user_table->users[item->uid]->user_id);
+            }
+        }
+    }
+    else if (op == SHARD_PATH_RESULT)
+    {
+        user* target_user = find_user(user_table, shard_get_string(&cursor, account));
+        double length = target_user != 0 && target_user->sign == 1 ? target_user->path_length : 0;
+        shard_put(reply, &length, sizeof(double));
+    }
+}
+
+// 工作进程的主循环，协调者发来SHARD_EXIT或断开连接时结束
+void shard_worker(int fd)
+{
+    FILE* capture = tmpfile();
+    if (capture != 0)
+    {
+        dup2(fileno(capture), STDOUT_FILENO);
+    }
+    runtime_init();
+    select_aggregate_kernel();
+    HashTable* user_table = initHashTable(HashTableSize);
+    Block* head = createLinkedList(user_table);
+    wait_load_finished();
+
+    pthread_rwlock_rdlock(&data_lock);
+    int n = user_table->user_count;
+    shard_view = *user_table;
+    shard_view.users = (user**)malloc(sizeof(user*) * (n + 1));
+    shard_view.user_count = 0;
+    shard_flags = (char*)calloc(n + 1, 1);
+    shard_frontier = (int*)malloc(sizeof(int) * (n + 1));
+    for (int uid = 0; uid < n; uid++)
+    {
+        if (shard_of(user_table->users[uid]->user_id) == shard_id)
+        {
+            shard_view.users[shard_view.user_count++] = user_table->users[uid];
+            shard_flags[uid] = SHARD_OWNED;
+        }
+    }
+    pthread_rwlock_unlock(&data_lock);
+
+    ShardMessage request = {0, 0, 0};
+    ShardMessage reply = {0, 0, 0};
+    int op;
+    while (shard_receive(fd, &op, &request) && op != SHARD_EXIT)
+    {
+        reply.length = 0;
+        pthread_rwlock_rdlock(&data_lock);
+        shard_handle(op, request.data, &reply, head, user_table);
+        pthread_rwlock_unlock(&data_lock);
+        if (!shard_send(fd, op, &reply))
+        {
+            break;
+        }
+    }
+    close(fd);
+}
+
+// 各分片的加载情况（工作进程加载完才会回复）
+void shard_status()
+{
+    ShardMessage request = {0, 0, 0};
+    ShardMessage* replies = (ShardMessage*)calloc(shard_count, sizeof(ShardMessage));
+    shard_scatter(SHARD_STATUS, &request, replies);
+    int total_users = 0;
+    for (int i = 0; i < shard_count; i++)
+    {
+        int* counts = (int*)replies[i].data;
+        printf("分片 %d: 区块数 %d，交易数 %d，负责的用户数 %d（含对手方共 %d）\n", i, counts[0], counts[1], counts[2], counts[3]);
+        total_users += counts[2];
+        free(replies[i].data);
+    }
+    printf("数据初始化已完成! 用户数: %d\n", total_users);
+    free(replies);
+}
+
+// 单账户查询转给账户所在的分片，打印它的输出
+void shard_account_in_out(unsigned time_start, unsigned time_end, int k, char* account)
+{
+    ShardMessage request = {0, 0, 0};
+    ShardMessage reply = {0, 0, 0};
+    shard_put(&request, &time_start, sizeof(unsigned));
+    shard_put(&request, &time_end, sizeof(unsigned));
+    shard_put(&request, &k, sizeof(int));
+    shard_put_string(&request, account);
+    shard_call(shard_of(account), SHARD_IN_OUT, &request, &reply);
+    fwrite(reply.data, 1, reply.length, stdout);
+    free(request.data);
+    free(reply.data);
+}
+
+void shard_account_amount(unsigned time_end, char* account)
+{
+    ShardMessage request = {0, 0, 0};
+    ShardMessage reply = {0, 0, 0};
+    shard_put(&request, &time_end, sizeof(unsigned));
+    shard_put_string(&request, account);
+    shard_call(shard_of(account), SHARD_AMOUNT, &request, &reply);
+    fwrite(reply.data, 1, reply.length, stdout);
+    free(request.data);
+    free(reply.data);
+}
+
+void shard_account_sketch(char* account)
+{
+    ShardMessage request = {0, 0, 0};
+    ShardMessage reply = {0, 0, 0};
+    shard_put_string(&request, account);
+    shard_call(shard_of(account), SHARD_SKETCH, &request, &reply);
+    fwrite(reply.data, 1, reply.length, stdout);
+    free(request.data);
+    free(reply.data);
+}
+
+int compare_candidate(const void* a, const void* b)
+{
+    long x = ((const ShardCandidate*)a)->first_seen;
+    long y = ((const ShardCandidate*)b)->first_seen;
+    return (x > y) - (x < y);
+}
+
+/*
+ * 把各分片的候选账户按首次出现的顺序建成一张小表。候选账户的数值是完整的，全局前k名一定在各分片的前k名中；
+ * 原来的排行函数在这张表上按编号打破并列，编号顺序就是单进程时的顺序，结果一致。
+ */
+HashTable* shard_gather_candidates(ShardMessage* replies)
+{
+    int total = 0;
+    for (int i = 0; i < shard_count; i++)
+    {
+        total += *(int*)replies[i].data;
+    }
+    ShardCandidate* candidates = (ShardCandidate*)malloc(sizeof(ShardCandidate) * (total + 1));
+    char account[1024];
+    int count = 0;
+    for (int i = 0; i < shard_count; i++)
+    {
+        char* cursor = replies[i].data;
+        int shard_total;
+        shard_get(&cursor, &shard_total, sizeof(int));
+        for (int j = 0; j < shard_total; j++)
+        {
+            ShardCandidate* candidate = &candidates[count++];
+            shard_get(&cursor, &candidate->first_seen, sizeof(long));
+            shard_get(&cursor, &candidate->in_count, sizeof(int));
+            shard_get(&cursor, &candidate->out_count, sizeof(int));
+            shard_get(&cursor, &candidate->in_amount, sizeof(double));
+            shard_get(&cursor, &candidate->out_amount, sizeof(double));
+            candidate->user_id = strdup(shard_get_string(&cursor, account));
+        }
+    }
+    qsort(candidates, count, sizeof(ShardCandidate), compare_candidate);
+
+    HashTable* table = initHashTable(2 * count + 1);
+    for (int i = 0; i < count; i++)
+    {
+        insert(table, candidates[i].user_id, 0);
+        user* candidate_user = table->users[table->user_count - 1];
+        candidate_user->in_count = candidates[i].in_count;
+        candidate_user->out_count = candidates[i].out_count;
+        candidate_user->in_list_head->amount = candidates[i].in_amount;
+        candidate_user->out_list_head->amount = candidates[i].out_amount;
+    }
+    free(candidates);
+    return table;
+}
+
+void free_candidates(HashTable* table)
+{
+    for (int uid = 0; uid < table->user_count; uid++)
+    {
+        user* candidate_user = table->users[uid];
+        free(candidate_user->user_id);
+        free(candidate_user->in_list_head);
+        free(candidate_user->out_list_head);
+        free(candidate_user);
+    }
+    for (int i = 0; i < table->size; i++)
+    {
+        free(table->table[i]);
+    }
+    free(table->table);
+    free(table->users);
+    free(table);
+}
+
+/*
+ * 全网转出 / 转入金额最高的账户：各分片的摘要在协调者合并。账户的uid换成协调者一张小表里的编号，
+ * 这样两边的Space-Saving才能按uid对齐合并。
+ */
+void shard_heavy_hitters(int k)
+{
+    ShardMessage request = {0, 0, 0};
+    ShardMessage* replies = (ShardMessage*)calloc(shard_count, sizeof(ShardMessage));
+    shard_scatter(SHARD_HEAVY, &request, replies);
+    // 每个账户在回复中至少占两个double和账号，按回复的总长度估计合并表的大小
+    long bytes = 0;
+    for (int i = 0; i < shard_count; i++)
+    {
+        bytes += replies[i].length;
+    }
+    HashTable* table = initHashTable((int)(bytes / 48) + 1);
+    StreamSketch* merged = (StreamSketch*)calloc(2, sizeof(StreamSketch));
+    StreamSketch* part = (StreamSketch*)calloc(1, sizeof(StreamSketch));
+    char account[1024];
+    for (int i = 0; i < shard_count; i++)
+    {
+        char* cursor = replies[i].data;
+        for (int side = 0; side < 2; side++)
+        {
+            shard_get(&cursor, &part->total, sizeof(double));
+            shard_get(&cursor, part->count_min, sizeof(part->count_min));
+            int capacity, count;
+            shard_get(&cursor, &capacity, sizeof(int));
+            shard_get(&cursor, &count, sizeof(int));
+            part->heavy.count = 0;
+            space_saving_resize(&part->heavy, capacity);
+            part->heavy.count = count;
+            shard_get(&cursor, &part->heavy.evicted, sizeof(double));
+            for (int j = 0; j < part->heavy.count; j++)
+            {
+                HeavyHitter* item = &part->heavy.items[j];
+                shard_get(&cursor, &item->weight, sizeof(double));
+                shard_get(&cursor, &item->error, sizeof(double));
+                shard_get_string(&cursor, account);
+                user* known = find_user(table, account);
+                if (known == 0)
+                {
+                    insert(table, strdup(account), 0);
+                    known = table->users[table->user_count - 1];
+                }
+                item->uid = known->uid;
+            }
+            space_saving_rebuild(&part->heavy);
+            stream_sketch_merge(&merged[side], part);
+        }
+        free(replies[i].data);
+    }
+    print_heavy_hitters(table, &merged[0], "转出金额", k);
+    print_heavy_hitters(table, &merged[1], "转入金额", k);
+    free_candidates(table);
+    for (int side = 0; side < 2; side++)
+    {
+        space_saving_free(&merged[side].heavy);
+    }
+    space_saving_free(&part->heavy);
+    free(merged);
+    free(part);
+    free(replies);
+}
+
+// 分发请求，合并各分片的候选后在合并表上调用排行函数
+void shard_rank(int op, ShardMessage* request, int k)
+{
+    ShardMessage* replies = (ShardMessage*)calloc(shard_count, sizeof(ShardMessage));
+    shard_scatter(op, request, replies);
+    HashTable* table = shard_gather_candidates(replies);
+    if (op == SHARD_WEALTH)
+    {
+        wealth_rank(table, k, UINT_MAX);
+    }
+    else
+    {
+        max_in_out(table, k, UINT_MAX);
+    }
+    free_candidates(table);
+    for (int i = 0; i < shard_count; i++)
+    {
+        free(replies[i].data);
+    }
+    free(replies);
+}
+
+// 某时刻的财富排行：各分片统计本分片账户到该时刻的收支
+void shard_wealth_rank(unsigned time_stamp, int k)
+{
+    ShardMessage request = {0, 0, 0};
+    shard_put(&request, &time_stamp, sizeof(unsigned));
+    shard_put(&request, &k, sizeof(int));
+    shard_rank(SHARD_WEALTH, &request, k);
+    free(request.data);
+}
+
+// 平均出度入度由各分片对本分片账户求和
+void shard_average_degree()
+{
+    ShardMessage request = {0, 0, 0};
+    ShardMessage* replies = (ShardMessage*)calloc(shard_count, sizeof(ShardMessage));
+    shard_scatter(SHARD_DEGREE, &request, replies);
+    DegreeSum total;
+    degree_sum_init(&total, 0);
+    int user_count = 0;
+    for (int i = 0; i < shard_count; i++)
+    {
+        char* cursor = replies[i].data;
+        int shard_users;
+        DegreeSum sum;
+        shard_get(&cursor, &shard_users, sizeof(int));
+        shard_get(&cursor, &sum, sizeof(DegreeSum));
+        user_count += shard_users;
+        degree_sum_merge(&total, &sum, 0);
+        free(replies[i].data);
+    }
+    free(replies);
+    print_average_degree(&total, user_count);
+}
+
+// 出度入度排行合并各分片的候选
+void shard_max_in_out(int k)
+{
+    ShardMessage request = {0, 0, 0};
+    shard_put(&request, &k, sizeof(int));
+    shard_rank(SHARD_RANK, &request, k);
+    free(request.data);
+}
+
+/*
+ * 分片的最短路径：按层进行的Bellman-Ford。每一层协调者把上一层发出的距离按终点所在的分片分组，
+ * 发给有消息或有待松弛顶点的分片，收齐回复后进入下一层，直到没有分片再发出距离。
+ */
+void shard_shortest_path(char* from, char* to)
+{
+    ShardMessage request = {0, 0, 0};
+    ShardMessage* replies = (ShardMessage*)calloc(shard_count, sizeof(ShardMessage));
+    ShardMessage* inbox = (ShardMessage*)calloc(shard_count, sizeof(ShardMessage));
+    ShardMessage* next_inbox = (ShardMessage*)calloc(shard_count, sizeof(ShardMessage));
+    int* inbox_count = (int*)calloc(shard_count, sizeof(int));
+    int* next_count = (int*)calloc(shard_count, sizeof(int));
+    int* pending = (int*)calloc(shard_count, sizeof(int));
+    char* active = (char*)calloc(shard_count, 1);
+
+    shard_put_string(&request, from);
+    shard_scatter(SHARD_PATH_RESET, &request, replies);
+    for (int i = 0; i < shard_count; i++)
+    {
+        pending[i] = *(int*)replies[i].data;
+    }
+
+    int levels = 0;
+    while (1)
+    {
+        int any = 0;
+        for (int i = 0; i < shard_count; i++)
+        {
+            active[i] = inbox_count[i] > 0 || pending[i] > 0;
+            if (active[i])
+            {
+                request.length = 0;
+                shard_put(&request, &inbox_count[i], sizeof(int));
+                shard_put(&request, inbox[i].data, inbox[i].length);
+                shard_request(i, SHARD_PATH_STEP, &request);
+                any = 1;
+            }
+        }
+        if (!any)
+        {
+            break;
+        }
+
+        char account[1024];
+        for (int i = 0; i < shard_count; i++)
+        {
+            if (!active[i])
+            {
+                continue;
+            }
+            shard_reply(i, &replies[i]);
+            char* cursor = replies[i].data;
+            int count;
+            double length;
+            shard_get(&cursor, &pending[i], sizeof(int));
+            shard_get(&cursor, &count, sizeof(int));
+            for (int j = 0; j < count; j++)
+            {
+                shard_get(&cursor, &length, sizeof(double));
+                int owner = shard_of(shard_get_string(&cursor, account));
+                shard_put(&next_inbox[owner], &length, sizeof(double));
+                shard_put_string(&next_inbox[owner], account);
+                next_count[owner]++;
+            }
+        }
+        for (int i = 0; i < shard_count; i++)
+        {
+            ShardMessage swap = inbox[i];
+            inbox[i] = next_inbox[i];
+            next_inbox[i] = swap;
+            next_inbox[i].length = 0;
+            inbox_count[i] = next_count[i];
+            next_count[i] = 0;
+        }
+        levels++;
+    }
+
+    request.length = 0;
+    shard_put_string(&request, to);
+    shard_call(shard_of(to), SHARD_PATH_RESULT, &request, &replies[0]);
+    double path_length = *(double*)replies[0].data;
+    if (path_length != 0)
+    {
+        printf("用户: %s\n到\n用户: %s\n最短路径为: %.2lf\n", from, to, path_length);
+    }
+    else
+    {
+        printf("用户: %s\n到\n用户: %s\n不存在路径\n", from, to);
+    }
+    printf("（分片之间交换了 %d 层距离）\n", levels);
+
+    for (int i = 0; i < shard_count; i++)
+    {
+        free(replies[i].data);
+        free(inbox[i].data);
+        free(next_inbox[i].data);
+    }
+    free(request.data);
+    free(replies);
+    free(inbox);
+    free(next_inbox);
+    free(inbox_count);
+    free(next_count);
+    free(pending);
+    free(active);
+}
+
+// 数据查询界面操作
+void data_lookup(Block* head, HashTable* user_table)
+{
+    int operator;
+    while (1)
+    {
+        operator = 0;
+        printf("请输入需要进行的查询操作: \n  0: 返回上一级操作\n");
+        printf("  1: 查找指定账号在一个时间段内的所有转入或转出记录，返回总记录数，交易金额最大的前k条记录\n");
         printf("  2: 查询某个账号在某个时刻的金额\n");
-        printf("  3: 在某个时刻的福布斯富豪榜!\n     输出在该时刻最有钱的前k个用户\n\n");
+        printf("  3: 在某个时刻的福布斯富豪榜!\n     输出在该时刻最有钱的前k个用户\n");
+        printf("  4: 统计一个时间段内全网的交易数和交易总额（可设单笔金额下限）\n");
+        printf("  5: 估计某个账号的不同交易对手数和转出 / 转入总额（概率摘要）\n");
+        printf("  6: 估计全网转出 / 转入金额最高的前k个账户（概率摘要，k不超过计数器数，计数器数在系统设置中设置）\n");
+        printf("  7: 按tx_id查找交易及其区块时间\n");
+        printf("  8: 按区块哈希查找区块及其交易\n");
+        printf("  9: 一个时间段内净收入增加 / 减少最多的前k个账户\n");
+        printf("  10: 按时间桶列出一个时间段内全网的交易数和交易额（桶宽在系统设置中设置）\n");
+        printf("  11: 按时间桶列出某个账号一个时间段内的转入和转出\n\n");
         scanf("%d", &operator);
         if (operator == 0)
         {
             break;
         }
-        else if (operator == 1)
+        else if (operator == 1)
+        {
+            char user_id[50];
+            int k;
+            unsigned start, end;
+            printf("请输入账号: \n");
+            scanf("%s", user_id);
+            printf("请输入k: \n");
+            scanf("%d", &k);
+            printf("请输入开始时间: \n");
+            scanf("%u", &start);
+            printf("请输入结束时间: \n");
+            scanf("%u", &end);
+            if (shard_count > 1)
+            {
+                start_time = clock();
+                shard_account_in_out(start, end, k, user_id);
+            }
+            else
+            {
+                wait_until_loaded(end);
+                start_time = clock();
+                pthread_rwlock_rdlock(&data_lock);
+                account_in_out(start, end, k, user_id, head, user_table);
+                pthread_rwlock_unlock(&data_lock);
+            }
+            end_time = clock();
+            double elapsed_time = (double)(end_time - start_time) / CLOCKS_PER_SEC;
+            printf("运行时间: %.3f 秒\n\n", elapsed_time);
+        }
+        else if (operator == 2)
+        {
+            char user_id[50];
+            unsigned end;
+            printf("请输入账号: \n");
+            scanf("%s", user_id);
+            printf("请输入时间: \n");
+            scanf("%u", &end);
+            if (shard_count > 1)
+            {
+                start_time = clock();
+                shard_account_amount(end, user_id);
+            }
+            else
+            {
+                wait_until_loaded(end);
+                start_time = clock();
+                pthread_rwlock_rdlock(&data_lock);
+                account_amount(end, user_id, head, user_table);
+                pthread_rwlock_unlock(&data_lock);
+            }
+            end_time = clock();
+            double elapsed_time = (double)(end_time - start_time) / CLOCKS_PER_SEC;
+            printf("运行时间: %.3f 秒\n\n", elapsed_time);
+        }
+        else if (operator == 3)
+        {
+            unsigned end;
+            int k;
+            printf("请输入k: \n");
+            scanf("%d", &k);
+            printf("请输入时间: \n");
+            scanf("%u", &end);
+            if (shard_count > 1)
+            {
+                start_time = clock();
+                shard_wealth_rank(end, k);
+            }
+            else
+            {
+                wait_until_loaded(end);
+                start_time = clock();
+                pthread_rwlock_rdlock(&data_lock);
+                time_wealth_rank(user_table, end, k);
+                pthread_rwlock_unlock(&data_lock);
+            }
+            end_time = clock();
+            double elapsed_time = (double)(end_time - start_time) / CLOCKS_PER_SEC;
+            printf("运行时间: %.3f 秒\n\n", elapsed_time);
+        }
+        else if (operator == 4)
+        {
+            unsigned start, end;
+            double threshold;
+            printf("请输入开始时间: \n");
+            scanf("%u", &start);
+            printf("请输入结束时间: \n");
+            scanf("%u", &end);
+            printf("请输入单笔金额下限（0表示不限）: \n");
+            scanf("%lf", &threshold);
+            if (shard_count > 1)
+            {
+                printf("分片模式下不支持该操作\n\n");
+                continue;
+            }
+            wait_until_loaded(end);
+            double begin = now_seconds();
+            pthread_rwlock_rdlock(&data_lock);
+            network_volume(start, end, threshold);
+            pthread_rwlock_unlock(&data_lock);
+            printf("运行时间: %.3f 秒\n\n", now_seconds() - begin);
+        }
+        else if (operator == 5)
+        {
+            char user_id[50];
+            printf("请输入账号: \n");
+            scanf("%s", user_id);
+            double begin = now_seconds();
+            if (shard_count > 1)
+            {
+                shard_account_sketch(user_id);
+            }
+            else
+            {
+                wait_until_loaded(UINT_MAX);
+                pthread_rwlock_rdlock(&data_lock);
+                account_sketch(user_table, user_id);
+                pthread_rwlock_unlock(&data_lock);
+            }
+            printf("运行时间: %.3f 秒\n\n", now_seconds() - begin);
+        }
+        else if (operator == 6)
+        {
+            int k;
+            printf("请输入k: \n");
+            scanf("%d", &k);
+            double begin = now_seconds();
+            if (shard_count > 1)
+            {
+                shard_heavy_hitters(k);
+            }
+            else
+            {
+                wait_until_loaded(UINT_MAX);
+                pthread_rwlock_rdlock(&data_lock);
+                heavy_hitters(user_table, k);
+                pthread_rwlock_unlock(&data_lock);
+            }
+            printf("运行时间: %.3f 秒\n\n", now_seconds() - begin);
+        }
+        else if (operator == 7 || operator == 8)
+        {
+            int tx_id = 0;
+            char hash[256];
+            if (operator == 7)
+            {
+                printf("请输入tx_id: \n");
+                scanf("%d", &tx_id);
+            }
+            else
+            {
+                printf("请输入区块哈希: \n");
+                scanf("%255s", hash);
+            }
+            if (shard_count > 1)
+            {
+                printf("分片模式下不支持该操作\n\n");
+                continue;
+            }
+            wait_until_loaded(UINT_MAX);
+            double begin = now_seconds();
+            pthread_rwlock_rdlock(&data_lock);
+            if (operator == 7)
+            {
+                lookup_transaction(user_table, tx_id);
+            }
+            else
+            {
+                lookup_block(user_table, hash);
+            }
+            pthread_rwlock_unlock(&data_lock);
+            printf("运行时间: %.3f 秒\n\n", now_seconds() - begin);
+        }
+        else if (operator == 9)
         {
-            char user_id[50];
-            int k;
             unsigned start, end;
-            printf("请输入账号: \n");
-            scanf("%s", user_id);
+            int k;
             printf("请输入k: \n");
             scanf("%d", &k);
             printf("请输入开始时间: \n");
             scanf("%u", &start);
             printf("请输入结束时间: \n");
             scanf("%u", &end);
-            start_time = clock();
-            account_in_out(start, end, k, user_id, head);
-            end_time = clock();
-            double elapsed_time = (double)(end_time - start_time) / CLOCKS_PER_SEC;
-            printf("运行时间: %.3f 秒\n\n", elapsed_time);
+            if (shard_count > 1)
+            {
+                printf("分片模式下不支持该操作\n\n");
+                continue;
+            }
+            wait_until_loaded(end);
+            double begin = now_seconds();
+            pthread_rwlock_rdlock(&data_lock);
+            net_change_rank(user_table, start, end, k);
+            pthread_rwlock_unlock(&data_lock);
+            printf("运行时间: %.3f 秒\n\n", now_seconds() - begin);
         }
-        else if (operator == 2)
+        else if (operator == 10 || operator == 11)
         {
+            unsigned start, end;
             char user_id[50];
-            unsigned end;
-            printf("请输入账号: \n");
-            scanf("%s", user_id);
-            printf("请输入时间: \n");
-            scanf("%u", &end);
-            start_time = clock();
-            account_amount(end, user_id, head);
-            end_time = clock();
-            double elapsed_time = (double)(end_time - start_time) / CLOCKS_PER_SEC;
-            printf("运行时间: %.3f 秒\n\n", elapsed_time);
-        }
-        else if (operator == 3)
-        {
-            unsigned end;
-            int k;
-            printf("请输入k: \n");
-            scanf("%d", &k);
-            printf("请输入时间: \n");
+            if (operator == 11)
+            {
+                printf("请输入账号: \n");
+                scanf("%s", user_id);
+            }
+            printf("请输入开始时间: \n");
+            scanf("%u", &start);
+            printf("请输入结束时间: \n");
             scanf("%u", &end);
-            start_time = clock();
-            time_wealth_rank(head, end, k);
-            end_time = clock();
-            double elapsed_time = (double)(end_time - start_time) / CLOCKS_PER_SEC;
-            printf("运行时间: %.3f 秒\n\n", elapsed_time);
+            if (shard_count > 1)
+            {
+                printf("分片模式下不支持该操作\n\n");
+                continue;
+            }
+            wait_until_loaded(end);
+            double begin = now_seconds();
+            pthread_rwlock_rdlock(&data_lock);
+            if (operator == 10)
+            {
+                rollup_network(start, end);
+            }
+            else
+            {
+                rollup_account(user_table, user_id, start, end);
+            }
+            pthread_rwlock_unlock(&data_lock);
+            printf("运行时间: %.3f 秒\n\n", now_seconds() - begin);
         }
         else
         {
@@ -1322,7 +11244,27 @@ void data_analysis(Block* head, HashTable* user_table)
         printf("  1: 构建交易关系图\n");
         printf("  2: 统计交易关系图的平均出度、入度，显示出度 / 入度最高的前k个帐号\n");
         printf("  3: 检查交易关系图中是否存在环（首次计算时间复杂度高）\n");
-        printf("  4: 给定一个账号A，求A到账号B的最短路径\n\n");
+        printf("  4: 给定一个账号A，求A到账号B的最短路径\n");
+        printf("  5: 列出交易关系图中长度不超过L的环（经过账号A，或全图金额最大的前N个）\n");
+        printf("  6: 给定账号A和时刻T，求资金从A出发按时间顺序最早何时到达账号B\n");
+        printf("  7: 列出一个时间段内从账号A出发按时间顺序可达的账户\n");
+        printf("  8: 追踪账号A在某时刻持有的资金之后的流向（按比例分摊污点）\n");
+        if (analysis_as_of == UINT_MAX)
+        {
+            printf("  9: 设置2~4项的截止时刻（当前: 不限）\n");
+        }
+        else
+        {
+            printf("  9: 设置2~4项的截止时刻（当前: %u）\n", analysis_as_of);
+        }
+        printf("  10: 最近区块滚动窗口内的交易概况和出度 / 入度最高的前k个帐号（窗口在系统设置中设置）\n");
+        printf("  11: 按转账金额加权的PageRank，输出前k个帐号\n");
+        printf("  12: 采样估计的介数中心性，输出前k个帐号\n");
+        printf("  13: 弱连通分量概况：分量数、最大的k个分量和大小分布\n");
+        printf("  14: 给定账号A和B，判断是否在同一个弱连通分量\n");
+        printf("  15: 交易模式检测：往返交易、扇出 / 扇入、剥离链（经过账号A，或全图）\n");
+        printf("  16: 账号A的k跳邻域：k跳内的账户和它们之间的交易边（可限制账户数）\n");
+        printf("  17: 判断账号A能否到达账号B，输出一条跳数最少的路径\n\n");
         scanf("%d", &operator);
         if (operator == 0)
         {
@@ -1332,22 +11274,46 @@ void data_analysis(Block* head, HashTable* user_table)
         {
             printf("交易关系图构建已完成\n");
         }
+        else if (operator == 2 && shard_count > 1)
+        {
+            int k;
+            shard_average_degree();
+            printf("输入k值: \n");
+            scanf("%d", &k);
+            start_time = clock();
+            shard_max_in_out(k);
+            end_time = clock();
+            double elapsed_time = (double)(end_time - start_time) / CLOCKS_PER_SEC;
+            printf("运行时间: %.3f 秒\n\n", elapsed_time);
+        }
         else if (operator == 2)
         {
             int k;
-            pathHashtable(user_table);
+            wait_until_loaded(analysis_as_of);
+            pthread_rwlock_rdlock(&data_lock);
+            pathHashtable(user_table, analysis_as_of);
+            pthread_rwlock_unlock(&data_lock);
             printf("输入k值: \n");
             scanf("%d", &k);
             start_time = clock();
-            max_in_out(user_table, k);
+            pthread_rwlock_rdlock(&data_lock);
+            max_in_out(user_table, k, analysis_as_of);
+            pthread_rwlock_unlock(&data_lock);
             end_time = clock();
             double elapsed_time = (double)(end_time - start_time) / CLOCKS_PER_SEC;
             printf("运行时间: %.3f 秒\n\n", elapsed_time);
         }
+        else if ((operator == 3 || operator >= 5) && shard_count > 1)
+        {
+            printf("分片模式下不支持该操作\n\n");
+        }
         else if (operator == 3)
         {
+            wait_until_loaded(analysis_as_of);
             start_time = clock();
-            check_ring(user_table);
+            pthread_rwlock_rdlock(&data_lock);
+            check_ring(user_table, analysis_as_of);
+            pthread_rwlock_unlock(&data_lock);
             end_time = clock();
             double elapsed_time = (double)(end_time - start_time) / CLOCKS_PER_SEC;
             printf("运行时间: %.3f 秒\n\n", elapsed_time);
@@ -1360,12 +11326,262 @@ void data_analysis(Block* head, HashTable* user_table)
             scanf("%s", user_from);
             printf("输入账号B: \n");
             scanf("%s", user_to);
-            start_time = clock();
-            shortest_path(user_table, user_from, user_to);
+            if (shard_count > 1)
+            {
+                start_time = clock();
+                shard_shortest_path(user_from, user_to);
+            }
+            else
+            {
+                wait_until_loaded(analysis_as_of);
+                start_time = clock();
+                pthread_rwlock_rdlock(&data_lock);
+                shortest_path(user_table, user_from, user_to, analysis_as_of);
+                pthread_rwlock_unlock(&data_lock);
+            }
             end_time = clock();
             double elapsed_time = (double)(end_time - start_time) / CLOCKS_PER_SEC;
             printf("运行时间: %.3f 秒\n\n", elapsed_time);
         }
+        else if (operator == 5)
+        {
+            char account[50];
+            int max_length, max_count, top_n = 0;
+            double time_limit;
+            printf("输入账号A（输入 * 表示全图）: \n");
+            scanf("%s", account);
+            printf("输入环的最大长度L: \n");
+            scanf("%d", &max_length);
+            if (strcmp(account, "*") == 0)
+            {
+                // 全图模式枚举全部环，只保留前N个
+                printf("输入N（按总金额输出前N个环）: \n");
+                scanf("%d", &top_n);
+                max_count = 0;
+            }
+            else
+            {
+                printf("输入最多输出的环数: \n");
+                scanf("%d", &max_count);
+            }
+            printf("输入时间上限（秒）: \n");
+            scanf("%lf", &time_limit);
+            wait_until_loaded(UINT_MAX);
+            double begin = now_seconds();
+            pthread_rwlock_rdlock(&data_lock);
+            list_cycles(user_table, strcmp(account, "*") == 0 ? 0 : account, max_length, max_count, top_n, time_limit);
+            pthread_rwlock_unlock(&data_lock);
+            printf("运行时间: %.3f 秒\n\n", now_seconds() - begin);
+        }
+        else if (operator == 6)
+        {
+            char user_from[50];
+            char user_to[50];
+            unsigned start;
+            printf("输入账号A: \n");
+            scanf("%s", user_from);
+            printf("输入账号B: \n");
+            scanf("%s", user_to);
+            printf("输入出发时刻T: \n");
+            scanf("%u", &start);
+            wait_until_loaded(UINT_MAX);
+            double begin = now_seconds();
+            pthread_rwlock_rdlock(&data_lock);
+            earliest_arrival(user_table, user_from, user_to, start);
+            pthread_rwlock_unlock(&data_lock);
+            printf("运行时间: %.3f 秒\n\n", now_seconds() - begin);
+        }
+        else if (operator == 7)
+        {
+            char account[50];
+            unsigned start, end;
+            int k;
+            printf("输入账号A: \n");
+            scanf("%s", account);
+            printf("输入开始时间: \n");
+            scanf("%u", &start);
+            printf("输入结束时间: \n");
+            scanf("%u", &end);
+            printf("输入k（按到达时间输出前k个账户）: \n");
+            scanf("%d", &k);
+            wait_until_loaded(end);
+            double begin = now_seconds();
+            pthread_rwlock_rdlock(&data_lock);
+            temporal_reach(user_table, account, start, end, k);
+            pthread_rwlock_unlock(&data_lock);
+            printf("运行时间: %.3f 秒\n\n", now_seconds() - begin);
+        }
+        else if (operator == 8)
+        {
+            char account[50];
+            unsigned start, end;
+            double amount;
+            int k;
+            printf("输入账号A: \n");
+            scanf("%s", account);
+            printf("输入开始时间: \n");
+            scanf("%u", &start);
+            printf("输入结束时间: \n");
+            scanf("%u", &end);
+            printf("输入追踪的金额（0表示A在开始时刻的全部余额）: \n");
+            scanf("%lf", &amount);
+            printf("输入k（输出持有污点最多的前k个账户）: \n");
+            scanf("%d", &k);
+            wait_until_loaded(end);
+            double begin = now_seconds();
+            pthread_rwlock_rdlock(&data_lock);
+            taint_trace(user_table, account, start, end, amount, k);
+            pthread_rwlock_unlock(&data_lock);
+            printf("运行时间: %.3f 秒\n\n", now_seconds() - begin);
+        }
+        else if (operator == 9)
+        {
+            unsigned as_of;
+            printf("输入截止时刻T（只看T之前的交易，0表示不限）: \n");
+            scanf("%u", &as_of);
+            analysis_as_of = as_of == 0 ? UINT_MAX : as_of;
+        }
+        else if (operator == 10)
+        {
+            int k;
+            printf("输入k值: \n");
+            scanf("%d", &k);
+            wait_until_loaded(UINT_MAX);
+            double begin = now_seconds();
+            pthread_rwlock_rdlock(&data_lock);
+            window_leaders(user_table, k);
+            pthread_rwlock_unlock(&data_lock);
+            printf("运行时间: %.3f 秒\n\n", now_seconds() - begin);
+        }
+        else if (operator == 11)
+        {
+            int k, max_iterations;
+            double damping, tolerance;
+            printf("输入k值: \n");
+            scanf("%d", &k);
+            printf("输入阻尼系数（如0.85）: \n");
+            scanf("%lf", &damping);
+            printf("输入收敛阈值（如1e-9）: \n");
+            scanf("%lf", &tolerance);
+            printf("输入最大迭代轮数: \n");
+            scanf("%d", &max_iterations);
+            wait_until_loaded(UINT_MAX);
+            double begin = now_seconds();
+            pthread_rwlock_rdlock(&data_lock);
+            pagerank(user_table, k, damping, tolerance, max_iterations < 1 ? 1 : max_iterations);
+            pthread_rwlock_unlock(&data_lock);
+            printf("运行时间: %.3f 秒\n\n", now_seconds() - begin);
+        }
+        else if (operator == 12)
+        {
+            int k, samples;
+            printf("输入k值: \n");
+            scanf("%d", &k);
+            printf("输入采样的源点数: \n");
+            scanf("%d", &samples);
+            wait_until_loaded(UINT_MAX);
+            double begin = now_seconds();
+            pthread_rwlock_rdlock(&data_lock);
+            betweenness(user_table, k, samples);
+            pthread_rwlock_unlock(&data_lock);
+            printf("运行时间: %.3f 秒\n\n", now_seconds() - begin);
+        }
+        else if (operator == 13)
+        {
+            int k;
+            printf("输入k值: \n");
+            scanf("%d", &k);
+            wait_until_loaded(UINT_MAX);
+            double begin = now_seconds();
+            pthread_rwlock_rdlock(&data_lock);
+            component_summary(user_table, k);
+            pthread_rwlock_unlock(&data_lock);
+            printf("运行时间: %.3f 秒\n\n", now_seconds() - begin);
+        }
+        else if (operator == 14)
+        {
+            char user_a[50];
+            char user_b[50];
+            printf("输入账号A: \n");
+            scanf("%s", user_a);
+            printf("输入账号B: \n");
+            scanf("%s", user_b);
+            wait_until_loaded(UINT_MAX);
+            double begin = now_seconds();
+            pthread_rwlock_rdlock(&data_lock);
+            same_component(user_table, user_a, user_b);
+            pthread_rwlock_unlock(&data_lock);
+            printf("运行时间: %.3f 秒\n\n", now_seconds() - begin);
+        }
+        else if (operator == 15)
+        {
+            char account[50];
+            double min_amount;
+            int min_degree, min_chain, k;
+            printf("输入账号A（输入 * 表示全图）: \n");
+            scanf("%s", account);
+            printf("输入单笔金额阈值: \n");
+            scanf("%lf", &min_amount);
+            printf("输入扇出 / 扇入的账户数阈值: \n");
+            scanf("%d", &min_degree);
+            printf("输入剥离链的最少跳数: \n");
+            scanf("%d", &min_chain);
+            printf("输入k值（每类模式输出前k个）: \n");
+            scanf("%d", &k);
+            wait_until_loaded(UINT_MAX);
+            double begin = now_seconds();
+            pthread_rwlock_rdlock(&data_lock);
+            motif_analysis(user_table, strcmp(account, "*") == 0 ? 0 : account, min_amount, min_degree, min_chain, k);
+            pthread_rwlock_unlock(&data_lock);
+            printf("运行时间: %.3f 秒\n\n", now_seconds() - begin);
+        }
+        else if (operator == 16 || operator == 17)
+        {
+            char user_a[50];
+            char user_b[50];
+            int hops = 0, direction = 0, limit = 0;
+            printf("输入账号A: \n");
+            scanf("%s", user_a);
+            if (operator == 16)
+            {
+                printf("输入跳数k: \n");
+                scanf("%d", &hops);
+            }
+            else
+            {
+                printf("输入账号B: \n");
+                scanf("%s", user_b);
+            }
+            printf("输入方向（1: 沿转出方向，2: 沿转入方向，3: 不分方向）: \n");
+            scanf("%d", &direction);
+            if (direction < HOP_OUT || direction > HOP_BOTH)
+            {
+                direction = HOP_BOTH;
+            }
+            if (operator == 16)
+            {
+                printf("输入账户数上限: \n");
+                scanf("%d", &limit);
+            }
+            if (shard_count > 1)
+            {
+                printf("分片模式下不支持该操作\n\n");
+                continue;
+            }
+            wait_until_loaded(UINT_MAX);
+            double begin = now_seconds();
+            pthread_rwlock_rdlock(&data_lock);
+            if (operator == 16)
+            {
+                ego_network(user_table, user_a, hops, direction, limit);
+            }
+            else
+            {
+                reachability(user_table, user_a, user_b, direction);
+            }
+            pthread_rwlock_unlock(&data_lock);
+            printf("运行时间: %.3f 秒\n\n", now_seconds() - begin);
+        }
         else
         {
             printf("请输入正确的操作指令...\n");
@@ -1386,6 +11602,7 @@ void add_file(Block* head, HashTable* user_table)
     if (file != NULL)
     {
         fclose(file);
+        wait_load_finished();
         add_new_transaction(head, user_table, file_direction);
     }
     else
@@ -1394,6 +11611,174 @@ void add_file(Block* head, HashTable* user_table)
     }
 }
 
+// 跟踪模式界面操作
+void follow_menu(Block* head, HashTable* user_table)
+{
+    int operator;
+    while (1)
+    {
+        operator = 0;
+        printf("请输入需要进行的跟踪操作: \n  0: 返回上一级操作\n");
+        printf("  1: 开始跟踪区块和交易文件的追加内容，新数据约1秒内可查询\n");
+        printf("  2: 停止跟踪\n");
+        printf("  3: 查看跟踪状态和延迟\n\n");
+        scanf("%d", &operator);
+        if (operator == 0)
+        {
+            break;
+        }
+        else if (operator == 1)
+        {
+            start_follow(head, user_table);
+        }
+        else if (operator == 2)
+        {
+            stop_follow();
+        }
+        else if (operator == 3)
+        {
+            follow_status();
+        }
+        else
+        {
+            printf("请输入正确的操作指令...\n");
+        }
+    }
+}
+
+// 系统设置界面操作
+void settings(HashTable* user_table)
+{
+    int operator;
+    while (1)
+    {
+        operator = 0;
+        printf("请输入需要修改的设置: \n  0: 返回上一级操作\n");
+        printf("  1: 线程数上限（当前: %d，0表示跟随机器的%d个逻辑处理器）\n", max_threads, runtime.thread_count);
+        printf("  2: 查询所需数据未加载完时（当前: %s）\n", partial_results ? "给出部分结果" : "等待数据");
+        if (out_of_core)
+        {
+            printf("  3: 外存模式（当前: 常驻内存上限 %ld MB）\n", memory_limit_mb);
+        }
+        else
+        {
+            printf("  3: 外存模式（当前: 关闭）\n");
+        }
+        if (rolling_window.enabled)
+        {
+            printf("  4: 滚动窗口（当前: 最近%d个区块，%u秒，0表示不限）\n", rolling_window.max_blocks, rolling_window.max_seconds);
+        }
+        else
+        {
+            printf("  4: 滚动窗口（当前: 关闭）\n");
+        }
+        if (query_cache.limit > 0)
+        {
+            printf("  5: 查询结果缓存（当前: 上限 %ld MB）\n", query_cache.limit >> 20);
+        }
+        else
+        {
+            printf("  5: 查询结果缓存（当前: 关闭）\n");
+        }
+        printf("  6: 时间桶汇总的桶宽（当前: %u 秒）\n", rollup.width);
+        if (heavy_hitter_budget < 0)
+        {
+            printf("  7: 金额最高账户摘要的计数器数（当前: 每%d个账户一个，%d）\n\n", -heavy_hitter_budget,
+            sketch_state.senders.heavy.capacity);
+        }
+        else
+        {
+            printf("  7: 金额最高账户摘要的计数器数（当前: %d）\n\n", sketch_state.senders.heavy.capacity);
+        }
+        scanf("%d", &operator);
+        if (operator == 0)
+        {
+            break;
+        }
+        // 这几项只改本进程的状态，分片模式下协调者不持有数据，工作进程按启动时的设置运行
+        else if ((operator == 1 || (operator >= 3 && operator <= 6)) && shard_count > 1)
+        {
+            printf("分片模式下不支持该操作\n\n");
+        }
+        else if (operator == 1)
+        {
+            printf("输入线程数上限: \n");
+            scanf("%d", &max_threads);
+            if (max_threads < 0)
+            {
+                max_threads = 0;
+            }
+            printf("并行任务将使用 %d 个线程\n\n", runtime_threads());
+        }
+        else if (operator == 2)
+        {
+            printf("输入 0 等待数据，1 给出部分结果: \n");
+            scanf("%d", &partial_results);
+            partial_results = partial_results != 0;
+        }
+        else if (operator == 3)
+        {
+            long limit_mb = 0;
+            printf("输入常驻内存上限（MB），0 关闭外存模式: \n");
+            scanf("%ld", &limit_mb);
+            pthread_rwlock_wrlock(&data_lock);
+            set_out_of_core(limit_mb > 0, limit_mb);
+            pthread_rwlock_unlock(&data_lock);
+        }
+        else if (operator == 4)
+        {
+            int max_blocks = 0;
+            unsigned max_seconds = 0;
+            printf("输入窗口内最多的区块数（0表示不限）: \n");
+            scanf("%d", &max_blocks);
+            printf("输入窗口覆盖的时间跨度（秒，0表示不限；两项都为0关闭窗口）: \n");
+            scanf("%u", &max_seconds);
+            pthread_rwlock_wrlock(&data_lock);
+            window_configure(max_blocks, max_seconds);
+            pthread_rwlock_unlock(&data_lock);
+        }
+        else if (operator == 5)
+        {
+            long limit_mb = 0;
+            printf("输入查询结果缓存的上限（MB），0 关闭缓存: \n");
+            scanf("%ld", &limit_mb);
+            pthread_rwlock_rdlock(&data_lock);
+            query_cache_configure(limit_mb);
+            pthread_rwlock_unlock(&data_lock);
+        }
+        else if (operator == 6)
+        {
+            unsigned width = 0;
+            printf("输入时间桶的宽度（秒，如3600按小时、86400按天，不小于%d）: \n", ROLLUP_MIN_WIDTH);
+            scanf("%u", &width);
+            pthread_rwlock_wrlock(&data_lock);
+            rollup_configure(width);
+            pthread_rwlock_unlock(&data_lock);
+            printf("时间桶汇总已按 %u 秒的桶宽重建\n\n", rollup.width);
+        }
+        else if (operator == 7)
+        {
+            if (shard_count > 1)
+            {
+                printf("分片模式下计数器数由各工作进程持有，请用启动参数 -H 设置\n\n");
+                continue;
+            }
+            int budget = 0;
+            printf("输入计数器数（向上取2的幂，误差上界为总额/计数器数；0表示默认的%d个；-k表示每k个账户一个，内存随账户数增长）: \n",
+            HEAVY_HITTERS);
+            scanf("%d", &budget);
+            pthread_rwlock_wrlock(&data_lock);
+            heavy_hitter_configure(user_table, budget);
+            pthread_rwlock_unlock(&data_lock);
+            printf("金额最高账户摘要已按 %d 个计数器重建\n\n", sketch_state.senders.heavy.capacity);
+        }
+        else
+        {
+            printf("请输入正确的操作指令...\n");
+        }
+    }
+}
+
 // 用户操作主界面
 void operation(Block* head, HashTable* user_table)
 {
@@ -1401,15 +11786,34 @@ int operator;
     while (1)
     {
         operator = 0;
-        printf("请输入你要进行的操作: \n  0: 退出系统\n  1: 数据初始化\n  2: 数据查询\n  3: 数据分析\n  4. 数据插入\n\n");
+        printf("请输入你要进行的操作: \n  0: 退出系统\n  1: 数据初始化\n  2: 数据查询\n  3: 数据分析\n  4. 数据插入\n  5: 系统设置\n  6: 跟踪数据文件\n  7: 写入快照并压缩预写日志\n  8: 按数据清单加载新的分区\n\n");
         scanf("%d", &operator);
         if (operator == 0)
         {
+            if (follow_state.running)
+            {
+                stop_follow();
+            }
             break;
         }
+        else if (operator == 1 && shard_count > 1)
+        {
+            shard_status();
+        }
         else if (operator == 1)
         {
-            printf("数据初始化已完成!\n");
+            pthread_rwlock_rdlock(&data_lock);
+            if (load_state.done)
+            {
+                printf("数据初始化已完成!\n");
+                print_storage_stats(user_table);
+                print_query_cache_stats();
+            }
+            else
+            {
+                print_load_progress();
+            }
+            pthread_rwlock_unlock(&data_lock);
         }
         else if (operator == 2)
         {
@@ -1421,11 +11825,37 @@ int operator;
             // 数据分析
             data_analysis(head, user_table);
         }
+        else if ((operator == 4 || operator == 6 || operator == 7 || operator == 8) && shard_count > 1)
+        {
+            printf("分片模式下不支持该操作\n");
+        }
         else if (operator == 4)
         {
             // 数据插入
             add_file(head, user_table);
         }
+        else if (operator == 5)
+        {
+            // 系统设置
+            settings(user_table);
+        }
+        else if (operator == 6)
+        {
+            // 跟踪数据文件
+            follow_menu(head, user_table);
+        }
+        else if (operator == 7)
+        {
+            // 写入快照，持读锁期间插入和跟踪暂停
+            wait_load_finished();
+            pthread_rwlock_rdlock(&data_lock);
+            compact_wal(user_table);
+            pthread_rwlock_unlock(&data_lock);
+        }
+        else if (operator == 8)
+        {
+            manifest_menu(head, user_table);
+        }
         else
         {
             printf("请输入正确的操作指令...\n");